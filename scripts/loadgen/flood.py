@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+
+# floods a server's game port with datagrams from a bunch of sockets and
+# reports how many packets per second the server managed to read. the
+# packets don't belong to any connection, so the server reads and drops
+# them, which exercises just the receive path. packets the server
+# couldn't keep up with show up as udp receive buffer errors, so this
+# only works on linux, against a server on the same machine. give it
+# the server's pid to also see how much cpu time each packet costs.
+#
+# usage: flood.py [-s server] [-p port] [-j procs] [-n sockets] [-t seconds]
+#                 [-P server pid]
+
+import os, socket, time, optparse
+
+
+def udp_errors():
+	f = open('/proc/net/snmp')
+	lines = [l.split() for l in f if l.startswith('Udp:')]
+	f.close()
+	hdr, vals = lines[0], lines[1]
+	stats = dict(zip(hdr[1:], [int(v) for v in vals[1:]]))
+	return stats.get('RcvbufErrors', 0)
+
+
+def cpu_time(pid):
+	if not pid:
+		return 0.0
+	f = open('/proc/%d/stat' % pid)
+	fields = f.read().rsplit(')', 1)[1].split()
+	f.close()
+	# utime and stime, in clock ticks
+	return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+
+def flood(opts, end):
+	dest = (opts.server, opts.port)
+	socks = []
+	for i in range(opts.n):
+		s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		s.connect(dest)
+		socks.append(s)
+
+	# something that looks like a position packet, but isn't a
+	# connection init.
+	pkt = b'\x03' + b'\x00' * (opts.len - 1)
+
+	sent = 0
+	while time.time() < end:
+		for s in socks:
+			for i in range(64):
+				try:
+					s.send(pkt)
+					sent += 1
+				except socket.error:
+					pass
+	return sent
+
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option('-s', '--server', type='string', dest='server', default='127.0.0.1')
+	parser.add_option('-p', '--port', type='int', dest='port', default=5000)
+	parser.add_option('-j', '--procs', type='int', dest='procs', default=4)
+	parser.add_option('-n', '--num', type='int', dest='n', default=16)
+	parser.add_option('-t', '--time', type='float', dest='time', default=5.0)
+	parser.add_option('-l', '--len', type='int', dest='len', default=22)
+	parser.add_option('-P', '--pid', type='int', dest='pid', default=0)
+	(opts, args) = parser.parse_args()
+
+	errs = udp_errors()
+	cpu = cpu_time(opts.pid)
+	start = time.time()
+
+	# one sender can't keep up with the server, so fork a few
+	pipes = []
+	for j in range(opts.procs):
+		r, w = os.pipe()
+		if os.fork() == 0:
+			os.close(r)
+			sent = flood(opts, start + opts.time)
+			os.write(w, ('%d' % sent).encode())
+			os._exit(0)
+		os.close(w)
+		pipes.append(r)
+
+	sent = 0
+	for r in pipes:
+		sent += int(os.read(r, 64))
+		os.close(r)
+		os.wait()
+	elapsed = time.time() - start
+
+	# let the server catch up before counting drops
+	time.sleep(0.5)
+	dropped = udp_errors() - errs
+	cpu = cpu_time(opts.pid) - cpu
+
+	print('sent %d packets in %.2fs: %.0f pkts/sec' % (sent, elapsed, sent / elapsed))
+	print('server dropped %d, read %.0f pkts/sec' %
+			(dropped, (sent - dropped) / elapsed))
+	if opts.pid and sent > dropped:
+		print('server used %.2fs cpu: %.0f ns/pkt' %
+				(cpu, cpu * 1e9 / (sent - dropped)))
+
+
+if __name__ == '__main__':
+	main()
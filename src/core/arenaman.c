@@ -274,6 +274,7 @@ local Arena * create_arena(const char *name, int permanent, Player *player)
 	a->status = ARENA_DO_INIT0;
 	a->cfg = NULL;
 	a->keep_alive = permanent ? 1 : 0;
+	LLInit(&a->playerlist);
 	ad->holds = 0;
 	ad->resurrect = FALSE;
 
@@ -213,11 +213,18 @@ local void get_arena_set(LinkedList *set, Arena *arena, Player *except)
 	Link *link;
 	Player *p;
 	pd->Lock();
-	FOR_EACH_PLAYER(p)
-		if (p->status == S_PLAYING &&
-		    (arena == ALLARENAS || p->arena == arena) &&
-		    p != except)
-			LLAdd(set, p);
+	if (arena == ALLARENAS)
+	{
+		FOR_EACH_PLAYER(p)
+			if (p->status == S_PLAYING && p != except)
+				LLAdd(set, p);
+	}
+	else
+	{
+		FOR_EACH_PLAYER_IN_ARENA(p, arena)
+			if (p->status == S_PLAYING && p != except)
+				LLAdd(set, p);
+	}
 	pd->Unlock();
 }
 
@@ -507,9 +514,8 @@ local void handle_freq(Player *p, int freq, const char *msg, int sound)
 		Player *i;
 
 		pd->Lock();
-		FOR_EACH_PLAYER(i)
+		FOR_EACH_PLAYER_IN_ARENA(i, arena)
 			if (i->p_freq == freq &&
-				i->arena == arena &&
 				i != p)
 				LLAdd(&set, i);
 		pd->Unlock();
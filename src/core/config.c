@@ -22,6 +22,12 @@
 #include "app.h"
 
 
+/* retired key snapshots (and the strings they point to) are kept
+ * around this long (in seconds) before being freed, to be sure no
+ * GetKey* caller is still looking at them. */
+#define SNAPSHOT_GRACE 10
+
+
 /* structs */
 
 struct Entry
@@ -29,6 +35,22 @@ struct Entry
 	const char *keystr, *val, *info;
 };
 
+/* the values of every interned key in one file. these are read without
+ * any locks, so once one is published it's never modified. changes to
+ * the file build a new one and retire the old one. */
+typedef struct KeySnapshot
+{
+	struct KeySnapshot *next; /* on the retired list */
+	time_t retired;
+	StringChunk *strings; /* freed along with this, if set */
+	int count;
+	struct
+	{
+		const char *str;
+		int ival;
+	} vals[0];
+} KeySnapshot;
+
 typedef struct ConfigFile
 {
 	pthread_mutex_t mutex; /* recursive */
@@ -39,6 +61,8 @@ typedef struct ConfigFile
 	int anychanged;
 	time_t lastmod;
 	char *filename, *arena, *name;
+	KeySnapshot *snapshot;
+	KeySnapshot *retired;
 } ConfigFile;
 
 struct ConfigHandle_
@@ -57,6 +81,12 @@ local HashTable *opened;
 local LinkedList files;
 local pthread_mutex_t cfgmtx; /* protects opened and files */
 
+/* interned keys. keyids maps "section:key" to index + 1 */
+local HashTable *keyids;
+local char **keynames;
+local int keycount, keyspace;
+local pthread_mutex_t keymtx;
+
 local Imodman *mm;
 local Ilogman *lm;
 local Imainloop *ml;
@@ -97,6 +127,80 @@ local char * unescape_string(char *dst, int dstlen, char *src, char stopon)
 }
 
 
+/* returns false if there's no section or key */
+local int make_keystring(char *keystring, const char *sec, const char *key)
+{
+	if (sec && key)
+		snprintf(keystring, MAXSECTIONLEN+MAXKEYLEN+1, "%s:%s", sec, key);
+	else if (sec)
+		astrncpy(keystring, sec, MAXSECTIONLEN+MAXKEYLEN+1);
+	else if (key)
+		astrncpy(keystring, key, MAXSECTIONLEN+MAXKEYLEN+1);
+	else
+		return FALSE;
+	return TRUE;
+}
+
+local int parse_int(const char *str)
+{
+	char *next;
+	int ret = strtol(str, &next, 0);
+	return str != next ? ret : str[0] == 'y' || str[0] == 'Y';
+}
+
+
+/* call with cf->mutex held. builds a new snapshot of all interned keys
+ * and publishes it. if oldstrings is given, it's freed along with the
+ * old snapshot. */
+local void update_snapshot(ConfigFile *cf, StringChunk *oldstrings)
+{
+	KeySnapshot *s, *old;
+	int i;
+
+	pthread_mutex_lock(&keymtx);
+	s = amalloc(sizeof(*s) + keycount * sizeof(s->vals[0]));
+	s->count = keycount;
+	for (i = 0; i < keycount; i++)
+	{
+		const char *str = HashGetOne(cf->table, keynames[i]);
+		s->vals[i].str = str;
+		s->vals[i].ival = str ? parse_int(str) : 0;
+	}
+	pthread_mutex_unlock(&keymtx);
+
+	old = cf->snapshot;
+	__atomic_store_n(&cf->snapshot, s, __ATOMIC_RELEASE);
+
+	if (old)
+	{
+		old->strings = oldstrings;
+		old->retired = time(NULL);
+		old->next = cf->retired;
+		cf->retired = old;
+	}
+	else if (oldstrings)
+		SCFree(oldstrings);
+}
+
+/* call with cf->mutex held */
+local void free_retired(ConfigFile *cf, int all)
+{
+	KeySnapshot **sp = &cf->retired, *s;
+	time_t now = time(NULL);
+
+	while ((s = *sp))
+		if (all || now - s->retired >= SNAPSHOT_GRACE)
+		{
+			*sp = s->next;
+			if (s->strings)
+				SCFree(s->strings);
+			afree(s);
+		}
+		else
+			sp = &s->next;
+}
+
+
 local ConfigFile *new_file()
 {
 	ConfigFile *f;
@@ -129,6 +233,8 @@ local void free_file(ConfigFile *cf)
 		LLEmpty(&cf->handles);
 	}
 
+	free_retired(cf, TRUE);
+	afree(cf->snapshot);
 	SCFree(cf->strings);
 	HashFree(cf->table);
 	pthread_mutex_destroy(&cf->mutex);
@@ -220,6 +326,7 @@ local int write_dirty_values(void *dummy)
 		else
 		{
 			write_dirty_values_one(cf, TRUE);
+			free_retired(cf, FALSE);
 			pthread_mutex_unlock(&cf->mutex);
 		}
 	}
@@ -365,6 +472,7 @@ local void do_load(ConfigFile *cf, const char *arena, const char *name)
 local void reload_file(ConfigFile *cf)
 {
 	struct stat st;
+	StringChunk *oldstrings;
 	Link *l;
 
 	if (lm)
@@ -376,14 +484,17 @@ local void reload_file(ConfigFile *cf)
 	/* just in case */
 	write_dirty_values_one(cf, FALSE);
 
-	/* free this stuff, then create it again */
-	SCFree(cf->strings);
+	/* free this stuff, then create it again. the old strings might
+	 * still be in use by GetKeyStr callers, so they go away with the
+	 * old snapshot. */
+	oldstrings = cf->strings;
 	HashFree(cf->table);
 	cf->table = HashAlloc();
 	cf->strings = SCAlloc();
 
 	/* now load file again */
 	do_load(cf, cf->arena, cf->name);
+	update_snapshot(cf, oldstrings);
 
 	cf->lastmod = stat(cf->filename, &st) == 0 ? st.st_mtime : 0;
 
@@ -495,6 +606,7 @@ local ConfigHandle OpenConfigFile(const char *arena, const char *name,
 
 		/* load the settings */
 		do_load(cf, arena, name);
+		update_snapshot(cf, NULL);
 
 		/* add this to the opened table */
 		HashAdd(opened, fname, cf);
@@ -553,14 +665,76 @@ local const char *GetStr(ConfigHandle ch, const char *sec, const char *key)
 
 local int GetInt(ConfigHandle ch, const char *sec, const char *key, int def)
 {
-	char *next;
 	const char *str;
-	int ret;
 
 	str = GetStr(ch, sec, key);
 	if (!str) return def;
-	ret = strtol(str, &next, 0);
-	return str != next ? ret : str[0] == 'y' || str[0] == 'Y';
+	return parse_int(str);
+}
+
+
+local ConfigKey GetKey(const char *sec, const char *key)
+{
+	char keystring[MAXSECTIONLEN+MAXKEYLEN+2];
+	ConfigKey k;
+	void *id;
+
+	if (!make_keystring(keystring, sec, key))
+		return -1;
+
+	pthread_mutex_lock(&keymtx);
+	id = HashGetOne(keyids, keystring);
+	if (id)
+		k = (long)id - 1;
+	else
+	{
+		if (keycount == keyspace)
+		{
+			keyspace = keyspace ? keyspace * 2 : 64;
+			keynames = arealloc(keynames, keyspace * sizeof(keynames[0]));
+		}
+		k = keycount++;
+		keynames[k] = astrdup(keystring);
+		HashAdd(keyids, keystring, (void *)(long)(k + 1));
+	}
+	pthread_mutex_unlock(&keymtx);
+
+	return k;
+}
+
+/* gets a snapshot that includes key k */
+local KeySnapshot * get_snapshot(ConfigFile *cf, ConfigKey k)
+{
+	KeySnapshot *s = __atomic_load_n(&cf->snapshot, __ATOMIC_ACQUIRE);
+
+	if (k >= s->count)
+	{
+		/* the key was interned after this snapshot was built */
+		pthread_mutex_lock(&cf->mutex);
+		if (k >= cf->snapshot->count)
+			update_snapshot(cf, NULL);
+		s = cf->snapshot;
+		pthread_mutex_unlock(&cf->mutex);
+	}
+
+	return s;
+}
+
+local const char *GetKeyStr(ConfigHandle ch, ConfigKey k)
+{
+	if (!ch || k < 0) return NULL;
+	if (ch == GLOBAL) ch = global;
+	return get_snapshot(ch->file, k)->vals[k].str;
+}
+
+local int GetKeyInt(ConfigHandle ch, ConfigKey k, int def)
+{
+	KeySnapshot *s;
+
+	if (!ch || k < 0) return def;
+	if (ch == GLOBAL) ch = global;
+	s = get_snapshot(ch->file, k);
+	return s->vals[k].str ? s->vals[k].ival : def;
 }
 
 
@@ -575,13 +749,7 @@ local void SetStr(ConfigHandle ch, const char *sec, const char *key,
 	if (ch == GLOBAL) ch = global;
 	cf = ch->file;
 
-	if (sec && key)
-		snprintf(keystring, MAXSECTIONLEN+MAXKEYLEN+1, "%s:%s", sec, key);
-	else if (sec)
-		astrncpy(keystring, sec, MAXSECTIONLEN+MAXKEYLEN+1);
-	else if (key)
-		astrncpy(keystring, key, MAXSECTIONLEN+MAXKEYLEN+1);
-	else
+	if (!make_keystring(keystring, sec, key))
 		return;
 
 	pthread_mutex_lock(&cf->mutex);
@@ -596,6 +764,7 @@ local void SetStr(ConfigHandle ch, const char *sec, const char *key,
 
 	data = SCAdd(cf->strings, val);
 	HashReplace(cf->table, keystring, data);
+	update_snapshot(cf, NULL);
 	cf->anychanged = TRUE;
 	if (perm)
 	{
@@ -660,6 +829,7 @@ local Iconfig _int =
 {
 	INTERFACE_HEAD_INIT(I_CONFIG, "config-file")
 	GetStr, GetInt, SetStr, SetInt,
+	GetKey, GetKeyStr, GetKeyInt,
 	OpenConfigFile, CloseConfigFile, ReloadConfigFile,
 	AddRef,
 	FlushDirtyValues, CheckModifiedFiles, ForceReload,
@@ -691,6 +861,11 @@ EXPORT int MM_config(int action, Imodman *mm_, Arena *arena)
 
 		pthread_mutex_init(&cfgmtx, NULL);
 
+		keyids = HashAlloc();
+		keynames = NULL;
+		keycount = keyspace = 0;
+		pthread_mutex_init(&keymtx, NULL);
+
 		global = OpenConfigFile(NULL, NULL, global_changed, NULL);
 		if (!global) return MM_FAIL;
 
@@ -736,6 +911,15 @@ EXPORT int MM_config(int action, Imodman *mm_, Arena *arena)
 
 		pthread_mutex_destroy(&cfgmtx);
 
+		{
+			int i;
+			for (i = 0; i < keycount; i++)
+				afree(keynames[i]);
+			afree(keynames);
+			HashFree(keyids);
+			pthread_mutex_destroy(&keymtx);
+		}
+
 		return MM_OK;
 	}
 	return MM_FAIL;
@@ -247,14 +247,15 @@ int process_player_states(void *v)
 			case S_CONNECTED:
 			case S_LOGGEDIN:
 				/* at this point, the player can't have an arena */
-				player->arena = NULL;
+				if (player->arena)
+					pd->SetArena(player, NULL);
 
 				/* check if the player's arena is ready.
 				 * LOCK: we don't grab the arena status lock because it
 				 * doesn't matter if we miss it this time around */
 				if (player->newarena && player->newarena->status == ARENA_RUNNING)
 				{
-					player->arena = player->newarena;
+					pd->SetArena(player, player->newarena);
 					player->newarena = NULL;
 					player->status = S_DO_FREQ_AND_ARENA_SYNC;
 				}
@@ -17,10 +17,6 @@ INTERNAL_MODULES = \
 	enf_shipchange enf_flagwin \
 	deadlock redirect $(unixsignal)
 
-# generated file for mapdata
-$(call tobuild, sparse.inc): $(builddir) $(SCRIPTS)/gensparse.py $(SCRIPTS)/sparse_params.py
-	$(PYTHON) $(SCRIPTS)/gensparse.py $@ $(SCRIPTS)/sparse_params.py
-
 # generated file for cfghelp
 $(call tobuild, cfghelp.inc): $(builddir) $(SCRIPTS)/extract-cfg-docs.py
 	$(PYTHON) $(SCRIPTS)/extract-cfg-docs.py -c $@ */*.c */*.py core/clientset.def
@@ -4,14 +4,26 @@
 #include "asss.h"
 #include "encrypt.h"
 
+/* the packet loops have sse2 and avx2 versions on x86, picked when the
+ * module loads based on what the cpu can do */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VIE_SIMD
+#include <immintrin.h>
+#endif
+
 #define BAD_KEY (-1) /* valid keys must be positive */
 
+#define TABLE_WORDS 130
+
 /* structs */
 
 typedef struct EncData
 {
 	int key;
-	char table[520];
+	char table[TABLE_WORDS*4];
+	/* prefix[i] is the key xored with table words 0 through i. encrypted
+	 * word i is that xored with plaintext words 0 through i. */
+	int prefix[TABLE_WORDS];
 } EncData;
 
 
@@ -31,10 +43,18 @@ local int ClientDecrypt(ClientEncryptData *ced, byte *, int);
 local void ClientVoid(ClientEncryptData *ced);
 
 
+local void enc_words(EncData *ed, int *data, int n);
+local void dec_words(EncData *ed, int *data, int n);
+local void pick_kernels(void);
+
+
 /* globals */
 
 local int enckey;
-local pthread_mutex_t mtx;
+
+/* the packet loops for this cpu */
+local void (*enc_kernel)(EncData *ed, int *data, int n) = enc_words;
+local void (*dec_kernel)(EncData *ed, int *data, int n) = dec_words;
 
 local Inet *net;
 local Iplayerdata *pd;
@@ -63,7 +83,7 @@ EXPORT int MM_enc_vie(int action, Imodman *mm, Arena *arena)
 		enckey = pd->AllocatePlayerData(sizeof(EncData*));
 		if (enckey == -1) return MM_FAIL;
 		mm->RegCallback(CB_CONNINIT, ConnInit, ALLARENAS);
-		pthread_mutex_init(&mtx, NULL);
+		pick_kernels();
 		mm->RegInterface(&ienc, ALLARENAS);
 		mm->RegInterface(&iclienc, ALLARENAS);
 		return MM_OK;
@@ -78,7 +98,6 @@ EXPORT int MM_enc_vie(int action, Imodman *mm, Arena *arena)
 		pd->FreePlayerData(enckey);
 		mm->ReleaseInterface(net);
 		mm->ReleaseInterface(pd);
-		pthread_mutex_destroy(&mtx);
 		return MM_OK;
 	}
 	return MM_FAIL;
@@ -130,7 +149,7 @@ local void ConnInit(struct sockaddr_in *sin, byte *pkt, int len, void *v)
 
 local void do_init(EncData *ed, int k)
 {
-	int t, loop;
+	int t, loop, work, *words;
 	short *mytable;
 
 	ed->key = k;
@@ -147,26 +166,174 @@ local void do_init(EncData *ed, int k)
 		if (!k || (k & 0x80000000)) k += 0x7FFFFFFF;
 		mytable[loop] = (short)k;
 	}
+
+	words = (int*)ed->table;
+	for (loop = 0, work = ed->key; loop < TABLE_WORDS; loop++)
+		ed->prefix[loop] = work ^= words[loop];
 }
 
 local void Init(Player *p, int k)
 {
-	EncData *ed, **p_ed = PPDATA(p, enckey);
-
-	pthread_mutex_lock(&mtx);
-	if (!(ed = *p_ed)) ed = *p_ed = amalloc(sizeof(*ed));
-	pthread_mutex_unlock(&mtx);
+	EncData *ed = amalloc(sizeof(*ed)), *old, **p_ed = PPDATA(p, enckey);
 
+	/* the tables are filled in before anyone can see them, so Encrypt
+	 * and Decrypt can read the pointer without locking */
 	do_init(ed, k);
+	old = __atomic_exchange_n(p_ed, ed, __ATOMIC_ACQ_REL);
+	afree(old);
+}
+
+
+/* one word at a time. encrypting has to go in order because each word
+ * depends on the one before. */
+local void enc_words(EncData *ed, int *mydata, int until)
+{
+	int work = ed->key, *mytable = (int*)ed->table, loop;
+
+	for (loop = 0; loop < until; loop++)
+	{
+		work = mydata[loop] ^ (mytable[loop] ^ work);
+		mydata[loop] = work;
+	}
+}
+
+local void dec_words(EncData *ed, int *mydata, int until)
+{
+	int work = ed->key, *mytable = (int*)ed->table, loop;
+
+	for (loop = 0; loop < until; loop++)
+	{
+		int tmp = mydata[loop];
+		mydata[loop] = mytable[loop] ^ work ^ tmp;
+		work = tmp;
+	}
+}
+
+#ifdef VIE_SIMD
+
+/* with the key and table folded into prefix, encrypting is a running
+ * xor of the plaintext, which can be done a vector at a time with a
+ * couple of shifts. */
+__attribute__((target("sse2")))
+local void enc_sse2(EncData *ed, int *mydata, int until)
+{
+	__m128i x, carry = _mm_setzero_si128();
+	int loop, work;
+
+	for (loop = 0; loop + 4 <= until; loop += 4)
+	{
+		x = _mm_loadu_si128((__m128i*)(mydata + loop));
+		x = _mm_xor_si128(x, _mm_slli_si128(x, 4));
+		x = _mm_xor_si128(x, _mm_slli_si128(x, 8));
+		x = _mm_xor_si128(x, carry);
+		carry = _mm_shuffle_epi32(x, 0xff);
+		x = _mm_xor_si128(x, _mm_loadu_si128((__m128i*)(ed->prefix + loop)));
+		_mm_storeu_si128((__m128i*)(mydata + loop), x);
+	}
+
+	for (work = _mm_cvtsi128_si32(carry); loop < until; loop++)
+	{
+		work ^= mydata[loop];
+		mydata[loop] = work ^ ed->prefix[loop];
+	}
+}
+
+__attribute__((target("avx2")))
+local void enc_avx2(EncData *ed, int *mydata, int until)
+{
+	const __m256i low3 = _mm256_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3);
+	const __m256i last = _mm256_set1_epi32(7);
+	__m256i x, carry = _mm256_setzero_si256();
+	int loop, work;
+
+	for (loop = 0; loop + 8 <= until; loop += 8)
+	{
+		x = _mm256_loadu_si256((__m256i*)(mydata + loop));
+		/* the shifts only work within each half, so the top half
+		 * needs the bottom half's total too */
+		x = _mm256_xor_si256(x, _mm256_slli_si256(x, 4));
+		x = _mm256_xor_si256(x, _mm256_slli_si256(x, 8));
+		x = _mm256_xor_si256(x, _mm256_blend_epi32(_mm256_setzero_si256(),
+				_mm256_permutevar8x32_epi32(x, low3), 0xf0));
+		x = _mm256_xor_si256(x, carry);
+		carry = _mm256_permutevar8x32_epi32(x, last);
+		x = _mm256_xor_si256(x, _mm256_loadu_si256((__m256i*)(ed->prefix + loop)));
+		_mm256_storeu_si256((__m256i*)(mydata + loop), x);
+	}
+
+	for (work = _mm_cvtsi128_si32(_mm256_castsi256_si128(carry)); loop < until; loop++)
+	{
+		work ^= mydata[loop];
+		mydata[loop] = work ^ ed->prefix[loop];
+	}
+}
+
+/* each decrypted word only needs two ciphertext words, so these go from
+ * the end backwards, so that the word before each vector hasn't been
+ * overwritten yet. */
+__attribute__((target("sse2")))
+local void dec_sse2(EncData *ed, int *mydata, int until)
+{
+	int *mytable = (int*)ed->table, loop;
+	__m128i cur, prev, t;
+
+	for (loop = until - 4; loop >= 1; loop -= 4)
+	{
+		cur = _mm_loadu_si128((__m128i*)(mydata + loop));
+		prev = _mm_loadu_si128((__m128i*)(mydata + loop - 1));
+		t = _mm_loadu_si128((__m128i*)(mytable + loop));
+		_mm_storeu_si128((__m128i*)(mydata + loop),
+				_mm_xor_si128(cur, _mm_xor_si128(prev, t)));
+	}
+
+	for (loop += 3; loop >= 0; loop--)
+		mydata[loop] ^= mytable[loop] ^ (loop ? mydata[loop-1] : ed->key);
+}
+
+__attribute__((target("avx2")))
+local void dec_avx2(EncData *ed, int *mydata, int until)
+{
+	int *mytable = (int*)ed->table, loop;
+	__m256i cur, prev, t;
+
+	for (loop = until - 8; loop >= 1; loop -= 8)
+	{
+		cur = _mm256_loadu_si256((__m256i*)(mydata + loop));
+		prev = _mm256_loadu_si256((__m256i*)(mydata + loop - 1));
+		t = _mm256_loadu_si256((__m256i*)(mytable + loop));
+		_mm256_storeu_si256((__m256i*)(mydata + loop),
+				_mm256_xor_si256(cur, _mm256_xor_si256(prev, t)));
+	}
+
+	for (loop += 7; loop >= 0; loop--)
+		mydata[loop] ^= mytable[loop] ^ (loop ? mydata[loop-1] : ed->key);
+}
+
+#endif
+
+local void pick_kernels(void)
+{
+#ifdef VIE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		enc_kernel = enc_avx2;
+		dec_kernel = dec_avx2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		enc_kernel = enc_sse2;
+		dec_kernel = dec_sse2;
+	}
+#endif
 }
 
 
 local int do_enc(EncData *ed, byte *data, int len)
 {
-	int work = ed->key, *mytable = (int*)ed->table;
-	int loop, until, *mydata;
+	int until, *mydata;
 
-	if (work == 0 || mytable == NULL) return len;
+	if (ed->key == 0) return len;
 
 	if (data[0] == 0)
 	{
@@ -179,30 +346,22 @@ local int do_enc(EncData *ed, byte *data, int len)
 		until = (len-1)/4 + 1;
 	}
 
-	for (loop = 0; loop < until; loop++)
-	{
-		work = mydata[loop] ^ (mytable[loop] ^ work);
-		mydata[loop] = work;
-	}
+	enc_kernel(ed, mydata, until);
 	return len;
 }
 
 local int Encrypt(Player *p, byte *data, int len)
 {
-	EncData *ed, **p_ed = PPDATA(p, enckey);
-	pthread_mutex_lock(&mtx);
-	ed = *p_ed;
-	pthread_mutex_unlock(&mtx);
+	EncData *ed = __atomic_load_n((EncData**)PPDATA(p, enckey), __ATOMIC_ACQUIRE);
 	return ed ? do_enc(ed, data, len) : len;
 }
 
 
 local int do_dec(EncData *ed, byte *data, int len)
 {
-	int work = ed->key, *mytable = (int*)ed->table;
-	int *mydata, loop, until;
+	int *mydata, until;
 
-	if (work == 0 || mytable == NULL) return len;
+	if (ed->key == 0) return len;
 
 	if (data[0] == 0)
 	{
@@ -215,33 +374,20 @@ local int do_dec(EncData *ed, byte *data, int len)
 		until = (len-1)/4 + 1;
 	}
 
-	for (loop = 0; loop < until; loop++)
-	{
-		int tmp = mydata[loop];
-		mydata[loop] = mytable[loop] ^ work ^ tmp;
-		work = tmp;
-	}
+	dec_kernel(ed, mydata, until);
 	return len;
 }
 
 local int Decrypt(Player *p, byte *data, int len)
 {
-	EncData *ed, **p_ed = PPDATA(p, enckey);
-	pthread_mutex_lock(&mtx);
-	ed = *p_ed;
-	pthread_mutex_unlock(&mtx);
+	EncData *ed = __atomic_load_n((EncData**)PPDATA(p, enckey), __ATOMIC_ACQUIRE);
 	return ed ? do_dec(ed, data, len) : len;
 }
 
 
 local void Void(Player *p)
 {
-	EncData *ed, **p_ed = PPDATA(p, enckey);
-	pthread_mutex_lock(&mtx);
-	ed = *p_ed;
-	afree(ed);
-	*p_ed = NULL;
-	pthread_mutex_unlock(&mtx);
+	afree(__atomic_exchange_n((EncData**)PPDATA(p, enckey), NULL, __ATOMIC_ACQ_REL));
 }
 
 
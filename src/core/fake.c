@@ -31,7 +31,7 @@ local Player * CreateFakePlayer(const char *name, Arena *arena, int ship, int fr
 	astrncpy(p->clientname, "<internal fake player>", sizeof(p->clientname));
 	p->p_ship = ship;
 	p->p_freq = freq;
-	p->arena = arena;
+	pd->SetArena(p, arena);
 	SET_SEND_DAMAGE(p);
 
 	/* enter arena */
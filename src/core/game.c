@@ -14,6 +14,14 @@
 
 #define WEAPONCOUNT 32
 
+/* the spatial grid divides the 16384x16384 pixel map into square cells
+ * of 1 << GRID_SHIFT pixels. the extra slot after the last cell holds
+ * players who have to be considered for every packet regardless of
+ * distance (speccers, turrets, and see_all_posn bots). */
+#define GRID_SHIFT 10
+#define GRID_DIM (1 << (14 - GRID_SHIFT))
+#define GRID_UNBINNED (GRID_DIM * GRID_DIM)
+
 
 /* structs */
 
@@ -42,6 +50,11 @@ typedef struct
 	time_t expires; /* when the lock expires, or 0 for session-long lock */
 	ticks_t lastrgncheck; /* when we last updated the region-based flags */
 	LinkedList lastrgnset;
+
+	/* spatial grid membership. protected by gridmtx. */
+	Arena *gridarena;
+	Player *gridnext, **gridprev;
+	int gridcell;
 } pdata;
 
 typedef struct
@@ -53,6 +66,10 @@ typedef struct
 	int deathwofiring;
 	int regionchecktime;
 	int nosafeanti;
+
+	/* spatial index of player positions. protected by gridmtx. */
+	Player **gridcells;
+	int gridmaxview;
 } adata;
 
 typedef struct safezone_closure_t
@@ -86,8 +103,14 @@ local int adkey, pdkey;
 
 local int cfg_bulletpix, cfg_wpnpix, cfg_pospix;
 local int cfg_sendanti;
+local int cfg_spatialgrid;
+
+/* arena settings read from the packet and kill handlers */
+local ConfigKey key_antiwarppixels, key_enterdelay;
+local ConfigKey key_useteamkillprize, key_teamkillprize;
 local int wpnrange[WEAPONCOUNT]; /* there are 5 bits in the weapon type */
 local pthread_mutex_t specmtx = PTHREAD_MUTEX_INITIALIZER;
+local pthread_mutex_t gridmtx = PTHREAD_MUTEX_INITIALIZER;
 local pthread_mutex_t freqshipmtx = PTHREAD_MUTEX_INITIALIZER;
 
 
@@ -137,6 +160,115 @@ local inline long lhypot (register long dx, register long dy)
 }
 
 
+/* spatial grid */
+
+local inline int grid_coord(int v)
+{
+	v >>= GRID_SHIFT;
+	return v < 0 ? 0 : v >= GRID_DIM ? GRID_DIM - 1 : v;
+}
+
+/* call with gridmtx locked */
+local void grid_unlink(Player *p)
+{
+	pdata *data = PPDATA(p, pdkey);
+
+	if (data->gridarena)
+	{
+		if (data->gridnext)
+			((pdata*)PPDATA(data->gridnext, pdkey))->gridprev = data->gridprev;
+		*data->gridprev = data->gridnext;
+		data->gridarena = NULL;
+		data->gridnext = NULL;
+		data->gridprev = NULL;
+	}
+}
+
+/* puts the player into the cell matching their last known position, or
+ * into the unbinned list if distance doesn't decide what they see. this
+ * has to be called whenever data->pos, data->speccing or p_attached
+ * change. */
+local void grid_update(Player *p)
+{
+	pdata *data = PPDATA(p, pdkey);
+	Arena *arena = p->arena;
+	adata *ad;
+	int cell;
+
+	if (!cfg_spatialgrid || !arena || !IS_STANDARD(p))
+		return;
+
+	ad = P_ARENA_DATA(arena, adkey);
+
+	pthread_mutex_lock(&gridmtx);
+
+	if (data->speccing || p->p_attached != -1 || p->flags.see_all_posn)
+		cell = GRID_UNBINNED;
+	else
+		cell = grid_coord(data->pos.y) * GRID_DIM + grid_coord(data->pos.x);
+
+	if (data->gridarena != arena || data->gridcell != cell)
+	{
+		grid_unlink(p);
+
+		if (!ad->gridcells)
+			ad->gridcells = amalloc((GRID_UNBINNED + 1) * sizeof(Player *));
+
+		data->gridarena = arena;
+		data->gridcell = cell;
+		data->gridprev = &ad->gridcells[cell];
+		data->gridnext = ad->gridcells[cell];
+		if (data->gridnext)
+			((pdata*)PPDATA(data->gridnext, pdkey))->gridprev = &data->gridnext;
+		ad->gridcells[cell] = p;
+	}
+
+	if (p->xres + p->yres > ad->gridmaxview)
+		ad->gridmaxview = p->xres + p->yres;
+
+	pthread_mutex_unlock(&gridmtx);
+}
+
+local void grid_remove(Player *p)
+{
+	pthread_mutex_lock(&gridmtx);
+	grid_unlink(p);
+	pthread_mutex_unlock(&gridmtx);
+}
+
+/* adds every player in the arena who might be within range pixels of
+ * (x, y) to the list, plus the unbinned ones. the caller still has to
+ * check the real distance. call with pd->Lock held. */
+local void grid_query(Arena *arena, int x, int y, int range, LinkedList *list)
+{
+	adata *ad = P_ARENA_DATA(arena, adkey);
+	int cx, cy, cx1, cy1, cx2, cy2;
+	Player *i;
+
+	pthread_mutex_lock(&gridmtx);
+
+	if (ad->gridcells)
+	{
+		cx1 = grid_coord(x - range);
+		cx2 = grid_coord(x + range);
+		cy1 = grid_coord(y - range);
+		cy2 = grid_coord(y + range);
+
+		for (cy = cy1; cy <= cy2; cy++)
+			for (cx = cx1; cx <= cx2; cx++)
+				for (i = ad->gridcells[cy * GRID_DIM + cx]; i;
+						i = ((pdata*)PPDATA(i, pdkey))->gridnext)
+					LLAdd(list, i);
+
+		for (i = ad->gridcells[GRID_UNBINNED]; i;
+				i = ((pdata*)PPDATA(i, pdkey))->gridnext)
+			LLAdd(list, i);
+	}
+
+	pthread_mutex_unlock(&gridmtx);
+}
+
+
 struct region_cb_params
 {
 	pdata *data;
@@ -259,6 +391,7 @@ local void handle_ppk(Player *p, struct C2SPosition *pos, int len, int isfake)
 	struct S2CWeapons wpn;
 	struct S2CPosition sendpos;
 	LinkedList advisers = LL_INITIALIZER;
+	LinkedList nearby = LL_INITIALIZER, *targets;
 	Appk *ppkadviser;
 	int drop;
 
@@ -330,6 +463,7 @@ local void handle_ppk(Player *p, struct C2SPosition *pos, int len, int isfake)
 		 * didn't send any epd, it will copy zeros because the buffer was
 		 * zeroed before data was recvd into it. */
 		memcpy(&data->pos, pkt, sizeof(data->pos));
+		grid_update(p);
 
 		/* update position in global player struct.
 		 * only copy x/y if they are nonzero, so we keep track of last
@@ -479,8 +613,28 @@ local void handle_ppk(Player *p, struct C2SPosition *pos, int len, int isfake)
 			ml->SetTimer(run_spawn_cb, 0, 0, p, NULL);
 		}
 
-		FOR_EACH_PLAYER_P(i, idata, pdkey)
-			if (i->status == S_PLAYING &&
+		/* narrow down the receivers using the spatial grid, unless the
+		 * packet is going to everyone anyway. */
+		if (cfg_spatialgrid && !sendtoall)
+		{
+			int range;
+			if (pos->weapon.type)
+				range = wpnrange[pos->weapon.type];
+			else
+			{
+				range = adata->gridmaxview;
+				if (range < cfg_pospix)
+					range = cfg_pospix;
+			}
+			grid_query(arena, x1, y1, range, &nearby);
+			targets = &nearby;
+		}
+		else
+			targets = &pd->playerlist;
+
+		FOR_EACH(targets, i, link)
+			if ((idata = PPDATA(i, pdkey)) &&
+				i->status == S_PLAYING &&
 				IS_STANDARD(i) &&
 				i->arena == arena &&
 				(i != p || p->flags.see_own_posn))
@@ -634,6 +788,7 @@ local void handle_ppk(Player *p, struct C2SPosition *pos, int len, int isfake)
 				}
 			}
 		pd->Unlock();
+		LLEmpty(&nearby);
 		mm->ReleaseAdviserList(&advisers);
 
 		/* do the position packet callback */
@@ -672,7 +827,7 @@ local int IsAntiwarped(Player *p, LinkedList *players)
 				int xdelta = (i->position.x - p->position.x);
 				int ydelta = (i->position.y - p->position.y);
 				int distSquared = (xdelta * xdelta + ydelta * ydelta);
-				int antiwarpRange = cfg->GetInt(p->arena->cfg, "Toggle", "AntiwarpPixels", 1);
+				int antiwarpRange = cfg->GetKeyInt(p->arena->cfg, key_antiwarppixels, 1);
 
 				if (distSquared < antiwarpRange * antiwarpRange)
 				{
@@ -773,6 +928,8 @@ local void PSpecRequest(Player *p, byte *pkt, int len)
 			add_speccing(data, t);
 	}
 
+	grid_update(p);
+
 	pthread_mutex_unlock(&specmtx);
 }
 
@@ -962,6 +1119,7 @@ local void SetShipAndFreq(Player *p, int ship, int freq)
 	p->p_freq = freq;
 	pthread_mutex_lock(&specmtx);
 	clear_speccing(data);
+	grid_update(p);
 	pthread_mutex_unlock(&specmtx);
 
 	pthread_mutex_unlock(&freqshipmtx);
@@ -1229,7 +1387,7 @@ local void PDie(Player *p, byte *pkt, int len)
 	pd->Lock();
 	p->flags.is_dead = 1;
 	/* continuum clients take EnterDelay + 100 ticks to respawn after death */
-	enterdelay = cfg->GetInt(arena->cfg, "Kill", "EnterDelay", 0) + 100;
+	enterdelay = cfg->GetKeyInt(arena->cfg, key_enterdelay, 0) + 100;
 	/* setting of 0 or less means respawn in place, with 1 second delay */
 	if (enterdelay <= 0)
 		enterdelay = 100;
@@ -1272,12 +1430,12 @@ local void PDie(Player *p, byte *pkt, int len)
 	/* cfghelp: Prize:UseTeamkillPrize, arena, int, def: 0
 	 * Whether to use a special prize for teamkills.
 	 * Prize:TeamkillPrize specifies the prize #. */
-	if (p->p_freq == killer->p_freq && cfg->GetInt(arena->cfg, "Prize", "UseTeamkillPrize", 0))
+	if (p->p_freq == killer->p_freq && cfg->GetKeyInt(arena->cfg, key_useteamkillprize, 0))
 	{
 		/* cfghelp: Prize:TeamkillPrize, arena, int, def: 0
 		 * The prize # to give for a teamkill, if
 		 * Prize:UseTeamkillPrize=1. */
-		green = cfg->GetInt(arena->cfg, "Prize", "TeamkillPrize", 0);
+		green = cfg->GetKeyInt(arena->cfg, key_teamkillprize, 0);
 	}
 	else
 	{
@@ -1413,6 +1571,7 @@ local void PAttach(Player *p, byte *pkt2, int len)
 		struct SimplePacket pkt = { S2C_TURRET, p->pid, pid2 };
 		net->SendToArena(arena, NULL, (byte*)&pkt, 5, NET_RELIABLE);
 		p->p_attached = pid2;
+		grid_update(p);
 
 		DO_CBS(CB_ATTACH, p->arena, AttachFunc, (p, to));
 	}
@@ -1491,6 +1650,8 @@ local void PlayerAction(Player *p, int action, Arena *arena)
 		data->wpnsent = 0;
 		data->deathwofiring = 0;
 		p->flags.sent_wpn = 0;
+
+		grid_update(p);
 	}
 	else if (action == PA_LEAVEARENA)
 	{
@@ -1502,7 +1663,10 @@ local void PlayerAction(Player *p, int action, Arena *arena)
 		pd->Lock();
 		FOR_EACH_PLAYER_P(i, idata, pdkey)
 			if (idata->speccing == p)
+			{
 				clear_speccing(idata);
+				grid_update(i);
+			}
 		pd->Unlock();
 
 		if (data->epd_queries > 0)
@@ -1512,6 +1676,8 @@ local void PlayerAction(Player *p, int action, Arena *arena)
 
 		pthread_mutex_unlock(&specmtx);
 
+		grid_remove(p);
+
 		LLEmpty(&data->lastrgnset);
 	}
 	else if (action == PA_ENTERGAME)
@@ -1540,7 +1706,10 @@ local void NewPlayer(Player *p, int new)
 		pd->Lock();
 		FOR_EACH_PLAYER_P(i, idata, pdkey)
 			if (idata->speccing == p)
+			{
 				clear_speccing(idata);
+				grid_update(i);
+			}
 		pd->Unlock();
 
 		pthread_mutex_unlock(&specmtx);
@@ -1605,6 +1774,16 @@ local void ArenaAction(Arena *arena, int action)
 		if (action == AA_CREATE)
 			ad->initlockship = ad->initspec = FALSE;
 	}
+	else if (action == AA_DESTROY)
+	{
+		adata *ad = P_ARENA_DATA(arena, adkey);
+
+		pthread_mutex_lock(&gridmtx);
+		afree(ad->gridcells);
+		ad->gridcells = NULL;
+		ad->gridmaxview = 0;
+		pthread_mutex_unlock(&gridmtx);
+	}
 }
 
 
@@ -1835,6 +2014,11 @@ EXPORT int MM_game(int action, Imodman *mm_, Arena *arena)
 		if (persist)
 			persist->RegPlayerPD(&persdata);
 
+		key_antiwarppixels = cfg->GetKey("Toggle", "AntiwarpPixels");
+		key_enterdelay = cfg->GetKey("Kill", "EnterDelay");
+		key_useteamkillprize = cfg->GetKey("Prize", "UseTeamkillPrize");
+		key_teamkillprize = cfg->GetKey("Prize", "TeamkillPrize");
+
 		/* cfghelp: Net:BulletPixels, global, int, def: 1500
 		 * How far away to always send bullets (in pixels). */
 		cfg_bulletpix = cfg->GetInt(GLOBAL, "Net", "BulletPixels", 1500);
@@ -1850,6 +2034,11 @@ EXPORT int MM_game(int action, Imodman *mm_, Arena *arena)
 		cfg_sendanti = cfg->GetInt(GLOBAL, "Net", "AntiwarpSendPercent", 5);
 		/* convert to a percentage of RAND_MAX */
 		cfg_sendanti = RAND_MAX / 100 * cfg_sendanti;
+		/* cfghelp: Net:SpatialGrid, global, bool, def: 1
+		 * Whether to keep a per-arena grid of player positions and use
+		 * it to find who should receive position and weapon packets,
+		 * instead of checking every player in the zone. */
+		cfg_spatialgrid = cfg->GetInt(GLOBAL, "Net", "SpatialGrid", 1);
 
 		for (i = 0; i < WEAPONCOUNT; i++)
 			wpnrange[i] = cfg_wpnpix;
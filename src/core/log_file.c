@@ -10,6 +10,7 @@
 
 
 local void LogFile(const char *);
+local void LogFileBatch(const char **lines, int count);
 local void FlushLog(void);
 local void ReopenLog(void);
 local int flush_timer(void *dummy);
@@ -17,6 +18,10 @@ local int reopen_timer(void *dummy);
 
 local FILE *logfile;
 local pthread_mutex_t logmtx = PTHREAD_MUTEX_INITIALIZER;
+/* the formatted time, which only changes once a second. logmtx protects
+ * these too. */
+local time_t stamptime;
+local char stamp[128];
 
 local Iconfig *cfg;
 local Ilogman *lm;
@@ -46,7 +51,7 @@ EXPORT int MM_log_file(int action, Imodman *mm, Arena *arenas)
 		logfile = NULL;
 		ReopenLog();
 
-		mm->RegCallback(CB_LOGFUNC, LogFile, ALLARENAS);
+		mm->RegCallback(CB_LOGFUNCBATCH, LogFileBatch, ALLARENAS);
 
 		/* cfghelp: Log:FileFlushPeriod, global, int, def: 10
 		 * How often to flush the log file to disk (in minutes). */
@@ -78,7 +83,7 @@ EXPORT int MM_log_file(int action, Imodman *mm, Arena *arenas)
 
 		ml->ClearTimer(reopen_timer, NULL);
 		ml->ClearTimer(flush_timer, NULL);
-		mm->UnregCallback(CB_LOGFUNC, LogFile, ALLARENAS);
+		mm->UnregCallback(CB_LOGFUNCBATCH, LogFileBatch, ALLARENAS);
 
 		pthread_mutex_lock(&logmtx);
 		if (logfile)
@@ -94,28 +99,39 @@ EXPORT int MM_log_file(int action, Imodman *mm, Arena *arenas)
 }
 
 
-void LogFile(const char *s)
+void LogFileBatch(const char **lines, int count)
 {
-	if (lm->FilterLog(s, "log_file"))
+	int i;
+
+	pthread_mutex_lock(&logmtx);
+	if (logfile)
 	{
-		pthread_mutex_lock(&logmtx);
-		if (logfile)
+		time_t t;
+
+		time(&t);
+		if (t != stamptime)
 		{
 			struct tm _tm;
-			time_t t;
-			char t3[128];
-
-			time(&t);
 			alocaltime_r(&t, &_tm);
-
-			strftime(t3, sizeof(t3), CFG_TIMEFORMAT, &_tm);
-			fputs(t3, logfile);
-			fputs(" ", logfile);
-			fputs(s, logfile);
-			fputs("\n", logfile);
+			strftime(stamp, sizeof(stamp) - 1, CFG_TIMEFORMAT, &_tm);
+			strcat(stamp, " ");
+			stamptime = t;
 		}
-		pthread_mutex_unlock(&logmtx);
+
+		for (i = 0; i < count; i++)
+			if (lm->FilterLog(lines[i], "log_file"))
+			{
+				fputs(stamp, logfile);
+				fputs(lines[i], logfile);
+				putc('\n', logfile);
+			}
 	}
+	pthread_mutex_unlock(&logmtx);
+}
+
+void LogFile(const char *s)
+{
+	LogFileBatch(&s, 1);
 }
 
 void FlushLog(void)
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sched.h>
+#include <time.h>
 
 #include "asss.h"
 
@@ -18,7 +20,56 @@ local int FilterLog(const char *, const char *);
 local void * LoggingThread(void *);
 
 
-local MPQueue queue;
+/* lines are formatted straight into a fixed set of buffers, so logging
+ * doesn't allocate anything. full buffers go to the logging thread
+ * through an MPSCQueue, which is as big as the set, so adding to it
+ * never has to wait. */
+#define LOG_LINES 4096 /* must be a power of two */
+#define LOG_LINE 1024
+/* how many lines the logging thread hands to handlers at once */
+#define LOG_BATCH 64
+
+struct logline
+{
+	int busy; /* set from claim_line until the logging thread is done */
+	char line[LOG_LINE];
+};
+
+local struct logline * claim_line(int wait);
+
+local struct logline *linepool;
+/* where claim_line looks next */
+local unsigned long nextline;
+local MPSCQueue queue;
+/* added to the queue to stop the logging thread */
+local struct logline quitline;
+/* lines dropped because every buffer was in use */
+local unsigned int fulldrops;
+
+
+/* rate limiting. each module and level gets a bucket that counts lines
+ * in the current second. buckets are claimed the first time a module
+ * logs at a level and never given back. if the table gets crowded,
+ * the leftovers share the last bucket. */
+#define RATE_BUCKETS 1024 /* must be a power of two */
+#define RATE_PROBES 8
+
+struct ratebucket
+{
+	unsigned int hash; /* 0 if unclaimed */
+	int named; /* set once mod and level are filled in */
+	char level;
+	char mod[24];
+	unsigned int second, count, dropped;
+};
+
+local struct ratebucket *buckets;
+/* lines per second per module and level. 0 means no limit. */
+local int ratelimit;
+local time_t lastreport;
+local unsigned int ratedrops;
+
+
 local pthread_t thd;
 local Imodman *mm;
 
@@ -41,13 +92,23 @@ EXPORT int MM_logman(int action, Imodman *mm_, Arena *arena)
 	{
 		mm = mm_;
 		cfg = NULL;
-		MPInit(&queue);
+		ratelimit = 0;
+		linepool = amalloc(LOG_LINES * sizeof(*linepool));
+		nextline = 0;
+		MPSCInit(&queue, LOG_LINES);
+		buckets = amalloc(RATE_BUCKETS * sizeof(*buckets));
 		mm->RegInterface(&logint, ALLARENAS);
 		return MM_OK;
 	}
 	else if (action == MM_POSTLOAD)
 	{
 		cfg = mm->GetInterface(I_CONFIG, ALLARENAS);
+		/* cfghelp: Log:RateLimit, global, int, def: 100
+		 * How many lines per second each module can log at each level.
+		 * Lines over the limit are dropped and counted, and the counts
+		 * are logged once a second. Errors and critical messages are
+		 * never dropped. 0 means no limit. */
+		ratelimit = cfg ? cfg->GetInt(GLOBAL, "Log", "RateLimit", 100) : 100;
 		pthread_create(&thd, NULL, LoggingThread, NULL);
 	}
 	else if (action == MM_PREUNLOAD)
@@ -58,73 +119,259 @@ EXPORT int MM_logman(int action, Imodman *mm_, Arena *arena)
 	{
 		if (mm->UnregInterface(&logint, ALLARENAS))
 			return MM_FAIL;
-		MPAdd(&queue, NULL);
+		MPSCAdd(&queue, &quitline);
 		pthread_join(thd, NULL);
-		MPDestroy(&queue);
+		MPSCDestroy(&queue);
+		afree(linepool);
+		afree(buckets);
 		return MM_OK;
 	}
 	return MM_FAIL;
 }
 
 
-void * LoggingThread(void *dummy)
+/* gets a buffer to format a line into. the logging thread frees them
+ * roughly in the order they were claimed, so if the next one is still
+ * busy, nearly all of them are. then this either waits for the logging
+ * thread to catch up or gives up. */
+local struct logline * claim_line(int wait)
 {
-	char *ll;
-
 	for (;;)
 	{
-		ll = MPRemove(&queue);
-		if (ll == NULL)
+		struct logline *l = &linepool[__atomic_fetch_add(&nextline, 1, __ATOMIC_RELAXED) & (LOG_LINES-1)];
+		int idle = FALSE;
+		if (__atomic_compare_exchange_n(&l->busy, &idle, TRUE, FALSE,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return l;
+		if (!wait)
 			return NULL;
+		sched_yield();
+	}
+}
+
+local void release_line(struct logline *l)
+{
+	__atomic_store_n(&l->busy, FALSE, __ATOMIC_RELEASE);
+}
+
+
+local void deliver(const char **lines, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+		DO_CBS(CB_LOGFUNC, ALLARENAS, LogFunc, (lines[i]));
+	DO_CBS(CB_LOGFUNCBATCH, ALLARENAS, LogFuncBatch, (lines, count));
+}
+
 
-		DO_CBS(CB_LOGFUNC, ALLARENAS, LogFunc, (ll));
-		afree(ll);
+/* logs and resets the drop counters, at most once a second */
+local void report_drops(void)
+{
+	time_t now = time(NULL);
+	unsigned int n;
+	int i;
+
+	if (now == lastreport ||
+	    (!__atomic_load_n(&ratedrops, __ATOMIC_RELAXED) &&
+	     !__atomic_load_n(&fulldrops, __ATOMIC_RELAXED)))
+		return;
+	lastreport = now;
+
+	if ((n = __atomic_exchange_n(&fulldrops, 0, __ATOMIC_RELAXED)))
+		Log(L_WARN, "<logman> log buffer full, dropped %u lines", n);
+
+	if (!__atomic_exchange_n(&ratedrops, 0, __ATOMIC_RELAXED))
+		return;
+	for (i = 0; i < RATE_BUCKETS; i++)
+	{
+		struct ratebucket *b = &buckets[i];
+		if (__atomic_load_n(&b->named, __ATOMIC_ACQUIRE) &&
+		    (n = __atomic_exchange_n(&b->dropped, 0, __ATOMIC_RELAXED)))
+			Log(L_WARN, "<logman> rate limit dropped %u %c lines from <%s>",
+					n, b->level, b->mod);
 	}
 }
 
 
-void Log(char level, const char *format, ...)
+void * LoggingThread(void *dummy)
 {
-	int len, async = 1;
-	va_list argptr;
-	char buf[1024];
+	struct logline *batch[LOG_BATCH];
+	const char *text[LOG_BATCH];
+	struct logline *l;
+	int i, count, quit = FALSE;
 
-	if (level & L_SYNC)
+	while (!quit)
 	{
-		level &= 0x7f;
-		async = 0;
+		/* wait for one line, then take whatever else is ready */
+		l = MPSCRemove(&queue);
+		for (count = 0; l; l = count < LOG_BATCH ? MPSCTryRemove(&queue) : NULL)
+		{
+			if (l == &quitline)
+			{
+				quit = TRUE;
+				break;
+			}
+			batch[count] = l;
+			text[count++] = l->line;
+		}
+
+		if (count)
+			deliver(text, count);
+
+		for (i = 0; i < count; i++)
+			release_line(batch[i]);
+
+		if (!quit)
+			report_drops();
 	}
 
-	buf[0] = level;
-	buf[1] = ' ';
+	return NULL;
+}
 
-	va_start(argptr, format);
-	len = vsnprintf(buf+2, 1022, format, argptr);
-	va_end(argptr);
 
-	if (len > 0)
+/* checks if a line can be logged, counting it against its module and
+ * level for this second. */
+local int rate_ok(char level, const char *mod, int modlen)
+{
+	unsigned int h = level, second;
+	struct ratebucket *b = NULL;
+	int i;
+
+	if (ratelimit <= 0 || level == L_ERROR || level == L_CRITICAL)
+		return TRUE;
+
+	if (modlen > (int)sizeof(b->mod) - 1)
+		modlen = sizeof(b->mod) - 1;
+	for (i = 0; i < modlen; i++)
+		h = h * 31 + (unsigned char)mod[i];
+	if (h == 0)
+		h = 1;
+
+	for (i = 0; i < RATE_PROBES; i++)
 	{
-		if (async)
-			MPAdd(&queue, astrdup(buf));
+		unsigned int cur, zero = 0;
+		b = &buckets[(h + i) & (RATE_BUCKETS-1)];
+		cur = __atomic_load_n(&b->hash, __ATOMIC_ACQUIRE);
+		if (cur == h)
+			break;
+		if (cur == 0)
+		{
+			if (__atomic_compare_exchange_n(&b->hash, &zero, h, FALSE,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				b->level = level;
+				memcpy(b->mod, mod, modlen);
+				__atomic_store_n(&b->named, TRUE, __ATOMIC_RELEASE);
+				break;
+			}
+			if (zero == h)
+				break;
+		}
+	}
+	if (i == RATE_PROBES)
+		b = &buckets[RATE_BUCKETS-1];
+
+	/* a few extra lines can get through when the second changes. that's
+	 * fine. */
+	second = (unsigned int)time(NULL);
+	if (__atomic_load_n(&b->second, __ATOMIC_RELAXED) != second)
+	{
+		__atomic_store_n(&b->second, second, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&b->count, 1, __ATOMIC_RELAXED) <= (unsigned int)ratelimit)
+		return TRUE;
+
+	__atomic_add_fetch(&b->dropped, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ratedrops, 1, __ATOMIC_RELAXED);
+	return FALSE;
+}
+
+
+/* gets a buffer to format a line into: one of ours, or buf for
+ * synchronous lines. returns NULL if the line should be dropped. */
+local char * start_line(char *level, const char *mod, int modlen,
+		char *buf, struct logline **lp)
+{
+	if (*level & L_SYNC)
+	{
+		*level &= 0x7f;
+		*lp = NULL;
+		return buf;
+	}
+
+	if (!rate_ok(*level, mod, modlen))
+		return NULL;
+
+	*lp = claim_line(*level == L_ERROR || *level == L_CRITICAL);
+	if (!*lp)
+	{
+		__atomic_add_fetch(&fulldrops, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return (*lp)->line;
+}
+
+local void finish_line(char *line, int len, struct logline *l)
+{
+	if (l)
+	{
+		if (len > 0)
+			MPSCAdd(&queue, l);
 		else
-			DO_CBS(CB_LOGFUNC, ALLARENAS, LogFunc, (buf));
+			release_line(l);
+	}
+	else if (len > 0)
+	{
+		const char *one[1] = { line };
+		deliver(one, 1);
 	}
 }
 
 
-void LogA(char level, const char *mod, Arena *a, const char *format, ...)
+void Log(char level, const char *format, ...)
 {
-	int len, async = 1;
+	int len, modlen = 0;
 	va_list argptr;
-	char buf[1024];
+	char buf[LOG_LINE], *line;
+	const char *mod = "unknown";
+	struct logline *l;
 
-	if (level & L_SYNC)
+	/* the module name is usually right at the front of the format */
+	if (format[0] == '<')
 	{
-		level &= 0x7f;
-		async = 0;
+		mod = format + 1;
+		while (mod[modlen] && mod[modlen] != '>')
+			modlen++;
 	}
+	else
+		modlen = strlen(mod);
+
+	if (!(line = start_line(&level, mod, modlen, buf, &l)))
+		return;
+
+	line[0] = level;
+	line[1] = ' ';
+
+	va_start(argptr, format);
+	len = vsnprintf(line+2, LOG_LINE-2, format, argptr);
+	va_end(argptr);
+
+	finish_line(line, len, l);
+}
+
+
+void LogA(char level, const char *mod, Arena *a, const char *format, ...)
+{
+	int len;
+	va_list argptr;
+	char buf[LOG_LINE], *line;
+	struct logline *l;
+
+	if (!(line = start_line(&level, mod, strlen(mod), buf, &l)))
+		return;
 
-	len = snprintf(buf, 256, "%c <%s> {%s} ",
+	len = snprintf(line, 256, "%c <%s> {%s} ",
 			level,
 			mod,
 			a ? a->name : "(bad arena)");
@@ -132,33 +379,25 @@ void LogA(char level, const char *mod, Arena *a, const char *format, ...)
 		len = 255;
 
 	va_start(argptr, format);
-	len += vsnprintf(buf + len, 1024 - len, format, argptr);
+	len += vsnprintf(line + len, LOG_LINE - len, format, argptr);
 	va_end(argptr);
 
-	if (len > 0)
-	{
-		if (async)
-			MPAdd(&queue, astrdup(buf));
-		else
-			DO_CBS(CB_LOGFUNC, ALLARENAS, LogFunc, (buf));
-	}
+	finish_line(line, len, l);
 }
 
 void LogP(char level, const char *mod, Player *p, const char *format, ...)
 {
-	int len, async = 1;
+	int len;
 	Arena *arena;
 	va_list argptr;
-	char buf[1024], buf2[16];
+	char buf[LOG_LINE], buf2[16], *line;
+	struct logline *l;
 
-	if (level & L_SYNC)
-	{
-		level &= 0x7f;
-		async = 0;
-	}
+	if (!(line = start_line(&level, mod, strlen(mod), buf, &l)))
+		return;
 
 	if (!p)
-		len = snprintf(buf, 256, "%c <%s> [(null player)] ",
+		len = snprintf(line, 256, "%c <%s> [(null player)] ",
 				level,
 				mod);
 	else
@@ -173,13 +412,13 @@ void LogP(char level, const char *mod, Player *p, const char *format, ...)
 
 		arena = p->arena;
 		if (arena)
-			len = snprintf(buf, 256, "%c <%s> {%s} [%s] ",
+			len = snprintf(line, 256, "%c <%s> {%s} [%s] ",
 					level,
 					mod,
 					arena->name,
 					name);
 		else
-			len = snprintf(buf, 256, "%c <%s> [%s] ",
+			len = snprintf(line, 256, "%c <%s> [%s] ",
 					level,
 					mod,
 					name);
@@ -189,16 +428,10 @@ void LogP(char level, const char *mod, Player *p, const char *format, ...)
 		len = 255;
 
 	va_start(argptr, format);
-	len += vsnprintf(buf + len, 1024 - len, format, argptr);
+	len += vsnprintf(line + len, LOG_LINE - len, format, argptr);
 	va_end(argptr);
 
-	if (len > 0)
-	{
-		if (async)
-			MPAdd(&queue, astrdup(buf));
-		else
-			DO_CBS(CB_LOGFUNC, ALLARENAS, LogFunc, (buf));
-	}
+	finish_line(line, len, l);
 }
 
 
@@ -3,6 +3,7 @@
 
 #ifndef WIN32
 #include <unistd.h>
+#include <time.h>
 #endif
 
 #include "asss.h"
@@ -15,6 +16,13 @@ typedef struct TimerData
 	void *param;
 	void *key;
 	int killme;
+	/* breaks ties between timers that are due at the same time, so
+	 * they run in the order they were created */
+	unsigned int seq;
+	/* position in the heap, or -1 while the timer is running */
+	int heapidx;
+	/* chain of timers in the same func/key hash bucket */
+	struct TimerData *hnext, **hprev;
 } TimerData;
 
 typedef struct WorkData
@@ -24,23 +32,162 @@ typedef struct WorkData
 } WorkData;
 
 
+/* timers are kept in a binary min-heap ordered by when they're due, so
+ * the main loop only has to look at the top. they're also hashed by
+ * func and key so ClearTimer can find them without a full scan. */
+#define TIMER_BUCKETS 1024
+
+/* the longest the main loop will sleep, in milliseconds. CB_MAINLOOP
+ * handlers expect to run about this often, even with no timers due. */
+#define MAX_SLEEP 10
+
 local int privatequit;
 local TimerData *thistimer;
-local LinkedList timers;
+local TimerData **heap;
+local int heapsize, heapalloc;
+local TimerData *buckets[TIMER_BUCKETS];
+local unsigned int nextseq;
 local Imodman *mm;
 
 local pthread_t worker_threads[CFG_THREAD_POOL_WORKER_THREADS];
 local MPQueue work_queue;
 
 local pthread_mutex_t tmrmtx = PTHREAD_MUTEX_INITIALIZER;
+local pthread_cond_t tmrcond;
 #define LOCK() pthread_mutex_lock(&tmrmtx)
 #define UNLOCK() pthread_mutex_unlock(&tmrmtx)
 
 
+/* heap and hash maintenance. call all of these with tmrmtx held. */
+
+local inline int timer_before(TimerData *a, TimerData *b)
+{
+	int diff = TICK_DIFF(a->when, b->when);
+	return diff < 0 || (diff == 0 && (int)(a->seq - b->seq) < 0);
+}
+
+local inline void heap_set(int i, TimerData *td)
+{
+	heap[i] = td;
+	td->heapidx = i;
+}
+
+local void heap_up(int i)
+{
+	TimerData *td = heap[i];
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if (!timer_before(td, heap[parent]))
+			break;
+		heap_set(i, heap[parent]);
+		i = parent;
+	}
+	heap_set(i, td);
+}
+
+local void heap_down(int i)
+{
+	TimerData *td = heap[i];
+	for (;;)
+	{
+		int child = 2 * i + 1;
+		if (child >= heapsize)
+			break;
+		if (child + 1 < heapsize && timer_before(heap[child + 1], heap[child]))
+			child++;
+		if (!timer_before(heap[child], td))
+			break;
+		heap_set(i, heap[child]);
+		i = child;
+	}
+	heap_set(i, td);
+}
+
+local void heap_insert(TimerData *td)
+{
+	if (heapsize == heapalloc)
+	{
+		heapalloc = heapalloc ? heapalloc * 2 : 64;
+		heap = arealloc(heap, heapalloc * sizeof(TimerData *));
+	}
+	heap_set(heapsize++, td);
+	heap_up(td->heapidx);
+}
+
+local void heap_remove(TimerData *td)
+{
+	int i = td->heapidx;
+	TimerData *last = heap[--heapsize];
+
+	td->heapidx = -1;
+	if (last != td)
+	{
+		heap_set(i, last);
+		heap_up(i);
+		heap_down(last->heapidx);
+	}
+}
+
+local inline TimerData **timer_bucket(TimerFunc func, void *key)
+{
+	unsigned long h = ((unsigned long)func >> 4) ^ ((unsigned long)key >> 4);
+	h ^= h >> 10;
+	return &buckets[h & (TIMER_BUCKETS - 1)];
+}
+
+local void hash_insert(TimerData *td)
+{
+	TimerData **bucket = timer_bucket(td->func, td->key);
+	td->hprev = bucket;
+	td->hnext = *bucket;
+	if (td->hnext)
+		td->hnext->hprev = &td->hnext;
+	*bucket = td;
+}
+
+local void hash_remove(TimerData *td)
+{
+	if (td->hnext)
+		td->hnext->hprev = td->hprev;
+	*td->hprev = td->hnext;
+}
+
+/* sleeps until the top timer is due, or MAX_SLEEP, whichever is
+ * sooner. StartTimer wakes us up early if it adds an earlier timer. */
+local void wait_for_timers(ticks_t gtc)
+{
+#ifndef WIN32
+	int ms = MAX_SLEEP;
+	TimeoutSpec timeout;
+
+	if (heapsize > 0)
+	{
+		struct timespec ts;
+		int ticks = TICK_DIFF(heap[0]->when, gtc) + 1;
+
+		if (ticks <= 0)
+			return;
+
+		/* ticks are 10ms, and a timer becomes due on a tick boundary */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		if (ticks * 10 - (int)(ts.tv_nsec % 10000000) / 1000000 < ms)
+			ms = ticks * 10 - (int)(ts.tv_nsec % 10000000) / 1000000;
+	}
+
+	timeout = schedule_timeout(ms);
+	pthread_cond_timedwait(&tmrcond, &tmrmtx, &timeout.target);
+#else
+	UNLOCK();
+	fullsleep(MAX_SLEEP);
+	LOCK();
+#endif
+}
+
+
 int RunLoop(void)
 {
 	TimerData *td;
-	Link *l;
 	ticks_t gtc;
 
 	while (!privatequit)
@@ -50,33 +197,36 @@ int RunLoop(void)
 
 		/* do timers */
 		LOCK();
-startover:
-		gtc = current_ticks();
-		for (l = LLGetHead(&timers); l; l = l->next)
+		for (;;)
 		{
-			td = (TimerData*) l->data;
-			if (td->func && TICK_GT(gtc, td->when))
+			int ret;
+
+			gtc = current_ticks();
+			if (heapsize == 0 || !TICK_GT(gtc, heap[0]->when))
+				break;
+
+			td = heap[0];
+			heap_remove(td);
+			thistimer = td;
+			UNLOCK();
+			ret = td->func(td->param);
+			LOCK();
+			thistimer = NULL;
+			if (td->interval == 0 || td->killme || !ret)
+			{
+				hash_remove(td);
+				afree(td);
+			}
+			else
 			{
-				int ret;
-				thistimer = td;
-				UNLOCK();
-				ret = td->func(td->param);
-				LOCK();
-				thistimer = NULL;
-				if (td->interval == 0 || td->killme || !ret)
-				{
-					LLRemove(&timers, td);
-					afree(td);
-				}
-				else
-					td->when = gtc + td->interval;
-				goto startover;
+				td->when = gtc + td->interval;
+				heap_insert(td);
 			}
 		}
-		UNLOCK();
 
 		/* rest a bit */
-		fullsleep(10);
+		wait_for_timers(gtc);
+		UNLOCK();
 	}
 
 	return privatequit & 0xff;
@@ -99,38 +249,60 @@ void StartTimer(TimerFunc f, int startint, int interval, void *param, void *key)
 	data->param = param;
 	data->key = key;
 	LOCK();
-	LLAdd(&timers, data);
+	data->seq = nextseq++;
+	hash_insert(data);
+	heap_insert(data);
+	/* wake up the main loop if this is the new earliest timer */
+	if (data->heapidx == 0)
+		pthread_cond_signal(&tmrcond);
 	UNLOCK();
 }
 
 
+local void cleanup_one(TimerData *td, CleanupFunc cleanup)
+{
+	if (cleanup)
+		cleanup(td->param);
+	/* we might be inside the timer we're trying to remove. if
+	 * so, mark it for the main loop to take care of. if not, do
+	 * the removal now. */
+	if (td == thistimer)
+	{
+		td->killme = TRUE;
+	}
+	else
+	{
+		hash_remove(td);
+		heap_remove(td);
+		afree(td);
+	}
+}
+
 void CleanupTimer(TimerFunc func, void *key, CleanupFunc cleanup)
 {
-	Link *l, *next;
+	TimerData *td, *next;
+	int i;
 
 	LOCK();
-	for (l = LLGetHead(&timers); l; l = next)
+	if (key)
 	{
-		TimerData *td = l->data;
-		next = l->next;
-
-		if (td->func == func && (td->key == key || key == NULL))
+		/* all matching timers are in one bucket */
+		for (td = *timer_bucket(func, key); td; td = next)
 		{
-			if (cleanup)
-				cleanup(td->param);
-			/* we might be inside the timer we're trying to remove. if
-			 * so, mark it for the main loop to take care of. if not, do
-			 * the removal now. */
-			if (td == thistimer)
-			{
-				td->killme = TRUE;
-			}
-			else
+			next = td->hnext;
+			if (td->func == func && td->key == key)
+				cleanup_one(td, cleanup);
+		}
+	}
+	else
+	{
+		for (i = 0; i < TIMER_BUCKETS; i++)
+			for (td = buckets[i]; td; td = next)
 			{
-				LLRemove(&timers, td);
-				afree(td);
+				next = td->hnext;
+				if (td->func == func)
+					cleanup_one(td, cleanup);
 			}
-		}
 	}
 	UNLOCK();
 }
@@ -178,7 +350,17 @@ EXPORT int MM_mainloop(int action, Imodman *mm_, Arena *arena)
 	{
 		mm = mm_;
 		privatequit = 0;
-		LLInit(&timers);
+#ifndef WIN32
+		{
+			pthread_condattr_t condattr;
+			pthread_condattr_init(&condattr);
+			pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+			pthread_cond_init(&tmrcond, &condattr);
+			pthread_condattr_destroy(&condattr);
+		}
+#else
+		pthread_cond_init(&tmrcond, NULL);
+#endif
 		MPInit(&work_queue);
 		for (i = 0; i < CFG_THREAD_POOL_WORKER_THREADS; i++)
 			pthread_create(&worker_threads[i], NULL, thread_main, NULL);
@@ -187,8 +369,17 @@ EXPORT int MM_mainloop(int action, Imodman *mm_, Arena *arena)
 	}
 	else if (action == MM_UNLOAD)
 	{
-		LLEnum(&timers, afree);
-		LLEmpty(&timers);
+		for (i = 0; i < TIMER_BUCKETS; i++)
+			while (buckets[i])
+			{
+				TimerData *td = buckets[i];
+				buckets[i] = td->hnext;
+				afree(td);
+			}
+		afree(heap);
+		heap = NULL;
+		heapsize = heapalloc = 0;
+		pthread_cond_destroy(&tmrcond);
 		for (i = 0; i < CFG_THREAD_POOL_WORKER_THREADS; i++)
 			MPAdd(&work_queue, NULL);
 		for (i = 0; i < CFG_THREAD_POOL_WORKER_THREADS; i++)
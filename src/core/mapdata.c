@@ -5,18 +5,29 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "asss.h"
 #include "packets/mapfname.h"
 
 /* extra includes */
 #include "pathutil.h"
-#include "sparse.inc"
 
 
 #define METADATA_MAGIC 0x6c766c65
 #define MAX_CHUNK_SIZE (128*1024)
 
+/* tiles are stored row by row in a flat array. coordinates wrap at the
+ * map edge, like the sparse array used to. */
+#define MAPSIZE 1024
+#define TILE_INDEX(x, y) ((((y) & (MAPSIZE-1)) * MAPSIZE) + ((x) & (MAPSIZE-1)))
+
+/* the distances FindEmptyTileNear starts from are stored in 4 bits, and
+ * it gives up this far out, which is as far as the old spiral search
+ * reached. */
+#define EMPTY_DIST_MAX 15
+#define EMPTY_SEARCH_MAX 18
+
 #pragma pack(push, 1)
 
 /* some structs */
@@ -34,7 +45,6 @@ struct Region
 	struct ELVL *lvl;
 	const char *name;
 	HashTable *chunks;
-	u32 setmap[8];
 
 	/* Random point generation stuff */
 	int tiles;
@@ -46,22 +56,66 @@ struct RLEEntry
 	int x, y, width, height;
 };
 
+/* a parsed lvl file. these are shared between all arenas using the
+ * same file and never change once loaded. */
 typedef struct ELVL
 {
-	sparse_arr tiles;
-	sparse_arr rgntiles;
+	byte *tiles;
+	/* for each tile, how far it is to the nearest empty one, counting
+	 * diagonal steps as 1 and capped at EMPTY_DIST_MAX. two tiles per
+	 * byte. bricks aren't included, they can only make it further. */
+	byte *emptydist;
+	/* which set of regions each tile is in. this is split into 32x32
+	 * blocks, which are only allocated if some region touches them.
+	 * the values are indexes into rgnsets. */
+	u16 **rgnblocks;
+	/* NULL terminated lists of regions. set 0 is always empty. */
 	Region ***rgnsets;
+	int rgnsetcount, rgnsetsalloc;
 	HashTable *attrs;
 	HashTable *regions;
 	HashTable *rawchunks;
 	int errors, flags;
-	pthread_mutex_t mtx;
+	/* these are protected by cache_mtx */
+	int refs;
+	/* the file this came from, or NULL if it isn't in the cache */
+	char *path;
+	time_t mtime;
+	off_t size;
 } ELVL;
 
+/* per-arena data */
+typedef struct ArenaLvl
+{
+	ELVL *lvl;
+	/* one bit per tile. bricks go here instead of in the shared tiles.
+	 * it's allocated the first time a brick is dropped and read without
+	 * locking, so only change it with atomic ops. */
+	u32 *bricks;
+	/* held while dropping bricks */
+	pthread_mutex_t mtx;
+} ArenaLvl;
+
 
 /* global data */
 local int lvlkey;
 
+/* loaded lvls, looked up by path. most zones run lots of arenas on a
+ * handful of maps, so each file is only parsed and kept in memory once. */
+local LinkedList lvlcache;
+local pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* arenas without a map point here, so lvl is never NULL */
+local ELVL emptylvl;
+
+/* what RaycastSolid treats as solid when not told otherwise */
+local byte default_solid[256];
+
+local inline ELVL * arena_lvl(Arena *a)
+{
+	return ((ArenaLvl*)P_ARENA_DATA(a, lvlkey))->lvl;
+}
+
 /* cached interfaces */
 local Imodman *mm;
 local Imainloop *mainloop;
@@ -89,7 +143,7 @@ local void read_plain_tile_data(ELVL *lvl, const void *vd, int len)
 			if (td->type == TILE_TURF_FLAG)
 				lvl->flags++;
 			if (td->type < TILE_BIG_ASTEROID)
-				insert_sparse(lvl->tiles, td->x, td->y, td->type);
+				lvl->tiles[TILE_INDEX(td->x, td->y)] = td->type;
 			else
 			{
 				int size = 1, x, y;
@@ -101,7 +155,7 @@ local void read_plain_tile_data(ELVL *lvl, const void *vd, int len)
 					size = 5;
 				for (x = 0; x < size; x++)
 					for (y = 0; y < size; y++)
-						insert_sparse(lvl->tiles, td->x+x, td->y+y, td->type);
+						lvl->tiles[TILE_INDEX(td->x+x, td->y+y)] = td->type;
 			}
 		}
 		else
@@ -163,15 +217,34 @@ local void free_region(Region *rgn)
 }
 
 
+#define RGN_BLOCK_BITS 5
+#define RGN_BLOCK_SIZE (1 << RGN_BLOCK_BITS)
+#define RGN_BLOCKS (MAPSIZE / RGN_BLOCK_SIZE)
+#define MAX_RGN_SETS 65536
+
+local inline int lookup_rgnset(ELVL *lvl, int x, int y)
+{
+	u16 *block;
+	x &= MAPSIZE-1;
+	y &= MAPSIZE-1;
+	block = lvl->rgnblocks[(y >> RGN_BLOCK_BITS) * RGN_BLOCKS + (x >> RGN_BLOCK_BITS)];
+	if (!block)
+		return 0;
+	return block[((y & (RGN_BLOCK_SIZE-1)) << RGN_BLOCK_BITS) + (x & (RGN_BLOCK_SIZE-1))];
+}
+
+
 local int Contains(Region *rgn, int x, int y)
 {
-	if (rgn->lvl->rgntiles)
+	if (rgn->lvl->rgnblocks)
 	{
-		int i = lookup_sparse(rgn->lvl->rgntiles, x, y);
-		return rgn->setmap[i >> 5] & (1 << (i & 31));
+		Region **set = rgn->lvl->rgnsets[lookup_rgnset(rgn->lvl, x, y)];
+		if (set)
+			for (; *set; set++)
+				if (*set == rgn)
+					return TRUE;
 	}
-	else
-		return FALSE;
+	return FALSE;
 }
 
 
@@ -182,52 +255,87 @@ local int rgn_set_len(Region **rgnset)
 	return c;
 }
 
-local void add_rgn_tile(Region *newrgn, int x, int y)
+/* adds a region to every tile in its rle rectangles. the new sets are
+ * interned as they're made: a new set is always an old set plus this
+ * region, so remembering which new set each old set turned into is
+ * enough to never make the same one twice. */
+local void add_rgn_tiles(Region *newrgn)
 {
 	ELVL *lvl = newrgn->lvl;
-	Region **oldset, **newset;
-	int i, len;
-
-	oldset = lvl->rgnsets[lookup_sparse(lvl->rgntiles, x, y)];
-
-	len = oldset ? rgn_set_len(oldset) : 0;
+	int oldcount, full = FALSE;
+	u16 *newidx;
+	Link *link;
 
-	/* try looking up new set */
-	for (i = 1; i < 256; i++)
+	if (!lvl->rgnblocks)
 	{
-		Region **tryset = lvl->rgnsets[i];
-		if (!tryset)
-			break;
-		if (memcmp(oldset, tryset, len * sizeof(Region *)) == 0 &&
-		    tryset[len] == newrgn)
-		{
-			/* we found the correct set */
-			insert_sparse(lvl->rgntiles, x, y, i);
-			return;
-		}
+		lvl->rgnblocks = amalloc(RGN_BLOCKS * RGN_BLOCKS * sizeof(u16 *));
+		lvl->rgnsetsalloc = 16;
+		lvl->rgnsets = amalloc(lvl->rgnsetsalloc * sizeof(Region **));
+		lvl->rgnsetcount = 1;
 	}
 
-	/* the correct set doesn't exist yet */
-	if (i < 256)
+	/* sets from before this region, and what they became. 0 means they
+	 * haven't been seen yet. anything newer already has this region. */
+	oldcount = lvl->rgnsetcount;
+	newidx = amalloc(oldcount * sizeof(u16));
+
+	for (link = LLGetHead(&newrgn->rle_data); link; link = link->next)
 	{
-		int j, offset = i >> 5;
-		u32 mask = 1 << (i & 31);
-
-		newset = amalloc((len + 2) * sizeof(Region *));
-		for (j = 0; j < len; j++)
-			(newset[j] = oldset[j])->setmap[offset] |= mask;
-		(newset[len] = newrgn)->setmap[offset] |= mask;
-		newset[len+1] = NULL;
-		lvl->rgnsets[i] = newset;
-		insert_sparse(lvl->rgntiles, x, y, i);
+		struct RLEEntry *e = link->data;
+		int x, y;
+
+		for (y = e->y; y < e->y + e->height && y < MAPSIZE; y++)
+			for (x = e->x; x < e->x + e->width && x < MAPSIZE; x++)
+			{
+				int bi = (y >> RGN_BLOCK_BITS) * RGN_BLOCKS + (x >> RGN_BLOCK_BITS);
+				u16 *block = lvl->rgnblocks[bi], *tile;
+				int old;
+
+				if (!block)
+					block = lvl->rgnblocks[bi] =
+						amalloc(RGN_BLOCK_SIZE * RGN_BLOCK_SIZE * sizeof(u16));
+				tile = &block[((y & (RGN_BLOCK_SIZE-1)) << RGN_BLOCK_BITS) + (x & (RGN_BLOCK_SIZE-1))];
+				old = *tile;
+
+				if (old >= oldcount)
+					continue;
+				if (!newidx[old])
+				{
+					Region **oldset = lvl->rgnsets[old], **newset;
+					int j, len = oldset ? rgn_set_len(oldset) : 0;
+
+					if (lvl->rgnsetcount >= MAX_RGN_SETS)
+					{
+						full = TRUE;
+						continue;
+					}
+
+					newset = amalloc((len + 2) * sizeof(Region *));
+					for (j = 0; j < len; j++)
+						newset[j] = oldset[j];
+					newset[len] = newrgn;
+
+					if (lvl->rgnsetcount == lvl->rgnsetsalloc)
+					{
+						lvl->rgnsetsalloc *= 2;
+						lvl->rgnsets = arealloc(lvl->rgnsets, lvl->rgnsetsalloc * sizeof(Region **));
+					}
+					newidx[old] = lvl->rgnsetcount;
+					lvl->rgnsets[lvl->rgnsetcount++] = newset;
+				}
+				*tile = newidx[old];
+			}
 	}
-	else
+
+	afree(newidx);
+
+	if (full)
 		lm->Log(L_WARN, "<mapdata> overlap limit reached. some region data will be lost.");
 }
 
 local int read_rle_tile_data(Region *rgn, const byte *d, int len)
 {
-	int cx = 0, cy = 0, i = 0, b, op, d1, n, x, y;
+	int cx = 0, cy = 0, i = 0, b, op, d1, n;
 
 	int last_row = -1;
 	LinkedList last_row_data;
@@ -269,9 +377,6 @@ local int read_rle_tile_data(Region *rgn, const byte *d, int len)
 				LLAdd(&last_row_data, entry);
 				LLAdd(&rgn->rle_data, entry);
 				rgn->tiles += n;
-
-				for (x = cx; x < (cx + n); x++)
-					add_rgn_tile(rgn, x, cy);
 				cx += n;
 				break;
 			case 2:
@@ -285,17 +390,16 @@ local int read_rle_tile_data(Region *rgn, const byte *d, int len)
 				if (cx != 0 || cy == 0)
 					return FALSE;
 
+				/* repeating an empty row adds nothing */
+				if (last_row != cy - 1)
+					LLEmpty(&last_row_data);
+
 				for (link = LLGetHead(&last_row_data); link; link = link->next)
 				{
 					struct RLEEntry *entry = link->data;
 					entry->height += n;
 					rgn->tiles += n * entry->width;
 				}
-
-				for (y = cy; y < (cy + n); y++)
-					for (x = 0; x < 1024; x++)
-						if (Contains(rgn, x, cy - 1))
-							add_rgn_tile(rgn, x, y);
 				cy += n;
 				last_row = cy - 1;
 				break;
@@ -308,6 +412,8 @@ local int read_rle_tile_data(Region *rgn, const byte *d, int len)
 		}
 	}
 
+	LLEmpty(&last_row_data);
+
 	if (i != len || cy != 1024)
 		return FALSE;
 
@@ -333,10 +439,8 @@ local int process_region_chunk(const char *key, void *vchunk, void *vrgn)
 	}
 	else if (chunk->type == MAKE_CHUNK_TYPE(rTIL))
 	{
-		if (!rgn->lvl->rgntiles)
-			rgn->lvl->rgntiles = init_sparse();
-		if (!rgn->lvl->rgnsets)
-			rgn->lvl->rgnsets = amalloc(256 * sizeof(Region **));
+		/* the tiles are added to the map once we know the region has
+		 * a name. whatever was read before an error still counts. */
 		if (!read_rle_tile_data(rgn, chunk->data, chunk->size))
 			lm->Log(L_WARN, "<mapdata> error in lvl file while reading rle tile data");
 		afree(chunk);
@@ -388,6 +492,7 @@ local int process_map_chunk(const char *key, void *vchunk, void *vlvl)
 			const char *t = rgn->name;
 			rgn->name = HashAdd(lvl->regions, rgn->name, rgn);
 			afree(t);
+			add_rgn_tiles(rgn);
 		}
 		else
 			/* all regions must have a name */
@@ -436,7 +541,7 @@ local int load_from_file(ELVL *lvl, const char *lvlname)
 	if (!map)
 		return FALSE;
 
-	lvl->tiles = init_sparse();
+	lvl->tiles = amalloc(MAPSIZE * MAPSIZE);
 
 	d = map->data;
 	bmfh = (struct bitmap_file_header_t*)d;
@@ -476,22 +581,27 @@ local int hash_enum_free_region(const char *key, void *rgn, void *clos)
 	return FALSE;
 }
 
-local void clear_level(ELVL *lvl)
+local void free_level(ELVL *lvl)
 {
 	if (lvl->tiles)
 	{
-		delete_sparse(lvl->tiles);
+		afree(lvl->tiles);
 		lvl->tiles = NULL;
 	}
-	if (lvl->rgntiles)
+	afree(lvl->emptydist);
+	lvl->emptydist = NULL;
+	if (lvl->rgnblocks)
 	{
-		delete_sparse(lvl->rgntiles);
-		lvl->rgntiles = NULL;
+		int i;
+		for (i = 0; i < RGN_BLOCKS * RGN_BLOCKS; i++)
+			afree(lvl->rgnblocks[i]);
+		afree(lvl->rgnblocks);
+		lvl->rgnblocks = NULL;
 	}
 	if (lvl->rgnsets)
 	{
 		int i;
-		for (i = 0; i < 256; i++)
+		for (i = 0; i < lvl->rgnsetcount; i++)
 			afree(lvl->rgnsets[i]);
 		afree(lvl->rgnsets);
 		lvl->rgnsets = NULL;
@@ -514,6 +624,181 @@ local void clear_level(ELVL *lvl)
 		HashFree(lvl->rawchunks);
 		lvl->rawchunks = NULL;
 	}
+	afree(lvl);
+}
+
+
+/* a chessboard distance transform of the empty tiles: one pass down
+ * the map looking at the neighbours above and to the left, one pass
+ * back up looking at the others. */
+local void build_empty_dist(ELVL *lvl)
+{
+	byte *dist = amalloc(MAPSIZE * MAPSIZE);
+	int x, y, i;
+
+	for (i = 0; i < MAPSIZE * MAPSIZE; i++)
+		dist[i] = lvl->tiles[i] ? 255 : 0;
+
+#define CLOSER(dx, dy) \
+	if (dist[i + (dy) * MAPSIZE + (dx)] + 1 < d) d = dist[i + (dy) * MAPSIZE + (dx)] + 1
+
+	for (y = 0; y < MAPSIZE; y++)
+		for (x = 0; x < MAPSIZE; x++)
+		{
+			int d;
+			i = y * MAPSIZE + x;
+			if ((d = dist[i]) == 0)
+				continue;
+			if (x > 0) CLOSER(-1, 0);
+			if (y > 0)
+			{
+				CLOSER(0, -1);
+				if (x > 0) CLOSER(-1, -1);
+				if (x < MAPSIZE-1) CLOSER(1, -1);
+			}
+			dist[i] = d;
+		}
+
+	for (y = MAPSIZE-1; y >= 0; y--)
+		for (x = MAPSIZE-1; x >= 0; x--)
+		{
+			int d;
+			i = y * MAPSIZE + x;
+			if ((d = dist[i]) == 0)
+				continue;
+			if (x < MAPSIZE-1) CLOSER(1, 0);
+			if (y < MAPSIZE-1)
+			{
+				CLOSER(0, 1);
+				if (x > 0) CLOSER(-1, 1);
+				if (x < MAPSIZE-1) CLOSER(1, 1);
+			}
+			dist[i] = d;
+		}
+
+#undef CLOSER
+
+	lvl->emptydist = amalloc(MAPSIZE * MAPSIZE / 2);
+	for (i = 0; i < MAPSIZE * MAPSIZE; i++)
+	{
+		int d = dist[i] < EMPTY_DIST_MAX ? dist[i] : EMPTY_DIST_MAX;
+		lvl->emptydist[i >> 1] |= d << ((i & 1) * 4);
+	}
+
+	afree(dist);
+}
+
+local inline int get_empty_dist(ELVL *lvl, int x, int y)
+{
+	int i = TILE_INDEX(x, y);
+	return (lvl->emptydist[i >> 1] >> ((i & 1) * 4)) & 15;
+}
+
+
+/* call with cache_mtx held */
+local ELVL * find_cached(const char *path)
+{
+	Link *link;
+	for (link = LLGetHead(&lvlcache); link; link = link->next)
+	{
+		ELVL *lvl = link->data;
+		if (strcmp(lvl->path, path) == 0)
+			return lvl;
+	}
+	return NULL;
+}
+
+/* finds the parsed lvl for a file, loading it if it isn't cached yet
+ * or the file has changed since. returns it with a reference held. */
+local ELVL * get_level(const char *path)
+{
+	struct stat st;
+	ELVL *lvl, *other;
+
+	if (stat(path, &st) < 0)
+		return NULL;
+
+	pthread_mutex_lock(&cache_mtx);
+	lvl = find_cached(path);
+	if (lvl && lvl->mtime == st.st_mtime && lvl->size == st.st_size)
+	{
+		lvl->refs++;
+		pthread_mutex_unlock(&cache_mtx);
+		return lvl;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+
+	/* parse it without the lock, so other arenas can keep loading. */
+	lvl = amalloc(sizeof(*lvl));
+	if (!load_from_file(lvl, path))
+	{
+		free_level(lvl);
+		return NULL;
+	}
+	build_empty_dist(lvl);
+	lvl->refs = 1;
+	lvl->mtime = st.st_mtime;
+	lvl->size = st.st_size;
+
+	pthread_mutex_lock(&cache_mtx);
+	other = find_cached(path);
+	if (other && other->mtime == lvl->mtime && other->size == lvl->size)
+	{
+		/* another arena loaded the same file meanwhile. use theirs. */
+		other->refs++;
+		pthread_mutex_unlock(&cache_mtx);
+		free_level(lvl);
+		return other;
+	}
+	if (other)
+	{
+		/* the file changed. arenas using the old copy keep it until
+		 * they're done with it. */
+		LLRemove(&lvlcache, other);
+		afree(other->path);
+		other->path = NULL;
+	}
+	lvl->path = astrdup(path);
+	LLAdd(&lvlcache, lvl);
+	pthread_mutex_unlock(&cache_mtx);
+
+	return lvl;
+}
+
+local void put_level(ELVL *lvl)
+{
+	int last;
+
+	if (lvl == &emptylvl)
+		return;
+
+	pthread_mutex_lock(&cache_mtx);
+	last = --lvl->refs == 0;
+	if (last && lvl->path)
+	{
+		LLRemove(&lvlcache, lvl);
+		afree(lvl->path);
+		lvl->path = NULL;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+
+	if (last)
+		free_level(lvl);
+}
+
+/* lvl is passed in so callers load ad->lvl once. it must have tiles. */
+local inline int get_tile(ArenaLvl *ad, ELVL *lvl, int x, int y)
+{
+	int i = TILE_INDEX(x, y);
+	u32 *bricks = __atomic_load_n(&ad->bricks, __ATOMIC_ACQUIRE);
+	if (bricks && (__atomic_load_n(&bricks[i >> 5], __ATOMIC_RELAXED) & (1u << (i & 31))))
+		return TILE_BRICK;
+	return lvl->tiles[i];
+}
+
+local inline ELVL * arena_lvl_acquire(ArenaLvl *ad)
+{
+	return __atomic_load_n(&ad->lvl, __ATOMIC_ACQUIRE);
 }
 
 
@@ -610,7 +895,7 @@ local void EnumLVZFiles(Arena *arena,
 
 local const char * GetAttr(Arena *arena, const char *key)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl(arena);
 	if (lvl->attrs)
 		return HashGetOne(lvl->attrs, key);
 	else
@@ -620,7 +905,7 @@ local const char * GetAttr(Arena *arena, const char *key)
 
 local int MapChunk(Arena *arena, u32 ctype, const void **datap, int *sizep)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl(arena);
 	if (lvl->rawchunks)
 	{
 		chunk *c;
@@ -640,162 +925,261 @@ local int MapChunk(Arena *arena, u32 ctype, const void **datap, int *sizep)
 
 local int GetFlagCount(Arena *a)
 {
-	ELVL *lvl = P_ARENA_DATA(a, lvlkey);
+	ELVL *lvl = arena_lvl(a);
 	return lvl->flags;
 }
 
 
 local enum map_tile_t GetTile(Arena *a, int x, int y)
 {
-	int ret;
-	ELVL *lvl = P_ARENA_DATA(a, lvlkey);
-	pthread_mutex_lock(&lvl->mtx);
-	ret = lvl->tiles ? lookup_sparse(lvl->tiles, x, y) : -1;
-	pthread_mutex_unlock(&lvl->mtx);
-	return ret;
+	ArenaLvl *ad = P_ARENA_DATA(a, lvlkey);
+	ELVL *lvl = arena_lvl_acquire(ad);
+	return lvl->tiles ? get_tile(ad, lvl, x, y) : -1;
 }
 
 
-local void FindEmptyTileNear(Arena *arena, int *x, int *y)
+local int GetTileLine(Arena *arena, int x1, int y1, int x2, int y2, byte *tiles, int maxtiles)
 {
-	/* init context. these values are funny because they are one
-	 * iteration before where we really want to start from. */
-	struct
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl_acquire(ad);
+	int dx = abs(x2 - x1), dy = abs(y2 - y1);
+	int sx = x1 < x2 ? 1 : -1, sy = y1 < y2 ? 1 : -1;
+	int err = dx - dy, count = 0;
+
+	if (!lvl->tiles)
+		return 0;
+
+	/* plain bresenham, both ends included */
+	while (count < maxtiles)
 	{
-		enum { up, right, down, left } dir;
-		int upto, remaining;
-		int x, y;
-	} ctx = { left, 0, 1, *x + 1, *y };
-	ELVL *lvl;
-	sparse_arr arr;
+		int e2 = 2 * err;
+		tiles[count++] = get_tile(ad, lvl, x1, y1);
+		if (x1 == x2 && y1 == y2)
+			break;
+		if (e2 > -dy)
+		{
+			err -= dy;
+			x1 += sx;
+		}
+		if (e2 < dx)
+		{
+			err += dx;
+			y1 += sy;
+		}
+	}
 
-	lvl = P_ARENA_DATA(arena, lvlkey);
-	pthread_mutex_lock(&lvl->mtx);
+	return count;
+}
 
-	arr = lvl->tiles;
-	if (!arr)
-		goto failed;
 
-	/* do it */
+local int RaycastSolid(Arena *arena, int x1, int y1, int x2, int y2,
+		const byte *solid, int *hitx, int *hity)
+{
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl_acquire(ad);
+	int tx = x1 >> 4, ty = y1 >> 4, ex = x2 >> 4, ey = y2 >> 4;
+	int stepx = x2 < x1 ? -1 : 1, stepy = y2 < y1 ? -1 : 1;
+	long adx = abs(x2 - x1), ady = abs(y2 - y1);
+	/* distances to the next tile edge along each axis, in half pixels
+	 * measured from the middle of the starting pixel, so everything
+	 * stays in integers. a tile is 32 half pixels wide. */
+	long distx = stepx > 0 ? 32 * (tx + 1) - (2 * x1 + 1) : (2 * x1 + 1) - 32 * tx;
+	long disty = stepy > 0 ? 32 * (ty + 1) - (2 * y1 + 1) : (2 * y1 + 1) - 32 * ty;
+	int n = abs(ex - tx) + abs(ey - ty);
+
+	if (!lvl->tiles)
+		return FALSE;
+	if (!solid)
+		solid = default_solid;
+
+	/* visit every tile the line passes through, in order. unlike
+	 * stepping along the line a few pixels at a time, this can't skip
+	 * over the corner of a wall. */
 	for (;;)
 	{
-		/* move 1 in current dir */
-		switch (ctx.dir)
+		if (tx < 0 || tx >= MAPSIZE || ty < 0 || ty >= MAPSIZE ||
+		    solid[get_tile(ad, lvl, tx, ty)])
 		{
-			case down:  ctx.y++; break;
-			case right: ctx.x++; break;
-			case up:    ctx.y--; break;
-			case left:  ctx.x--; break;
+			if (hitx) *hitx = tx;
+			if (hity) *hity = ty;
+			return TRUE;
 		}
-		ctx.remaining--;
-		/* if we're at the end of the line */
-		if (ctx.remaining == 0)
+
+		if (n-- == 0)
+			return FALSE;
+
+		/* cross whichever tile edge the line reaches first */
+		if (ty == ey || (tx != ex && distx * ady < disty * adx))
 		{
-			ctx.dir = (ctx.dir + 1) % 4;
-			if (ctx.dir == 0 || ctx.dir == 2)
-				ctx.upto++;
-			ctx.remaining = ctx.upto;
+			tx += stepx;
+			distx += 32;
 		}
-
-		/* check if the tile is empty */
-		if (lookup_sparse(arr, ctx.x, ctx.y))
+		else
 		{
-			if (ctx.upto < 35)
-				continue;
-			else
-				goto failed;
+			ty += stepy;
+			disty += 32;
 		}
+	}
+}
+
+
+/* looks for the empty tile closest to (cx, cy) among those exactly r
+ * tiles away, counting diagonal steps as 1. */
+local int find_empty_in_ring(ArenaLvl *ad, ELVL *lvl, int cx, int cy, int r, int *x, int *y)
+{
+	int k, j;
 
-		/* return values */
-		*x = ctx.x; *y = ctx.y;
-		break;
+	/* go round the ring closest first: the tiles straight out from the
+	 * middle, then working out towards the corners. */
+	for (k = 0; k <= r; k++)
+	{
+		const int off[8][2] =
+		{
+			{ k, -r }, { r, k }, { -k, r }, { -r, -k },
+			{ -k, -r }, { r, -k }, { k, r }, { -r, k }
+		};
+		int count = (k == 0 || k == r) ? 4 : 8;
+
+		for (j = 0; j < count; j++)
+		{
+			int tx = cx + off[j][0], ty = cy + off[j][1];
+			if (tx >= 0 && tx < MAPSIZE && ty >= 0 && ty < MAPSIZE &&
+			    !get_tile(ad, lvl, tx, ty))
+			{
+				*x = tx;
+				*y = ty;
+				return TRUE;
+			}
+		}
 	}
 
-failed:
-	pthread_mutex_unlock(&lvl->mtx);
+	return FALSE;
+}
+
+local void FindEmptyTileNear(Arena *arena, int *x, int *y)
+{
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl_acquire(ad);
+	int cx = *x, cy = *y, r = 0;
+
+	if (!lvl->tiles)
+		return;
+
+	/* the distance map says which ring the nearest empty tile is in,
+	 * unless bricks have filled it since. then keep looking outward. */
+	if (cx >= 0 && cx < MAPSIZE && cy >= 0 && cy < MAPSIZE)
+		r = get_empty_dist(lvl, cx, cy);
+
+	for (; r <= EMPTY_SEARCH_MAX; r++)
+		if (find_empty_in_ring(ad, lvl, cx, cy, r, x, y))
+			return;
 }
 
 local u32 GetChecksum(Arena *arena, u32 key)
 {
 	int x, y, savekey = (int)key;
-	ELVL *lvl;
-	sparse_arr arr;
-
-	lvl = P_ARENA_DATA(arena, lvlkey);
-	pthread_mutex_lock(&lvl->mtx);
+	/* bricks aren't part of the checksum, so this only needs the
+	 * shared tiles. */
+	ELVL *lvl = arena_lvl_acquire(P_ARENA_DATA(arena, lvlkey));
+	const byte *arr = lvl->tiles;
 
-	arr = lvl->tiles;
 	if (!arr)
-		goto failed;
+		return key;
 
 	for (y = savekey % 32; y < 1024; y += 32)
 		for (x = savekey % 31; x < 1024; x += 31)
 		{
-			byte tile = lookup_sparse(arr, x, y);
+			byte tile = arr[TILE_INDEX(x, y)];
 			if ((tile >= TILE_START && tile <= TILE_END) || tile == TILE_SAFE)
 				key += savekey ^ tile;
 		}
 
-failed:
-	pthread_mutex_unlock(&lvl->mtx);
 	return key;
 }
 
 
 local void DoBrick(Arena *arena, int drop, int x1, int y1, int x2, int y2)
 {
-	unsigned char tile = drop ? TILE_BRICK : 0;
-	sparse_arr arr;
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	int x, y;
 
-	pthread_mutex_lock(&lvl->mtx);
-	arr = lvl->tiles;
-	if (!arr)
+	/* the map itself is shared with other arenas, so bricks go in a
+	 * separate bitmap for this arena only. */
+	pthread_mutex_lock(&ad->mtx);
+	if (!ad->lvl->tiles)
 		goto failed;
-
-	if (x1 == x2)
-	{
-		int y;
-		for (y = y1; y <= y2; y++)
-			insert_sparse(arr, x1, y, tile);
-	}
-	else if (y1 == y2)
+	if (!ad->bricks)
 	{
-		int x;
-		for (x = x1; x <= x2; x++)
-			insert_sparse(arr, x, y1, tile);
+		if (!drop)
+			goto failed;
+		__atomic_store_n(&ad->bricks, amalloc(MAPSIZE * MAPSIZE / 8), __ATOMIC_RELEASE);
 	}
 
-	/* try to keep memory down */
-	if (tile == 0)
-		cleanup_sparse(arr);
+	if (x1 == x2 || y1 == y2)
+		for (y = y1; y <= y2; y++)
+			for (x = x1; x <= x2; x++)
+			{
+				int i = TILE_INDEX(x, y);
+				if (drop)
+					__atomic_or_fetch(&ad->bricks[i >> 5], 1u << (i & 31), __ATOMIC_RELAXED);
+				else
+					__atomic_and_fetch(&ad->bricks[i >> 5], ~(1u << (i & 31)), __ATOMIC_RELAXED);
+			}
 
 failed:
-	pthread_mutex_unlock(&lvl->mtx);
+	pthread_mutex_unlock(&ad->mtx);
 }
 
 
 local void GetMemoryStats(Arena *arena, struct mapdata_memory_stats_t *stats)
 {
 	int bts, blks, i;
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl;
 
 	memset(stats, 0, sizeof(*stats));
 
 	/* get data for lvl itself */
 	bts = blks = 0;
-	pthread_mutex_lock(&lvl->mtx);
-	sparse_allocated(lvl->tiles, &bts, &blks);
-	pthread_mutex_unlock(&lvl->mtx);
+	pthread_mutex_lock(&ad->mtx);
+	lvl = ad->lvl;
+	if (lvl->tiles)
+	{
+		bts = MAPSIZE * MAPSIZE + MAPSIZE * MAPSIZE / 2;
+		blks = 2;
+	}
 	stats->lvlbytes = bts;
 	stats->lvlblocks = blks;
 
+	/* and this arena's bricks */
+	if (ad->bricks)
+	{
+		stats->brickbytes = MAPSIZE * MAPSIZE / 8;
+		stats->brickblocks = 1;
+	}
+	pthread_mutex_unlock(&ad->mtx);
+
+	/* how much of that is shared */
+	pthread_mutex_lock(&cache_mtx);
+	stats->lvlrefs = lvl->refs;
+	stats->cachedlvls = LLCount(&lvlcache);
+	pthread_mutex_unlock(&cache_mtx);
+
 	/* now data for regions */
 	bts = blks = 0;
-	if (lvl->rgntiles)
-		sparse_allocated(lvl->rgntiles, &bts, &blks);
+	if (lvl->rgnblocks)
+	{
+		bts += RGN_BLOCKS * RGN_BLOCKS * sizeof(u16 *);
+		blks += 1;
+		for (i = 0; i < RGN_BLOCKS * RGN_BLOCKS; i++)
+			if (lvl->rgnblocks[i])
+			{
+				bts += RGN_BLOCK_SIZE * RGN_BLOCK_SIZE * sizeof(u16);
+				blks += 1;
+			}
+	}
 	if (lvl->rgnsets)
-		for (i = 0; i < 256; i++)
+		for (i = 0; i < lvl->rgnsetcount; i++)
 		{
 			Region **set = lvl->rgnsets[i];
 			if (set)
@@ -811,7 +1195,7 @@ local void GetMemoryStats(Arena *arena, struct mapdata_memory_stats_t *stats)
 
 local Region * FindRegionByName(Arena *arena, const char *name)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl(arena);
 
 	if (lvl->regions)
 		return HashGetOne(lvl->regions, name);
@@ -862,15 +1246,14 @@ local int enum_all_work(const char *rname, void *rgn, void *clos)
 local void EnumContaining(Arena *arena, int x, int y,
 		void (*cb)(void *clos, Region *rgn), void *clos)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl(arena);
 
-	if (!lvl->regions || !lvl->rgntiles || !lvl->rgnsets)
+	if (!lvl->regions || !lvl->rgnblocks)
 		return;
 
 	if (x >= 0 && y >= 0)
 	{
-		int i = lookup_sparse(lvl->rgntiles, x, y);
-		Region **set = lvl->rgnsets[i];
+		Region **set = lvl->rgnsets[lookup_rgnset(lvl, x, y)];
 		if (set)
 			for (; *set; set++)
 				cb(clos, *set);
@@ -886,13 +1269,13 @@ local void EnumContaining(Arena *arena, int x, int y,
 
 local Region * GetOneContaining(Arena *arena, int x, int y)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = arena_lvl(arena);
 	Region **set;
 
-	if (!lvl->regions || !lvl->rgntiles || !lvl->rgnsets)
+	if (!lvl->regions || !lvl->rgnblocks)
 		return NULL;
 
-	set = lvl->rgnsets[lookup_sparse(lvl->rgntiles, x, y)];
+	set = lvl->rgnsets[lookup_rgnset(lvl, x, y)];
 	return set ? *set : NULL;
 }
 
@@ -939,46 +1322,59 @@ local void FindRandomPoint(Region *rgn, int *x, int *y)
 local void aaction_work(void *clos)
 {
 	Arena *arena = clos;
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl;
+	char mapname[256];
 
-	pthread_mutex_lock(&lvl->mtx);
-	/* clear on either create or destory */
-	clear_level(lvl);
-	/* on create, do work */
-	if (arena->status < ARENA_RUNNING)
+	if (GetMapFilename(arena, mapname, sizeof(mapname), NULL) &&
+	    (lvl = get_level(mapname)))
 	{
-		char mapname[256];
-		if (GetMapFilename(arena, mapname, sizeof(mapname), NULL) &&
-		    load_from_file(lvl, mapname))
-		{
-			lm->LogA(L_INFO, "mapdata", arena,
-					"successfully processed map file '%s'", mapname);
-		}
-		else
-		{
-			/* fall back to emergency. this matches the compressed map
-			 * in mapnewsdl.c. */
-			lm->LogA(L_WARN, "mapdata", arena, "error finding or reading level file");
-			lvl->tiles = init_sparse();
-			insert_sparse(lvl->tiles, 0, 0, 1);
-			lvl->flags = lvl->errors = 0;
-		}
+		lm->LogA(L_INFO, "mapdata", arena,
+				"successfully processed map file '%s'", mapname);
 	}
-	pthread_mutex_unlock(&lvl->mtx);
+	else
+	{
+		/* fall back to emergency. this matches the compressed map
+		 * in mapnewsdl.c. */
+		lm->LogA(L_WARN, "mapdata", arena, "error finding or reading level file");
+		lvl = amalloc(sizeof(*lvl));
+		lvl->tiles = amalloc(MAPSIZE * MAPSIZE);
+		lvl->tiles[TILE_INDEX(0, 0)] = 1;
+		build_empty_dist(lvl);
+		lvl->refs = 1;
+	}
+
+	pthread_mutex_lock(&ad->mtx);
+	__atomic_store_n(&ad->lvl, lvl, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ad->mtx);
+
 	aman->Unhold(arena);
 }
 
 local void md_aaction(Arena *arena, int action)
 {
-	ELVL *lvl = P_ARENA_DATA(arena, lvlkey);
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
 
 	if (action == AA_PRECREATE)
-		pthread_mutex_init(&lvl->mtx, NULL);
+	{
+		pthread_mutex_init(&ad->mtx, NULL);
+		ad->lvl = &emptylvl;
+		ad->bricks = NULL;
+	}
 	else if (action == AA_POSTDESTROY)
-		pthread_mutex_destroy(&lvl->mtx);
+	{
+		/* readers don't lock, so the level and the brick bitmap stay
+		 * around until now, when nothing can be using the arena. the
+		 * level might be shared, so this only drops our reference. */
+		put_level(ad->lvl);
+		ad->lvl = &emptylvl;
+		pthread_mutex_destroy(&ad->mtx);
+		afree(ad->bricks);
+		ad->bricks = NULL;
+	}
 
-	/* pass these actions to the worker thread */
-	if (action == AA_PRECREATE || action == AA_DESTROY)
+	/* loading the map happens in the worker thread */
+	if (action == AA_PRECREATE)
 	{
 		mainloop->RunInThread(aaction_work, arena);
 		aman->Hold(arena);
@@ -999,13 +1395,16 @@ local Imapdata mapdataint =
 	FindRegionByName, RegionName,
 	RegionChunk, Contains,
 	EnumContaining, GetOneContaining,
-	EnumLVZFiles, FindRandomPoint
+	EnumLVZFiles, FindRandomPoint,
+	GetTileLine, RaycastSolid
 };
 
 EXPORT const char info_mapdata[] = CORE_MOD_INFO("mapdata");
 
 EXPORT int MM_mapdata(int action, Imodman *mm_, Arena *arena)
 {
+	int i;
+
 	if (action == MM_LOAD)
 	{
 		mm = mm_;
@@ -1016,9 +1415,14 @@ EXPORT int MM_mapdata(int action, Imodman *mm_, Arena *arena)
 		prng = mm->GetInterface(I_PRNG, ALLARENAS);
 		if (!mainloop || !cfg || !aman || !lm || !prng) return MM_FAIL;
 
-		lvlkey = aman->AllocateArenaData(sizeof(ELVL));
+		lvlkey = aman->AllocateArenaData(sizeof(ArenaLvl));
 		if (lvlkey == -1) return MM_FAIL;
 
+		/* the same tiles hs_turrets and friends treat as blocking */
+		for (i = 0; i < 256; i++)
+			default_solid[i] = (i >= 1 && i <= 161) ||
+				(i >= 192 && i <= 240) || (i >= 243 && i <= 251);
+
 		mm->RegCallback(CB_ARENAACTION, md_aaction, ALLARENAS);
 
 		mm->RegInterface(&mapdataint, ALLARENAS);
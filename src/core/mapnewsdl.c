@@ -7,17 +7,45 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <utime.h>
+#include <dirent.h>
 
 #include "zlib.h"
 
 #include "asss.h"
 
 
+/* where compressed maps and copies of lvzs are kept. files are named
+ * by what's in them, so every arena using the same file shares one,
+ * and they're still good after a restart. */
+#define DL_CACHE_DIR "tmp/dl"
+/* cache files that haven't been used for this long are removed at
+ * startup. a file is used when an arena loads it. */
+#define DL_CACHE_DAYS 30
+
+/* the part of a download after the 17 byte header. this is shared by
+ * every arena with the same file, and is usually mapped from the cache
+ * directory. */
+struct DLFile
+{
+	int refs;
+	u32 len;
+	byte *data;
+	/* NULL if data is on the heap because the cache didn't work */
+	MMapData *mmd;
+	char key[32];
+};
+
 struct MapDownloadData
 {
+	/* cmplen includes the header, which has the filename in it and so
+	 * isn't part of file */
 	u32 checksum, uncmplen, cmplen;
 	int optional;
-	byte *cmpmap;
+	struct DLFile *file;
 	char filename[20];
 };
 
@@ -42,6 +70,13 @@ local Imapdata *mapdata;
 
 local int dlkey;
 
+/* the DLFiles in use, by key. protected by cachemtx. */
+local HashTable *dlcache;
+local pthread_mutex_t cachemtx = PTHREAD_MUTEX_INITIALIZER;
+/* false if DL_CACHE_DIR couldn't be made. then everything is kept in
+ * memory. */
+local int cachedir_ok;
+
 local const char *cfg_newsfile;
 local u32 newschecksum, cmpnewssize;
 local byte *cmpnews;
@@ -166,10 +201,184 @@ local void SendMapFilename(Player *p)
 
 
 
+/* writes a new cache file. it's written under a temporary name and
+ * renamed, so nobody can see half of one. */
+local int write_cache_file(const char *path, byte *data, uLong len)
+{
+	char tmp[PATH_MAX];
+	FILE *f;
+	int fd, ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd == -1)
+		return FALSE;
+	f = fdopen(fd, "wb");
+	if (!f)
+	{
+		close(fd);
+		unlink(tmp);
+		return FALSE;
+	}
+
+	ok = fwrite(data, len, 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+	if (ok)
+		ok = rename(tmp, path) == 0;
+	if (!ok)
+		unlink(tmp);
+	return ok;
+}
+
+local struct DLFile * new_dlfile(const char *key, MMapData *mmd, byte *data, u32 len)
+{
+	struct DLFile *file = amalloc(sizeof(*file));
+	file->refs = 1;
+	file->mmd = mmd;
+	file->data = mmd ? mmd->data : data;
+	file->len = mmd ? mmd->len : len;
+	astrncpy(file->key, key, sizeof(file->key));
+	return file;
+}
+
+/* finds or makes the cache entry for a file's contents. src is the
+ * whole file, which gets compressed if docomp is set. */
+local struct DLFile * get_dlfile(MMapData *src, u32 checksum, int docomp)
+{
+	char key[32], path[PATH_MAX];
+	struct DLFile *file, *other;
+	MMapData *mmd;
+	byte *data = NULL;
+	uLong csize = 0;
+
+	snprintf(key, sizeof(key), "%08x-%u.%s", checksum, src->len, docomp ? "z" : "raw");
+
+	pthread_mutex_lock(&cachemtx);
+	file = HashGetOne(dlcache, key);
+	if (file)
+		file->refs++;
+	pthread_mutex_unlock(&cachemtx);
+	if (file)
+		return file;
+
+	/* it might be there from before. if so, mark it used so
+	 * prune_cache keeps it. */
+	snprintf(path, sizeof(path), DL_CACHE_DIR "/%s", key);
+	mmd = cachedir_ok ? MapFile(path, FALSE) : NULL;
+	if (mmd)
+		utime(path, NULL);
+	else
+	{
+		/* allocate space for compressed version */
+		if (docomp)
+			csize = (uLong)(1.0011 * src->len + 35);
+		else
+			csize = src->len;
+
+		data = malloc(csize);
+		if (!data)
+			return NULL;
+
+		if (docomp)
+			/* compress the stuff! */
+			compress(data, &csize, src->data, src->len);
+		else
+			/* just copy */
+			memcpy(data, src->data, src->len);
+
+		if (cachedir_ok && write_cache_file(path, data, csize) && (mmd = MapFile(path, FALSE)))
+			free(data);
+		else
+		{
+			byte *shrunk;
+			if (cachedir_ok)
+				lm->Log(L_WARN, "<mapnewsdl> can't write %s, keeping it in memory", path);
+			/* shrink the allocated memory */
+			if ((shrunk = realloc(data, csize)))
+				data = shrunk;
+		}
+	}
+
+	file = new_dlfile(key, mmd, data, csize);
+
+	/* someone else might have made the same one while we weren't
+	 * looking */
+	pthread_mutex_lock(&cachemtx);
+	other = HashGetOne(dlcache, key);
+	if (other)
+		other->refs++;
+	else
+		HashAdd(dlcache, key, file);
+	pthread_mutex_unlock(&cachemtx);
+
+	if (other)
+	{
+		if (file->mmd)
+			UnmapFile(file->mmd);
+		else
+			free(file->data);
+		afree(file);
+		file = other;
+	}
+
+	return file;
+}
+
+/* removes cache files nobody has used in DL_CACHE_DAYS, and temporary
+ * ones left behind by a crash in write_cache_file. this runs before any
+ * arena exists, so none of them are in use. */
+local void prune_cache(void)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	struct stat st;
+	time_t cutoff = time(NULL) - DL_CACHE_DAYS * 24 * 60 * 60;
+	int removed = 0;
+	DIR *dir = opendir(DL_CACHE_DIR);
+
+	if (!dir)
+		return;
+
+	while ((de = readdir(dir)))
+	{
+		const char *ext = strrchr(de->d_name, '.');
+		int ours = ext && (!strcmp(ext, ".z") || !strcmp(ext, ".raw"));
+
+		snprintf(path, sizeof(path), DL_CACHE_DIR "/%s", de->d_name);
+		if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+			continue;
+		if ((!ours || st.st_mtime < cutoff) && unlink(path) == 0)
+			removed++;
+	}
+	closedir(dir);
+
+	if (removed)
+		lm->Log(L_INFO, "<mapnewsdl> removed %d old files from " DL_CACHE_DIR, removed);
+}
+
+local void put_dlfile(struct DLFile *file)
+{
+	int last;
+
+	pthread_mutex_lock(&cachemtx);
+	last = --file->refs == 0;
+	if (last)
+		HashRemove(dlcache, file->key, file);
+	pthread_mutex_unlock(&cachemtx);
+
+	if (last)
+	{
+		if (file->mmd)
+			UnmapFile(file->mmd);
+		else
+			free(file->data);
+		afree(file);
+	}
+}
+
+
 local struct MapDownloadData * compress_map(const char *fname, int docomp)
 {
-	byte *cmap;
-	uLong csize;
 	const char *mapname;
 	struct MapDownloadData *data;
 	MMapData *mmd;
@@ -192,55 +401,22 @@ local struct MapDownloadData * compress_map(const char *fname, int docomp)
 	data->checksum = crc32(crc32(0, Z_NULL, 0), mmd->data, mmd->len);
 	data->uncmplen = mmd->len;
 
-	/* allocate space for compressed version */
-	if (docomp)
-		csize = (uLong)(1.0011 * mmd->len + 35);
-	else
-		csize = mmd->len + 17;
-
-	cmap = malloc(csize);
-	if (!cmap)
+	data->file = get_dlfile(mmd, data->checksum, docomp);
+	if (!data->file)
 	{
 		lm->Log(L_ERROR, "<mapnewsdl> malloc failed in compress_map for %s", fname);
 		goto fail2;
 	}
 
-	/* set up packet header */
-	cmap[0] = S2C_MAPDATA;
-	strncpy((char*)(cmap+1), mapname, 16);
-
-	if (docomp)
-	{
-		/* compress the stuff! */
-		compress(cmap+17, &csize, mmd->data, mmd->len);
-		csize += 17;
-
-		/* shrink the allocated memory */
-		data->cmpmap = realloc(cmap, csize);
-		if (data->cmpmap == NULL)
-		{
-			lm->Log(L_ERROR, "<mapnewsdl> realloc failed in compress_map for %s", fname);
-			goto fail3;
-		}
-	}
-	else
-	{
-		/* just copy */
-		memcpy(cmap+17, mmd->data, mmd->len);
-		data->cmpmap = cmap;
-	}
+	data->cmplen = data->file->len + 17;
 
-	data->cmplen = csize;
-
-	if (csize > 256*1024)
+	if (data->cmplen > 256*1024)
 		lm->Log(L_WARN, "<mapnewsdl> compressed map/lvz is bigger than 256k: %s", fname);
 
 	UnmapFile(mmd);
 
 	return data;
 
-fail3:
-	free(cmap);
 fail2:
 	UnmapFile(mmd);
 fail1:
@@ -274,22 +450,21 @@ local void aaction_work(void *clos)
 
 	if (!data)
 	{
-		/* emergency hardcoded map: */
+		/* emergency hardcoded map (compressed, without the header): */
 		byte emergencymap[] =
 		{
-			0x2a, 0x74, 0x69, 0x6e, 0x79, 0x6d, 0x61, 0x70,
-			0x2e, 0x6c, 0x76, 0x6c, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x78, 0x9c, 0x63, 0x60, 0x60, 0x60, 0x04,
+			0x78, 0x9c, 0x63, 0x60, 0x60, 0x60, 0x04,
 			0x00, 0x00, 0x05, 0x00, 0x02
 		};
+		byte *copy = amalloc(sizeof(emergencymap));
 
 		lm->LogA(L_WARN, "mapnewsdl", arena, "can't load level file, falling back to tinymap.lvl");
+		memcpy(copy, emergencymap, sizeof(emergencymap));
 		data = amalloc(sizeof(*data));
 		data->checksum = 0x5643ef8a;
 		data->uncmplen = 4;
-		data->cmplen = sizeof(emergencymap);
-		data->cmpmap  = amalloc(sizeof(emergencymap));
-		memcpy(data->cmpmap, emergencymap, sizeof(emergencymap));
+		data->cmplen = sizeof(emergencymap) + 17;
+		data->file = new_dlfile("", NULL, copy, sizeof(emergencymap));
 		astrncpy(data->filename, "tinymap.lvl", sizeof(data->filename));
 	}
 
@@ -315,7 +490,14 @@ local void ArenaAction(Arena *arena, int action)
 		for (l = LLGetHead(dls); l; l = l->next)
 		{
 			struct MapDownloadData *data = l->data;
-			afree(data->cmpmap);
+			if (data->file->key[0])
+				put_dlfile(data->file);
+			else
+			{
+				/* the emergency map isn't in the cache */
+				afree(data->file->data);
+				afree(data->file);
+			}
 			afree(data);
 		}
 		LLEmpty(dls);
@@ -353,6 +535,27 @@ local struct MapDownloadData *get_map(Arena *arena, int lvznum, int wantopt)
 }
 
 
+/* copies part of a download. the header is made up on the spot, and
+ * the rest comes straight from the cache file. */
+local void copy_download(struct MapDownloadData *data, int offset, byte *buf, int needed)
+{
+	if (offset < 17)
+	{
+		byte header[17];
+		int n = 17 - offset;
+
+		if (n > needed)
+			n = needed;
+		header[0] = S2C_MAPDATA;
+		strncpy((char*)(header+1), data->filename, 16);
+		memcpy(buf, header + offset, n);
+		buf += n;
+		offset += n;
+		needed -= n;
+	}
+	memcpy(buf, data->file->data + offset - 17, needed);
+}
+
 local void get_data(void *clos, int offset, byte *buf, int needed)
 {
 	struct MapDownloadData *data;
@@ -368,7 +571,7 @@ local void get_data(void *clos, int offset, byte *buf, int needed)
 	else if (dl->arena &&
 	         (data = get_map(dl->arena, dl->lvznum, dl->wantopt)) &&
 	         dl->len == data->cmplen)
-		memcpy(buf, data->cmpmap + offset, needed);
+		copy_download(data, offset, buf, needed);
 	else if (buf)
 		memset(buf, 0, needed);
 }
@@ -497,6 +700,14 @@ EXPORT int MM_mapnewsdl(int action, Imodman *mm_, Arena *arena)
 		dlkey = aman->AllocateArenaData(sizeof(LinkedList));
 		if (dlkey == -1) return MM_FAIL;
 
+		dlcache = HashAlloc();
+		cachedir_ok = mkdir(DL_CACHE_DIR, 0755) == 0 || errno == EEXIST;
+		if (cachedir_ok)
+			prune_cache();
+		else
+			lm->Log(L_WARN, "<mapnewsdl> can't create " DL_CACHE_DIR ": %s. "
+					"map and lvz downloads will be kept in memory", strerror(errno));
+
 		/* set up callbacks */
 		net->AddPacket(C2S_UPDATEREQUEST, PUpdateRequest);
 		net->AddPacket(C2S_MAPREQUEST, PMapRequest);
@@ -533,6 +744,7 @@ EXPORT int MM_mapnewsdl(int action, Imodman *mm_, Arena *arena)
 		ml->ClearTimer(RefreshNewsTxt, NULL);
 
 		aman->FreeArenaData(dlkey);
+		HashFree(dlcache);
 
 		mm->ReleaseInterface(pd);
 		mm->ReleaseInterface(net);
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stddef.h>
 #include <assert.h>
 
 #ifndef WIN32
@@ -16,6 +17,10 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 #include "asss.h"
 #include "encrypt.h"
 #include "net-client.h"
@@ -37,6 +42,45 @@
 /* log stupid stuff, like when we get packets from unknown sources */
 /* #define CFG_LOG_STUPID_STUFF */
 
+/* the send thread won't run more often than this, so that packets
+ * queued close together still get grouped (in millis) */
+#define CFG_SEND_MIN_INTERVAL 5
+
+/* how soon to look again at a connection whose packets are held back
+ * by bandwidth limiting or the reliable window (in millis) */
+#define CFG_SEND_RETRY_INTERVAL 10
+
+/* reliable packets that have been sent once wait for their resend in a
+ * ring of this many slots, each covering this many millis, so a send
+ * pass only looks at the slots that have come due. both have to be
+ * powers of two so the slots line up when the millis wrap around. */
+#define CFG_RESEND_SLOTS 64
+#define CFG_RESEND_SLOT_MS 32
+
+/* how often to check for lagouts and timewait players (in millis) */
+#define CFG_LAGOUT_INTERVAL 100
+
+/* on linux, read game packets in batches using epoll and recvmmsg.
+ * comment this out to always use the portable select loop. */
+#ifdef __linux__
+#define CFG_BATCH_RECEIVE
+#endif
+
+/* how many datagrams to read with one recvmmsg call */
+#define CFG_RECV_BATCH 32
+
+/* how many batches to read from one socket before checking the others */
+#define CFG_RECV_BATCHES_PER_WAKE 8
+
+/* on linux, hand the datagrams from each send thread pass to the
+ * kernel with sendmmsg. */
+#ifdef __linux__
+#define CFG_BATCH_SEND
+#endif
+
+/* how many datagrams the send thread collects before flushing them */
+#define CFG_SEND_BATCH 64
+
 
 /* other internal constants */
 
@@ -79,7 +123,18 @@ struct sized_send_data
 
 struct Buffer;
 
-typedef struct
+/* the contents of a packet going to several connections. each
+ * connection's outlist gets its own small Buffer pointing at this, with
+ * its own reliable header if it needs one. it never changes once it's
+ * made, and the last buffer to let go of it frees it. */
+typedef struct SharedPayload
+{
+	int refs;
+	int len;
+	byte data[1];
+} SharedPayload;
+
+typedef struct ConnData
 {
 	/* the player this connection is for, or NULL for a client
 	 * connection */
@@ -123,10 +178,28 @@ typedef struct
 	LinkedList sizedsends;
 	/* bandwidth limiting */
 	BWLimit *bw;
-	/* the outlists */
+	/* the outlists. outlist[BW_REL] is kept in seqnum order, so its
+	 * head is the lowest seqnum that hasn't been acked. */
 	DQNode outlist[BW_PRIS];
+	/* the reliable packets that have been sent at least once, by when
+	 * they should be resent, and the slot time the next pass starts
+	 * looking from. relnext is the first one in outlist[BW_REL] that
+	 * hasn't been sent yet, and everything after it hasn't either.
+	 * relcount is how many are in outlist[BW_REL]. protected by olmtx. */
+	DQNode resend[CFG_RESEND_SLOTS];
+	ticks_t resendfrom;
+	struct Buffer *relnext;
+	int relcount;
 	/* the reliable buffer space */
 	struct Buffer *relbuf[CFG_INCOMING_BUFFER];
+	/* whether this connection is in the send thread's ready list, and
+	 * when it next needs looking at (in millis). protected by olmtx. */
+	int inready;
+	ticks_t sendat;
+	/* next in the ready list, protected by the shard's readymtx */
+	struct ConnData *readynext;
+	/* which send thread looks after this connection */
+	struct SendShard *shard;
 	/* some mutexes */
 	pthread_mutex_t olmtx;
 	pthread_mutex_t relmtx;
@@ -143,11 +216,19 @@ typedef struct Buffer
 	ConnData *conn;
 	short len;
 	byte tries, flags;
+	/* which size this is. small buffers don't have room for all of d. */
+	byte bufclass;
 	ticks_t lastretry; /* in millis, not ticks! */
 	/* used for reliable buffers in the outlist only { */
 	RelCallback callback;
 	void *clos;
+	/* which resend slot it's in, and when it's due */
+	DQNode resendnode;
+	ticks_t resendat;
 	/* } */
+	/* if this is set, the packet is whatever header is in d (the
+	 * reliable header, or nothing), followed by the shared data */
+	SharedPayload *shared;
 	union
 	{
 		struct ReliablePacket rel;
@@ -155,6 +236,33 @@ typedef struct Buffer
 	} d;
 } Buffer;
 
+/* buffers come in two sizes: small ones for the short packets most
+ * game traffic is made of, and full ones for everything else,
+ * including anything read from a socket. */
+#define SMALL_BUFFER 64
+enum { BUF_SMALL, BUF_FULL, BUF_CLASSES };
+
+local const int bufsizes[BUF_CLASSES] =
+{
+	offsetof(Buffer, d) + SMALL_BUFFER,
+	sizeof(Buffer)
+};
+
+/* each thread keeps some free buffers of each size to itself, so
+ * getting and freeing them usually doesn't touch freemtx */
+#define BUFCACHEBATCH 16
+
+typedef struct BufferCache
+{
+	/* linked through node.next */
+	Buffer *head[BUF_CLASSES];
+	int count[BUF_CLASSES];
+	int registered;
+	/* gets minus frees, collected into global_stats whenever we touch
+	 * the shared free lists */
+	int used[BUF_CLASSES];
+} BufferCache;
+
 
 typedef struct ListenData
 {
@@ -176,11 +284,31 @@ struct ClientConnection
 };
 
 
+/* datagrams that are encrypted and accounted for, but not handed to
+ * the kernel yet */
+typedef struct SendBatch
+{
+	int count;
+	struct
+	{
+		int sock, len;
+		struct sockaddr_in sin;
+		byte data[MAXPACKET+4];
+	} pkts[CFG_SEND_BATCH];
+#ifdef CFG_BATCH_SEND
+	struct mmsghdr msgs[CFG_SEND_BATCH];
+	struct iovec iovs[CFG_SEND_BATCH];
+#endif
+} SendBatch;
+
+
 typedef struct GroupedPacket
 {
 	byte buf[MAXPACKET];
 	byte *ptr;
 	int count;
+	/* where to put finished datagrams, or NULL to send them right away */
+	SendBatch *batch;
 } GroupedPacket;
 
 
@@ -222,16 +350,22 @@ local void DropClientConnection(ClientConnection *cc);
 local inline int HashIP(struct sockaddr_in);
 local inline Player * LookupIP(struct sockaddr_in);
 local void SendRaw(ConnData *, byte *, int);
+local void SendRawBatched(ConnData *, byte *, int, SendBatch *);
+local void flush_send_batch(SendBatch *);
 local void ProcessBuffer(Buffer *);
 local int InitSockets(void);
-local Buffer * GetBuffer(void);
+local Buffer * GetBuffer(int len);
 local Buffer * BufferPacket(ConnData *conn, byte *data, int len, int flags,
 		RelCallback callback, void *clos);
+local Buffer * BufferShared(ConnData *conn, SharedPayload *sp, int flags,
+		RelCallback callback, void *clos);
 local void FreeBuffer(Buffer *);
+local void remove_rel(ConnData *conn, Buffer *buf);
 
 /* threads: */
 local void * RecvThread(void *);
 local void * SendThread(void *);
+local void send_thread_chores(ticks_t now, ticks_t *lastlagout);
 local void * RelThread(void *);
 
 local int queue_more_data(void *);
@@ -271,8 +405,29 @@ local int clientsock;
 local LinkedList clientconns = LL_INITIALIZER;
 local pthread_mutex_t ccmtx = PTHREAD_MUTEX_INITIALIZER;
 
-local DQNode freelist;
+/* each send thread has a shard of the connections, picked by pid. it
+ * only looks at the ones in its ready list, which BufferPacket adds to
+ * and wakes it up through readycond. */
+typedef struct SendShard
+{
+	int index;
+	ConnData *readylist;
+	int sendwake;
+	pthread_mutex_t readymtx;
+	pthread_cond_t readycond;
+	/* held while the thread works through the connections it took off
+	 * the ready list, so they can't be freed under it */
+	pthread_mutex_t passmtx;
+} SendShard;
+
+local SendShard *shards;
+local int sendthreads;
+
+local DQNode freelist[BUF_CLASSES];
 local pthread_mutex_t freemtx;
+local __thread BufferCache bufcache;
+local pthread_key_t bufcachekey;
+local pthread_once_t bufcacheonce = PTHREAD_ONCE_INIT;
 local MPQueue relqueue;
 local LinkedList threads = LL_INITIALIZER;
 
@@ -293,6 +448,8 @@ local struct
 	int overhead;
 	/* how often to refresh the ping packet data */
 	int pingrefreshtime;
+	/* whether to use the batched receive loop */
+	int batchrecv;
 } config;
 
 local volatile struct net_stats global_stats;
@@ -395,8 +552,19 @@ EXPORT int MM_net(int action, Imodman *mm_, Arena *a)
 		config.queue_threshold = cfg->GetInt(GLOBAL, "Net", "PresizedQueueThreshold", 5);
 		config.queue_packets = cfg->GetInt(GLOBAL, "Net", "PresizedQueuePackets", 25);
 		relthdcount = cfg->GetInt(GLOBAL, "Net", "ReliableThreads", 1);
+		/* cfghelp: Net:SendThreads, global, int, def: 1, range: 1-16
+		 * How many threads to use for sending outgoing packets. Each
+		 * one handles a share of the players, so busy zones can use
+		 * more than one cpu for encryption and retransmits. */
+		sendthreads = cfg->GetInt(GLOBAL, "Net", "SendThreads", 1);
+		CLIP(sendthreads, 1, 16);
 		config.overhead = cfg->GetInt(GLOBAL, "Net", "PerPacketOverhead", 28);
 		config.pingrefreshtime = cfg->GetInt(GLOBAL, "Net", "PingDataRefreshTime", 200);
+		/* cfghelp: Net:BatchReceive, global, bool, def: 1
+		 * Whether to read incoming packets in batches using epoll and
+		 * recvmmsg (linux only). Turn this off to use the plain select
+		 * loop. */
+		config.batchrecv = cfg->GetInt(GLOBAL, "Net", "BatchReceive", 1);
 
 		/* get the sockets */
 		if (InitSockets())
@@ -413,16 +581,39 @@ EXPORT int MM_net(int action, Imodman *mm_, Arena *a)
 			clienthash[i] = NULL;
 		pthread_mutex_init(&hashmtx, NULL);
 		pthread_mutex_init(&freemtx, NULL);
-		DQInit(&freelist);
+		for (i = 0; i < BUF_CLASSES; i++)
+			DQInit(&freelist[i]);
 		MPInit(&relqueue);
+		shards = amalloc(sendthreads * sizeof(SendShard));
+		for (i = 0; i < sendthreads; i++)
+		{
+			SendShard *sh = &shards[i];
+			sh->index = i;
+			pthread_mutex_init(&sh->readymtx, NULL);
+			pthread_mutex_init(&sh->passmtx, NULL);
+#ifndef WIN32
+			{
+				pthread_condattr_t condattr;
+				pthread_condattr_init(&condattr);
+				pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+				pthread_cond_init(&sh->readycond, &condattr);
+				pthread_condattr_destroy(&condattr);
+			}
+#else
+			pthread_cond_init(&sh->readycond, NULL);
+#endif
+		}
 
 		/* start the threads */
 		thd = amalloc(sizeof(pthread_t));
 		pthread_create(thd, NULL, RecvThread, NULL);
 		LLAdd(&threads, thd);
-		thd = amalloc(sizeof(pthread_t));
-		pthread_create(thd, NULL, SendThread, NULL);
-		LLAdd(&threads, thd);
+		for (i = 0; i < sendthreads; i++)
+		{
+			thd = amalloc(sizeof(pthread_t));
+			pthread_create(thd, NULL, SendThread, &shards[i]);
+			LLAdd(&threads, thd);
+		}
 		for (i = 0; i < relthdcount; i++)
 		{
 			thd = amalloc(sizeof(pthread_t));
@@ -513,6 +704,14 @@ EXPORT int MM_net(int action, Imodman *mm_, Arena *a)
 			LLEmpty(sizedhandlers + i);
 		}
 		MPDestroy(&relqueue);
+		for (i = 0; i < sendthreads; i++)
+		{
+			pthread_mutex_destroy(&shards[i].readymtx);
+			pthread_mutex_destroy(&shards[i].passmtx);
+			pthread_cond_destroy(&shards[i].readycond);
+		}
+		afree(shards);
+		shards = NULL;
 
 		/* close all our sockets */
 		for (link = LLGetHead(&listening); link; link = link->next)
@@ -628,7 +827,10 @@ local void clear_buffers(Player *p)
 				buf->callback(p, 0, buf->clos);
 				pthread_mutex_lock(&conn->olmtx);
 			}
-			DQRemove((DQNode*)buf);
+			if (i == BW_REL)
+				remove_rel(conn, buf);
+			else
+				DQRemove((DQNode*)buf);
 			FreeBuffer(buf);
 		}
 
@@ -674,43 +876,138 @@ local void InitConnData(ConnData *conn, Iencrypt *enc)
 	LLInit(&conn->sizedsends);
 	for (i = 0; i < BW_PRIS; i++)
 		DQInit(&conn->outlist[i]);
+	for (i = 0; i < CFG_RESEND_SLOTS; i++)
+		DQInit(&conn->resend[i]);
+	conn->resendfrom = current_millis();
 }
 
 
-Buffer * GetBuffer(void)
+/* call with freemtx locked */
+local void flush_buffer_stats(BufferCache *c)
+{
+	global_stats.smallbuffersused += c->used[BUF_SMALL];
+	global_stats.buffersused += c->used[BUF_FULL];
+	c->used[BUF_SMALL] = c->used[BUF_FULL] = 0;
+}
+
+/* moves buffers from a thread's cache to the shared free list until it
+ * has keep left. call with freemtx locked. */
+local void spill_buffers(BufferCache *c, int cls, int keep)
+{
+	while (c->count[cls] > keep)
+	{
+		Buffer *buf = c->head[cls];
+		c->head[cls] = (Buffer*)buf->node.next;
+		c->count[cls]--;
+		DQAdd(&freelist[cls], &buf->node);
+	}
+}
+
+/* gives everything back when a thread exits */
+local void buffer_cache_exit(void *v)
 {
-	DQNode *dq;
+	BufferCache *c = v;
+	int cls;
 
 	pthread_mutex_lock(&freemtx);
-	global_stats.buffersused++;
-	dq = freelist.prev;
-	if (dq == &freelist)
+	flush_buffer_stats(c);
+	for (cls = 0; cls < BUF_CLASSES; cls++)
+		spill_buffers(c, cls, 0);
+	pthread_mutex_unlock(&freemtx);
+}
+
+local void buffer_cache_key_init(void)
+{
+	pthread_key_create(&bufcachekey, buffer_cache_exit);
+}
+
+local void register_buffer_cache(BufferCache *c)
+{
+	if (!c->registered)
 	{
-		/* no buffers left, alloc one */
-		global_stats.buffercount++;
-		pthread_mutex_unlock(&freemtx);
-		dq = amalloc(sizeof(Buffer));
-		DQInit(dq);
+		pthread_once(&bufcacheonce, buffer_cache_key_init);
+		pthread_setspecific(bufcachekey, c);
+		c->registered = TRUE;
 	}
-	else
+}
+
+local void refill_buffers(BufferCache *c, int cls)
+{
+	int missing;
+
+	register_buffer_cache(c);
+
+	pthread_mutex_lock(&freemtx);
+	flush_buffer_stats(c);
+	while (c->count[cls] < BUFCACHEBATCH && freelist[cls].prev != &freelist[cls])
 	{
-		/* grab one off free list */
+		DQNode *dq = freelist[cls].prev;
 		DQRemove(dq);
-		pthread_mutex_unlock(&freemtx);
-		/* clear it after releasing mtx */
+		dq->next = (DQNode*)c->head[cls];
+		c->head[cls] = (Buffer*)dq;
+		c->count[cls]++;
+	}
+	/* if there weren't any, alloc some more after unlocking */
+	missing = c->count[cls] ? 0 : BUFCACHEBATCH;
+	if (cls == BUF_SMALL)
+		global_stats.smallbuffercount += missing;
+	else
+		global_stats.buffercount += missing;
+	pthread_mutex_unlock(&freemtx);
+
+	while (missing--)
+	{
+		Buffer *buf = amalloc(bufsizes[cls]);
+		buf->node.next = (DQNode*)c->head[cls];
+		c->head[cls] = buf;
+		c->count[cls]++;
 	}
-	memset(dq + 1, 0, sizeof(Buffer) - sizeof(DQNode));
-	((Buffer*)dq)->callback = NULL;
-	return (Buffer *)dq;
 }
 
 
-void FreeBuffer(Buffer *dq)
+/* len is how much of d the buffer needs room for */
+Buffer * GetBuffer(int len)
 {
-	pthread_mutex_lock(&freemtx);
-	DQAdd(&freelist, (DQNode*)dq);
-	global_stats.buffersused--;
-	pthread_mutex_unlock(&freemtx);
+	BufferCache *c = &bufcache;
+	int cls = len <= SMALL_BUFFER ? BUF_SMALL : BUF_FULL;
+	Buffer *buf;
+
+	if (!c->head[cls])
+		refill_buffers(c, cls);
+	buf = c->head[cls];
+	c->head[cls] = (Buffer*)buf->node.next;
+	c->count[cls]--;
+	c->used[cls]++;
+
+	memset(&buf->node + 1, 0, bufsizes[cls] - sizeof(DQNode));
+	DQInit(&buf->node);
+	buf->bufclass = cls;
+	return buf;
+}
+
+
+void FreeBuffer(Buffer *buf)
+{
+	BufferCache *c = &bufcache;
+	int cls = buf->bufclass;
+
+	if (buf->shared &&
+	    __atomic_sub_fetch(&buf->shared->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		afree(buf->shared);
+
+	buf->node.next = (DQNode*)c->head[cls];
+	c->head[cls] = buf;
+	c->count[cls]++;
+	c->used[cls]--;
+
+	if (c->count[cls] >= 2 * BUFCACHEBATCH)
+	{
+		register_buffer_cache(c);
+		pthread_mutex_lock(&freemtx);
+		flush_buffer_stats(c);
+		spill_buffers(c, cls, BUFCACHEBATCH);
+		pthread_mutex_unlock(&freemtx);
+	}
 }
 
 
@@ -922,21 +1219,14 @@ local void dump_pk(byte *d, int len)
 #endif
 
 
-local void handle_game_packet(ListenData *ld)
+/* takes ownership of buf */
+local void process_game_packet(ListenData *ld, Buffer *buf, int len,
+		struct sockaddr_in sin)
 {
-	int len, status;
-	unsigned int sinsize;
-	struct sockaddr_in sin;
+	int status;
 	Player *p;
 	ConnData *conn;
 
-	Buffer *buf;
-
-	buf = GetBuffer();
-	sinsize = sizeof(sin);
-	len = recvfrom(ld->gamesock, buf->d.raw, MAXPACKET, 0,
-			(struct sockaddr*)&sin, &sinsize);
-
 	if (len < 1) goto freebuf;
 
 #ifdef CFG_DUMP_RAW_PACKETS
@@ -1046,6 +1336,22 @@ freebuf:
 }
 
 
+local void handle_game_packet(ListenData *ld)
+{
+	int len;
+	unsigned int sinsize;
+	struct sockaddr_in sin;
+	Buffer *buf;
+
+	buf = GetBuffer(MAXPACKET);
+	sinsize = sizeof(sin);
+	len = recvfrom(ld->gamesock, buf->d.raw, MAXPACKET, 0,
+			(struct sockaddr*)&sin, &sinsize);
+
+	process_game_packet(ld, buf, len, sin);
+}
+
+
 /* ping protocol described in doc/ping.txt */
 local void handle_ping_packet(ListenData *ld)
 {
@@ -1188,7 +1494,7 @@ local void handle_client_packet(void)
 	Link *l;
 	char ipbuf[INET_ADDRSTRLEN];
 
-	buf = GetBuffer();
+	buf = GetBuffer(MAXPACKET);
 	sinsize = sizeof(sin);
 	memset(&sin, 0, sizeof(sin));
 	len = recvfrom(clientsock, buf->d.raw, MAXPACKET, 0,
@@ -1254,7 +1560,7 @@ local void handle_client_packet(void)
 }
 
 
-void * RecvThread(void *dummy)
+local void select_loop(void)
 {
 	struct timeval tv;
 	fd_set myfds, selfds;
@@ -1304,6 +1610,143 @@ void * RecvThread(void *dummy)
 		if (clientsock >= 0 && FD_ISSET(clientsock, &selfds))
 			handle_client_packet();
 	}
+}
+
+
+
+#ifdef CFG_BATCH_RECEIVE
+
+/* what an epoll event refers to */
+enum { SOCK_GAME, SOCK_PING, SOCK_CLIENT };
+#define EPOLL_TAG(ld, type) ((u64)(unsigned long)(ld) | (type))
+
+typedef struct RecvBatch
+{
+	Buffer *bufs[CFG_RECV_BATCH];
+	struct mmsghdr msgs[CFG_RECV_BATCH];
+	struct iovec iovs[CFG_RECV_BATCH];
+	struct sockaddr_in sins[CFG_RECV_BATCH];
+	int epfd;
+} RecvBatch;
+
+local void free_recv_batch(void *v)
+{
+	RecvBatch *rb = v;
+	int i;
+	for (i = 0; i < CFG_RECV_BATCH; i++)
+		if (rb->bufs[i])
+			FreeBuffer(rb->bufs[i]);
+	if (rb->epfd >= 0)
+		close(rb->epfd);
+	afree(rb);
+}
+
+/* reads everything waiting on a game socket, CFG_RECV_BATCH datagrams
+ * at a time. buffers that don't get used stay around for the next
+ * call. */
+local void drain_game_socket(RecvBatch *rb, ListenData *ld)
+{
+	int i, n, rounds = 0;
+
+	do
+	{
+		for (i = 0; i < CFG_RECV_BATCH; i++)
+		{
+			if (!rb->bufs[i])
+				rb->bufs[i] = GetBuffer(MAXPACKET);
+			rb->iovs[i].iov_base = rb->bufs[i]->d.raw;
+			rb->iovs[i].iov_len = MAXPACKET;
+			memset(&rb->msgs[i].msg_hdr, 0, sizeof(rb->msgs[i].msg_hdr));
+			rb->msgs[i].msg_hdr.msg_name = &rb->sins[i];
+			rb->msgs[i].msg_hdr.msg_namelen = sizeof(rb->sins[i]);
+			rb->msgs[i].msg_hdr.msg_iov = &rb->iovs[i];
+			rb->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(ld->gamesock, rb->msgs, CFG_RECV_BATCH, MSG_DONTWAIT, NULL);
+
+		for (i = 0; i < n; i++)
+		{
+			Buffer *buf = rb->bufs[i];
+			rb->bufs[i] = NULL;
+			process_game_packet(ld, buf, rb->msgs[i].msg_len, rb->sins[i]);
+		}
+	}
+	while (n == CFG_RECV_BATCH && ++rounds < CFG_RECV_BATCHES_PER_WAKE);
+}
+
+/* returns FALSE if epoll can't be used, so the caller can fall back to
+ * select. */
+local int batch_loop(void)
+{
+	struct epoll_event ev, events[16];
+	RecvBatch *rb;
+	Link *l;
+	int i, n;
+
+	rb = amalloc(sizeof(*rb));
+	rb->epfd = epoll_create(16);
+	if (rb->epfd < 0)
+	{
+		afree(rb);
+		return FALSE;
+	}
+
+#define WATCH(fd, tag) \
+	do { \
+		ev.events = EPOLLIN; \
+		ev.data.u64 = (tag); \
+		epoll_ctl(rb->epfd, EPOLL_CTL_ADD, (fd), &ev); \
+	} while (0)
+
+	for (l = LLGetHead(&listening); l; l = l->next)
+	{
+		ListenData *ld = l->data;
+		WATCH(ld->gamesock, EPOLL_TAG(ld, SOCK_GAME));
+		WATCH(ld->pingsock, EPOLL_TAG(ld, SOCK_PING));
+	}
+	if (clientsock >= 0)
+		WATCH(clientsock, EPOLL_TAG(NULL, SOCK_CLIENT));
+
+#undef WATCH
+
+	pthread_cleanup_push(free_recv_batch, rb);
+
+	for (;;)
+	{
+		pthread_testcancel();
+		n = epoll_wait(rb->epfd, events, sizeof(events)/sizeof(events[0]), 1000);
+
+		for (i = 0; i < n; i++)
+		{
+			/* ListenData is at least 4-byte aligned, so the low bits
+			 * are free for the socket type. */
+			ListenData *ld = (ListenData*)(unsigned long)(events[i].data.u64 & ~(u64)3);
+			switch (events[i].data.u64 & 3)
+			{
+				case SOCK_GAME: drain_game_socket(rb, ld); break;
+				case SOCK_PING: handle_ping_packet(ld); break;
+				case SOCK_CLIENT: handle_client_packet(); break;
+			}
+		}
+	}
+
+	pthread_cleanup_pop(1);
+	return TRUE;
+}
+
+#endif
+
+
+void * RecvThread(void *dummy)
+{
+#ifdef CFG_BATCH_RECEIVE
+	if (config.batchrecv && batch_loop())
+		return NULL;
+	if (config.batchrecv)
+		lm->Log(L_WARN, "<net> can't use epoll, falling back to select");
+#endif
+	select_loop();
 	return NULL;
 }
 
@@ -1364,7 +1807,7 @@ int queue_more_data(void *dummy)
 			continue;
 
 		if ((l = LLGetHead(&conn->sizedsends)) &&
-		    DQCount(&conn->outlist[BW_REL]) < config.queue_threshold)
+		    conn->relcount < config.queue_threshold)
 		{
 			struct sized_send_data *sd = l->data;
 
@@ -1430,12 +1873,12 @@ local void grouped_flush(GroupedPacket *gp, ConnData *conn)
 		/* there's only one in the group, so don't send it
 		 * in a group. +3 to skip past the 00 0E and size of
 		 * first packet */
-		SendRaw(conn, gp->buf + 3, (gp->ptr - gp->buf) - 3);
+		SendRawBatched(conn, gp->buf + 3, (gp->ptr - gp->buf) - 3, gp->batch);
 	}
 	else if (gp->count > 1)
 	{
 		/* send the whole thing as a group */
-		SendRaw(conn, gp->buf, gp->ptr - gp->buf);
+		SendRawBatched(conn, gp->buf, gp->ptr - gp->buf, gp->batch);
 	}
 
 	if (gp->count > 0 && gp->count < NET_GROUPED_STATS_LEN)
@@ -1446,6 +1889,20 @@ local void grouped_flush(GroupedPacket *gp, ConnData *conn)
 	grouped_init(gp);
 }
 
+/* copies what a buffer sends, which might be partly in a shared
+ * payload, to dest */
+local void copy_buffer(Buffer *buf, byte *dest)
+{
+	if (buf->shared)
+	{
+		int hdr = buf->len - buf->shared->len;
+		memcpy(dest, buf->d.raw, hdr);
+		memcpy(dest + hdr, buf->shared->data, buf->shared->len);
+	}
+	else
+		memcpy(dest, buf->d.raw, buf->len);
+}
+
 local void grouped_send(GroupedPacket *gp, Buffer *buf, ConnData *conn)
 {
 	if (buf->len <= 255)
@@ -1453,49 +1910,271 @@ local void grouped_send(GroupedPacket *gp, Buffer *buf, ConnData *conn)
 		if ((gp->ptr - gp->buf) > (MAXPACKET - 10 - buf->len))
 			grouped_flush(gp, conn);
 		*gp->ptr++ = (byte)buf->len;
-		memcpy(gp->ptr, buf->d.raw, buf->len);
+		copy_buffer(buf, gp->ptr);
 		gp->ptr += buf->len;
 		gp->count++;
 	}
 	else
 	{
 		/* can't fit in group, send immediately */
-		SendRaw(conn, buf->d.raw, buf->len);
+		if (!buf->shared)
+			SendRawBatched(conn, buf->d.raw, buf->len, gp->batch);
+		else if (buf->len == buf->shared->len)
+			SendRawBatched(conn, buf->shared->data, buf->len, gp->batch);
+		else
+		{
+			byte tmp[MAXPACKET+4];
+			copy_buffer(buf, tmp);
+			SendRawBatched(conn, tmp, buf->len, gp->batch);
+		}
 		global_stats.grouped_stats[0]++;
 	}
 }
 
 
-/* call with outlistmtx locked */
-local void send_outgoing(ConnData *conn)
+/* wakes up a send thread */
+local void wake_send_thread(SendShard *sh)
+{
+	pthread_mutex_lock(&sh->readymtx);
+	sh->sendwake = TRUE;
+	pthread_cond_signal(&sh->readycond);
+	pthread_mutex_unlock(&sh->readymtx);
+}
+
+/* makes sure the send thread looks at this connection no later than
+ * when (in millis). call with outlistmtx locked. */
+local void schedule_send(ConnData *conn, ticks_t when)
+{
+	SendShard *sh = conn->shard;
+
+	if (conn->cc)
+	{
+		/* client connections are looked at on every pass of the first
+		 * send thread anyway */
+		wake_send_thread(&shards[0]);
+	}
+	else if (!conn->inready)
+	{
+		conn->inready = TRUE;
+		conn->sendat = when;
+		pthread_mutex_lock(&sh->readymtx);
+		conn->readynext = sh->readylist;
+		sh->readylist = conn;
+		sh->sendwake = TRUE;
+		pthread_cond_signal(&sh->readycond);
+		pthread_mutex_unlock(&sh->readymtx);
+	}
+	else if (TICK_GT(conn->sendat, when))
+	{
+		conn->sendat = when;
+		wake_send_thread(sh);
+	}
+}
+
+/* takes a connection out of its shard's ready list before it's freed.
+ * this waits for the shard's thread to finish its current pass, so
+ * don't call it from that thread. lock order is passmtx, then olmtx,
+ * then readymtx. */
+local void unschedule_send(ConnData *conn)
+{
+	SendShard *sh = conn->shard;
+	ConnData **cp;
+
+	pthread_mutex_lock(&sh->passmtx);
+	pthread_mutex_lock(&conn->olmtx);
+	if (conn->inready)
+	{
+		pthread_mutex_lock(&sh->readymtx);
+		for (cp = &sh->readylist; *cp; cp = &(*cp)->readynext)
+			if (*cp == conn)
+			{
+				*cp = conn->readynext;
+				break;
+			}
+		pthread_mutex_unlock(&sh->readymtx);
+		conn->inready = FALSE;
+	}
+	pthread_mutex_unlock(&conn->olmtx);
+	pthread_mutex_unlock(&sh->passmtx);
+}
+
+/* keeps track of the earliest time in millis */
+#define SOONER(t, when) \
+	do { ticks_t _w = (when); if (TICK_GT(t, _w)) t = _w; } while (0)
+
+#define RESEND_SLOT(t) (((t) / CFG_RESEND_SLOT_MS) % CFG_RESEND_SLOTS)
+#define RESEND_BUF(n) ((Buffer*)((char*)(n) - offsetof(Buffer, resendnode)))
+
+/* (re)files a sent reliable packet to be looked at again at when */
+local void resend_at(ConnData *conn, Buffer *buf, ticks_t when, ticks_t *next)
+{
+	buf->resendat = when;
+	DQRemove(&buf->resendnode);
+	DQAdd(&conn->resend[RESEND_SLOT(when)], &buf->resendnode);
+	SOONER(*next, when);
+}
+
+/* takes a reliable packet out of the outlist. call with outlistmtx
+ * locked. */
+local void remove_rel(ConnData *conn, Buffer *buf)
+{
+	if (conn->relnext == buf)
+		conn->relnext = buf->node.next != &conn->outlist[BW_REL] ?
+			(Buffer*)buf->node.next : NULL;
+	DQRemove((DQNode*)buf);
+	DQRemove(&buf->resendnode);
+	conn->relcount--;
+}
+
+/* sends the reliable packets whose resend is due, and then as many new
+ * ones as the client's window and the bandwidth allow. returns true if
+ * something has been retried too many times. */
+local int send_reliable(ConnData *conn, GroupedPacket *gp, ticks_t now,
+		ticks_t *next, int *retries)
 {
-	GroupedPacket gp;
-	ticks_t now = current_millis();
-	int pri, retries = 0, minseqnum, outlistlen = 0;
-	Buffer *buf, *nbuf;
-	DQNode *outlist;
 	/* use an estimate of the average round-trip time to figure out when
 	 * to resend a packet */
 	unsigned long timeout = conn->avgrtt + 4*conn->rttdev;
 	int cansend = bwlimit->GetCanBufferPackets(conn->bw);
+	int minseqnum, slots, i;
+	DQNode *slot, *n, *nn;
+	Buffer *buf;
 
 	CLIP(timeout, 250, 2000);
 
+	if (conn->relcount == 0)
+		return FALSE;
+	minseqnum = ((Buffer*)conn->outlist[BW_REL].next)->d.rel.seqnum;
+
+	/* look at every slot from where the last pass left off up to the
+	 * current one. anything in them that isn't due is either later in
+	 * the current slot or a lap or more away. */
+	slots = TICK_DIFF(now, conn->resendfrom) / CFG_RESEND_SLOT_MS + 1;
+	CLIP(slots, 1, CFG_RESEND_SLOTS);
+	for (i = 0; i < slots; i++)
+	{
+		slot = &conn->resend[RESEND_SLOT(conn->resendfrom + i * CFG_RESEND_SLOT_MS)];
+		for (n = slot->next; n != slot; n = nn)
+		{
+			nn = n->next;
+			buf = RESEND_BUF(n);
+
+			if (TICK_GT(buf->resendat, now))
+			{
+				SOONER(*next, buf->resendat);
+				continue;
+			}
+
+			/* only buffer fixed number of rel packets to client */
+			if ((buf->d.rel.seqnum - minseqnum) > cansend)
+			{
+				resend_at(conn, buf, TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL), next);
+				continue;
+			}
+
+			/* if we've retried too many times, kick the player */
+			if (buf->tries >= config.maxretries)
+			{
+				conn->hitmaxretries = TRUE;
+				return TRUE;
+			}
+
+			if (!bwlimit->Check(
+						conn->bw,
+						buf->len + ((buf->len <= 255) ? 1 : config.overhead),
+						BW_REL))
+			{
+				resend_at(conn, buf, TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL), next);
+				continue;
+			}
+
+			/* record it for lag stats and also reduce bw limit (with
+			 * clipping) */
+			(*retries)++;
+			bwlimit->AdjustForRetry(conn->bw);
+
+			/* use linearly increasing timeouts */
+			buf->lastretry = now;
+			buf->tries++;
+			grouped_send(gp, buf, conn);
+			resend_at(conn, buf, TICK_MAKE(now + timeout * buf->tries + 1), next);
+		}
+	}
+	conn->resendfrom = TICK_MAKE(now - now % CFG_RESEND_SLOT_MS);
+
+	/* new packets go out in seqnum order, so stop at the first one that
+	 * can't */
+	while ((buf = conn->relnext))
+	{
+		assert(buf->d.rel.t1 == 0x00 && buf->d.rel.t2 == 0x03);
+
+		if ((buf->d.rel.seqnum - minseqnum) > cansend ||
+		    !bwlimit->Check(
+					conn->bw,
+					buf->len + ((buf->len <= 255) ? 1 : config.overhead),
+					BW_REL))
+		{
+			SOONER(*next, TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL));
+			break;
+		}
+
+		buf->lastretry = now;
+		buf->tries++;
+		grouped_send(gp, buf, conn);
+
+		conn->relnext = buf->node.next != &conn->outlist[BW_REL] ?
+			(Buffer*)buf->node.next : NULL;
+		resend_at(conn, buf, TICK_MAKE(now + timeout + 1), next);
+	}
+
+	/* and come back when the next slot with anything in it is due */
+	for (i = 1; i < CFG_RESEND_SLOTS; i++)
+	{
+		ticks_t t = TICK_MAKE(conn->resendfrom + i * CFG_RESEND_SLOT_MS);
+		slot = &conn->resend[RESEND_SLOT(t)];
+		if (slot->next != slot)
+		{
+			SOONER(*next, t);
+			break;
+		}
+	}
+
+	return FALSE;
+}
+
+/* call with outlistmtx locked. returns true if anything is left in the
+ * outlist, and sets conn->sendat to when it should be looked at again.
+ * datagrams go into batch if it's non-NULL, and the caller has to flush
+ * it. */
+local int send_outgoing(ConnData *conn, SendBatch *batch)
+{
+	GroupedPacket gp;
+	ticks_t now = current_millis();
+	ticks_t next = TICK_MAKE(now + CFG_LAGOUT_INTERVAL);
+	int pri, retries = 0, outlistlen = 0;
+	Buffer *buf, *nbuf;
+	DQNode *outlist;
+
 	/* update the bandwidth limiter's counters */
 	bwlimit->Iter(conn->bw, now);
 
-	/* find smallest seqnum remaining in outlist */
-	minseqnum = INT_MAX;
-	outlist = &conn->outlist[BW_REL];
-	for (buf = (Buffer*)outlist->next; (DQNode*)buf != outlist; buf = (Buffer*)buf->node.next)
-		if (buf->d.rel.seqnum < minseqnum)
-			minseqnum = buf->d.rel.seqnum;
-
 	grouped_init(&gp);
+	gp.batch = batch;
 
 	/* process highest priority first */
 	for (pri = BW_PRIS-1; pri >= 0; pri--)
 	{
+		if (pri == BW_REL)
+		{
+			if (send_reliable(conn, &gp, now, &next, &retries))
+			{
+				conn->sendat = TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL);
+				return TRUE;
+			}
+			outlistlen += conn->relcount;
+			continue;
+		}
+
 		outlist = conn->outlist + pri;
 		for (buf = (Buffer*)outlist->next; (DQNode*)buf != outlist; buf = nbuf)
 		{
@@ -1511,23 +2190,6 @@ local void send_outgoing(ConnData *conn)
 			else
 				assert(pri != BW_REL && pri != BW_ACK);
 
-			/* check if it's time to send this yet (use linearly
-			 * increasing timeouts) */
-			if (buf->tries != 0 &&
-			    (unsigned long)TICK_DIFF(now, buf->lastretry) <= timeout * buf->tries)
-				continue;
-
-			/* only buffer fixed number of rel packets to client */
-			if (pri == BW_REL && (buf->d.rel.seqnum - minseqnum) > cansend)
-				continue;
-
-			/* if we've retried too many times, kick the player */
-			if (buf->tries >= config.maxretries)
-			{
-				conn->hitmaxretries = TRUE;
-				return;
-			}
-
 			/* at this point, there's only one more check to determine
 			 * if we're sending this packet now: bandwidth limiting. */
 			if (!bwlimit->Check(
@@ -1538,38 +2200,24 @@ local void send_outgoing(ConnData *conn)
 				/* try dropping it, if we can */
 				if (buf->flags & NET_DROPPABLE)
 				{
-					assert(pri < BW_REL);
 					DQRemove((DQNode*)buf);
 					FreeBuffer(buf);
 					conn->pktdropped++;
 					outlistlen--;
 				}
+				else
+					SOONER(next, TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL));
 				/* but in either case, skip it */
 				continue;
 			}
 
-			if (buf->tries > 0)
-			{
-				/* this is a retry, not an initial send. record it for
-				 * lag stats and also reduce bw limit (with clipping) */
-				retries++;
-				bwlimit->AdjustForRetry(conn->bw);
-			}
-
-			buf->lastretry = now;
-			buf->tries++;
-
 			/* this sends it or adds it to a pending grouped packet */
 			grouped_send(&gp, buf, conn);
 
-			/* if we just sent an unreliable packet, free it so we don't
-			 * send it again. */
-			if (pri != BW_REL)
-			{
-				DQRemove((DQNode*)buf);
-				FreeBuffer(buf);
-				outlistlen--;
-			}
+			/* unreliable packets only get sent once */
+			DQRemove((DQNode*)buf);
+			FreeBuffer(buf);
+			outlistlen--;
 		}
 	}
 
@@ -1580,6 +2228,9 @@ local void send_outgoing(ConnData *conn)
 
 	if (outlistlen > config.maxoutlist)
 		conn->hitmaxoutlist = TRUE;
+
+	conn->sendat = next;
+	return outlistlen > 0;
 }
 
 
@@ -1677,70 +2328,183 @@ local void process_lagouts(Player *p, unsigned int gtc, LinkedList *tokill, Link
 }
 
 
-void * SendThread(void *dummy)
+void * SendThread(void *v)
 {
+	SendShard *sh = v;
+	ticks_t lastpass = current_millis(), lastlagout = lastpass;
+	SendBatch *batch = amalloc(sizeof(*batch));
+
+	pthread_cleanup_push((void(*)(void*)) afree, batch);
+
 	for (;;)
 	{
-		ticks_t gtc;
-		ConnData *conn;
+		ticks_t now, nextwake;
+		ConnData *conn, *next, *ready, *requeue = NULL, **tail = &requeue;
 		Player *p;
-		Link *link;
-		ClientConnection *dropme;
-		LinkedList tofree = LL_INITIALIZER;
-		LinkedList tokill = LL_INITIALIZER;
 
-		/* first send outgoing packets (players) */
-		pd->Lock();
-		FOR_EACH_PLAYER_P(p, conn, connkey)
-			if (p->status >= S_CONNECTED &&
-			    p->status < S_TIMEWAIT &&
-			    IS_OURS(p) &&
-			    pthread_mutex_trylock(&conn->olmtx) == 0)
+		/* take the connections that have something to send. they stay
+		 * ours until they're back on the ready list, and passmtx keeps
+		 * them from being freed until then, so this doesn't need
+		 * pd->Lock. */
+		pthread_mutex_lock(&sh->passmtx);
+		pthread_mutex_lock(&sh->readymtx);
+		ready = sh->readylist;
+		sh->readylist = NULL;
+		sh->sendwake = FALSE;
+		pthread_mutex_unlock(&sh->readymtx);
+
+		now = lastpass = current_millis();
+		if (sh->index == 0)
+		{
+			nextwake = TICK_MAKE(lastlagout + CFG_LAGOUT_INTERVAL);
+			if (!LLIsEmpty(&clientconns))
+				SOONER(nextwake, TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL));
+		}
+		else
+			nextwake = TICK_MAKE(now + CFG_LAGOUT_INTERVAL);
+
+		/* send outgoing packets (players) */
+		for (conn = ready; conn; conn = next)
+		{
+			next = conn->readynext;
+
+			if (pthread_mutex_trylock(&conn->olmtx) != 0)
 			{
-				send_outgoing(conn);
-				submit_rel_stats(p);
-				pthread_mutex_unlock(&conn->olmtx);
+				/* someone else has it. look again soon. */
+				*tail = conn;
+				tail = &conn->readynext;
+				SOONER(nextwake, TICK_MAKE(now + 1));
+				continue;
 			}
-		pd->Unlock();
 
-		/* process lagouts and timewait */
+			p = conn->p;
+			if (p->status >= S_TIMEWAIT)
+				/* clear_buffers will take care of the rest */
+				conn->inready = FALSE;
+			else if (p->status < S_CONNECTED)
+				conn->sendat = TICK_MAKE(now + CFG_SEND_RETRY_INTERVAL);
+			else if (!TICK_GT(conn->sendat, now) && !send_outgoing(conn, batch))
+				conn->inready = FALSE;
+
+			if (conn->inready)
+			{
+				*tail = conn;
+				tail = &conn->readynext;
+				SOONER(nextwake, conn->sendat);
+			}
+
+			pthread_mutex_unlock(&conn->olmtx);
+		}
+
+		/* put back the ones that still have work to do */
+		pthread_mutex_lock(&sh->readymtx);
+		*tail = sh->readylist;
+		sh->readylist = requeue;
+		pthread_mutex_unlock(&sh->readymtx);
+		pthread_mutex_unlock(&sh->passmtx);
+
+		flush_send_batch(batch);
+
+		/* the first thread also does everything that isn't per-shard */
+		if (sh->index == 0)
+			send_thread_chores(now, &lastlagout);
+
+		pthread_testcancel();
+
+		/* sleep until something is queued or a retransmit is due, but
+		 * leave at least CFG_SEND_MIN_INTERVAL between passes. */
+#ifndef WIN32
+		pthread_mutex_lock(&sh->readymtx);
+		pthread_cleanup_push((void(*)(void*)) pthread_mutex_unlock, (void*) &sh->readymtx);
+		for (;;)
+		{
+			ticks_t until = nextwake;
+			TimeoutSpec timeout;
+
+			now = current_millis();
+			if (sh->sendwake)
+			{
+				if (TICK_DIFF(now, lastpass) >= CFG_SEND_MIN_INTERVAL)
+					break;
+				SOONER(until, TICK_MAKE(lastpass + CFG_SEND_MIN_INTERVAL));
+			}
+			if (TICK_DIFF(now, until) >= 0)
+				break;
+
+			timeout = schedule_timeout(TICK_DIFF(until, now));
+			pthread_cond_timedwait(&sh->readycond, &sh->readymtx, &timeout.target);
+		}
+		pthread_cleanup_pop(1);
+#else
+		usleep(10000); /* 1/100 second */
+#endif
+
+		pthread_testcancel();
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+
+/* lagouts, timewait, freeing players, and client connections. called
+ * from the first send thread. */
+local void send_thread_chores(ticks_t now, ticks_t *lastlagout)
+{
+	Player *p;
+	Link *link;
+	ClientConnection *dropme;
+	LinkedList tofree = LL_INITIALIZER;
+	LinkedList tokill = LL_INITIALIZER;
+
+	/* process lagouts and timewait. this has to look at every
+	 * player, so don't do it on every pass. */
+	if (TICK_DIFF(now, *lastlagout) >= CFG_LAGOUT_INTERVAL)
+	{
+		ticks_t gtc = current_ticks();
+		*lastlagout = now;
 		pd->Lock();
-		gtc = current_ticks();
 		FOR_EACH_PLAYER(p)
 			if (p->status >= S_CONNECTED &&
 			    IS_OURS(p))
+			{
+				if (p->status < S_TIMEWAIT)
+					submit_rel_stats(p);
 				process_lagouts(p, gtc, &tokill, &tofree);
+			}
 		pd->Unlock();
+	}
 
-		/* now kill the ones we needed to above */
-		for (link = LLGetHead(&tokill); link; link = link->next)
-			pd->KickPlayer(link->data);
-		LLEmpty(&tokill);
+	/* now kill the ones we needed to above */
+	for (link = LLGetHead(&tokill); link; link = link->next)
+		pd->KickPlayer(link->data);
+	LLEmpty(&tokill);
 
-		/* and free ... */
-		for (link = LLGetHead(&tofree); link; link = link->next)
-		{
-			Player *p = link->data;
-			ConnData *conn = PPDATA(p, connkey);
-			/* one more time, just to be sure */
-			clear_buffers(p);
-			pthread_mutex_destroy(&conn->olmtx);
-			pthread_mutex_destroy(&conn->relmtx);
-			pthread_mutex_destroy(&conn->bigmtx);
-			bwlimit->Free(conn->bw);
-			pd->FreePlayer(link->data);
-		}
-		LLEmpty(&tofree);
+	/* and free ... */
+	for (link = LLGetHead(&tofree); link; link = link->next)
+	{
+		Player *p = link->data;
+		ConnData *conn = PPDATA(p, connkey);
+		/* one more time, just to be sure */
+		clear_buffers(p);
+		unschedule_send(conn);
+		pthread_mutex_destroy(&conn->olmtx);
+		pthread_mutex_destroy(&conn->relmtx);
+		pthread_mutex_destroy(&conn->bigmtx);
+		bwlimit->Free(conn->bw);
+		pd->FreePlayer(link->data);
+	}
+	LLEmpty(&tofree);
 
-		/* outgoing packets and lagouts for client connections */
-		dropme = NULL;
-		pthread_mutex_lock(&ccmtx);
-		gtc = current_ticks();
+	/* outgoing packets and lagouts for client connections */
+	dropme = NULL;
+	pthread_mutex_lock(&ccmtx);
+	{
+		ticks_t gtc = current_ticks();
 		for (link = LLGetHead(&clientconns); link; link = link->next)
 		{
 			ClientConnection *cc = link->data;
 			pthread_mutex_lock(&cc->c.olmtx);
-			send_outgoing(&cc->c);
+			send_outgoing(&cc->c, NULL);
 			pthread_mutex_unlock(&cc->c.olmtx);
 			/* we can't drop it in the loop because we're holding ccmtx.
 			 * keep track of it and drop it later. FIXME: there are
@@ -1753,19 +2517,14 @@ void * SendThread(void *dummy)
 			    TICK_DIFF(gtc, cc->c.lastpkt) > (cc->c.pktrecvd ? 6500 : 1000))
 				dropme = cc;
 		}
-		pthread_mutex_unlock(&ccmtx);
-
-		if (dropme)
-		{
-			dropme->i->Disconnected();
-			DropClientConnection(dropme);
-		}
+	}
+	pthread_mutex_unlock(&ccmtx);
 
-		pthread_testcancel();
-		usleep(10000); /* 1/100 second */
-		pthread_testcancel();
+	if (dropme)
+	{
+		dropme->i->Disconnected();
+		DropClientConnection(dropme);
 	}
-	return NULL;
 }
 
 
@@ -1901,6 +2660,7 @@ Player * NewConnection(int type, struct sockaddr_in *sin, Iencrypt *enc, void *v
 	InitConnData(conn, enc);
 
 	conn->p = p;
+	conn->shard = &shards[p->pid % sendthreads];
 
 	/* copy info from ListenData */
 	conn->whichsock = ld->gamesock;
@@ -2045,7 +2805,9 @@ void ProcessGrouped(Buffer *buf)
 		len = buf->d.raw[pos++];
 		if (pos + len <= buf->len)
 		{
-			Buffer *b = GetBuffer();
+			/* handlers get a full buffer, zeroed past the end of
+			 * the packet, just like one straight off the socket */
+			Buffer *b = GetBuffer(MAXPACKET);
 			b->conn = buf->conn;
 			b->len = len;
 			memcpy(b->d.raw, buf->d.raw + pos, len);
@@ -2077,7 +2839,7 @@ void ProcessAck(Buffer *buf)
 		nbuf = (Buffer*)b->node.next;
 		if (b->d.rel.seqnum == buf->d.rel.seqnum)
 		{
-			DQRemove((DQNode*)b);
+			remove_rel(conn, b);
 			pthread_mutex_unlock(&conn->olmtx);
 
 			if (b->callback)
@@ -2391,15 +3153,70 @@ void ReallyRawSend(struct sockaddr_in *sin, byte *pkt, int len, void *v_ld)
 }
 
 
+/* hands everything in the batch to the kernel */
+local void flush_send_batch(SendBatch *batch)
+{
+#ifdef CFG_BATCH_SEND
+	int i, start, n, sent;
+
+	for (i = 0; i < batch->count; i++)
+	{
+		batch->iovs[i].iov_base = batch->pkts[i].data;
+		batch->iovs[i].iov_len = batch->pkts[i].len;
+		memset(&batch->msgs[i].msg_hdr, 0, sizeof(batch->msgs[i].msg_hdr));
+		batch->msgs[i].msg_hdr.msg_name = &batch->pkts[i].sin;
+		batch->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* one sendmmsg per run of datagrams for the same socket. with a
+	 * single listen socket, that's one call for the whole batch. */
+	for (start = 0; start < batch->count; start = i)
+	{
+		for (i = start + 1; i < batch->count &&
+				batch->pkts[i].sock == batch->pkts[start].sock; i++) ;
+		for (n = start; n < i; n += sent)
+		{
+			sent = sendmmsg(batch->pkts[start].sock, batch->msgs + n, i - n, 0);
+			/* a datagram the kernel won't take gets dropped, like a
+			 * failed sendto would be */
+			if (sent < 1)
+				sent = 1;
+		}
+	}
+#else
+	int i;
+	for (i = 0; i < batch->count; i++)
+		sendto(batch->pkts[i].sock, batch->pkts[i].data, batch->pkts[i].len, 0,
+				(struct sockaddr*)&batch->pkts[i].sin, sizeof(struct sockaddr_in));
+#endif
+	batch->count = 0;
+}
+
+
 /* IMPORTANT: anyone calling SendRaw MUST hold the outlistmtx for the
  * player that they're sending data to if you want bytessince to be
  * accurate. */
 void SendRaw(ConnData *conn, byte *data, int len)
 {
-	byte encbuf[MAXPACKET+4];
+	SendRawBatched(conn, data, len, NULL);
+}
+
+
+/* like SendRaw, but if batch is non-NULL, the encrypted datagram is
+ * added to it instead of being sent right away. it's still counted as
+ * sent now. */
+void SendRawBatched(ConnData *conn, byte *data, int len, SendBatch *batch)
+{
+	byte stackbuf[MAXPACKET+4], *encbuf;
 	Player *p = conn->p;
 
 	assert(len <= MAXPACKET);
+
+	if (batch && batch->count == CFG_SEND_BATCH)
+		flush_send_batch(batch);
+	encbuf = batch ? batch->pkts[batch->count].data : stackbuf;
 	memcpy(encbuf, data, len);
 
 #ifdef CFG_DUMP_RAW_PACKETS
@@ -2419,8 +3236,16 @@ void SendRaw(ConnData *conn, byte *data, int len)
 	dump_pk(encbuf, len);
 #endif
 
-	sendto(conn->whichsock, encbuf, len, 0,
-			(struct sockaddr*)&conn->sin, sizeof(struct sockaddr_in));
+	if (batch)
+	{
+		batch->pkts[batch->count].sock = conn->whichsock;
+		batch->pkts[batch->count].len = len;
+		batch->pkts[batch->count].sin = conn->sin;
+		batch->count++;
+	}
+	else
+		sendto(conn->whichsock, encbuf, len, 0,
+				(struct sockaddr*)&conn->sin, sizeof(struct sockaddr_in));
 
 	conn->bytesent += len;
 	conn->pktsent++;
@@ -2429,11 +3254,13 @@ void SendRaw(ConnData *conn, byte *data, int len)
 }
 
 
-/* must be called with outlist mutex! */
-Buffer * BufferPacket(ConnData *conn, byte *data, int len, int flags,
-		RelCallback callback, void *clos)
+/* the guts of BufferPacket and BufferShared. if shared is set, data
+ * and len are its contents. */
+local Buffer * buffer_packet(ConnData *conn, byte *data, int len,
+		SharedPayload *shared, int flags, RelCallback callback, void *clos)
 {
 	Buffer *buf;
+	ticks_t now;
 	int pri;
 
 	assert(len <= (MAXPACKET - REL_HEADER));
@@ -2485,9 +3312,18 @@ Buffer * BufferPacket(ConnData *conn, byte *data, int len, int flags,
 		}
 	}
 
-	buf = GetBuffer();
+	now = current_millis();
+	if (shared)
+	{
+		/* only room for the header */
+		buf = GetBuffer(REL_HEADER);
+		buf->shared = shared;
+		__atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+	}
+	else
+		buf = GetBuffer((flags & NET_RELIABLE) ? len + REL_HEADER : len);
 	buf->conn = conn;
-	buf->lastretry = TICK_MAKE(current_millis() - 10000U);
+	buf->lastretry = TICK_MAKE(now - 10000U);
 	buf->tries = 0;
 	buf->callback = callback;
 	buf->clos = clos;
@@ -2500,20 +3336,44 @@ Buffer * BufferPacket(ConnData *conn, byte *data, int len, int flags,
 		buf->d.rel.t1 = 0x00;
 		buf->d.rel.t2 = 0x03;
 		buf->d.rel.seqnum = conn->s2cn++;
-		memcpy(buf->d.rel.data, data, len);
+		if (!shared)
+			memcpy(buf->d.rel.data, data, len);
+		DQInit(&buf->resendnode);
+		if (!conn->relnext)
+			conn->relnext = buf;
+		conn->relcount++;
 	}
 	else
 	{
 		buf->len = len;
-		memcpy(buf->d.raw, data, len);
+		if (!shared)
+			memcpy(buf->d.raw, data, len);
 	}
 
 	/* add it to out list */
 	DQAdd(&conn->outlist[pri], (DQNode*)buf);
 
+	/* and let the send thread know about it */
+	schedule_send(conn, now);
+
 	return buf;
 }
 
+/* must be called with outlist mutex! */
+Buffer * BufferPacket(ConnData *conn, byte *data, int len, int flags,
+		RelCallback callback, void *clos)
+{
+	return buffer_packet(conn, data, len, NULL, flags, callback, clos);
+}
+
+/* like BufferPacket, but the buffer points at sp instead of getting
+ * its own copy. must be called with outlist mutex! */
+Buffer * BufferShared(ConnData *conn, SharedPayload *sp, int flags,
+		RelCallback callback, void *clos)
+{
+	return buffer_packet(conn, sp->data, sp->len, sp, flags, callback, clos);
+}
+
 
 void SendToOne(Player *p, byte *data, int len, int flags)
 {
@@ -2552,12 +3412,22 @@ void SendToArenaWithCallback(Arena *arena, Player *except, byte *data, int len,
 	Player *p;
 
 	pd->Lock();
-	FOR_EACH_PLAYER(p)
-		if (p->status == S_PLAYING &&
-		    (p->arena == arena || !arena) &&
-		    p != except &&
-		    IS_OURS(p))
-			LLAdd(&set, p);
+	if (arena)
+	{
+		FOR_EACH_PLAYER_IN_ARENA(p, arena)
+			if (p->status == S_PLAYING &&
+			    p != except &&
+			    IS_OURS(p))
+				LLAdd(&set, p);
+	}
+	else
+	{
+		FOR_EACH_PLAYER(p)
+			if (p->status == S_PLAYING &&
+			    p != except &&
+			    IS_OURS(p))
+				LLAdd(&set, p);
+	}
 	pd->Unlock();
 	SendToSetWithCallback(&set, data, len, flags, callback, clos);
 	LLEmpty(&set);
@@ -2612,16 +3482,37 @@ void SendToSetWithCallback(LinkedList *set, byte *data, int len, int flags, RelC
 	}
 	else
 	{
+		SharedPayload *sp = NULL;
 		Link *l;
+
+		/* packets that wouldn't fit in a small buffer are shared by
+		 * everyone they're going to, instead of being copied into a
+		 * full one for each */
+		if (len > SMALL_BUFFER - REL_HEADER &&
+		    LLGetHead(set) && LLGetHead(set)->next)
+		{
+			sp = amalloc(sizeof(*sp) + len);
+			/* our own reference, so it can't go away during the loop */
+			sp->refs = 1;
+			sp->len = len;
+			memcpy(sp->data, data, len);
+		}
+
 		for (l = LLGetHead(set); l; l = l->next)
 		{
 			Player *p = l->data;
 			ConnData *conn = PPDATA(p, connkey);
 			if (!IS_OURS(p)) continue;
 			pthread_mutex_lock(&conn->olmtx);
-			BufferPacket(conn, data, len, flags, callback, clos);
+			if (sp)
+				BufferShared(conn, sp, flags, callback, clos);
+			else
+				BufferPacket(conn, data, len, flags, callback, clos);
 			pthread_mutex_unlock(&conn->olmtx);
 		}
+
+		if (sp && __atomic_sub_fetch(&sp->refs, 1, __ATOMIC_ACQ_REL) == 0)
+			afree(sp);
 	}
 }
 
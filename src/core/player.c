@@ -9,14 +9,22 @@
 
 #include "asss.h"
 
-#define USE_RWLOCK
+#define USE_BRLOCK
 #define PID_REUSE_DELAY 10 /* how many seconds before we re-use a pid */
 
 /* static data */
 
 local Imodman *mm;
 local int dummykey, magickey;
-#ifdef USE_RWLOCK
+#if defined(USE_BRLOCK)
+/* every thread reads the player list many times per tick, and it only
+ * changes when players connect or leave, so readers get the fast path. */
+local brlock_t plock;
+#define RDLOCK() brl_readlock(&plock)
+#define WRLOCK() brl_writelock(&plock)
+#define RULOCK() brl_readunlock(&plock)
+#define WULOCK() brl_writeunlock(&plock)
+#elif defined(USE_RWLOCK)
 local rwlock_t plock;
 #define RDLOCK() rwl_readlock(&plock)
 #define WRLOCK() rwl_writelock(&plock)
@@ -145,6 +153,8 @@ local void FreePlayer(Player *p)
 	DO_CBS(CB_NEWPLAYER, ALLARENAS, NewPlayerFunc, (p, FALSE));
 
 	WRLOCK();
+	if (p->arena)
+		LLRemove(&p->arena->playerlist, p);
 	LLRemove(&pd->playerlist, p);
 	pidmap[p->pid].p = NULL;
 	pidmap[p->pid].available = time(NULL) + PID_REUSE_DELAY;
@@ -156,6 +166,21 @@ local void FreePlayer(Player *p)
 }
 
 
+local void SetArena(Player *p, Arena *arena)
+{
+	WRLOCK();
+	if (p->arena != arena)
+	{
+		if (p->arena)
+			LLRemove(&p->arena->playerlist, p);
+		if (arena)
+			LLAdd(&arena->playerlist, p);
+		p->arena = arena;
+	}
+	WULOCK();
+}
+
+
 local Player * PidToPlayer(int pid)
 {
 	RDLOCK();
@@ -248,6 +273,19 @@ local void TargetToSet(const Target *target, LinkedList *set)
 	{
 		LLAdd(set, target->u.p);
 	}
+	else if (target->type == T_ARENA || target->type == T_FREQ)
+	{
+		/* only look at the players in the right arena */
+		Arena *arena = target->type == T_ARENA ?
+			target->u.arena : target->u.freq.arena;
+		if (!arena)
+			return;
+		RDLOCK();
+		FOR_EACH_PLAYER_IN_ARENA(p, arena)
+			if (p->status == S_PLAYING && matches(target, p))
+				LLAdd(set, p);
+		RULOCK();
+	}
 	else
 	{
 		RDLOCK();
@@ -344,7 +382,8 @@ local Iplayerdata pdint =
 	PidToPlayer, FindPlayer,
 	TargetToSet,
 	AllocatePlayerData, FreePlayerData,
-	Lock, WriteLock, Unlock, WriteUnlock
+	Lock, WriteLock, Unlock, WriteUnlock,
+	SetArena
 };
 
 EXPORT const char info_playerdata[] = CORE_MOD_INFO("playerdata");
@@ -362,7 +401,9 @@ EXPORT int MM_playerdata(int action, Imodman *mm_, Arena *arena)
 		pthread_mutexattr_init(&recmtxattr);
 		pthread_mutexattr_settype(&recmtxattr, PTHREAD_MUTEX_RECURSIVE);
 		pthread_mutexattr_settype(&recmtxattr, PTHREAD_MUTEX_RECURSIVE);
-#ifdef USE_RWLOCK
+#if defined(USE_BRLOCK)
+		brl_init(&plock);
+#elif defined(USE_RWLOCK)
 		rwl_init(&plock);
 #else
 		pthread_mutex_init(&plock, &recmtxattr);
@@ -403,6 +444,9 @@ EXPORT int MM_playerdata(int action, Imodman *mm_, Arena *arena)
 			return MM_FAIL;
 
 		pthread_mutexattr_destroy(&recmtxattr);
+#if defined(USE_BRLOCK)
+		brl_destroy(&plock);
+#endif
 
 		FreePlayerData(dummykey);
 		FreePlayerData(magickey);
@@ -1262,9 +1262,13 @@ local void Cnetstats(const char *tc, const char *params, Player *p, const Target
 	bwout = (stats.bytesent + stats.pktsent * 28) / secs;
 	bwin = (stats.byterecvd + stats.pktrecvd * 28) / secs;
 	chat->SendMessage(p, "netstats: bw out=%u  bw in=%u", bwout, bwin);
-	chat->SendMessage(p, "netstats: buffers used=%u/%u (%.1f%%)",
+	chat->SendMessage(p, "netstats: buffers used=%u/%u (%.1f%%)  small=%u/%u (%.1f%%)",
 			stats.buffersused, stats.buffercount,
-			(double)stats.buffersused/(double)stats.buffercount*100.0);
+			stats.buffercount ?
+				(double)stats.buffersused/(double)stats.buffercount*100.0 : 0.0,
+			stats.smallbuffersused, stats.smallbuffercount,
+			stats.smallbuffercount ?
+				(double)stats.smallbuffersused/(double)stats.smallbuffercount*100.0 : 0.0);
 	chat->SendMessage(p, "netstats: grouped=%d/%d/%d/%d/%d/%d/%d/%d",
 			stats.grouped_stats[0],
 			stats.grouped_stats[1],
@@ -1283,6 +1287,26 @@ local void Cnetstats(const char *tc, const char *params, Player *p, const Target
 }
 
 
+local helptext_t linkstats_help =
+"Targets: none\n"
+"Args: none\n"
+"Prints out counters from the linked list allocator: links allocated\n"
+"and freed, how often threads went to the shared pool, and how often\n"
+"they had to wait for it.\n";
+
+local void Clinkstats(const char *tc, const char *params, Player *p, const Target *target)
+{
+	LinkStats stats;
+
+	LLGetStats(&stats);
+
+	chat->SendMessage(p, "linkstats: allocs=%lu  frees=%lu  in use=%ld",
+			stats.allocs, stats.frees, (long)(stats.allocs - stats.frees));
+	chat->SendMessage(p, "linkstats: refills=%lu  spills=%lu  lock waits=%lu  chunks=%lu",
+			stats.refills, stats.spills, stats.lockwaits, stats.chunks);
+}
+
+
 local void do_common_bw_stuff(Player *p, Player *t, ticks_t tm,
 		const char *prefix, int include_sensitive)
 {
@@ -2568,8 +2592,12 @@ local void Cmapinfo(const char *tc, const char *params, Player *p, const Target
 	chat->SendMessage(p, "regions: %d", regs);
 
 	mapdata->GetMemoryStats(p->arena, &stats);
-	chat->SendMessage(p, "memory (bytes/blocks): lvl=%d/%d  region=%d/%d.",
-			stats.lvlbytes, stats.lvlblocks, stats.rgnbytes, stats.rgnblocks);
+	chat->SendMessage(p, "memory (bytes/blocks): lvl=%d/%d  region=%d/%d  bricks=%d/%d.",
+			stats.lvlbytes, stats.lvlblocks, stats.rgnbytes, stats.rgnblocks,
+			stats.brickbytes, stats.brickblocks);
+	chat->SendMessage(p, "lvl data shared by %d arena%s, %d map%s loaded.",
+			stats.lvlrefs, stats.lvlrefs == 1 ? "" : "s",
+			stats.cachedlvls, stats.cachedlvls == 1 ? "" : "s");
 }
 
 
@@ -2756,6 +2784,7 @@ local const struct cmd_info core_commands[] =
 	CMD(warn)
 	CMD(reply)
 	CMD(netstats)
+	CMD(linkstats)
 	CMD(send)
 	CMD(recyclearena)
 	CMD(where)
@@ -134,7 +134,7 @@ typedef struct rec_adata
 	int specfreq;
 	int ispaused;
 	double curpos;
-	MPQueue mpq;
+	MPSCQueue mpq;
 	pthread_t thd;
 } rec_adata;
 
@@ -219,7 +219,7 @@ local void cb_paction(Player *p, int action, Arena *a)
 		astrncpy(ev->squad, p->squad, sizeof(ev->squad));
 		ev->ship = p->p_ship;
 		ev->freq = p->p_freq;
-		MPAdd(&ra->mpq, ev);
+		MPSCAdd(&ra->mpq, ev);
 	}
 	else if (action == PA_LEAVEARENA)
 	{
@@ -227,7 +227,7 @@ local void cb_paction(Player *p, int action, Arena *a)
 		ev->head.tm = current_ticks();
 		ev->head.type = EV_LEAVE;
 		ev->pid = p->pid;
-		MPAdd(&ra->mpq, ev);
+		MPSCAdd(&ra->mpq, ev);
 	}
 }
 
@@ -242,7 +242,7 @@ local void cb_shipchange(Player *p, int ship, int freq)
 	ev->pid = p->pid;
 	ev->newship = ship;
 	ev->newfreq = freq;
-	MPAdd(&ra->mpq, ev);
+	MPSCAdd(&ra->mpq, ev);
 }
 
 
@@ -255,7 +255,7 @@ local void cb_freqchange(Player *p, int freq)
 	ev->head.type = EV_FREQCHANGE;
 	ev->pid = p->pid;
 	ev->newfreq = freq;
-	MPAdd(&ra->mpq, ev);
+	MPSCAdd(&ra->mpq, ev);
 }
 
 local void cb_shipfreqchange(Player *p, int newship, int oldship, int newfreq, int oldfreq)
@@ -282,7 +282,7 @@ local void cb_kill(Arena *a, Player *killer, Player *killed,
 	ev->killed = killed->pid;
 	ev->pts = *pts; /* FIXME: this is only accurate if this is the last callback to get called */
 	ev->flags = flags;
-	MPAdd(&ra->mpq, ev);
+	MPSCAdd(&ra->mpq, ev);
 }
 
 
@@ -302,7 +302,7 @@ local void cb_chat(Player *p, int type, int sound, Player *target, int freq, con
 		ev->sound = sound;
 		ev->len = len;
 		memcpy(ev->msg, txt, len);
-		MPAdd(&ra->mpq, ev);
+		MPSCAdd(&ra->mpq, ev);
 	}
 }
 
@@ -340,7 +340,7 @@ local void ppk(Player *p, byte *pkt, int len)
 	memcpy(&ev->pos, pkt, len);
 	ev->pos.type = len;
 	ev->pos.time = p->pid;
-	MPAdd(&ra->mpq, ev);
+	MPSCAdd(&ra->mpq, ev);
 }
 
 
@@ -373,7 +373,7 @@ local void ppk(Player *p, byte *pkt, int len)
 	ev->head.type = EV_PACKET;
 	ev->len = (flags & NET_RELIABLE) ? -n : n;
 	memcpy(ev->data, pkt, n);
-	MPAdd(&ra->mpq, ev);
+	MPSCAdd(&ra->mpq, ev);
 }*/
 
 
@@ -390,7 +390,7 @@ local void *recorder_thread(void *v)
 
 	assert(ra->gzf);
 
-	while ((ev = MPRemove(&ra->mpq)))
+	while ((ev = MPSCRemove(&ra->mpq)))
 	{
 		int len = get_size(ev);
 		/* normalize events to start from 0 */
@@ -503,7 +503,7 @@ local int start_recording(Arena *a, const char *file, const char *recorder, cons
 
 				ra->specfreq = header.specfreq;
 
-				MPInit(&ra->mpq);
+				MPSCInit(&ra->mpq, 4096);
 
 				mm->RegCallback(CB_PLAYERACTION, cb_paction, a);
 				mm->RegCallback(CB_SHIPFREQCHANGE, cb_shipfreqchange, a);
@@ -556,7 +556,7 @@ local int stop_recording(Arena *a, int suicide)
 
 		if (!suicide)
 		{
-			MPAdd(&ra->mpq, NULL);
+			MPSCAdd(&ra->mpq, NULL);
 			pthread_join(ra->thd, NULL);
 		}
 		else
@@ -568,7 +568,7 @@ local int stop_recording(Arena *a, int suicide)
 		mm->UnregCallback(CB_CHATMSG, cb_chat, a);
 		/* net->SetArenaPacketHook(a, NULL); */
 
-		MPDestroy(&ra->mpq);
+		MPSCDestroy(&ra->mpq);
 
 		gzclose(ra->gzf);
 		ra->gzf = NULL;
@@ -821,7 +821,7 @@ local void *playback_thread(void *v)
 	for (;;)
 	{
 		/* try reading a control command */
-		cmd = (long)MPTryRemove(&ra->mpq);
+		cmd = (long)MPSCTryRemove(&ra->mpq);
 		switch (cmd)
 		{
 			case PC_NULL:
@@ -1049,6 +1049,9 @@ out:
 	assert(ra->state == s_playing);
 	ra->state = s_none;
 
+	/* nobody can send us commands once state is s_none */
+	MPSCDestroy(&ra->mpq);
+
 	gzclose(ra->gzf);
 	ra->gzf = NULL;
 	afree(ra->fname);
@@ -1126,7 +1129,7 @@ local int start_playback(Arena *a, const char *file)
 					chat->SendArenaMessage(a, "Game recorded in arena %s by %s on %s",
 							header.arenaname, header.recorder, date);
 
-					MPInit(&ra->mpq);
+					MPSCInit(&ra->mpq, 4096);
 
 					ra->state = s_playing;
 
@@ -1163,7 +1166,7 @@ local int stop_playback(Arena *a)
 	if (ra->state == s_playing)
 	{
 		/* all we can do is tell it to stop */
-		MPAdd(&ra->mpq, (void*)PC_STOP);
+		MPSCAdd(&ra->mpq, (void*)PC_STOP);
 
 		ok = TRUE;
 	}
@@ -1213,14 +1216,17 @@ local void Cgamerecord(const char *tc, const char *params, Player *p, const Targ
 		}
 		else
 		{
-			int state, isp;
+			int resumed = FALSE;
+			/* the playback thread destroys the queue when it sets the
+			 * state to s_none, so only post while holding the lock */
 			LOCK(a);
-			state = ra->state;
-			isp = ra->ispaused;
+			if (ra->state == s_playing && ra->ispaused)
+			{
+				MPSCAdd(&ra->mpq, (void*)PC_RESUME);
+				resumed = TRUE;
+			}
 			UNLOCK(a);
-			if (state == s_playing && isp)
-				MPAdd(&ra->mpq, (void*)PC_RESUME);
-			else
+			if (!resumed)
 				chat->SendMessage(p, "You must specify a filename to %s.",
 						"play from");
 		}
@@ -1255,14 +1261,13 @@ local void Cgamerecord(const char *tc, const char *params, Player *p, const Targ
 	}
 	else if (strcasecmp(params, "pause") == 0)
 	{
-		int state, isp;
+		int state;
 		LOCK(a);
 		state = ra->state;
-		isp = ra->ispaused;
-		UNLOCK(a);
 		if (state == s_playing)
-			MPAdd(&ra->mpq, isp ? (void*)PC_RESUME : (void*)PC_PAUSE);
-		else
+			MPSCAdd(&ra->mpq, ra->ispaused ? (void*)PC_RESUME : (void*)PC_PAUSE);
+		UNLOCK(a);
+		if (state != s_playing)
 			chat->SendMessage(p, "There is no game being played here.");
 	}
 	else
@@ -57,7 +57,7 @@ local void MyPA(Player *p, int action, Arena *arena)
 			}
 			else
 			{
-				p->arena = a; /* redirect him to new arena! */
+				pd->SetArena(p, a); /* redirect him to new arena! */
 				chat->SendMessage(p, "You don't have permission to enter arena %s.",
 						arena->name);
 				if (lm) lm->Log(L_INFO, "<squadperm> [%s] redirected from arena {%s} to {%s}",
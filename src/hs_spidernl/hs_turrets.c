@@ -145,7 +145,6 @@ local void detach(Player *p);
 local void sendPositionPacket(Turret *turret, bool withWeapon, int rotation);
 local void readConfig(ConfigHandle ch, ArenaData *adata);
 
-local int fitsOnMap(Arena *arena, int x_, int y_);
 local int isClearPath(Arena *arena, int x1, int y1, int x2, int y2);
 local long lhypot(register long dx, register long dy);
 local inline int getBestFiringAngle(Turret *turret);
@@ -800,108 +799,9 @@ local void readConfig(ConfigHandle ch, ArenaData *adata)
 }
 
 //Shooting/targeting code
-local int fitsOnMap(Arena *arena, int x_, int y_)
-{
-    int x = x_ >> 4;
-    int y = y_ >> 4;
-
-    enum map_tile_t tile = map->GetTile(arena, x, y);
-
-    if ((tile >= 1 && tile <= 161)
-       || (tile >= 192 && tile <= 240)
-       || (tile >= 243 && tile <= 251))
-    {
-        return 0;
-    }
-
-	return 1;
-}
-
-#define PATHCLEAR_INCREASE (8)
 local int isClearPath(Arena *arena, int x1, int y1, int x2, int y2)
 {
-	int i, dx, dy, numpixels;
-	int d, dinc1, dinc2;
-	int x, xinc1, xinc2;
-	int y, yinc1, yinc2;
-
-	/* calculate deltax and deltay for initialisation */
-	dx = x2 - x1;
-	dy = y2 - y1;
-	if (dx < 0) dx = -dx;
-	if (dy < 0) dy = -dy;
-
-	/* initialize all vars based on which is the independent variable */
-	if (dx > dy)
-	{
-		/* x is independent variable */
-		numpixels = dx + 1;
-		d = (2 * dy) - dx;
-		dinc1 = dy << 1;
-		dinc2 = (dy - dx) << 1;
-		xinc1 = 1;
-		xinc2 = 1;
-		yinc1 = 0;
-		yinc2 = 1;
-	}
-	else
-	{
-		/* y is independent variable */
-		numpixels = dy + 1;
-		d = (2 * dx) - dy;
-		dinc1 = dx << 1;
-		dinc2 = (dx - dy) << 1;
-		xinc1 = 0;
-		xinc2 = 1;
-		yinc1 = 1;
-		yinc2 = 1;
-	}
-
-	/* make sure x and y move in the right directions */
-	if (x1 > x2)
-	{
-		xinc1 = - xinc1;
-		xinc2 = - xinc2;
-	}
-	if (y1 > y2)
-	{
-		yinc1 = - yinc1;
-		yinc2 = - yinc2;
-	}
-
- 	dinc1 *= PATHCLEAR_INCREASE;
-	dinc2 *= PATHCLEAR_INCREASE;
-	xinc1 *= PATHCLEAR_INCREASE;
-	xinc2 *= PATHCLEAR_INCREASE;
-	yinc1 *= PATHCLEAR_INCREASE;
-	yinc2 *= PATHCLEAR_INCREASE;
-
-	/* start drawing at */
-	x = x1;
-	y = y1;
-
-	/* trace the line */
-	for(i = 1; i < numpixels; i+= PATHCLEAR_INCREASE)
-	{
-		if (!fitsOnMap(arena, x, y))
-			return 0;
-
-		/* bresenham stuff */
-		if (d < 0)
-		{
-			d = d + dinc1;
-			x = x + xinc1;
-			y = y + yinc1;
-		}
-		else
-		{
-			d = d + dinc2;
-			x = x + xinc2;
-			y = y + yinc2;
-		}
-	}
-
-	return 1;
+	return !map->RaycastSolid(arena, x1, y1, x2, y2, NULL, NULL, NULL);
 }
 
 local long lhypot(register long dx, register long dy)
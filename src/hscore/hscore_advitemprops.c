@@ -321,6 +321,8 @@ static void EditPlayerPositionPacket(Player *player, struct C2SPosition *pos)
  *
  * @return
  *  The property total.
+ *
+ * Call with the hull owner's lock held.
  */
 static int CalculatePropertyTotal(ShipHull *hull, char *prop_name, int def_value)
 {
@@ -337,9 +339,6 @@ static int CalculatePropertyTotal(ShipHull *hull, char *prop_name, int def_value
   int found = 0;
   int tvalue = 0;
 
-
-  database->lock();
-
   // Process hull properties.
   FOR_EACH(hull->propertyList, property, plink) {
     if (!property)
@@ -384,8 +383,6 @@ static int CalculatePropertyTotal(ShipHull *hull, char *prop_name, int def_value
   }
 
 ct_finished:
-  database->unlock();
-
   return found ? tvalue : def_value;
 }
 
@@ -408,6 +405,8 @@ ct_finished:
  *
  * @return
  *  The total value for the property.
+ *
+ * Call with the hull owner's lock held.
  */
 static int CalculateBasedPropertyTotal(ShipHull *hull, char *item_type, char *prop_name, int def_value)
 {
@@ -428,9 +427,6 @@ static int CalculateBasedPropertyTotal(ShipHull *hull, char *item_type, char *pr
   int avalue = 0;
   int absolute = 0;
 
-
-  database->lock();
-
   // Process hull properties.
   FOR_EACH(hull->propertyList, property, plink) {
     if (!property)
@@ -492,8 +488,6 @@ static int CalculateBasedPropertyTotal(ShipHull *hull, char *item_type, char *pr
     }
   }
 
-  database->unlock();
-
   return (base_found ? bvalue + avalue : def_value);
 }
 
@@ -536,7 +530,7 @@ static void CalculateWeaponStats(Player *player, ShipHull *hull, int freq, int s
 
   PlayerStatsData *pdata = PPDATA(player, pdkey);
 
-
+  database->lockPlayer(player);
 
   // Calculate gun stats
   pdata->gun_level = HSC_CLAMP(CalculateBasedPropertyTotal(hull, "Gun", "Gun Level", 0), 0, 4);
@@ -587,9 +581,7 @@ static void CalculateWeaponStats(Player *player, ShipHull *hull, int freq, int s
     pdata->modify_packets = 1;
   }
 
-
-
-
+  database->unlockPlayer(player);
 }
 
 
@@ -51,7 +51,7 @@ local void printAllCategories(Player *p)
 	chat->SendMessage(p, "+----------------------------------+------------------------------------------------------------------+");
 	chat->SendMessage(p, "| Ships                            | All the ship hulls you can buy in this arena.                    |");
 
-	database->lock();
+	database->lockCatalog();
 	for (link = LLGetHead(categoryList); link; link = link->next)
 	{
 		Category *category = link->data;
@@ -64,7 +64,7 @@ local void printAllCategories(Player *p)
 			chat->SendMessage(p, "| %-32s | %-64s |", category->name, category->description);
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	chat->SendMessage(p, "+----------------------------------+------------------------------------------------------------------+");
 }
@@ -100,7 +100,7 @@ local void compressPrice(char * buffer, int price)
 	sprintf(buffer, "%lg%c", digits, power);
 }
 
-local void printCategoryItems(Player *p, Category *category) //call with lock held
+local void printCategoryItems(Player *p, Category *category) //call with the catalog locked
 {
 	Link *link;
 	Link plink = {NULL, p};
@@ -211,7 +211,7 @@ local void printShipList(Player *p)
 	chat->SendMessage(p, "+-----------+-----------+------------+--------+----------------------------------------------------+");
 }
 
-local void buyItem(Player *p, Item *item, int count, int ship)
+local void buyItem(Player *p, Item *item, int count, int ship) //call with the player locked
 {
 	int origCount = count;
 
@@ -260,7 +260,6 @@ local void buyItem(Player *p, Item *item, int count, int ship)
 						{
 							int i;
 							Link *link;
-							database->lock();
 							for (link = LLGetHead(&item->itemTypeEntries); link; link = link->next)
 							{
 								ItemTypeEntry *entry = link->data;
@@ -275,11 +274,9 @@ local void buyItem(Player *p, Item *item, int count, int ship)
 								if (count <= 0) //have no free spots
 								{
 									chat->SendMessage(p, "You do not have enough free %s spots.", entry->itemType->name);
-									database->unlock();
 									return;
 								}
 							}
-							database->unlock();
 
 
 							LinkedList advisers = LL_INITIALIZER;
@@ -371,7 +368,7 @@ local void buyItem(Player *p, Item *item, int count, int ship)
 	}
 }
 
-local void sellItem(Player *p, Item *item, int count, int ship)
+local void sellItem(Player *p, Item *item, int count, int ship) //call with the player locked
 {
 	if (item->sellPrice)
 	{
@@ -402,7 +399,6 @@ local void sellItem(Player *p, Item *item, int count, int ship)
 				{
 					int i;
 					Link *link;
-					database->lock();
 					for (link = LLGetHead(&item->itemTypeEntries); link; link = link->next)
 					{
 						ItemTypeEntry *entry = link->data;
@@ -410,11 +406,9 @@ local void sellItem(Player *p, Item *item, int count, int ship)
 						if (items->getFreeItemTypeSpots(p, entry->itemType, ship) + (entry->delta * count) < 0) //have no free spots
 						{
 							chat->SendMessage(p, "You do not have enough free %s spots.", entry->itemType->name);
-							database->unlock();
 							return;
 						}
 					}
-					database->unlock();
 
 
 					LinkedList advisers = LL_INITIALIZER;
@@ -504,7 +498,7 @@ local void sellItem(Player *p, Item *item, int count, int ship)
 	}
 }
 
-local void buyShip(Player *p, int ship)
+local void buyShip(Player *p, int ship) //call with the player locked
 {
 	// Prevent people from buying/selling ships in combat to force reshipping
     if (p->p_ship != SHIP_SPEC && !(p->position.status & STATUS_SAFEZONE)) {
@@ -579,7 +573,7 @@ local void buyShip(Player *p, int ship)
 	}
 }
 
-local void sellShip(Player *p, int ship)
+local void sellShip(Player *p, int ship) //call with the player locked
 {
 	// Prevent people from buying/selling ships in combat to force reshipping
     if (p->p_ship != SHIP_SPEC && !(p->position.status & STATUS_SAFEZONE)) {
@@ -733,13 +727,15 @@ local void buyCommand(const char *command, const char *params, Player *p, const
 			{
 				if (strcasecmp(newParams, shipNames[i]) == 0)
 				{
+					database->lockPlayer(p);
 					buyShip(p, i);
+					database->unlockPlayer(p);
 					return;
 				}
 			}
 
 			//check if they're asking for a category
-			database->lock();
+			database->lockCatalog();
 			matches = 0;
 			for (link = LLGetHead(categoryList); link; link = link->next)
 			{
@@ -756,17 +752,17 @@ local void buyCommand(const char *command, const char *params, Player *p, const
 			{
 				printCategoryItems(p, category);
 
-				database->unlock();
+				database->unlockCatalog();
 				return;
 			}
 			else if (matches > 1)
 			{
 				chat->SendMessage(p, "Too many partial matches! Try typing more of the name!");
 
-				database->unlock();
+				database->unlockCatalog();
 				return;
 			}
-			database->unlock();
+			database->unlockCatalog();
 
 			//not a category. check for an item
 			Item *item = items->getItemByPartialName(newParams, p->arena);
@@ -776,8 +772,11 @@ local void buyCommand(const char *command, const char *params, Player *p, const
 				{
 					if (database->getPlayerCurrentHull(p) != NULL)
 					{
-						//check - counts
+						//check - counts. the lock keeps the money and slot checks
+						//good until the purchase goes through.
+						database->lockPlayer(p);
 						buyItem(p, item, count, p->p_ship);
+						database->unlockPlayer(p);
 					}
 					else
 					{
@@ -900,7 +899,9 @@ local void sellCommand(const char *command, const char *params, Player *p, const
 			{
 				if (i != p->p_ship)
 				{
+					database->lockPlayer(p);
 					sellShip(p, i);
+					database->unlockPlayer(p);
 				}
 				else
 				{
@@ -920,7 +921,9 @@ local void sellCommand(const char *command, const char *params, Player *p, const
 				if (database->getPlayerCurrentHull(p) != NULL)
 				{
 					//check - counts
+					database->lockPlayer(p);
 					sellItem(p, item, count, p->p_ship);
+					database->unlockPlayer(p);
 				}
 				else
 				{
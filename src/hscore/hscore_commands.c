@@ -100,42 +100,50 @@ local void shipsCommand(const char *command, const char *params, Player *p, cons
 	}
 }
 
-local int printCacheEntry(const char *key, void *val, void *clos)
+//call with the player's lock held
+local void printCacheEntries(Player *p, ShipHull *hull)
 {
-	PropertyCacheEntry *cacheEntry = val;
-	Player *p = clos;
+	PropertySums *sums = hull->propertySums;
+	int i;
 
-	if (cacheEntry != NULL)
+	for (i = 0; sums && i < sums->count; i++)
 	{
+		PropertyCacheEntry *cacheEntry = &sums->sums[i];
+
+		if (!cacheEntry->valid)
+		{
+			continue;
+		}
+
 		if (cacheEntry->absolute)
 		{
-			chat->SendMessage(p, "| %-16s | =%-13i |", key, cacheEntry->value);
+			chat->SendMessage(p, "| %-16s | =%-13i |", database->getPropertyName(i), cacheEntry->value);
 		}
 		else if (cacheEntry->value != 0)
 		{
-			chat->SendMessage(p, "| %-16s | %+-14i |", key, cacheEntry->value);
+			chat->SendMessage(p, "| %-16s | %+-14i |", database->getPropertyName(i), cacheEntry->value);
 		}
 	}
-
-	return 0;
 }
 
-local int cacheEntriesToList(const char *key, void *val, void *clos)
+//call with the player's lock held
+local void cacheEntriesToList(ShipHull *hull, LinkedList *list)
 {
-	PropertyCacheEntry *cacheEntry = (PropertyCacheEntry *)val;
-	LinkedList *list = (LinkedList *)clos;
+	PropertySums *sums = hull->propertySums;
+	int i;
 
-	if (cacheEntry != NULL)
+	for (i = 0; sums && i < sums->count; i++)
 	{
-		if (cacheEntry->absolute || cacheEntry->value != 0)
+		PropertyCacheEntry *cacheEntry = &sums->sums[i];
+
+		if (cacheEntry->valid && (cacheEntry->absolute || cacheEntry->value != 0))
 		{
 			KeyCacheEntryPair *pair = amalloc(sizeof(*pair));
-			pair->key = key;
+			pair->key = database->getPropertyName(i);
 			pair->cacheEntry = cacheEntry;
 			LLAdd(list, pair);
 		}
 	}
-	return 0;
 }
 
 local helptext_t cacheHelp =
@@ -182,7 +190,9 @@ local void cacheCommand(const char *command, const char *params, Player *p, cons
 			chat->SendMessage(p, "| Property Name    | Property Value |");
 			chat->SendMessage(p, "+------------------+----------------+");
 
-			HashEnum(hull->propertySums, printCacheEntry, p);
+			database->lockPlayer(t);
+			printCacheEntries(p, hull);
+			database->unlockPlayer(t);
 
 			chat->SendMessage(p, "+------------------+----------------+");
 		}
@@ -295,7 +305,7 @@ local void shipItemsCommand(const char *command, const char *params, Player *p,
 			chat->SendMessage(p, "| %-16s |", shipNames[ship]);
 			chat->SendMessage(p, "+------------------+--------------------------------------------------------------------------+");
 
-			database->lock();
+			database->lockPlayer(t);
 			for (link = LLGetHead(&hull->inventoryEntryList); link; link = link->next)
 			{
 				InventoryEntry *entry = link->data;
@@ -405,7 +415,7 @@ local void shipItemsCommand(const char *command, const char *params, Player *p,
 					lineLen = strlen(line);
 				}
 			}
-			database->unlock();
+			database->unlockPlayer(t);
 
 			//check if there's still stuff left in the line
 			if (lineLen != 0)
@@ -523,7 +533,7 @@ local void shipStatusCommand(const char *command, const char *params, Player *p,
 
 			Link *link;
 
-			database->lock();
+			database->lockPlayer(t);
 			for (link = LLGetHead(&hull->inventoryEntryList); link; link = link->next)
 			{
 				InventoryEntry *entry = link->data;
@@ -603,10 +613,10 @@ local void shipStatusCommand(const char *command, const char *params, Player *p,
 
 				items->recalculateEntireCacheForShipSet(t, ship, shipset);
 				//unsorted method
-				//HashEnum(hull->propertySums, printCacheEntry, p);
+				//printCacheEntries(p, hull);
 
 				//new sorted method
-				HashEnum(hull->propertySums, cacheEntriesToList, &propertiesList);
+				cacheEntriesToList(hull, &propertiesList);
 				LLSort(&propertiesList, sortKeyCacheEntryPair);
 
 				for (pairsLink = LLGetHead(&propertiesList); pairsLink; pairsLink = pairsLink->next)
@@ -627,7 +637,7 @@ local void shipStatusCommand(const char *command, const char *params, Player *p,
 
 				chat->SendMessage(p, "+------------------+----------------+");
 			}
-			database->unlock();
+			database->unlockPlayer(t);
 		}
 		else
 		{
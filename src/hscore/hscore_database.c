@@ -33,6 +33,8 @@ typedef struct PerPlayerData
     const char *sarena; // Arena identifier (in case we desynch)
 
     long uniqueID; //internal use only (some kind of documentation would have been nice...)
+
+    pthread_mutex_t mutex; //guards everything above. see lockPlayer()
 } PerPlayerData;
 
 typedef struct PerArenaData
@@ -55,7 +57,6 @@ local Iplayerdata *pd;
 local Imainloop *ml;
 
 //local prototypes
-local int hash_enum_remove(const char *key, void *val, void *d);
 local PerArenaData * getPerArenaData(Arena *arena);
 local Item * getItemByID(int id);
 local ItemType * getItemTypeByID(int id);
@@ -111,8 +112,15 @@ local int areShipsLoaded(Player *p);
 local LinkedList * getItemList();
 local LinkedList * getStoreList(Arena *arena);
 local LinkedList * getCategoryList(Arena *arena);
+local int getPropertyId(const char *name);
+local const char * getPropertyName(int id);
+local int getPropertyCount();
 local void lock();
 local void unlock();
+local void lockPlayer(Player *p);
+local void unlockPlayer(Player *p);
+local void lockCatalog();
+local void unlockCatalog();
 local void updateItem(Player *p, int ship, Item *item, int newCount, int newData);
 local void updateItemOnShipSet(Player *p, int ship, int shipset, Item *item, int newCount, int newData);
 local void updateItemOnHull(Player *p, ShipHull *hull, Item *item, int newCount, int newData);
@@ -147,9 +155,30 @@ local int arenaDataKey;
 local LinkedList itemList;
 local LinkedList itemTypeList;
 
-//mutex
-local pthread_mutexattr_t db_mutex_attr;
-local pthread_mutex_t db_mutex;
+//locks. the order is in locking.txt. catalogLock guards the item, item
+//type, store, category and ship property lists; lock() takes it
+//exclusively, lockCatalog() and lockPlayer() take it shared. each
+//player's mutex guards their PerPlayerData and hulls.
+local pthread_rwlock_t catalogLock;
+local pthread_mutexattr_t player_mutex_attr;
+
+//how many times this thread holds catalogLock each way, so the locks can
+//nest like the old recursive mutex did
+typedef struct CatalogHolds
+{
+    int shared;
+    int exclusive;
+} CatalogHolds;
+
+local __thread CatalogHolds catalogHolds;
+
+//interned property names. propertyIds maps a name to its id + 1; the
+//hash is case insensitive, so names are checked again with strcmp.
+local HashTable *propertyIds;
+local char **propertyNames;
+local int propertyCount;
+local int propertySpace;
+local pthread_mutex_t prop_mutex;
 
 
 //+-------------------------+
@@ -157,9 +186,40 @@ local pthread_mutex_t db_mutex;
 //| Miscellaneous Functions |
 //|                         |
 //+-------------------------+
-local int hash_enum_remove(const char *key, void *val, void *d)
+local void freePropertySums(ShipHull *hull)
 {
-        return 1;
+        PropertySums *sums = hull->propertySums;
+
+        while (sums)
+        {
+                PropertySums *next = sums->retired;
+                afree(sums);
+                sums = next;
+        }
+
+        hull->propertySums = NULL;
+}
+
+//call with the lock held. marks every cached sum on the hull as stale.
+local void invalidatePropertySums(ShipHull *hull)
+{
+        PropertySums *sums = hull->propertySums;
+        int i;
+
+        if (sums == NULL)
+        {
+                return;
+        }
+
+        __atomic_store_n(&hull->propertySeq, hull->propertySeq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        for (i = 0; i < sums->count; i++)
+        {
+                __atomic_store_n(&sums->sums[i].valid, 0, __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&hull->propertySeq, hull->propertySeq + 1, __ATOMIC_RELEASE);
 }
 
 //+-------------------------+
@@ -183,7 +243,7 @@ local Item * getItemByID(int id)
     Link *link;
     Item *returnValue = NULL;
 
-    lock();
+    lockCatalog();
     for (link = LLGetHead(&itemList); link; link = link->next)
     {
         Item *item = link->data;
@@ -194,7 +254,7 @@ local Item * getItemByID(int id)
             break;
         }
     }
-    unlock();
+    unlockCatalog();
 
     return returnValue;
 }
@@ -204,7 +264,7 @@ local ItemType * getItemTypeByID(int id)
     Link *link;
     ItemType *returnValue = NULL;
 
-    lock();
+    lockCatalog();
     for (link = LLGetHead(&itemTypeList); link; link = link->next)
     {
         ItemType *itemType = link->data;
@@ -215,7 +275,7 @@ local ItemType * getItemTypeByID(int id)
             break;
         }
     }
-    unlock();
+    unlockCatalog();
 
     return returnValue;
 }
@@ -525,8 +585,7 @@ local void loadPropertiesQueryCallback(int status, db_res *result, void *passedD
                     if (!playerData->hull[x])
                             continue;
 
-                    HashEnum(playerData->hull[x]->propertySums, hash_enum_afree, 0);
-                    HashEnum(playerData->hull[x]->propertySums, hash_enum_remove, 0);
+                    invalidatePropertySums(playerData->hull[x]);
             }
     }
     pd->Unlock();
@@ -555,6 +614,7 @@ local void loadPropertiesQueryCallback(int status, db_res *result, void *passedD
                     {
                             property = amalloc(sizeof(*property));
                             astrncpy(property->name, mysql->GetField(row, 1), 33);
+                            property->id = getPropertyId(property->name);
                             LLAdd(&item->propertyList, property);
                     }
 
@@ -882,6 +942,7 @@ local void loadPlayerWalletQueryCallback(int status, db_res *result, void *passe
 
     row = mysql->GetRow(result);
 
+    lockPlayer(p);
     playerData->id = atoi(mysql->GetField(row, 0));                                 //id
     playerData->money = atoi(mysql->GetField(row, 1));                              //money
     playerData->exp = atoi(mysql->GetField(row, 2));                                //exp
@@ -895,6 +956,7 @@ local void loadPlayerWalletQueryCallback(int status, db_res *result, void *passe
 
     playerData->walletLoaded = 1;
     playerData->warena = getArenaIdentifier(arena);
+    unlockPlayer(p);
 
     lm->LogP(L_DRIVEL, "hscore_database", p, "Loaded played wallet for arena %s.", playerData->warena);
     LoadPlayerShips(p, arena);
@@ -998,9 +1060,9 @@ local void loadPlayerShipItemsQueryCallback(int status, db_res *result, void *pa
                     inventoryEntry->count = count;
                     inventoryEntry->data = data;
 
-                    lock();
+                    lockPlayer(p);
                     LLAdd(&hull->inventoryEntryList, inventoryEntry);
-                    unlock();
+                    unlockPlayer(p);
                 }
                 else
                 {
@@ -1048,6 +1110,7 @@ local void loadPlayerShipsQueryCallback(int status, db_res *result, void *passed
 
     results = mysql->GetRowCount(result);
 
+    lockPlayer(p);
     while ((row = mysql->GetRow(result)))
     {
         int id = atoi(mysql->GetField(row, 0));         //id
@@ -1058,7 +1121,7 @@ local void loadPlayerShipsQueryCallback(int status, db_res *result, void *passed
             ShipHull *hull = amalloc(sizeof(*hull));
 
             LLInit(&hull->inventoryEntryList);
-            hull->propertySums = HashAlloc();
+            hull->propertySums = NULL;
             hull->ship = ship % 8;
             hull->id = id;
 
@@ -1073,6 +1136,7 @@ local void loadPlayerShipsQueryCallback(int status, db_res *result, void *passed
 
     playerData->shipsLoaded = 1;
     playerData->sarena = getArenaIdentifier(arena);
+    unlockPlayer(p);
 
     lm->LogP(L_DRIVEL, "hscore_database", p, "%i ships were loaded from MySQL.", results);
 
@@ -1356,6 +1420,7 @@ local void loadShipPropertyListsQueryCallback(int status, db_res *result, void *
         Property *property = amalloc(sizeof(*property));
 
         astrncpy(property->name, mysql->GetField(row, 1), 33);
+        property->id = getPropertyId(property->name);
         property->value = atoi(mysql->GetField(row, 2));                //value
         property->absolute = atoi(mysql->GetField(row, 3));             //absolute
 
@@ -1388,6 +1453,8 @@ local void InitPerPlayerData(Player *p) //called before data is touched
     for (i = 0; i < HSCORE_MAX_HULLS; i++) {
         playerData->hull[i] = NULL;
     }
+
+    pthread_mutex_init(&playerData->mutex, &player_mutex_attr);
 }
 
 local void InitPerArenaData(Arena *arena) //called before data is touched
@@ -1418,19 +1485,14 @@ local void UnloadPlayerWallet(Player *p)
     lm->LogP(L_DRIVEL, "hscore_database", p, "Freed global data.");
 }
 
-local void UnloadPlayerShip(ShipHull *ship)
+local void UnloadPlayerShip(ShipHull *ship) //call with the owner's lock held
 {
-    lock();
-
     LLEnum(&ship->inventoryEntryList, afree);
     LLEmpty(&ship->inventoryEntryList);
 
-    HashEnum(ship->propertySums, hash_enum_afree, NULL);
-    HashFree(ship->propertySums);
+    freePropertySums(ship);
 
     afree(ship);
-
-    unlock();
 }
 
 local void UnloadPlayerShips(Player *p) //called to free any allocated data
@@ -1438,7 +1500,7 @@ local void UnloadPlayerShips(Player *p) //called to free any allocated data
     PerPlayerData *playerData = getPerPlayerData(p);
     int i;
 
-    lock();
+    lockPlayer(p);
 
     for (i = 0; i < HSCORE_MAX_HULLS; i++)
     {
@@ -1452,7 +1514,7 @@ local void UnloadPlayerShips(Player *p) //called to free any allocated data
     playerData->shipsLoaded = 0;
     playerData->sarena = NULL;
 
-    unlock();
+    unlockPlayer(p);
 
     lm->LogP(L_DRIVEL, "hscore_database", p, "Freed ship data.");
 }
@@ -1563,6 +1625,9 @@ local void UnloadAllPerPlayerData()
 {
     Player *p;
     Link *link;
+
+    //our locks come before pd's
+    lock();
     pd->Lock();
 
     FOR_EACH_PLAYER(p) {
@@ -1573,6 +1638,7 @@ local void UnloadAllPerPlayerData()
     }
 
     pd->Unlock();
+    unlock();
 }
 
 //+------------------+
@@ -1690,7 +1756,7 @@ local void StorePlayerWallet(Player *p) //store player globals. MUST FINISH IN O
 
     if (isWalletLoaded(p))
     {
-        lock();
+        lockPlayer(p);
 
         mysql->Query(NULL, NULL, 0, "UPDATE hs_players SET money = #, exp = #, money_give = #, money_grant = #, money_buysell = #, money_kill = #, money_flag = #, money_ball = #, money_event = # WHERE id = #",
                 playerData->money,
@@ -1704,7 +1770,7 @@ local void StorePlayerWallet(Player *p) //store player globals. MUST FINISH IN O
                 playerData->moneyType[MONEY_TYPE_EVENT],
                 playerData->id);
 
-        unlock();
+        unlockPlayer(p);
     }
     else
     {
@@ -1722,7 +1788,7 @@ local void StorePlayerShips(Player *p, Arena *arena) //store player ships. MUST
         if (areShipsLoaded(p))
         {
                 int i;
-                lock();
+                lockPlayer(p);
 
                 for (i = 0; i < HSCORE_MAX_HULLS; i++)
                 {
@@ -1755,7 +1821,7 @@ local void StorePlayerShips(Player *p, Arena *arena) //store player ships. MUST
                         }
                 }
 
-                unlock();
+                unlockPlayer(p);
         }
         else
         {
@@ -1767,6 +1833,7 @@ local void StoreAllPerPlayerData()
 {
         Player *p;
         Link *link;
+        lock();
         pd->Lock();
         FOR_EACH_PLAYER(p)
                 if (isWalletLoaded(p))
@@ -1778,6 +1845,7 @@ local void StoreAllPerPlayerData()
                         StorePlayerWallet(p);
                 }
         pd->Unlock();
+        unlock();
 }
 
 //+---------------------+
@@ -1831,8 +1899,8 @@ local void refundCommand(const char *command, const char *params, Player *p, con
 
         LLInit(&list);
 
-        pd->Lock();
         lock();
+        pd->Lock();
         FOR_EACH_PLAYER(i)
                 if (isWalletLoaded(i))
                 {
@@ -1889,8 +1957,8 @@ local void refundCommand(const char *command, const char *params, Player *p, con
                                 }
                         }
                 }
-        unlock();
         pd->Unlock();
+        unlock();
 
         chat->SendMessage(p, "Refunding items of offline players...");
 
@@ -1927,7 +1995,7 @@ local void resetCommand(const char *command, const char *params, Player *p, cons
         {
                 if(t->p_ship == SHIP_SPEC)
                 {
-                        lock();
+                        lockPlayer(t);
                         //do money+exp first
 
                         //insert a new player into MySQL and then get it
@@ -1963,8 +2031,7 @@ local void resetCommand(const char *command, const char *params, Player *p, cons
 
                                         LLEnum(&ship->inventoryEntryList, afree);
                                         LLEmpty(&ship->inventoryEntryList);
-                                        HashEnum(ship->propertySums, hash_enum_afree, NULL);
-                                        HashFree(ship->propertySums);
+                                        freePropertySums(ship);
 
                                         afree(ship);
 
@@ -1972,7 +2039,7 @@ local void resetCommand(const char *command, const char *params, Player *p, cons
                                 }
                         }
 
-                        unlock();
+                        unlockPlayer(t);
 
                         //reset score too
 
@@ -2020,7 +2087,9 @@ local void allocatePlayerCallback(Player *p, int allocating)
         }
         else //p is being deallocated
         {
-                //already taken care of on disconnect
+                //already taken care of on disconnect, except for the lock
+                PerPlayerData *playerData = getPerPlayerData(p);
+                pthread_mutex_destroy(&playerData->mutex);
         }
 }
 
@@ -2121,6 +2190,72 @@ local LinkedList * getCategoryList(Arena *arena)
         return &arenaData->categoryList;
 }
 
+local int getPropertyId(const char *name)
+{
+        LinkedList ids;
+        Link *link;
+        int id = -1;
+
+        if (name == NULL)
+        {
+                return -1;
+        }
+
+        LLInit(&ids);
+        pthread_mutex_lock(&prop_mutex);
+
+        HashGetAppend(propertyIds, name, &ids);
+        for (link = LLGetHead(&ids); link; link = link->next)
+        {
+                int candidate = (int)(long)link->data - 1;
+                if (strcmp(propertyNames[candidate], name) == 0)
+                {
+                        id = candidate;
+                        break;
+                }
+        }
+        LLEmpty(&ids);
+
+        if (id == -1)
+        {
+                if (propertyCount == propertySpace)
+                {
+                        propertySpace = propertySpace ? propertySpace * 2 : 128;
+                        propertyNames = arealloc(propertyNames, propertySpace * sizeof(*propertyNames));
+                }
+
+                id = propertyCount;
+                propertyNames[id] = astrdup(name);
+                HashAdd(propertyIds, name, (void*)(long)(id + 1));
+
+                //readers check this without the lock, so publish it last
+                __atomic_store_n(&propertyCount, id + 1, __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&prop_mutex);
+
+        return id;
+}
+
+local const char * getPropertyName(int id)
+{
+        const char *name = NULL;
+
+        pthread_mutex_lock(&prop_mutex);
+        if (0 <= id && id < propertyCount)
+        {
+                name = propertyNames[id];
+        }
+        pthread_mutex_unlock(&prop_mutex);
+
+        return name;
+}
+
+local int getPropertyCount()
+{
+        return __atomic_load_n(&propertyCount, __ATOMIC_ACQUIRE);
+}
+
 local LinkedList * getShipPropertyList(Arena *arena, int ship)
 {
         if (ship < 0 || 7 < ship)
@@ -2135,12 +2270,59 @@ local LinkedList * getShipPropertyList(Arena *arena, int ship)
 
 local void lock()
 {
-        pthread_mutex_lock(&db_mutex);
+        if (catalogHolds.exclusive++ == 0)
+        {
+                if (catalogHolds.shared)
+                {
+                        //can't upgrade without risking a deadlock, so carry on with
+                        //what we hold. this is a bug in the caller.
+                        lm->Log(L_ERROR, "<hscore_database> lock() called while holding a player or the catalog. See hscore/locking.txt.");
+                }
+                else
+                {
+                        pthread_rwlock_wrlock(&catalogLock);
+                }
+        }
 }
 
 local void unlock()
 {
-        pthread_mutex_unlock(&db_mutex);
+        if (--catalogHolds.exclusive == 0 && !catalogHolds.shared)
+        {
+                pthread_rwlock_unlock(&catalogLock);
+        }
+}
+
+local void lockCatalog()
+{
+        if (catalogHolds.shared++ == 0 && !catalogHolds.exclusive)
+        {
+                pthread_rwlock_rdlock(&catalogLock);
+        }
+}
+
+local void unlockCatalog()
+{
+        if (--catalogHolds.shared == 0 && !catalogHolds.exclusive)
+        {
+                pthread_rwlock_unlock(&catalogLock);
+        }
+}
+
+local void lockPlayer(Player *p)
+{
+        PerPlayerData *playerData = getPerPlayerData(p);
+
+        lockCatalog();
+        pthread_mutex_lock(&playerData->mutex);
+}
+
+local void unlockPlayer(Player *p)
+{
+        PerPlayerData *playerData = getPerPlayerData(p);
+
+        pthread_mutex_unlock(&playerData->mutex);
+        unlockCatalog();
 }
 
 local void updateItem(Player *p, int ship, Item *item, int newCount, int newData)
@@ -2183,7 +2365,7 @@ local void updateItemOnHull(Player *p, ShipHull *hull, Item *item, int newCount,
     return;
   }
 
-  lock();
+  lockPlayer(p);
 
         inventoryList = &hull->inventoryEntryList;
 
@@ -2251,7 +2433,7 @@ local void updateItemOnHull(Player *p, ShipHull *hull, Item *item, int newCount,
                                 DO_CBS(CB_ITEM_COUNT_CHANGED, p->arena, ItemCountChanged, (p, hull, item, NULL, 0, oldCount));
                         }
 
-                        unlock();
+                        unlockPlayer(p);
                         return;
                 }
         }
@@ -2291,7 +2473,7 @@ local void updateItemOnHull(Player *p, ShipHull *hull, Item *item, int newCount,
                 lm->LogP(L_ERROR, "hscore_database", p, "asked to remove item %s not on hull.", item->name);
         }
 
-    unlock();
+    unlockPlayer(p);
 }
 
 local void updateInventory(Player *p, int ship, InventoryEntry *entry, int newCount, int newData)
@@ -2333,7 +2515,7 @@ local void updateInventoryOnHull(Player *p, ShipHull *hull, InventoryEntry *entr
     return;
   }
 
-  lock();
+  lockPlayer(p);
 
         inventoryList = &hull->inventoryEntryList;
 
@@ -2397,7 +2579,7 @@ local void updateInventoryOnHull(Player *p, ShipHull *hull, InventoryEntry *entr
                 DO_CBS(CB_ITEM_COUNT_CHANGED, p->arena, ItemCountChanged, (p, hull, item, NULL, 0, oldCount));
         }
 
-    unlock();
+    unlockPlayer(p);
 }
 
 local void addShip(Player *p, int ship) //the ships id may not be valid until later
@@ -2427,17 +2609,18 @@ local void addShipToShipSet(Player *p, int ship, int shipset)
       return;
     }
 
+    lockPlayer(p);
+
     if (pdata->hull[(hid = ship + shipset * 8)]) {
       lm->LogP(L_ERROR, "hscore_database", p, "Asked to add owned ship %i to shipset %i (hull id: %i).", ship, shipset, hid);
+      unlockPlayer(p);
       return;
     }
 
-    lock();
-
     ShipHull *hull = amalloc(sizeof(*hull));
 
     LLInit(&hull->inventoryEntryList);
-    hull->propertySums = HashAlloc();
+    hull->propertySums = NULL;
     hull->ship = ship;
     hull->id = -1;
 
@@ -2449,7 +2632,7 @@ local void addShipToShipSet(Player *p, int ship, int shipset)
     PlayerReference *ref = getPlayerReference(p, p->arena);
     mysql->Query(loadShipIDQueryCallback, ref, 1, "SELECT id, ship FROM hs_player_ships WHERE player_id = # AND ship = #", pdata->id, hid);
 
-    unlock();
+    unlockPlayer(p);
   }
 }
 
@@ -2491,11 +2674,10 @@ local void removeShipFromShipSet(Player *p, int ship, int shipset)
     // Delete the ship
     mysql->Query(NULL, NULL, 0, "DELETE FROM hs_player_ships WHERE id = #", sid);
 
-    lock();
+    lockPlayer(p);
     UnloadPlayerShip(pdata->hull[hid]);
-    unlock();
-
     pdata->hull[hid] = NULL;
+    unlockPlayer(p);
   }
 }
 
@@ -2506,8 +2688,10 @@ local void addMoney(Player *p, MoneyType type, int amount)
     if (isWalletLoaded(p)) {
         PerPlayerData *pdata = getPerPlayerData(p);
 
+        lockPlayer(p);
         pdata->money += amount;
         pdata->moneyType[type] += amount;
+        unlockPlayer(p);
     } else if (p->type != T_FAKE) {
         lm->LogP(L_WARN, "hscore_database", p, "Tried to add money before wallet has loaded.");
     }
@@ -2517,10 +2701,11 @@ local void setMoney(Player *p, MoneyType type, int amount)
 {
     if (isWalletLoaded(p)) {
         PerPlayerData *pdata = getPerPlayerData(p);
-        int diff = amount - pdata->money;
 
+        lockPlayer(p);
+        pdata->moneyType[type] += amount - pdata->money;
         pdata->money = amount;
-        pdata->moneyType[type] += diff;
+        unlockPlayer(p);
     } else if (p->type != T_FAKE) {
         lm->LogP(L_WARN, "hscore_database", p, "Tried to set money before wallet has loaded.");
     }
@@ -2557,7 +2742,9 @@ local void addExp(Player *p, int amount)
     if (isWalletLoaded(p)) {
         PerPlayerData *pdata = getPerPlayerData(p);
 
+        lockPlayer(p);
         pdata->exp += amount;
+        unlockPlayer(p);
     } else if (p->type != T_FAKE) {
         lm->LogP(L_WARN, "hscore_database", p, "Tried to add experience before wallet has loaded.");
     }
@@ -2603,10 +2790,14 @@ local int setPlayerShipSet(Player *p, int shipset)
   PerPlayerData *pdata;
 
   if (p && (pdata = getPerPlayerData(p)) && (shipset > -1 && shipset < HSCORE_MAX_SHIPSETS)) {
-    int prev = pdata->shipset;
+    int prev;
+
+    lockPlayer(p);
+    prev = pdata->shipset;
     pdata->shipset = shipset;
 
     DO_CBS(CB_SHIPSET_CHANGED, p->arena, ShipSetChanged, (p, prev, pdata->shipset));
+    unlockPlayer(p);
 
     return prev;
   }
@@ -2649,7 +2840,10 @@ local Ihscoredatabase interface =
   INTERFACE_HEAD_INIT(I_HSCORE_DATABASE, "hscore_database")
   getPlayerWalletId, isWalletLoaded, areShipsLoaded,
   getItemList, getStoreList, getCategoryList, getShipPropertyList,
+  getPropertyId, getPropertyName, getPropertyCount,
   lock, unlock,
+  lockPlayer, unlockPlayer,
+  lockCatalog, unlockCatalog,
   updateItem, updateItemOnShipSet, updateItemOnHull,
   updateInventory, updateInventoryOnShipSet, updateInventoryOnHull,
   addShip, addShipToShipSet,
@@ -2688,17 +2882,26 @@ EXPORT int MM_hscore_database(int action, Imodman *_mm, Arena *arena)
                         goto fail;
                 }
 
-                // Lock allocation.
-                if (pthread_mutexattr_init(&db_mutex_attr)) {
+                // Lock allocation. Reloads take the catalog exclusively and
+                // would starve behind a steady stream of buys otherwise. This
+                // is safe because no thread takes the read side twice.
+                pthread_rwlockattr_t catalogAttr;
+                pthread_rwlockattr_init(&catalogAttr);
+                pthread_rwlockattr_setkind_np(&catalogAttr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+                int initFailed = pthread_rwlock_init(&catalogLock, &catalogAttr);
+                pthread_rwlockattr_destroy(&catalogAttr);
+                if (initFailed) {
                     goto fail;
                 }
 
-                // Set lock to be reentrant so we don't need modules to care about lock state.
-                pthread_mutexattr_settype(&db_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
-                if (pthread_mutex_init(&db_mutex, &db_mutex_attr)) {
-                    pthread_mutexattr_destroy(&db_mutex_attr);
-                    goto fail;
-                }
+                // Player locks are reentrant so we don't need modules to care about lock state.
+                pthread_mutexattr_init(&player_mutex_attr);
+                pthread_mutexattr_settype(&player_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+
+                pthread_mutex_init(&prop_mutex, NULL);
+                propertyIds = HashAlloc();
+                propertyNames = NULL;
+                propertyCount = propertySpace = 0;
 
                 playerDataKey = pd->AllocatePlayerData(sizeof(PerPlayerData));
                 if (playerDataKey == -1)
@@ -2706,6 +2909,16 @@ EXPORT int MM_hscore_database(int action, Imodman *_mm, Arena *arena)
                         goto fail;
                 }
 
+                // Players who are already here need their locks set up.
+                {
+                        Player *p;
+                        Link *link;
+                        pd->Lock();
+                        FOR_EACH_PLAYER(p)
+                                InitPerPlayerData(p);
+                        pd->Unlock();
+                }
+
                 arenaDataKey = aman->AllocateArenaData(sizeof(PerArenaData));
                 if (arenaDataKey == -1)
                 {
@@ -2777,6 +2990,26 @@ EXPORT int MM_hscore_database(int action, Imodman *_mm, Arena *arena)
                 UnloadItemList();
                 UnloadItemTypeList();
 
+                {
+                        int i;
+                        for (i = 0; i < propertyCount; i++)
+                        {
+                                afree(propertyNames[i]);
+                        }
+                        afree(propertyNames);
+                        HashFree(propertyIds);
+                        pthread_mutex_destroy(&prop_mutex);
+                }
+
+                {
+                        Player *p;
+                        Link *link;
+                        pd->Lock();
+                        FOR_EACH_PLAYER(p)
+                                pthread_mutex_destroy(&getPerPlayerData(p)->mutex);
+                        pd->Unlock();
+                }
+
                 pd->FreePlayerData(playerDataKey);
                 aman->FreeArenaData(arenaDataKey);
 
@@ -2790,7 +3023,7 @@ EXPORT int MM_hscore_database(int action, Imodman *_mm, Arena *arena)
                 mm->ReleaseInterface(ml);
 
                 // Release lock and lock attributes
-                if (pthread_mutex_destroy(&db_mutex) || pthread_mutexattr_destroy(&db_mutex_attr)) {
+                if (pthread_rwlock_destroy(&catalogLock) || pthread_mutexattr_destroy(&player_mutex_attr)) {
                     return MM_FAIL;
                 }
 
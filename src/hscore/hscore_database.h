@@ -4,7 +4,7 @@
 /* pyinclude: hscore/hscore_types.h */
 /* pyinclude: hscore/hscore_database.h */
 
-#define I_HSCORE_DATABASE "hscore_database-6"
+#define I_HSCORE_DATABASE "hscore_database-8"
 
 /**
  * The maximum number of shipsets players are allowed. Must be at least 1. May go as high as memory
@@ -24,7 +24,7 @@
 
 #define CB_ITEM_COUNT_CHANGED "itemcount-3"
 //NOTE: *entry may be NULL if newCount is 0.
-//called with lock held
+//called with the player's lock held
 typedef void (*ItemCountChanged)(Player *p, ShipHull *hull, Item *item, InventoryEntry *entry, int newCount, int oldCount);
 
 #define CB_HS_ITEMRELOAD "hs-itemreload-1"
@@ -83,9 +83,59 @@ typedef struct Ihscoredatabase
 	LinkedList * (*getCategoryList)(Arena *arena);
 	LinkedList * (*getShipPropertyList)(Arena *arena, int ship);
 
+	/**
+	 * Interns a property name. Every Property loaded from the database
+	 * gets its id from here, so ids are dense, start at zero, and never
+	 * change while this module is loaded. Names are case sensitive.
+	 *
+	 * @param *name
+	 *	The property name.
+	 *
+	 * @return
+	 *	The property's id, or -1 if name is NULL.
+	 */
+	int (*getPropertyId)(const char *name);
+
+	/**
+	 * Gets the name of an interned property, or NULL if the id is unknown.
+	 */
+	const char * (*getPropertyName)(int id);
+
+	/**
+	 * Gets the number of interned properties. Ids are always less than this.
+	 */
+	int (*getPropertyCount)();
+
+	/**
+	 * Locks everything: the item catalog and every player's wallet, hulls
+	 * and inventories. Prefer lockPlayer or lockCatalog, which let other
+	 * players and arenas keep going. Recursive, but must not be called
+	 * while holding lockPlayer or lockCatalog. See hscore/locking.txt.
+	 */
 	void (*lock)();
 	void (*unlock)();
 
+	/**
+	 * Locks one player's wallet, hulls, inventories and property caches,
+	 * and holds the catalog shared. Recursive. Hold it across a check and
+	 * the change that depends on it (e.g. money before a purchase).
+	 * Callbacks from hscore about a player are made with their lock held.
+	 * To hold two players at once, lock the one with the lower pid first.
+	 *
+	 * @param *p
+	 *	The player to lock.
+	 */
+	void (*lockPlayer)(Player *p);
+	void (*unlockPlayer)(Player *p);
+
+	/**
+	 * Holds the item, item type, store, category and ship property lists
+	 * shared, so they can be walked while other threads do the same.
+	 * Recursive.
+	 */
+	void (*lockCatalog)();
+	void (*unlockCatalog)();
+
 	//call whenever you want an item to be written back into SQL
 	//a newCount of 0 will delete the item from the database
 	void (*updateItem)(Player *p, int ship, Item *item, int newCount, int newData);
@@ -51,6 +51,8 @@ local Item * getItemByPartialName(const char *name, Arena *arena);
 local int getPropertySum(Player *p, int ship, const char *prop, int def);
 local int getPropertySumOnShipSet(Player *p, int ship, int shipset, const char *prop, int def);
 local int getPropertySumOnHull(Player *p, ShipHull *hull, const char *prop, int default_value);
+local int getPropertyId(const char *prop);
+local int getPropertySumById(Player *p, ShipHull *hull, int id, int def);
 
 local void triggerEvent(Player *p, int ship, const char *event);
 local void triggerEventOnShipSet(Player *p, int ship, int shipset, const char *event);
@@ -121,7 +123,7 @@ local void itemInfoCommand(const char *command, const char *params, Player *p, c
 	}
 
 	//get item type string
-	database->lock();
+	database->lockCatalog();
 	itemTypes[0] = '\0';
 	for (link = LLGetHead(&item->itemTypeEntries); link; link = link->next)
 	{
@@ -154,7 +156,7 @@ local void itemInfoCommand(const char *command, const char *params, Player *p, c
 
 		strcat(itemTypes, buf);
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	//get the ammo string
 	if (item->ammo != NULL)
@@ -190,7 +192,7 @@ local void itemInfoCommand(const char *command, const char *params, Player *p, c
 		}
 	}
 
-	database->lock();
+	database->lockCatalog();
 	link = LLGetHead(&item->propertyList);
 	if (link)
 	{
@@ -222,7 +224,7 @@ local void itemInfoCommand(const char *command, const char *params, Player *p, c
 		//no item properties
 		chat->SendMessage(p, "+-----------------------------------------------------------------------------------------------------+");
 	}
-	database->unlock();
+	database->unlockCatalog();
 }
 
 local helptext_t grantItemHelp =
@@ -439,7 +441,7 @@ local void grantItemCommand(const char *command, const char *params, Player *p,
 					if (ignore || (item->shipsAllowed >> ship) & 0x1)
 					{
 						Link *link;
-						database->lock();
+						database->lockPlayer(t);
 						for (link = LLGetHead(&item->itemTypeEntries); link; link = link->next)
 						{
 							ItemTypeEntry *entry = link->data;
@@ -450,12 +452,12 @@ local void grantItemCommand(const char *command, const char *params, Player *p,
 								{
 									chat->SendMessage(p, "Does not have enough free %s spots.", entry->itemType->name);
 
-									database->unlock();
+									database->unlockPlayer(t);
 									return;
 								}
 							}
 						}
-						database->unlock();
+						database->unlockPlayer(t);
 
 
 						if (!ignore)
@@ -560,7 +562,7 @@ local void grantItemCommand(const char *command, const char *params, Player *p,
 						if (item->max == 0 || newItemCount <= item->max)
 						{
 							Link *link;
-							database->lock();
+							database->lockPlayer(t);
 							for (link = LLGetHead(&item->itemTypeEntries); link; link = link->next)
 							{
 								ItemTypeEntry *entry = link->data;
@@ -576,7 +578,7 @@ local void grantItemCommand(const char *command, const char *params, Player *p,
 									}
 								}
 							}
-							database->unlock();
+							database->unlockPlayer(t);
 
 							if (!ignore && !((item->shipsAllowed >> ship) & 0x1))
 							{
@@ -666,7 +668,7 @@ local int timer_callback(void *clos)
 	return FALSE;
 }
 
-local void doEvent(Player *p, InventoryEntry *entry, Event *event, LinkedList *updateList) //called with lock held
+local void doEvent(Player *p, InventoryEntry *entry, Event *event, LinkedList *updateList) //called with the player's lock held
 {
 	int action = event->action;
 
@@ -887,7 +889,7 @@ local int getItemCountOnHull(Player *p, Item *item, ShipHull *hull)
 	Link *link;
 	int count = 0;
 
-	database->lock();
+	database->lockPlayer(p);
 
 	inventoryList = &hull->inventoryEntryList;
 
@@ -900,14 +902,80 @@ local int getItemCountOnHull(Player *p, Item *item, ShipHull *hull)
 		}
 	}
 
-	database->unlock();
+	database->unlockPlayer(p);
 	return count;
 }
 
-local int deleteCacheEntry(const char *key, void *val, void *clos)
+//the property sum cache is a seqlock: writers hold the player's lock and
+//bump hull->propertySeq to odd before touching any entry and back to even
+//after, so getPropertySumById can read without taking the lock.
+local inline void beginSumsUpdate(ShipHull *hull)
 {
-	afree(val);
-	return 1;
+	__atomic_store_n(&hull->propertySeq, hull->propertySeq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+local inline void endSumsUpdate(ShipHull *hull)
+{
+	__atomic_store_n(&hull->propertySeq, hull->propertySeq + 1, __ATOMIC_RELEASE);
+}
+
+local inline void setSum(PropertyCacheEntry *entry, int value, int absolute, int valid)
+{
+	__atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->absolute, absolute, __ATOMIC_RELAXED);
+	__atomic_store_n(&entry->valid, valid, __ATOMIC_RELAXED);
+}
+
+//call with the player's lock held. makes sure the hull's sums have room
+//for every interned property. the array grows by doubling, and arrays it
+//replaces stay around until the hull is freed, since a reader might still
+//be looking at one.
+local PropertySums * growPropertySums(ShipHull *hull)
+{
+	PropertySums *old = hull->propertySums, *sums;
+	int needed = database->getPropertyCount();
+	int count = 64;
+
+	if (old && old->count >= needed)
+	{
+		return old;
+	}
+
+	while (count < needed)
+	{
+		count *= 2;
+	}
+
+	sums = amalloc(sizeof(*sums) + count * sizeof(sums->sums[0]));
+	sums->count = count;
+	sums->retired = old;
+	if (old)
+	{
+		memcpy(sums->sums, old->sums, old->count * sizeof(old->sums[0]));
+	}
+
+	__atomic_store_n(&hull->propertySums, sums, __ATOMIC_RELEASE);
+	return sums;
+}
+
+//call with the player's lock held
+local void clearPropertySums(ShipHull *hull)
+{
+	PropertySums *sums = hull->propertySums;
+	int i;
+
+	if (sums == NULL)
+	{
+		return;
+	}
+
+	beginSumsUpdate(hull);
+	for (i = 0; i < sums->count; i++)
+	{
+		__atomic_store_n(&sums->sums[i].valid, 0, __ATOMIC_RELAXED);
+	}
+	endSumsUpdate(hull);
 }
 
 local int addItem(Player *p, Item *item, int ship, int amount)
@@ -961,7 +1029,7 @@ local int addItemToHull(Player *p, Item *item, ShipHull *hull, int amount)
 		//return 0;
 	}
 
-	database->lock();
+	database->lockPlayer(p);
 
 	inventoryList = &hull->inventoryEntryList;
 
@@ -992,41 +1060,44 @@ local int addItemToHull(Player *p, Item *item, ShipHull *hull, int amount)
 		count = 0; //no negative counts make sense
 	}
 
-	if (item->ammo == NULL)
+	if (item->ammo == NULL && hull->propertySums != NULL)
 	{
+		PropertySums *sums = hull->propertySums;
+
 		//recalc the related entries
+		beginSumsUpdate(hull);
 		for (propLink = LLGetHead(&item->propertyList); propLink; propLink = propLink->next)
 		{
 			Property *prop = propLink->data;
+			PropertyCacheEntry *propertySum;
 
-			//cache it
-			PropertyCacheEntry *propertySum = (PropertyCacheEntry*)HashGetOne(hull->propertySums, prop->name);
-			if (propertySum != NULL)
-			{
-				if (prop->absolute || prop->ignoreCount)
-				{
-					// there's no good way to update these cases, so remove it and it'll get recalculated
-					HashRemove(hull->propertySums, prop->name, propertySum);
-				}
-				else
-				{
-					int propDifference = prop->value * amount;
-					propertySum->value += propDifference;
-				}
-			}
-			else
+			if (prop->id >= sums->count || !sums->sums[prop->id].valid)
 			{
 				//not in cache already
 
 				//it's too much work to generate the entire entry only to update it.
 				//instead we'll just leave it out of the cache, and it can be fully generated when needed
+				continue;
+			}
+
+			propertySum = &sums->sums[prop->id];
+			if (prop->absolute || prop->ignoreCount)
+			{
+				// there's no good way to update these cases, so invalidate it and it'll get recalculated
+				__atomic_store_n(&propertySum->valid, 0, __ATOMIC_RELAXED);
+			}
+			else
+			{
+				int propDifference = prop->value * amount;
+				__atomic_store_n(&propertySum->value, propertySum->value + propDifference, __ATOMIC_RELAXED);
 			}
 		}
+		endSumsUpdate(hull);
 	}
-	else
+	else if (item->ammo != NULL)
 	{
 		// Empty the cache. it'll get rebuilt later
-		HashEnum(hull->propertySums, deleteCacheEntry, 0);
+		clearPropertySums(hull);
 	}
 
 	database->updateItemOnHull(p, hull, item, count, data);
@@ -1063,7 +1134,7 @@ local int addItemToHull(Player *p, Item *item, ShipHull *hull, int amount)
 		triggerEventOnHullItem(p, item, hull, "init");
 	}
 
-	database->unlock();
+	database->unlockPlayer(p);
 	return count ? 0 : 1;
 }
 
@@ -1116,7 +1187,7 @@ local int addItemToHullCheckLimits(Player *p, Item *item, ShipHull *hull, int am
 
 	int currentAmount;
 	int result = 0;
-	database->lock();
+	database->lockPlayer(p);
 
 	if (item->max != 0 && (currentAmount = getItemCountOnHull(p, item, hull)) + amount > item->max)
 	{
@@ -1152,7 +1223,7 @@ local int addItemToHullCheckLimits(Player *p, Item *item, ShipHull *hull, int am
 
 	result = amount ? addItemToHull(p, item, hull, amount) : 0;
 
-	database->unlock();
+	database->unlockPlayer(p);
 	return result;
 }
 
@@ -1163,7 +1234,7 @@ local Item * getItemByName(const char *name, Arena *arena)
 
 	//to deal with the fact that an item name is only unique per arena,
 	//we scan the items in the categories rather than the item list
-	database->lock();
+	database->lockCatalog();
 	for (catLink = LLGetHead(categoryList); catLink; catLink = catLink->next)
 	{
 		Category *category = catLink->data;
@@ -1175,12 +1246,12 @@ local Item * getItemByName(const char *name, Arena *arena)
 
 			if (strcasecmp(item->name, name) == 0)
 			{
-				database->unlock();
+				database->unlockCatalog();
 				return item;
 			}
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	return NULL;
 }
@@ -1194,7 +1265,7 @@ local Item * getItemByPartialName(const char *name, Arena *arena)
 
 	//to deal with the fact that an item name is only unique per arena,
 	//we scan the items in the categories rather than the item list
-	database->lock();
+	database->lockCatalog();
 	for (catLink = LLGetHead(categoryList); catLink; catLink = catLink->next)
 	{
 		Category *category = catLink->data;
@@ -1211,7 +1282,7 @@ local Item * getItemByPartialName(const char *name, Arena *arena)
 			}
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	if (matches == 1)
 	{
@@ -1245,53 +1316,36 @@ local int getPropertySumOnShipSet(Player *p, int ship, int shipset, const char *
 
 local int getPropertySumOnHull(Player *p, ShipHull *hull, const char *propString, int def)
 {
-	PropertyCacheEntry *propertySum;
-	Link *link;
-	LinkedList *inventoryList;
-	int count = 0;
-	int absolute = 0;
-
-	if (!database->areShipsLoaded(p))
-	{
-		//lm->LogP(L_ERROR, "hscore_items", p, "asked to get props from a player with unloaded ships");
-		return 0;
-	}
-
-	if (!hull) {
-		//not unusual or dangerous
-		//lm->LogP(L_ERROR, "hscore_items", p, "asked to get props from unowned ship %i", ship);
-		return 0;
-	}
-
 	if (propString == NULL)	{
 		lm->LogP(L_ERROR, "hscore_items", p, "asked to get props for NULL string.");
 		return 0;
 	}
 
-	database->lock();
+	return getPropertySumById(p, hull, database->getPropertyId(propString), def);
+}
 
-	//check if it's in the cache
-	propertySum = (PropertyCacheEntry*)HashGetOne(hull->propertySums, propString);
-	if (propertySum != NULL)
-	{
-		if (propertySum->absolute)
-		{
-			def = 0;
-		}
+local int getPropertyId(const char *propString)
+{
+	return database->getPropertyId(propString);
+}
 
-		database->unlock();
-		return propertySum->value + def;
-	}
+//call with the player's lock held. adds up one property over the hull
+//and everything in it.
+local void computePropertySum(Player *p, ShipHull *hull, int id, int *value, int *absolute)
+{
+	Link *link;
+	LinkedList *inventoryList;
+	int count = 0;
+	int abs = 0;
 
-	//not in the cache, look it up
 	for (link = LLGetHead(hull->propertyList); link; link = link->next)
 	{
 		Property *prop = link->data;
 
-		if (strcmp(prop->name, propString) == 0)
+		if (prop->id == id)
 		{
 			count += prop->value;
-			absolute = absolute || prop->absolute;
+			abs = abs || prop->absolute;
 			break;
 		}
 	}
@@ -1318,7 +1372,7 @@ local int getPropertySumOnHull(Player *p, ShipHull *hull, const char *propString
 		{
 			Property *prop = propLink->data;
 
-			if (strcmp(prop->name, propString) == 0)
+			if (prop->id == id)
 			{
 				if (prop->ignoreCount)
 				{
@@ -1329,31 +1383,84 @@ local int getPropertySumOnHull(Player *p, ShipHull *hull, const char *propString
 					count += prop->value * entry->count;
 				}
 
-				absolute = absolute || prop->absolute;
+				abs = abs || prop->absolute;
 				break;
 			}
 		}
 	}
 
-	//cache it
-	propertySum = amalloc(sizeof(*propertySum));
-	propertySum->value = count;
-	propertySum->absolute = absolute;
-	HashAdd(hull->propertySums, propString, propertySum);
+	*value = count;
+	*absolute = abs;
+}
+
+local int getPropertySumById(Player *p, ShipHull *hull, int id, int def)
+{
+	PropertySums *sums;
+	PropertyCacheEntry *propertySum;
+	unsigned seq;
+	int value, absolute;
 
-	if (absolute)
+	if (!database->areShipsLoaded(p))
 	{
-		def = 0;
+		//lm->LogP(L_ERROR, "hscore_items", p, "asked to get props from a player with unloaded ships");
+		return 0;
+	}
+
+	if (!hull) {
+		//not unusual or dangerous
+		return 0;
 	}
 
-	//then return
-	database->unlock();
-	return count + def;
+	if (id < 0 || id >= database->getPropertyCount()) {
+		lm->LogP(L_ERROR, "hscore_items", p, "asked to get props for bad property id %i.", id);
+		return 0;
+	}
+
+	//check the cache without the lock. if it's being changed right now,
+	//or the sum hasn't been computed yet, fall back to the lock.
+	seq = __atomic_load_n(&hull->propertySeq, __ATOMIC_ACQUIRE);
+	sums = __atomic_load_n(&hull->propertySums, __ATOMIC_ACQUIRE);
+	if (!(seq & 1) && sums && id < sums->count)
+	{
+		int valid;
+
+		propertySum = &sums->sums[id];
+		value = __atomic_load_n(&propertySum->value, __ATOMIC_RELAXED);
+		absolute = __atomic_load_n(&propertySum->absolute, __ATOMIC_RELAXED);
+		valid = __atomic_load_n(&propertySum->valid, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (valid && __atomic_load_n(&hull->propertySeq, __ATOMIC_RELAXED) == seq)
+		{
+			return absolute ? value : value + def;
+		}
+	}
+
+	database->lockPlayer(p);
+
+	sums = growPropertySums(hull);
+	propertySum = &sums->sums[id];
+	if (!propertySum->valid)
+	{
+		//not in the cache, look it up
+		computePropertySum(p, hull, id, &value, &absolute);
+
+		//cache it
+		beginSumsUpdate(hull);
+		setSum(propertySum, value, absolute, 1);
+		endSumsUpdate(hull);
+	}
+	value = propertySum->value;
+	absolute = propertySum->absolute;
+
+	database->unlockPlayer(p);
+
+	return absolute ? value : value + def;
 }
 
 local void processUpdateList(Player *p, ShipHull *hull, LinkedList *updateList)
 {
-	database->lock();
+	database->lockPlayer(p);
 
 	Link *link;
 	for (link = LLGetHead(updateList); link; link = link->next)
@@ -1385,7 +1492,7 @@ local void processUpdateList(Player *p, ShipHull *hull, LinkedList *updateList)
 	}
 
 	LLEmpty(updateList);
-	database->unlock();
+	database->unlockPlayer(p);
 }
 
 local void triggerEvent(Player *p, int ship, const char *eventName)
@@ -1435,7 +1542,7 @@ local void triggerEventOnHull(Player *p, ShipHull *hull, const char *eventName)
 		return;
 	}
 
-	database->lock();
+	database->lockPlayer(p);
 	LLInit(&updateList);
 	inventoryList = &hull->inventoryEntryList;
 
@@ -1464,7 +1571,7 @@ local void triggerEventOnHull(Player *p, ShipHull *hull, const char *eventName)
 	}
 
 	processUpdateList(p, hull, &updateList);
-	database->unlock();
+	database->unlockPlayer(p);
 }
 
 local void triggerEventOnItem(Player *p, Item *triggerItem, int ship, const char *eventName)
@@ -1518,7 +1625,7 @@ local void triggerEventOnHullItem(Player *p, Item *triggerItem, ShipHull *hull,
 		return;
 	}
 
-	database->lock();
+	database->lockPlayer(p);
 
 	LLInit(&updateList);
 	inventoryList = &hull->inventoryEntryList;
@@ -1580,7 +1687,7 @@ local void triggerEventOnHullItem(Player *p, Item *triggerItem, ShipHull *hull,
 	processUpdateList(p, hull, &updateList);
 
 	DO_CBS(CB_TRIGGER_EVENT, p->arena, triggerEventFunction, (p, triggerItem, hull, eventName));
-	database->unlock();
+	database->unlockPlayer(p);
 }
 
 local int getFreeItemTypeSpots(Player *p, ItemType *type, int ship)
@@ -1629,7 +1736,7 @@ local int getFreeItemTypeSpotsOnHull(Player *p, ItemType *type, ShipHull *hull)
 	LinkedList *inventoryList;
 	int count;
 
-	database->lock();
+	database->lockPlayer(p);
 	inventoryList = &hull->inventoryEntryList;
 
 	count = type->max;
@@ -1651,7 +1758,7 @@ local int getFreeItemTypeSpotsOnHull(Player *p, ItemType *type, ShipHull *hull)
 		}
 	}
 
-	database->unlock();
+	database->unlockPlayer(p);
 	return count;
 }
 
@@ -1697,15 +1804,6 @@ local int hasItemsLeftOnHull(Player *p, ShipHull *hull)
 	return (LLGetHead(inventoryList) == NULL) ? 0 : 1;
 }
 
-local int zeroCacheEntry(const char *key, void *val, void *clos)
-{
-	PropertyCacheEntry *cacheEntry = val;
-	cacheEntry->value = 0;
-	cacheEntry->absolute = 0;
-
-	return 0;
-}
-
 local void recalculateEntireCache(Player *p, int ship)
 {
 	if (ship < 0 || 7 < ship)	{
@@ -1743,40 +1841,34 @@ local void recalculateEntireCacheForHull(Player *p, ShipHull *hull)
 		return;
 	}
 
-	HashTable *table;
+	PropertySums *sums;
 	Link *link;
 	LinkedList *inventoryList;
+	int known, i;
+
+	database->lockPlayer(p);
+	sums = growPropertySums(hull);
+
+	//every property that can show up on the hull is interned by now, so
+	//all of those sums will be right when we're done, including the zeros
+	known = database->getPropertyCount();
 
-	database->lock();
-	table = hull->propertySums;
+	beginSumsUpdate(hull);
 
-	//first, set all cache entries to zero, so we can keep the 0 entries
-	HashEnum(table, zeroCacheEntry, NULL);
+	for (i = 0; i < sums->count; i++)
+	{
+		setSum(&sums->sums[i], 0, 0, i < known);
+	}
 
 	//then iterate every property and update the cache with it
 	LinkedList *shipProperties = database->getShipPropertyList(p->arena, hull->ship);
 	for (link = LLGetHead(shipProperties); link; link = link->next)
 	{
 		Property *prop = link->data;
-		PropertyCacheEntry *propertySum;
+		PropertyCacheEntry *propertySum = &sums->sums[prop->id];
 
-		int propDifference = prop->value;
-
-		//get it out of the cache
-		propertySum = (PropertyCacheEntry*)HashGetOne(table, prop->name);
-		if (propertySum != NULL)
-		{
-			propertySum->value += propDifference;
-			propertySum->absolute = propertySum->absolute || prop->absolute;
-		}
-		else
-		{
-			//no cache entry; create one
-			propertySum = amalloc(sizeof(*propertySum));
-			propertySum->value = propDifference;
-			propertySum->absolute = prop->absolute;
-			HashAdd(hull->propertySums, prop->name, propertySum);
-		}
+		setSum(propertySum, propertySum->value + prop->value,
+				propertySum->absolute || prop->absolute, 1);
 	}
 
 	inventoryList = &hull->inventoryEntryList;
@@ -1799,7 +1891,7 @@ local void recalculateEntireCacheForHull(Player *p, ShipHull *hull)
 		for (propLink = LLGetHead(&item->propertyList); propLink; propLink = propLink->next)
 		{
 			Property *prop = propLink->data;
-			PropertyCacheEntry *propertySum;
+			PropertyCacheEntry *propertySum = &sums->sums[prop->id];
 
 			int propDifference;
 
@@ -1812,25 +1904,14 @@ local void recalculateEntireCacheForHull(Player *p, ShipHull *hull)
 				propDifference = prop->value * entry->count;
 			}
 
-			//get it out of the cache
-			propertySum = (PropertyCacheEntry*)HashGetOne(table, prop->name);
-			if (propertySum != NULL)
-			{
-				propertySum->value += propDifference;
-				propertySum->absolute = propertySum->absolute || prop->absolute;
-			}
-			else
-			{
-				//no cache entry; create one
-				propertySum = amalloc(sizeof(*propertySum));
-				propertySum->value = propDifference;
-				propertySum->absolute = prop->absolute;
-				HashAdd(hull->propertySums, prop->name, propertySum);
-			}
+			setSum(propertySum, propertySum->value + propDifference,
+					propertySum->absolute || prop->absolute, 1);
 		}
 	}
 
-	database->unlock();
+	endSumsUpdate(hull);
+
+	database->unlockPlayer(p);
 }
 
 local void killCallback(Arena *arena, Player *killer, Player *killed, int bounty, int flags, int *pts, int *green)
@@ -1854,6 +1935,7 @@ local Ihscoreitems interface =
 	getItemByName, getItemByPartialName,
 
 	getPropertySum, getPropertySumOnShipSet, getPropertySumOnHull,
+	getPropertyId, getPropertySumById,
 
 	triggerEvent, triggerEventOnShipSet, triggerEventOnHull,
 	triggerEventOnItem, triggerEventOnShipSetItem, triggerEventOnHullItem,
@@ -7,7 +7,7 @@
 /* pytype: opaque, ItemType *, type */
 /* pytype: opaque, ShipHull *, hull */
 
-#define I_HSCORE_ITEMS "hscore_items-12"
+#define I_HSCORE_ITEMS "hscore_items-13"
 
 //callback
 #define CB_EVENT_ACTION "eventaction"
@@ -75,6 +75,15 @@ typedef struct Ihscoreitems
 	int (*getPropertySumOnHull)(Player *p, ShipHull *hull, const char *prop, int def); //properties ARE case sensitive
 	/* pyint: player, hull, string, int -> int */
 
+	//interns a property name (the same as Ihscoredatabase::getPropertyId).
+	//look ids up once and use getPropertySumById in timers and packet handlers.
+	int (*getPropertyId)(const char *prop); //properties ARE case sensitive
+	/* pyint: string -> int */
+
+	//doesn't take the player's lock unless the sum isn't cached yet
+	int (*getPropertySumById)(Player *p, ShipHull *hull, int id, int def);
+	/* pyint: player, hull, int, int -> int */
+
 
 	void (*triggerEvent)(Player *p, int ship, const char *event);
 	/* pyint: player, int, string -> void */
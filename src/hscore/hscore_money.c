@@ -860,7 +860,7 @@ local void shareExpCommand(const char *command, const char *params, Player *p, c
 	Link *link;
 	int min_required_exp = 0;
 
-	database->lock();
+	database->lockPlayer(p);
 	for (int ss = 0; ss < HSCORE_MAX_SHIPSETS; ++ss) {
 	  for (int ship = SHIP_WARBIRD; ship <= SHIP_SHARK; ++ship) {
 		if (!(hull = database->getPlayerHull(p, ship, ss)))
@@ -874,7 +874,7 @@ local void shareExpCommand(const char *command, const char *params, Player *p, c
 		}
 	  }
 	}
-	database->unlock();
+	database->unlockPlayer(p);
 
 	// Set the max to 2/3 of the difference if that is lower than max_give.
 	if(((diff << 1) / 3) < max_give)
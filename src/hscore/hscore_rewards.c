@@ -72,6 +72,14 @@ typedef struct AData
 	HashTable *players_flag_time;
 } AData;
 
+// a payout worked out under pd->Lock, handed to the database after unlocking
+typedef struct Reward
+{
+	Player *p;
+	int money;
+	int exp;
+} Reward;
+
 //modules
 local Imodman *mm;
 local Ilogman *lm;
@@ -92,6 +100,10 @@ local int pdkey;
 local int adkey;
 local BountyMap bounty_map;
 
+/* read on every kill and from the position packet adviser */
+local ConfigKey key_privfreqstart, key_maxfrequency, key_minbonusplayers;
+local int prop_exp_multiplier, prop_hsd_multiplier;
+
 // Hack: collision possible for if freq numbers > 255
 local inline char *playtime_key(Player *p, int freq)
 {
@@ -109,8 +121,8 @@ local inline char *playtime_key(Player *p, int freq)
 
 local inline int flagging_freq(Arena *arena, int freq)
 {
-	int priv_freq_start = cfg->GetInt(arena->cfg, "Team", "PrivFreqStart", 100);
-	int max_freq = cfg->GetInt(arena->cfg, "Team", "MaxFrequency", (priv_freq_start + 2));
+	int priv_freq_start = cfg->GetKeyInt(arena->cfg, key_privfreqstart, 100);
+	int max_freq = cfg->GetKeyInt(arena->cfg, key_maxfrequency, (priv_freq_start + 2));
 	return (freq >= priv_freq_start && freq < max_freq) || (freq == 90 || freq == 91);
 }
 
@@ -301,8 +313,8 @@ local void update_flag_rewards(Arena *arena, int freq)
 
 		// Impl note:
 		// More hackery to make sure only players on the flag teams get rewarded.
-		int priv_freq_start = cfg->GetInt(arena->cfg, "Team", "PrivFreqStart", 100);
-		int max_freq = cfg->GetInt(arena->cfg, "Team", "MaxFrequency", (priv_freq_start + 2));
+		int priv_freq_start = cfg->GetKeyInt(arena->cfg, key_privfreqstart, 100);
+		int max_freq = cfg->GetKeyInt(arena->cfg, key_maxfrequency, (priv_freq_start + 2));
 
 		// IMPL NOTE: This is a hack to have a single winner/loser freq. It operates under the assumtion
 		// that only two frequences exist for flagging (90/91 at the time of writing). If more freqs are
@@ -441,6 +453,8 @@ local void flagWinCallback(Arena *arena, int freq, int *pts)
 	{
 		Player *i;
 		Link *link;
+		LinkedList rewards = LL_INITIALIZER;
+		Reward *r;
 		Iteamnames *teamnames;
 
 		update_flag_rewards(arena, freq);
@@ -463,8 +477,8 @@ local void flagWinCallback(Arena *arena, int freq, int *pts)
 			chat->SendArenaMessage(arena, "Maximum reward: $%d (%d exp)", adata->max_flag_money, adata->max_flag_exp);
 		}
 
-		int priv_freq_start = cfg->GetInt(arena->cfg, "Team", "PrivFreqStart", 100);
-		int max_freq = cfg->GetInt(arena->cfg, "Team", "MaxFrequency", (priv_freq_start + 2));
+		int priv_freq_start = cfg->GetKeyInt(arena->cfg, key_privfreqstart, 100);
+		int max_freq = cfg->GetKeyInt(arena->cfg, key_maxfrequency, (priv_freq_start + 2));
 
 		pd->Lock();
 		FOR_EACH_PLAYER_IN_ARENA(i, arena)
@@ -536,8 +550,11 @@ local void flagWinCallback(Arena *arena, int freq, int *pts)
 						chat->SendMessage(i, "You didn't play long enough for a reward.");
 					}
 
-					database->addMoney(i, MONEY_TYPE_FLAG, hsd_reward);
-					database->addExp(i, exp_reward);
+					r = amalloc(sizeof(*r));
+					r->p = i;
+					r->money = hsd_reward;
+					r->exp = exp_reward;
+					LLAdd(&rewards, r);
 				} else if (i->p_freq >= priv_freq_start && i->p_freq < max_freq) {
 					int exp_reward = adata->max_loss_exp;
 					int hsd_reward = adata->max_loss_money;
@@ -550,8 +567,11 @@ local void flagWinCallback(Arena *arena, int freq, int *pts)
 					// exp_reward *= exp_mul;
 					// hsd_reward *= hsd_mul;
 
-					database->addMoney(i, MONEY_TYPE_FLAG, hsd_reward);
-					database->addExp(i, exp_reward);
+					r = amalloc(sizeof(*r));
+					r->p = i;
+					r->money = hsd_reward;
+					r->exp = exp_reward;
+					LLAdd(&rewards, r);
 
 					if (exp_reward && hsd_reward) {
 						chat->SendMessage(i, "You received $%d and %d exp for a flag loss.", hsd_reward, exp_reward);
@@ -567,6 +587,14 @@ local void flagWinCallback(Arena *arena, int freq, int *pts)
 		}
 		pd->Unlock();
 
+		FOR_EACH(&rewards, r, link)
+		{
+			database->addMoney(r->p, MONEY_TYPE_FLAG, r->money);
+			database->addExp(r->p, r->exp);
+		}
+		LLEnum(&rewards, afree);
+		LLEmpty(&rewards);
+
 		HashFree(adata->players_flag_time);
 		adata->players_flag_time = HashAlloc();
 
@@ -634,7 +662,7 @@ local int calculateKillExpReward(Arena *arena, Player *killer, Player *killed, i
 
 	HashFree(vars);
 
-	int pmul = items->getPropertySum(killer, killer->p_ship, "exp_multiplier", 100);
+	int pmul = items->getPropertySumById(killer, database->getPlayerCurrentHull(killer), prop_exp_multiplier, 100);
 	float multiplier = ((float) pmul / 100.0);
 
 	exp *= multiplier;
@@ -696,7 +724,7 @@ local int calculateKillMoneyReward(Arena *arena, Player *killer, Player *killed,
 
 	HashFree(vars);
 
-	int pmul = items->getPropertySum(killer, killer->p_ship, "hsd_multiplier", 100);
+	int pmul = items->getPropertySumById(killer, database->getPlayerCurrentHull(killer), prop_hsd_multiplier, 100);
 	float multiplier = ((float) pmul / 100.0);
 
 	money *= multiplier;
@@ -720,7 +748,7 @@ local void killCallback(Arena *arena, Player *killer, Player *killed, int bounty
 	{
 		/* cfghelp: Hyperspace:MinBonusPlayers, arena, int, def: 4, mod: hscore_rewards
 		 * Minimum number of players in game required for bonus money. */
-		int minBonusPlayers  = cfg->GetInt(arena->cfg, "Hyperspace", "MinBonusPlayers",  4);
+		int minBonusPlayers  = cfg->GetKeyInt(arena->cfg, key_minbonusplayers, 4);
 
 		//Calculate Earned Money
 		int bonus = arena->playing >= minBonusPlayers;
@@ -752,37 +780,41 @@ local void killCallback(Arena *arena, Player *killer, Player *killed, int bounty
 		//give money to teammates
 		Player *p;
 		Link *link;
+		LinkedList mates = LL_INITIALIZER;
 		pd->Lock();
 		FOR_EACH_PLAYER(p)
-		{
 			if(p->arena == killer->arena && p->p_freq == killer->p_freq && p->p_ship != SHIP_SPEC && p != killer && !(p->position.status & STATUS_SAFEZONE))
+				LLAdd(&mates, p);
+		pd->Unlock();
+
+		// getExp and addMoney lock the player, which mustn't happen under pd->Lock
+		FOR_EACH(&mates, p, link)
+		{
+			double maxReward;
+			if (database->getExp(p) > killerexp)
 			{
-				double maxReward;
-				if (database->getExp(p) > killerexp)
-				{
-					maxReward = adata->teammate_max[p->p_ship] * calculateKillMoneyReward(arena, p, killed, bounty, bonus);
-				}
-				else
-				{
-					maxReward = adata->teammate_max[p->p_ship] * money;
-				}
+				maxReward = adata->teammate_max[p->p_ship] * calculateKillMoneyReward(arena, p, killed, bounty, bonus);
+			}
+			else
+			{
+				maxReward = adata->teammate_max[p->p_ship] * money;
+			}
 
-				int xdelta = (p->position.x - killer->position.x);
-				int ydelta = (p->position.y - killer->position.y);
-				double distPercentage = ((double)(xdelta * xdelta + ydelta * ydelta)) / adata->dist_coeff[p->p_ship];
+			int xdelta = (p->position.x - killer->position.x);
+			int ydelta = (p->position.y - killer->position.y);
+			double distPercentage = ((double)(xdelta * xdelta + ydelta * ydelta)) / adata->dist_coeff[p->p_ship];
 
-				int reward = (int)(maxReward * exp(-distPercentage));
+			int reward = (int)(maxReward * exp(-distPercentage));
 
-				database->addMoney(p, MONEY_TYPE_KILL, reward);
+			database->addMoney(p, MONEY_TYPE_KILL, reward);
 
-				PData *tdata = PPDATA(p, pdkey);
-				if (tdata->min_shared_money_to_notify != -1 && tdata->min_shared_money_to_notify <= reward)
-				{
-					chat->SendMessage(p, "You received $%d for %s's kill of %s.", reward, killer->name, killed->name);
-				}
+			PData *tdata = PPDATA(p, pdkey);
+			if (tdata->min_shared_money_to_notify != -1 && tdata->min_shared_money_to_notify <= reward)
+			{
+				chat->SendMessage(p, "You received $%d for %s's kill of %s.", reward, killer->name, killed->name);
 			}
 		}
-		pd->Unlock();
+		LLEmpty(&mates);
 	}
 }
 
@@ -799,14 +831,14 @@ local int edit_ppk_bounty(Player *p, Player *t, struct C2SPosition *pos, int *ex
 			{
 				if (pdata->show_exp)
 				{
-					int minBonusPlayers = cfg->GetInt(p->arena->cfg, "Hyperspace", "MinBonusPlayers",  4);
+					int minBonusPlayers = cfg->GetKeyInt(p->arena->cfg, key_minbonusplayers, 4);
 					int bonus = p->arena->playing >= minBonusPlayers;
 					int exp = calculateKillExpReward(p->arena, t, p, pos->bounty, bonus);
 					bounty_map.bounty[index] = exp;
 				}
 				else
 				{
-					int minBonusPlayers = cfg->GetInt(p->arena->cfg, "Hyperspace", "MinBonusPlayers",  4);
+					int minBonusPlayers = cfg->GetKeyInt(p->arena->cfg, key_minbonusplayers, 4);
 					int bonus = p->arena->playing >= minBonusPlayers;
 					int money = calculateKillMoneyReward(p->arena, t, p, pos->bounty, bonus);
 					bounty_map.bounty[index] = 	money;
@@ -916,6 +948,8 @@ local int getPeriodicPoints(Arena *arena, int freq, int freqplayers, int totalpl
 		int exp = 0;
 		Player *p;
 		Link *link;
+		LinkedList rewards = LL_INITIALIZER;
+		Reward *r;
 		HashTable *vars = HashAlloc();
 
 		FormulaVariable arena_var, freq_var, flags_var;
@@ -974,47 +1008,58 @@ local int getPeriodicPoints(Arena *arena, int freq, int freqplayers, int totalpl
 			if(p->arena == arena && p->p_freq == freq && p->p_ship != SHIP_SPEC)
 			{
 				PData *pdata = PPDATA(p, pdkey);
-				int p_money, p_exp;
 
+				r = amalloc(sizeof(*r));
+				r->p = p;
 				if (adata->periodic_tally)
 				{
-					p_money = (money * pdata->periodic_tally) / adata->periodic_tally;
-					p_exp = (exp * pdata->periodic_tally) / adata->periodic_tally;
+					r->money = (money * pdata->periodic_tally) / adata->periodic_tally;
+					r->exp = (exp * pdata->periodic_tally) / adata->periodic_tally;
 				}
 				else
 				{
-					p_money = money;
-					p_exp = exp;
-				}
-
-				int pmul_exp = items->getPropertySum(p, p->p_ship, "exp_multiplier", 100);
-				float exp_mul = ((float) pmul_exp / 100.0);
-				int pmul_hsd = items->getPropertySum(p, p->p_ship, "hsd_multiplier", 100);
-				float hsd_mul = ((float) pmul_hsd / 100.0);
-
-				p_exp *= exp_mul;
-				p_money *= hsd_mul;
-
-				database->addMoney(p, MONEY_TYPE_FLAG, p_money);
-				database->addExp(p, p_exp);
-				if (p_money && p_exp)
-				{
-					chat->SendMessage(p, "You received $%d and %d exp for holding %d %s.", p_money, p_exp, flagsowned, flagstring);
-				}
-				else if (p_money)
-				{
-					chat->SendMessage(p, "You received $%d for holding %d %s.", p_money, flagsowned, flagstring);
-				}
-				else if (p_exp)
-				{
-					chat->SendMessage(p, "You received %d exp for holding %d %s.", p_exp, flagsowned, flagstring);
+					r->money = money;
+					r->exp = exp;
 				}
+				LLAdd(&rewards, r);
 			}
 		}
 
 		adata->reset = 1;
 		pd->Unlock();
 
+		FOR_EACH(&rewards, r, link)
+		{
+			int p_money = r->money, p_exp = r->exp;
+			p = r->p;
+
+			ShipHull *hull = database->getPlayerCurrentHull(p);
+			int pmul_exp = items->getPropertySumById(p, hull, prop_exp_multiplier, 100);
+			float exp_mul = ((float) pmul_exp / 100.0);
+			int pmul_hsd = items->getPropertySumById(p, hull, prop_hsd_multiplier, 100);
+			float hsd_mul = ((float) pmul_hsd / 100.0);
+
+			p_exp *= exp_mul;
+			p_money *= hsd_mul;
+
+			database->addMoney(p, MONEY_TYPE_FLAG, p_money);
+			database->addExp(p, p_exp);
+			if (p_money && p_exp)
+			{
+				chat->SendMessage(p, "You received $%d and %d exp for holding %d %s.", p_money, p_exp, flagsowned, flagstring);
+			}
+			else if (p_money)
+			{
+				chat->SendMessage(p, "You received $%d for holding %d %s.", p_money, flagsowned, flagstring);
+			}
+			else if (p_exp)
+			{
+				chat->SendMessage(p, "You received %d exp for holding %d %s.", p_exp, flagsowned, flagstring);
+			}
+		}
+		LLEnum(&rewards, afree);
+		LLEmpty(&rewards);
+
 		return money;
 	}
 
@@ -1350,6 +1395,13 @@ EXPORT int MM_hscore_rewards(int action, Imodman *_mm, Arena *arena)
 			return MM_FAIL;
 		}
 
+		key_privfreqstart = cfg->GetKey("Team", "PrivFreqStart");
+		key_maxfrequency = cfg->GetKey("Team", "MaxFrequency");
+		key_minbonusplayers = cfg->GetKey("Hyperspace", "MinBonusPlayers");
+
+		prop_exp_multiplier = database->getPropertyId("exp_multiplier");
+		prop_hsd_multiplier = database->getPropertyId("hsd_multiplier");
+
 		// setup the bounty cache
 		bounty_map.size = 64;
 		bounty_map.bounty = amalloc(sizeof(*bounty_map.bounty) * bounty_map.size * bounty_map.size);
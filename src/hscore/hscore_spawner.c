@@ -763,9 +763,9 @@ local void shipsLoadedCallback(Player *p)
 {
 	PlayerDataStruct *data = PPDATA(p, playerDataKey);
 
-	database->lock();
+	database->lockPlayer(p);
 	addOverrides(p, database->getPlayerShipSet(p));
-	database->unlock();
+	database->unlockPlayer(p);
 	//send the packet the first time
 	data->reship_after_settings = 1;
 	clientset->SendClientSettingsWithCallback(p, PlayerSettingsReceived, data);
@@ -778,9 +778,9 @@ local void shipsetChangedCallback(Player *p, int oldshipset, int newshipset)
 {
 	PlayerDataStruct *data = PPDATA(p, playerDataKey);
 
-	database->lock();
+	database->lockPlayer(p);
 	addOverrides(p, newshipset);
-	database->unlock();
+	database->unlockPlayer(p);
 
 	//send the packet the first time
 	data->reship_after_settings = 1;
@@ -795,9 +795,9 @@ local void shipsetChangedCallback(Player *p, int oldshipset, int newshipset)
 local void OnShipAdded(Player *p, int ship, int shipset) {
 	PlayerDataStruct *data = PPDATA(p, playerDataKey);
 
-	database->lock();
+	database->lockPlayer(p);
 	addOverrides(p, shipset);
-	database->unlock();
+	database->unlockPlayer(p);
 	//send the packet the first time
 	data->reship_after_settings = 1;
 	clientset->SendClientSettingsWithCallback(p, PlayerSettingsReceived, data);
@@ -837,9 +837,9 @@ local void killCallback(Arena *arena, Player *killer, Player *killed, int bounty
 	if (data->dirty)
 	{
 		data->dirty = 0;
-		database->lock();
+		database->lockPlayer(killed);
 		addOverrides(killed, database->getPlayerShipSet(killed));
-		database->unlock();
+		database->unlockPlayer(killed);
 		data->reship_after_settings = 0;
 		clientset->SendClientSettingsWithCallback(killed, PlayerSettingsReceived, data);
 	}
@@ -864,9 +864,9 @@ local void shipFreqChangeCallback(Player *p, int newship, int oldship, int newfr
 		if (data->dirty == 1 || (changingIntoNewShip && perShipInUse))
 		{
 			data->dirty = 0;
-			database->lock();
+			database->lockPlayer(p);
 			addOverrides(p, database->getPlayerShipSet(p));
-			database->unlock();
+			database->unlockPlayer(p);
 			data->reship_after_settings = 1;
 			clientset->SendClientSettingsWithCallback(p, PlayerSettingsReceived, data);
 		}
@@ -1209,12 +1209,12 @@ local void resendOverrides(Player *p)
 {
 	PlayerDataStruct *data = PPDATA(p, playerDataKey);
 
-	database->lock();
+	database->lockPlayer(p);
 	addOverrides(p, database->getPlayerShipSet(p));
 
 	data->reship_after_settings = 1;
 	clientset->SendClientSettingsWithCallback(p, PlayerSettingsReceived, data);
-	database->unlock();
+	database->unlockPlayer(p);
 }
 
 local int getFullEnergy(Player *p)
@@ -1253,18 +1253,20 @@ local void HSItemReloadCallback(void)
 	Player *p;
 	PlayerDataStruct *data;
 	Link *link;
+
+	//the database locks have to be taken before pd's
+	database->lock();
 	pd->Lock();
 	FOR_EACH_PLAYER(p)
 	{
-		database->lock();
 		addOverrides(p, database->getPlayerShipSet(p));
-		database->unlock();
 
 		data = PPDATA(p, playerDataKey);
 		data->reship_after_settings = 0;
 		clientset->SendClientSettingsWithCallback(p, PlayerSettingsReceived, data);
 	}
 	pd->Unlock();
+	database->unlock();
 }
 
 local Ihscorespawner interface =
@@ -1579,8 +1579,8 @@ static void OnItemsReloaded()
   ShipHull *hull;
 
   // Reload settings for managed players.
-  pd->Lock();
   database->lock();
+  pd->Lock();
   pthread_mutex_lock(&pdata_mutex);
 
   FOR_EACH_PLAYER(player) {
@@ -1592,8 +1592,8 @@ static void OnItemsReloaded()
   }
 
   pthread_mutex_unlock(&pdata_mutex);
-  database->unlock();
   pd->Unlock();
+  database->unlock();
 }
 
 /**
@@ -1607,8 +1607,8 @@ static void OnModuleAttach(Arena *arena)
   ShipHull *hull;
 
   // Manage players who are already in the arena
-  pd->Lock();
   database->lock();
+  pd->Lock();
   pthread_mutex_lock(&pdata_mutex);
 
   FOR_EACH_PLAYER(player) {
@@ -1628,8 +1628,8 @@ static void OnModuleAttach(Arena *arena)
   }
 
   pthread_mutex_unlock(&pdata_mutex);
-  database->unlock();
   pd->Unlock();
+  database->unlock();
 }
 
 /**
@@ -1642,8 +1642,8 @@ static void OnModuleDetach(Arena *arena)
   Link *link;
 
   // Revert settings for players who are still in the arena
-  pd->Lock();
   database->lock();
+  pd->Lock();
   pthread_mutex_lock(&pdata_mutex);
 
   FOR_EACH_PLAYER(player) {
@@ -1656,8 +1656,8 @@ static void OnModuleDetach(Arena *arena)
   }
 
   pthread_mutex_unlock(&pdata_mutex);
-  database->unlock();
   pd->Unlock();
+  database->unlock();
 }
 
 
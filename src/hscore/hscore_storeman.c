@@ -36,20 +36,20 @@ local void storeInfoCommand(const char *command, const char *params, Player *p,
 		chat->SendMessage(p, "| Stores                           |");
 		chat->SendMessage(p, "+----------------------------------+");
 
-		database->lock();
+		database->lockCatalog();
 		for (link = LLGetHead(database->getStoreList(p->arena)); link; link = link->next)
 		{
 			Store *store = link->data;
 
 			chat->SendMessage(p, "| %-32s |", store->name);
 		}
-		database->unlock();
+		database->unlockCatalog();
 
 		chat->SendMessage(p, "+----------------------------------+");
 	}
 	else
 	{
-		database->lock();
+		database->lockCatalog();
 		for (link = LLGetHead(database->getStoreList(p->arena)); link; link = link->next)
 		{
 			Store *store = link->data;
@@ -70,11 +70,11 @@ local void storeInfoCommand(const char *command, const char *params, Player *p,
 
 				chat->SendMessage(p, "+--------------------------------------------------------------------------------------------------+");
 
-				database->unlock();
+				database->unlockCatalog();
 				return;
 			}
 		}
-		database->unlock();
+		database->unlockCatalog();
 
 		//didn't find it
 		chat->SendMessage(p, "No stored named %s in this arena.", params);
@@ -87,7 +87,7 @@ local int canBuyItem(Player *p, Item *item) /*must be unlocked*/
 
 	Link *link, *itemLink;
 
-	database->lock();
+	database->lockCatalog();
 	for (link = LLGetHead(database->getStoreList(p->arena)); link; link = link->next)
 	{
 		Store *store = link->data;
@@ -102,7 +102,7 @@ local int canBuyItem(Player *p, Item *item) /*must be unlocked*/
 				//check if the player is in that store's region.
 				if (strcmp(store->region, "anywhere") == 0)
 				{
-					database->unlock();
+					database->unlockCatalog();
 					return 1;
 				}
 
@@ -113,14 +113,14 @@ local int canBuyItem(Player *p, Item *item) /*must be unlocked*/
 				{
 					if (mapdata->Contains(region, p->position.x >> 4, p->position.y >> 4))
 					{
-						database->unlock();
+						database->unlockCatalog();
 						return 1; //player's in the region
 					}
 				}
 			}
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	return 0; //player is not in any stores that sell the item.
 }
@@ -132,7 +132,7 @@ local int canSellItem(Player *p, Item *item) /*must be unlocked*/
 	Link *link, *itemLink;
 	int inStore = 0;
 
-	database->lock();
+	database->lockCatalog();
 	for (link = LLGetHead(database->getStoreList(p->arena)); link; link = link->next)
 	{
 		Store *store = link->data;
@@ -149,7 +149,7 @@ local int canSellItem(Player *p, Item *item) /*must be unlocked*/
 				//check if the player is in that store's region.
 				if (strcmp(store->region, "anywhere") == 0)
 				{
-					database->unlock();
+					database->unlockCatalog();
 					return 1;
 				}
 
@@ -160,14 +160,14 @@ local int canSellItem(Player *p, Item *item) /*must be unlocked*/
 				{
 					if (mapdata->Contains(region, p->position.x >> 4, p->position.y >> 4))
 					{
-						database->unlock();
+						database->unlockCatalog();
 						return 1; //player's in the region
 					}
 				}
 			}
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 
 	return !inStore; //if it's in a store, they can't sell it.
 }
@@ -186,7 +186,7 @@ void getStoreList(Player *p, Item *item, LinkedList *list) /*must be unlocked*/
 {
 	Link *link, *itemLink;
 
-	database->lock();
+	database->lockCatalog();
 	for (link = LLGetHead(database->getStoreList(p->arena)); link; link = link->next)
 	{
 		Store *store = link->data;
@@ -201,7 +201,7 @@ void getStoreList(Player *p, Item *item, LinkedList *list) /*must be unlocked*/
 			}
 		}
 	}
-	database->unlock();
+	database->unlockCatalog();
 }
 
 local Ihscorestoreman interface =
@@ -92,6 +92,7 @@ typedef struct Property
 	int value;
 	int absolute;
 	int ignoreCount;
+	int id; //interned name, from Ihscoredatabase::getPropertyId
 } Property;
 
 typedef struct ItemType
@@ -164,9 +165,17 @@ typedef struct InventoryEntry
 typedef struct PropertyCacheEntry
 {
 	int value;
-	int absolute;
+	short absolute;
+	short valid; //zero until the sum has been computed
 } PropertyCacheEntry;
 
+typedef struct PropertySums
+{
+	int count; //number of entries, indexed by property id
+	struct PropertySums *retired; //smaller arrays this one replaced. freed with the hull.
+	PropertyCacheEntry sums[0];
+} PropertySums;
+
 typedef struct ShipHull
 {
 	LinkedList inventoryEntryList;
@@ -174,8 +183,11 @@ typedef struct ShipHull
 	// The ship this hull represents. Probably shouldn't be changed outside of hscore_database.
 	int ship;
 
-	//if we compile a hashmap of properties, it can go in here.
-	HashTable *propertySums;
+	// Cached property sums, indexed by property id. Only changed with the
+	// owning player's lock held, inside a propertySeq write section, so
+	// Ihscoreitems::getPropertySumById can read them without the lock.
+	PropertySums *propertySums;
+	unsigned propertySeq;
 
 	// A collection of properties attached to the hull itself.
 	LinkedList *propertyList;
@@ -41,6 +41,16 @@ struct Arena
 
 	int _reserved : 31;
 
+	/** the players in this arena.
+	 * this list is maintained by the playerdata module and protected by
+	 * the global player lock. use FOR_EACH_PLAYER_IN_ARENA instead of
+	 * touching it directly, and Iplayerdata::SetArena to change it. */
+	LinkedList playerlist;
+
+	/** the callback handlers registered for this arena. this belongs
+	 * to the module manager, don't touch it. */
+	struct CallbackTable *cbtable;
+
 	/** space for private data associated with this arena */
 	byte arenaextradata[0];
 };
@@ -120,7 +130,7 @@ enum
 
 
 /** the interface id for arenaman */
-#define I_ARENAMAN "arenaman-9"
+#define I_ARENAMAN "arenaman-11"
 
 /** the arenaman interface struct */
 typedef struct Iarenaman
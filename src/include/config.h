@@ -30,6 +30,11 @@
  * change and when. this information may be written back to the
  * configuration files.
  *
+ * code that reads the same setting over and over (in position packet,
+ * kill or timer handlers) should intern the name once with GetKey and
+ * then use GetKeyInt or GetKeyStr. those don't format or hash anything
+ * and don't take any locks.
+ *
  * FlushDirtyValues and CheckModifiedFiles do what they say. there's no
  * need to call them in general; the config module performs those
  * actions internally based on timers also.
@@ -50,6 +55,10 @@ typedef struct ConfigHandle_ *ConfigHandle;
 /** use this special ConfigHandle to refer to the global config file. */
 #define GLOBAL ((ConfigHandle)(-3))
 
+/** an interned "section:key" name, good for any config file.
+ ** get one with Iconfig::GetKey. */
+typedef int ConfigKey;
+
 /** pass functions of this type to LoadConfigFile to be notified when
  ** the given file is changed. */
 typedef void (*ConfigChangedFunc)(void *clos);
@@ -63,7 +72,7 @@ typedef void (*GlobalConfigChangedFunc)(void);
 
 
 /** the config interface id */
-#define I_CONFIG "config-4"
+#define I_CONFIG "config-5"
 
 /** the config interface struct */
 typedef struct Iconfig
@@ -124,6 +133,31 @@ typedef struct Iconfig
 			int value, const char *info, int permanent);
 	/* pyint: config, string, string, int, zstring, int -> void */
 
+	/** Interns a section and key name for fast lookups.
+	 * The same name always gets the same key (case doesn't matter),
+	 * and keys never become invalid, so it's fine to look one up when
+	 * your module loads and keep it in a static.
+	 * @param section which section the key is in
+	 * @param key the name of the key
+	 * @return a key to pass to GetKeyStr or GetKeyInt, or -1 if both
+	 * section and key are NULL
+	 */
+	ConfigKey (*GetKey)(const char *section, const char *key);
+
+	/** Gets a string value using an interned key.
+	 * Same as GetStr, but without any locking or string hashing.
+	 * \see Iconfig::GetStr
+	 */
+	const char * (*GetKeyStr)(ConfigHandle ch, ConfigKey k);
+
+	/** Gets an integer value using an interned key.
+	 * Same as GetInt, except that the value was already converted when
+	 * the file was loaded or the setting last changed, so this is just
+	 * a couple of memory reads.
+	 * \see Iconfig::GetInt
+	 */
+	int (*GetKeyInt)(ConfigHandle ch, ConfigKey k, int defvalue);
+
 	/** Open a new config file.
 	 * This opens a new config file to be managed by the config module.
 	 * You should close each file you open with CloseConfigFile. The
@@ -49,6 +49,18 @@
 typedef void (*LogFunc)(const char *line);
 /* pycb: string */
 
+/** this callback is called with lines in batches, as they come out of
+ ** the logging thread's queue.
+ * handlers that do some work for every call, like locking a file or
+ * formatting a timestamp, should use this instead of CB_LOGFUNC. lines
+ * are delivered to both. synchronous lines come in batches of one. */
+#define CB_LOGFUNCBATCH "logbatch"
+/** the type of batched log handlers.
+ * @param lines the log lines, oldest first. they're only valid until
+ * the handler returns.
+ * @param count how many lines there are */
+typedef void (*LogFuncBatch)(const char **lines, int count);
+
 
 /** the Ilogman interface id */
 #define I_LOGMAN "logman-2"
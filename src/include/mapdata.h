@@ -9,10 +9,12 @@
  * that need information about the location of objects on the map should
  * use it.
  *
- * internally, the map file is represented as a sparse array using a
- * two-dimensional trie structure. it uses about 200k per map, which is
- * 1/5 of the space a straight bitmap would use, but retains efficient
- * access speeds.
+ * internally, the tiles are kept in a flat 1024x1024 byte array that
+ * is shared by every arena using the same map file and never changes
+ * after loading, so reading tiles doesn't need any locks. bricks are
+ * kept separately for each arena. region membership is stored as an
+ * index into a table of distinct region combinations for each tile, in
+ * 32x32 blocks that are only allocated where there are regions.
  */
 
 /** return codes for GetTile() */
@@ -68,12 +70,17 @@ typedef struct Region Region;
 struct mapdata_memory_stats_t
 {
 	int lvlbytes, lvlblocks, rgnbytes, rgnblocks;
-	int reserved[8];
+	/* lvl and region data is shared by every arena using the same
+	 * file. lvlrefs is how many arenas that is, cachedlvls is how many
+	 * different files are loaded, and the brick fields count this
+	 * arena's own bricks. */
+	int lvlrefs, cachedlvls, brickbytes, brickblocks;
+	int reserved[4];
 };
 
 
 /** interface id for Imapdata */
-#define I_MAPDATA "mapdata-9"
+#define I_MAPDATA "mapdata-10"
 
 /** interface struct for Imapdata
  * you should use this to figure out what's going on in the map in a
@@ -122,7 +129,10 @@ typedef struct Imapdata
 	 * efficiency concerns. */
 
 	/** finds the tile nearest to the given tile that is appropriate for
-	 ** placing a flag. */
+	 ** placing a flag.
+	 * this is a table lookup plus a scan of one ring of tiles in the
+	 * usual case. if there's nothing empty within 18 tiles, x and y are
+	 * left alone. */
 	void (*FindEmptyTileNear)(Arena *arena, int *x, int *y);
 	/* pyint: arena, int inout, int inout -> void */
 
@@ -223,6 +233,33 @@ typedef struct Imapdata
 	 * @param y pointer to the y coordinate
 	 */
 	void (*FindRandomPoint)(Region *rgn, int *x, int *y);
+
+	/** reads the tiles along a line, in order, both ends included.
+	 * this is much faster than calling GetTile for each one.
+	 * @param arena the arena whose map we're dealing with.
+	 * @param x1, y1, x2, y2 the ends of the line, in tiles.
+	 * @param tiles where to put the tile contents.
+	 * @param maxtiles how many tiles fit in tiles.
+	 * @return how many tiles were filled in.
+	 */
+	int (*GetTileLine)(Arena *arena, int x1, int y1, int x2, int y2,
+			byte *tiles, int maxtiles);
+	/** checks if anything solid is in the way between two points.
+	 * this visits every tile the line passes through, so unlike
+	 * stepping along it a few pixels at a time it can't slip past the
+	 * corner of a wall. anything off the map counts as solid.
+	 * @param arena the arena whose map we're dealing with.
+	 * @param x1, y1, x2, y2 the ends of the line, in pixels.
+	 * @param solid a table of 256 entries, nonzero for tile types that
+	 * block the line. NULL means walls (1-161), 192-240 and 243-251,
+	 * which includes bricks.
+	 * @param hitx, hity if not NULL, and something is in the way, these
+	 * get the coordinates of the first solid tile.
+	 * @return true if something is in the way, false if the line is
+	 * clear.
+	 */
+	int (*RaycastSolid)(Arena *arena, int x1, int y1, int x2, int y2,
+			const byte *solid, int *hitx, int *hity);
 } Imapdata;
 
 #endif
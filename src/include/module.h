@@ -143,7 +143,25 @@ typedef int (*ModuleLoaderFunc)(int action, mod_args_t *args, const char *line,
 
 
 /** this is only used from python */
-#define I_MODMAN "modman-3"
+#define I_MODMAN "modman-4"
+
+/** the handlers registered for one callback id in one arena (or
+ ** globally). these are never changed once they're made, which lets
+ ** DO_CBS walk them without holding any locks. */
+typedef struct CallbackSet
+{
+	int count;
+	void *funcs[0];
+} CallbackSet;
+
+/** what BeginCallbacks fills in: the global handlers, then the arena
+ ** ones. don't touch these yourself, use DO_CBS. */
+typedef struct CallbackSnapshot
+{
+	CallbackSet *sets[2];
+	int owned;
+} CallbackSnapshot;
+
 
 /** the module manager interface struct */
 typedef struct Imodman
@@ -274,6 +292,8 @@ typedef struct Imodman
 
 	/** Returns a list of currently registered handlers for a type of
 	 ** callback and arena.
+	 * This is the old way of doing it. It locks, allocates, and does
+	 * string lookups, so prefer DO_CBS.
 	 * If arena is set, returns all callbacks registered for that arena,
 	 * and also all registered globally. If arena is ALLARENAS, returns
 	 * only callbacks registered globally.
@@ -343,6 +363,25 @@ typedef struct Imodman
 	 * Returns MM_OK if all modules detached okay, returns MM_FAIL if any
 	 * module failed to detach. */
 	int (*DetachAllFromArena)(Arena *arena);
+
+	/** Returns the slot number for a callback id. DO_CBS uses slots to
+	 * find handlers without any string lookups. Slots are never reused,
+	 * so it's safe to remember them. Returns -1 if we've run out.
+	 * @see DO_CBS
+	 */
+	int (*GetCallbackSlot)(const char *id);
+	/** Gets the handlers currently registered for a callback, without
+	 * locking or allocating anything. Each call must be matched by a
+	 * call to EndCallbacks, and the snapshot stays valid until then,
+	 * even if handlers are unregistered in the meantime.
+	 * Don't use this directly, use the DO_CBS macro.
+	 * @see DO_CBS
+	 */
+	void (*BeginCallbacks)(const char *id, int slot, Arena *arena, CallbackSnapshot *snap);
+	/** Releases a snapshot from BeginCallbacks.
+	 * @see DO_CBS
+	 */
+	void (*EndCallbacks)(CallbackSnapshot *snap);
 	
 	/* these functions should be called only from main.c */
 	struct
@@ -383,14 +422,19 @@ void DeInitModuleManager(Imodman *mm);
  * @param args the arguments to the callback handler, enclosed in an
  * extra set of parenthesis
  */
-#define DO_CBS(cb, arena, type, args)        \
-do {                                         \
-	LinkedList _a_lst;                       \
-	Link *_a_l;                              \
-	mm->LookupCallback(cb, arena, &_a_lst);  \
-	for (_a_l = LLGetHead(&_a_lst); _a_l; _a_l = _a_l->next)  \
-		((type)_a_l->data) args ;            \
-	mm->FreeLookupResult(&_a_lst);           \
+#define DO_CBS(cb, arena, type, args)                              \
+do {                                                               \
+	static int _a_slot = -2;                                       \
+	CallbackSnapshot _a_snap;                                      \
+	int _a_s, _a_i;                                                \
+	if (_a_slot == -2)                                             \
+		_a_slot = mm->GetCallbackSlot(cb);                         \
+	mm->BeginCallbacks(cb, _a_slot, arena, &_a_snap);              \
+	for (_a_s = 0; _a_s < 2; _a_s++)                               \
+		if (_a_snap.sets[_a_s])                                    \
+			for (_a_i = 0; _a_i < _a_snap.sets[_a_s]->count; _a_i++) \
+				((type)_a_snap.sets[_a_s]->funcs[_a_i]) args ;     \
+	mm->EndCallbacks(&_a_snap);                                    \
 } while (0)
 
 #endif
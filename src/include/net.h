@@ -57,12 +57,16 @@ struct net_stats
 {
 	unsigned int pcountpings, pktsent, pktrecvd;
 	unsigned int bytesent, byterecvd;
+	/* full size buffers. buffersused can lag a little, since threads
+	 * only report their counts now and then. */
 	unsigned int buffercount, buffersused;
 #define NET_GROUPED_STATS_LEN 8
 	unsigned int grouped_stats[NET_GROUPED_STATS_LEN];
 #define NET_PRI_STATS_LEN 5 /* must match BW_PRIS in bwlimit.h */
 	unsigned int pri_stats[NET_PRI_STATS_LEN];
-	byte reserved[176];
+	/* small buffers, for short outgoing packets */
+	unsigned int smallbuffercount, smallbuffersused;
+	byte reserved[168];
 };
 
 struct net_client_stats
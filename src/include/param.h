@@ -98,8 +98,10 @@
 /* whether to keep a list of free links. this is an optimization that
  * will have different effects on different systems. enabling it will
  * probably decrease memory use a bit, and might make things faster or
- * slower, depending on your system and malloc implementation. */
-/* #define CFG_USE_FREE_LINK_LIST */
+ * slower, depending on your system and malloc implementation. with gcc,
+ * each thread keeps its own cache of links, so threads rarely wait on
+ * each other for them. */
+#define CFG_USE_FREE_LINK_LIST
 
 
 /* whether to enable a few locks for unimportant data that may decrease
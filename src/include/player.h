@@ -288,7 +288,7 @@ typedef void (*NewPlayerFunc)(Player *p, int isnew);
 
 
 /** the interface id for playerdata */
-#define I_PLAYERDATA "playerdata-8"
+#define I_PLAYERDATA "playerdata-9"
 
 /** the playerdata interface struct */
 typedef struct Iplayerdata
@@ -393,6 +393,18 @@ typedef struct Iplayerdata
 	 */
 	void (*WriteUnlock)(void);
 
+	/** Moves a player into a different arena.
+	 * This sets p->arena and keeps the arena player lists used by
+	 * FOR_EACH_PLAYER_IN_ARENA and TargetToSet in sync. Anything that
+	 * changes p->arena must use this instead of assigning it directly.
+	 * It acquires the player write lock, so don't call it while
+	 * holding the read lock.
+	 * @param p the player to move
+	 * @param arena the new arena, or NULL to take the player out of
+	 * any arena
+	 */
+	void (*SetArena)(Player *p, Arena *arena);
+
 	/** This list contains all the players the server knows about.
 	 * Don't forget the necessary locking. You don't want to use this
 	 * directly, but should use these macros instead:
@@ -427,15 +439,18 @@ typedef struct Iplayerdata
 			link && ((p = link->data, link = link->next) || 1); )
 
 /** This is similar to FOR_EACH_PLAYER, but only looks at players in the
- * Arena * a. This macro has all the same needs as FOR_EACH_PLAYER,
- * namely that it requires a Link * named "link" and an Iplayerdata *
- * named "pd" in the current scope. Again, you need to call pd->Lock
- * first.
+ * Arena * a. It walks the arena's own player list, so it costs time
+ * proportional to the arena's population rather than the zone's. It
+ * requires a Link * named "link" in the current scope. Again, you need
+ * to call pd->Lock first.
  * @see Iplayerdata::Lock
  * @param p the Player * which will hold successive players
  * @param a the Arena * within which to find players
  */
-#define FOR_EACH_PLAYER_IN_ARENA(p, a) FOR_EACH_PLAYER(p) if (p->arena == a)
+#define FOR_EACH_PLAYER_IN_ARENA(p, a) \
+	for ( \
+			link = LLGetHead(&(a)->playerlist); \
+			link && ((p = link->data, link = link->next) || 1); )
 
 /** This is a slightly fancier iterating over players macro.
  * It requires a Link * named "link" and an Iplayerdata * named "pd" in
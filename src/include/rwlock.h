@@ -51,3 +51,43 @@ extern int rwl_writelock (rwlock_t *rwlock);
 extern int rwl_writetrylock (rwlock_t *rwlock);
 extern int rwl_writeunlock (rwlock_t *rwlock);
 
+
+/*
+ * Structure describing a reader-biased ("big reader") lock. Each thread
+ * that read-locks one gets a private, cache-line sized record holding
+ * its read counts for every brlock, so taking and dropping a read lock
+ * only touches memory owned by the calling thread and the (read-mostly)
+ * writer flag. Writers pay instead: they raise the flag, check every
+ * thread's read count for this lock, and if anyone is reading, lower it
+ * again and wait for them to leave.
+ *
+ * Like rwlock_t, this prefers readers: new readers only wait while a
+ * writer actually holds the lock, never for one that's just waiting, so
+ * a steady stream of readers can keep a writer out. The same extensions
+ * as rwlock_t apply: read locks and write locks are recursive, and the
+ * writer can take read locks. Upgrading a read lock to a write lock
+ * deadlocks, just like rwlock_t.
+ */
+typedef struct brlock_tag {
+	pthread_mutex_t     mutex;
+	pthread_cond_t      read;           /* wait for writer to leave */
+	pthread_cond_t      write;          /* wait for readers/writer to leave */
+	int                 index;          /* slot in each thread's record */
+	int                 writer;         /* set while a writer holds it or is checking for readers */
+	int                 w_wait;         /* writers waiting for readers to leave */
+	int                 w_active;       /* write lock depth */
+	pthread_t           w_owner;        /* who has this owned for write */
+} brlock_t;
+
+/* at most this many brlocks can exist at once */
+#define BRLOCK_MAX      16
+
+/*
+ * Define reader-biased lock functions
+ */
+extern int brl_init (brlock_t *brlock);
+extern int brl_destroy (brlock_t *brlock);
+extern int brl_readlock (brlock_t *brlock);
+extern int brl_readunlock (brlock_t *brlock);
+extern int brl_writelock (brlock_t *brlock);
+extern int brl_writeunlock (brlock_t *brlock);
@@ -190,8 +190,27 @@ typedef struct LinkedList
  ** calling LLInit, if you so choose. */
 #define LL_INITIALIZER { NULL, NULL }
 
+/** counters for the link allocator (see CFG_USE_FREE_LINK_LIST).
+ * each thread keeps a cache of links, and only goes to the shared pool
+ * when its cache runs dry or gets too big. allocs and frees are
+ * collected from the caches at those times, so they lag a little. */
+typedef struct LinkStats
+{
+	unsigned long allocs, frees;
+	/** how many times a thread's cache took links from, or gave links
+	 ** back to, the shared pool */
+	unsigned long refills, spills;
+	/** how many times a thread had to wait for the shared pool's lock */
+	unsigned long lockwaits;
+	/** how many blocks of links were allocated from the heap */
+	unsigned long chunks;
+} LinkStats;
+
 /** allocates a new linked list. */
 LinkedList * LLAlloc(void);
+/** gets the link allocator counters. they're all zero if the server
+ ** was built without CFG_USE_FREE_LINK_LIST. */
+void LLGetStats(LinkStats *stats);
 /** initializes a linked list allocated through some other means. */
 void LLInit(LinkedList *lst);
 /** frees memory occupied by the links of a list (not the items
@@ -444,6 +463,55 @@ void MPClearOne(MPQueue *mpq, void *data);
 #endif /* MPQUEUE */
 
 
+#ifndef NOMPSCQUEUE
+
+/* lock-free queue stuff */
+
+/** a bounded queue for any number of producer threads and exactly one
+ * consumer thread. adding and removing items doesn't take any locks,
+ * unless the consumer is asleep waiting for something to show up.
+ * use this instead of MPQueue for hot paths where only one thread ever
+ * removes items. don't access its members directly. */
+typedef struct MPSCQueue
+{
+	/* next slot producers will claim */
+	unsigned long tail;
+	char pad1[64 - sizeof(unsigned long)];
+	/* next slot the consumer will read. only the consumer touches it. */
+	unsigned long head;
+	char pad2[64 - sizeof(unsigned long)];
+	/* set while the consumer is blocked in MPSCRemove */
+	int sleeping;
+	char pad3[64 - sizeof(int)];
+	struct MPSCCell { unsigned long seq; void *data; } *cells;
+	unsigned long mask;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+} MPSCQueue;
+
+/** initializes an mpscqueue that can hold up to size items. size is
+ * rounded up to a power of two. you need to allocate memory for the
+ * queue itself. */
+void MPSCInit(MPSCQueue *q, int size);
+/** destroys an mpscqueue. items still in it are not freed. */
+void MPSCDestroy(MPSCQueue *q);
+/** adds an item to the end of the queue. if the queue is full, this
+ * waits for the consumer to make room. any thread can call this. */
+void MPSCAdd(MPSCQueue *q, void *data);
+/** adds an item to the end of the queue, or returns false if the queue
+ * is full. any thread can call this. */
+int MPSCTryAdd(MPSCQueue *q, void *data);
+/** removes an item from the front of the queue, or returns NULL if
+ * it's empty. only the consumer thread can call this. */
+void * MPSCTryRemove(MPSCQueue *q);
+/** removes an item from the front of the queue, blocking until there
+ * is one. only the consumer thread can call this. it's a cancellation
+ * point. */
+void * MPSCRemove(MPSCQueue *q);
+
+#endif /* MPSCQUEUE */
+
+
 #ifndef NOMMAP
 
 /* memory mapped files stuff */
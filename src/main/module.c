@@ -45,6 +45,9 @@ local void ReleaseArenaInterface(void *iface, Arena *arena);
 local void RegCallback(const char *, void *, Arena *);
 local void UnregCallback(const char *, void *, Arena *);
 local void LookupCallback(const char *, Arena *, LinkedList *);
+local int GetCallbackSlot(const char *);
+local void BeginCallbacks(const char *, int, Arena *, CallbackSnapshot *);
+local void EndCallbacks(CallbackSnapshot *);
 local void FreeLookupResult(LinkedList *);
 
 local void RegAdviser(void *adv, Arena *arena);
@@ -73,6 +76,32 @@ local pthread_mutex_t intmtx = PTHREAD_MUTEX_INITIALIZER;
 local pthread_mutex_t cbmtx = PTHREAD_MUTEX_INITIALIZER;
 local pthread_mutex_t advmtx = PTHREAD_MUTEX_INITIALIZER;
 
+/* the hash tables above are where callbacks really live. for DO_CBS,
+ * each callback id also gets a slot number, and each slot has an
+ * immutable CallbackSet for the global handlers and one per arena.
+ * Reg/UnregCallback build a new set and swap it in, and the old one
+ * goes on the retired list. retired sets are freed only when nobody is
+ * between BeginCallbacks and EndCallbacks. anything that could have
+ * seen them must have started before they were swapped out, and
+ * must have finished by then. */
+#define MAX_CALLBACK_SLOTS 512
+
+struct CallbackTable
+{
+	/* how many of the sets are non-NULL */
+	int used;
+	CallbackSet *sets[MAX_CALLBACK_SLOTS];
+};
+
+local HashTable *cbslots;
+local int nextcbslot;
+local CallbackSet *globalcbsets[MAX_CALLBACK_SLOTS];
+/* threads between BeginCallbacks and EndCallbacks */
+local int cbactive;
+/* sets and tables waiting to be freed, protected by cbmtx */
+local LinkedList cbretired = LL_INITIALIZER;
+local int cbretiredcount;
+
 
 local Imodman mmint =
 {
@@ -86,6 +115,7 @@ local Imodman mmint =
 	RegModuleLoader, UnregModuleLoader,
 	GetModuleInfo, GetModuleLoader,
 	DetachAllFromArena,
+	GetCallbackSlot, BeginCallbacks, EndCallbacks,
 	{ DoStage, UnloadAllModules, NoMoreModules },
 	{ NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
 };
@@ -108,6 +138,7 @@ Imodman * InitModuleManager(void)
 	LLInit(&attachments);
 	arenacallbacks = HashAlloc();
 	globalcallbacks = HashAlloc();
+	cbslots = HashAlloc();
 	arenaints = HashAlloc();
 	globalints = HashAlloc();
 	intsbyname = HashAlloc();
@@ -130,6 +161,16 @@ void DeInitModuleManager(Imodman *mm)
 	LLEmpty(&mods);
 	HashFree(arenacallbacks);
 	HashFree(globalcallbacks);
+	HashFree(cbslots);
+	{
+		int i;
+		Link *l;
+		for (i = 0; i < MAX_CALLBACK_SLOTS; i++)
+			afree(globalcbsets[i]);
+		for (l = LLGetHead(&cbretired); l; l = l->next)
+			afree(l->data);
+		LLEmpty(&cbretired);
+	}
 	HashFree(arenaints);
 	HashFree(globalints);
 	HashFree(intsbyname);
@@ -683,18 +724,122 @@ void ReleaseArenaInterface(void *iface, Arena *arena)
 
 /* callback stuff */
 
+/* call with cbmtx held */
+local int get_slot(const char *id)
+{
+	long slot = (long)HashGetOne(cbslots, id);
+	if (slot == 0 && nextcbslot < MAX_CALLBACK_SLOTS)
+	{
+		slot = ++nextcbslot;
+		HashReplace(cbslots, id, (void*)slot);
+	}
+	return slot - 1;
+}
+
+/* frees retired sets if nobody can be looking at them. call with cbmtx
+ * held. */
+local void reclaim_callbacks(void)
+{
+	Link *l;
+
+	if (LLIsEmpty(&cbretired))
+		return;
+	if (__atomic_load_n(&cbactive, __ATOMIC_SEQ_CST) != 0)
+		return;
+
+	for (l = LLGetHead(&cbretired); l; l = l->next)
+		afree(l->data);
+	LLEmpty(&cbretired);
+	__atomic_store_n(&cbretiredcount, 0, __ATOMIC_RELAXED);
+}
+
+/* call with cbmtx held */
+local void retire_callbacks(void *p)
+{
+	if (p)
+	{
+		LLAdd(&cbretired, p);
+		__atomic_store_n(&cbretiredcount, LLCount(&cbretired), __ATOMIC_RELAXED);
+	}
+}
+
+/* makes a new set from a list of handlers, or NULL if it's empty */
+local CallbackSet *make_set(LinkedList *lst)
+{
+	CallbackSet *set;
+	Link *l;
+	int n = LLCount(lst);
+
+	if (n == 0)
+		return NULL;
+	set = amalloc(sizeof(*set) + n * sizeof(void*));
+	for (l = LLGetHead(lst); l; l = l->next)
+		set->funcs[set->count++] = l->data;
+	return set;
+}
+
+/* rebuilds the set for a callback id after the hash tables changed.
+ * call with cbmtx held. */
+local void update_callback_set(const char *id, const char *key, Arena *arena)
+{
+	int slot = get_slot(id);
+	LinkedList lst = LL_INITIALIZER;
+	CallbackSet *set, *old;
+
+	if (slot < 0)
+		/* DO_CBS will use the hash tables for this one */
+		return;
+
+	HashGetAppend(arena ? arenacallbacks : globalcallbacks, key, &lst);
+	set = make_set(&lst);
+	LLEmpty(&lst);
+
+	if (arena == ALLARENAS)
+	{
+		old = __atomic_exchange_n(&globalcbsets[slot], set, __ATOMIC_SEQ_CST);
+		retire_callbacks(old);
+	}
+	else
+	{
+		struct CallbackTable *tbl = arena->cbtable;
+
+		if (!tbl)
+		{
+			if (!set)
+				return;
+			tbl = amalloc(sizeof(*tbl));
+			__atomic_store_n(&arena->cbtable, tbl, __ATOMIC_SEQ_CST);
+		}
+
+		old = __atomic_exchange_n(&tbl->sets[slot], set, __ATOMIC_SEQ_CST);
+		tbl->used += (set != NULL) - (old != NULL);
+		retire_callbacks(old);
+
+		if (tbl->used == 0)
+		{
+			/* nothing left for this arena */
+			__atomic_store_n(&arena->cbtable, NULL, __ATOMIC_SEQ_CST);
+			retire_callbacks(tbl);
+		}
+	}
+
+	reclaim_callbacks();
+}
+
 void RegCallback(const char *id, void *f, Arena *arena)
 {
 	pthread_mutex_lock(&cbmtx);
 	if (arena == ALLARENAS)
 	{
 		HashAdd(globalcallbacks, id, f);
+		update_callback_set(id, id, arena);
 	}
 	else
 	{
 		char key[MAX_ID_LEN];
 		snprintf(key, sizeof(key), "%p-%s", (void*)arena, id);
 		HashAdd(arenacallbacks, key, f);
+		update_callback_set(id, key, arena);
 	}
 	pthread_mutex_unlock(&cbmtx);
 }
@@ -705,12 +850,14 @@ void UnregCallback(const char *id, void *f, Arena *arena)
 	if (arena == ALLARENAS)
 	{
 		HashRemove(globalcallbacks, id, f);
+		update_callback_set(id, id, arena);
 	}
 	else
 	{
 		char key[MAX_ID_LEN];
 		snprintf(key, sizeof(key), "%p-%s", (void*)arena, id);
 		HashRemove(arenacallbacks, key, f);
+		update_callback_set(id, key, arena);
 	}
 	pthread_mutex_unlock(&cbmtx);
 }
@@ -731,6 +878,63 @@ void LookupCallback(const char *id, Arena *arena, LinkedList *ll)
 	pthread_mutex_unlock(&cbmtx);
 }
 
+int GetCallbackSlot(const char *id)
+{
+	int slot;
+	pthread_mutex_lock(&cbmtx);
+	slot = get_slot(id);
+	pthread_mutex_unlock(&cbmtx);
+	return slot;
+}
+
+void BeginCallbacks(const char *id, int slot, Arena *arena, CallbackSnapshot *snap)
+{
+	if (slot < 0)
+	{
+		/* out of slots: do it the slow way */
+		LinkedList lst;
+		LookupCallback(id, arena, &lst);
+		snap->sets[0] = make_set(&lst);
+		snap->sets[1] = NULL;
+		snap->owned = TRUE;
+		LLEmpty(&lst);
+		return;
+	}
+
+	/* this has to be visible before we look at any sets, so that
+	 * nothing we see gets freed until EndCallbacks */
+	__atomic_add_fetch(&cbactive, 1, __ATOMIC_SEQ_CST);
+
+	snap->sets[0] = __atomic_load_n(&globalcbsets[slot], __ATOMIC_SEQ_CST);
+	snap->sets[1] = NULL;
+	snap->owned = FALSE;
+	if (arena != ALLARENAS)
+	{
+		struct CallbackTable *tbl = __atomic_load_n(&arena->cbtable, __ATOMIC_SEQ_CST);
+		if (tbl)
+			snap->sets[1] = __atomic_load_n(&tbl->sets[slot], __ATOMIC_SEQ_CST);
+	}
+}
+
+void EndCallbacks(CallbackSnapshot *snap)
+{
+	if (snap->owned)
+	{
+		afree(snap->sets[0]);
+		return;
+	}
+
+	if (__atomic_sub_fetch(&cbactive, 1, __ATOMIC_SEQ_CST) == 0 &&
+	    __atomic_load_n(&cbretiredcount, __ATOMIC_RELAXED) &&
+	    pthread_mutex_trylock(&cbmtx) == 0)
+	{
+		/* we might be the last one out. if cbmtx is busy, whoever
+		 * gets here next will clean up instead. */
+		reclaim_callbacks();
+		pthread_mutex_unlock(&cbmtx);
+	}
+}
+
 void FreeLookupResult(LinkedList *lst)
 {
 	LLEmpty(lst);
@@ -23,6 +23,10 @@
  * lock. rwl_writetrylock() attempts to lock a read-write lock
  * for write access, and returns EBUSY instead of blocking.
  *
+ * brlock_t is a reader-biased variant with the same interface (minus the
+ * trylock functions), for locks that are read far more often than they
+ * are written. See rwlock.h.
+ *
  * Extensions: A thread that has the lock locked for write access can
  * lock it for write access again without deadlock; it must be unlocked
  * the same number of times it was locked. A thread that has it locked
@@ -31,6 +35,8 @@
  */
 #include "pthread.h"
 #include "errno.h"
+#include <stdlib.h>
+#include <string.h>
 
 #include "asss.h"
 #include "rwlock.h"
@@ -311,3 +317,305 @@ int rwl_writeunlock (rwlock_t *rwl)
 	return status;
 }
 
+
+
+/*
+ * Reader-biased locks.
+ *
+ * Every thread that read-locks a brlock gets a brl_thread record holding
+ * its read depth for each brlock, indexed by brlock_t.index. Only the
+ * owning thread writes to its record, and the counts fill exactly one
+ * cache line, so readers on different cpus never share a dirty line.
+ * A reader publishes its count and then checks the writer flag; a
+ * writer sets the flag and then sums everyone's counts. With both
+ * sides using sequentially consistent accesses, at least one of them
+ * sees the other, so a reader that sees no writer is safe to go ahead,
+ * and one that sees a writer backs out and waits on the mutex.
+ *
+ * The flag is only left up while the writer holds the lock. If the
+ * writer finds readers it lowers the flag again before waiting, so
+ * like rwl_readlock, readers only ever wait for an active writer.
+ */
+typedef struct brl_thread {
+	int                 count[BRLOCK_MAX];  /* read depth for each brlock */
+	struct brl_thread   *next;              /* protected by brl_regmtx */
+} __attribute__((aligned(64))) brl_thread;
+
+static __thread brl_thread *brl_self;
+static brl_thread *brl_threads;
+static int brl_used[BRLOCK_MAX];
+static pthread_mutex_t brl_regmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t brl_key;
+static pthread_once_t brl_once = PTHREAD_ONCE_INIT;
+
+static void brl_thread_exit (void *arg)
+{
+	brl_thread *t = (brl_thread *)arg, **pp;
+
+	pthread_mutex_lock (&brl_regmtx);
+	for (pp = &brl_threads; *pp; pp = &(*pp)->next)
+		if (*pp == t) {
+			*pp = t->next;
+			break;
+		}
+	pthread_mutex_unlock (&brl_regmtx);
+	brl_self = NULL;
+	free (t);
+}
+
+static void brl_key_init (void)
+{
+	pthread_key_create (&brl_key, brl_thread_exit);
+}
+
+/*
+ * Give the calling thread its record. It's linked in before the thread
+ * publishes any count, so a writer that doesn't find it yet must have
+ * raised its flag before the thread looks at it.
+ */
+static brl_thread * brl_register (void)
+{
+	void *mem;
+	brl_thread *t;
+
+	pthread_once (&brl_once, brl_key_init);
+	if (posix_memalign (&mem, 64, sizeof(brl_thread)) != 0)
+		return NULL;
+	t = (brl_thread *)mem;
+	memset (t, 0, sizeof(*t));
+	pthread_mutex_lock (&brl_regmtx);
+	t->next = brl_threads;
+	brl_threads = t;
+	pthread_mutex_unlock (&brl_regmtx);
+	pthread_setspecific (brl_key, t);
+	brl_self = t;
+	return t;
+}
+
+/*
+ * Check whether any thread holds a read lock on brl.
+ */
+static int brl_readers (brlock_t *brl)
+{
+	brl_thread *t;
+	int found = 0;
+
+	pthread_mutex_lock (&brl_regmtx);
+	for (t = brl_threads; t && !found; t = t->next)
+		found = __atomic_load_n (&t->count[brl->index], __ATOMIC_SEQ_CST) != 0;
+	pthread_mutex_unlock (&brl_regmtx);
+	return found;
+}
+
+/*
+ * Initialize a reader-biased lock
+ */
+int brl_init (brlock_t *brl)
+{
+	int status, i;
+
+	pthread_mutex_lock (&brl_regmtx);
+	for (i = 0; i < BRLOCK_MAX && brl_used[i]; i++)
+		;
+	if (i < BRLOCK_MAX)
+		brl_used[i] = 1;
+	pthread_mutex_unlock (&brl_regmtx);
+	if (i == BRLOCK_MAX)
+		return EAGAIN;
+
+	brl->index = i;
+	brl->writer = 0;
+	brl->w_wait = 0;
+	brl->w_active = 0;
+	status = pthread_mutex_init (&brl->mutex, NULL);
+	if (status == 0) {
+		status = pthread_cond_init (&brl->read, NULL);
+		if (status == 0) {
+			status = pthread_cond_init (&brl->write, NULL);
+			if (status == 0)
+				return 0;
+			pthread_cond_destroy (&brl->read);
+		}
+		pthread_mutex_destroy (&brl->mutex);
+	}
+	pthread_mutex_lock (&brl_regmtx);
+	brl_used[i] = 0;
+	pthread_mutex_unlock (&brl_regmtx);
+	return status;
+}
+
+/*
+ * Destroy a reader-biased lock
+ */
+int brl_destroy (brlock_t *brl)
+{
+	pthread_mutex_lock (&brl->mutex);
+	if (brl->writer || brl_readers (brl)) {
+		pthread_mutex_unlock (&brl->mutex);
+		return EBUSY;
+	}
+	pthread_mutex_unlock (&brl->mutex);
+
+	pthread_mutex_lock (&brl_regmtx);
+	brl_used[brl->index] = 0;
+	pthread_mutex_unlock (&brl_regmtx);
+	pthread_mutex_destroy (&brl->mutex);
+	pthread_cond_destroy (&brl->read);
+	pthread_cond_destroy (&brl->write);
+	return 0;
+}
+
+static void brl_unlockcleanup (void *arg)
+{
+	pthread_mutex_unlock (&((brlock_t *)arg)->mutex);
+}
+
+/*
+ * The read lock slow path: a writer holds the lock or is checking for
+ * readers. Unless it's us, back out and wait for it to finish. A writer
+ * that's only checking does it under the mutex, so if it didn't get the
+ * lock, the flag is already down again by the time we get the mutex.
+ */
+static int brl_readwait (brlock_t *brl, int *count)
+{
+	int status = 0;
+
+	pthread_mutex_lock (&brl->mutex);
+	if (brl->w_active && pthread_equal (brl->w_owner, pthread_self ())) {
+		pthread_mutex_unlock (&brl->mutex);
+		return 0;
+	}
+	__atomic_store_n (count, 0, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast (&brl->write);
+	pthread_cleanup_push (brl_unlockcleanup, (void*)brl);
+	while (brl->writer) {
+		status = pthread_cond_wait (&brl->read, &brl->mutex);
+		if (status != 0)
+			break;
+	}
+	pthread_cleanup_pop (0);
+	/* writers set the flag under the mutex, so the next one will
+	 * see this count when it scans. */
+	if (status == 0)
+		__atomic_store_n (count, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock (&brl->mutex);
+	return status;
+}
+
+/*
+ * Lock a reader-biased lock for read access.
+ */
+int brl_readlock (brlock_t *brl)
+{
+	brl_thread *t = brl_self;
+	int *count, n;
+
+	if (!t && !(t = brl_register ()))
+		return ENOMEM;
+	count = &t->count[brl->index];
+	n = __atomic_load_n (count, __ATOMIC_RELAXED);
+	if (n > 0) {
+		/* we already hold it, so no writer can get in */
+		__atomic_store_n (count, n + 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_store_n (count, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n (&brl->writer, __ATOMIC_SEQ_CST))
+		return 0;
+	return brl_readwait (brl, count);
+}
+
+/*
+ * Unlock a reader-biased lock from read access.
+ */
+int brl_readunlock (brlock_t *brl)
+{
+	int *count = &brl_self->count[brl->index];
+	int n = __atomic_load_n (count, __ATOMIC_RELAXED);
+
+	if (n > 1) {
+		__atomic_store_n (count, n - 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	__atomic_store_n (count, 0, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&brl->writer, __ATOMIC_SEQ_CST) ||
+	    __atomic_load_n (&brl->w_wait, __ATOMIC_SEQ_CST)) {
+		/* a writer might be waiting for us */
+		pthread_mutex_lock (&brl->mutex);
+		pthread_cond_broadcast (&brl->write);
+		pthread_mutex_unlock (&brl->mutex);
+	}
+	return 0;
+}
+
+/*
+ * Handle cleanup when a writer is cancelled while waiting: it isn't
+ * waiting anymore.
+ */
+static void brl_writecleanup (void *arg)
+{
+	brlock_t *brl = (brlock_t *)arg;
+
+	__atomic_store_n (&brl->w_wait, brl->w_wait - 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock (&brl->mutex);
+}
+
+/*
+ * Lock a reader-biased lock for write access.
+ */
+int brl_writelock (brlock_t *brl)
+{
+	int status = 0;
+
+	pthread_mutex_lock (&brl->mutex);
+	if (brl->w_active && pthread_equal (brl->w_owner, pthread_self ())) {
+		brl->w_active++;
+		pthread_mutex_unlock (&brl->mutex);
+		return 0;
+	}
+
+	/* announce ourselves before looking, so that a reader leaving after
+	 * we look knows to wake us */
+	__atomic_store_n (&brl->w_wait, brl->w_wait + 1, __ATOMIC_SEQ_CST);
+	pthread_cleanup_push (brl_writecleanup, (void*)brl);
+	for (;;) {
+		/* the flag is only up outside the mutex while another writer
+		 * holds the lock */
+		if (!brl->writer) {
+			__atomic_store_n (&brl->writer, 1, __ATOMIC_SEQ_CST);
+			if (!brl_readers (brl))
+				break;
+			/* someone's reading, so let readers carry on while we
+			 * wait */
+			__atomic_store_n (&brl->writer, 0, __ATOMIC_SEQ_CST);
+			pthread_cond_broadcast (&brl->read);
+		}
+		status = pthread_cond_wait (&brl->write, &brl->mutex);
+		if (status != 0)
+			break;
+	}
+	pthread_cleanup_pop (status != 0);
+	if (status != 0)
+		return status;
+	__atomic_store_n (&brl->w_wait, brl->w_wait - 1, __ATOMIC_SEQ_CST);
+
+	brl->w_active = 1;
+	brl->w_owner = pthread_self ();
+	pthread_mutex_unlock (&brl->mutex);
+	return 0;
+}
+
+/*
+ * Unlock a reader-biased lock from write access.
+ */
+int brl_writeunlock (brlock_t *brl)
+{
+	pthread_mutex_lock (&brl->mutex);
+	if (--brl->w_active == 0) {
+		__atomic_store_n (&brl->writer, 0, __ATOMIC_SEQ_CST);
+		pthread_cond_broadcast (&brl->read);
+		pthread_cond_broadcast (&brl->write);
+	}
+	pthread_mutex_unlock (&brl->mutex);
+	return 0;
+}
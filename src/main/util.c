@@ -23,6 +23,7 @@
 #endif
 
 #include "pthread.h"
+#include <sched.h>
 
 /* make sure to get the prototypes for thread functions instead of macros */
 #define USE_PROTOTYPES
@@ -321,15 +322,32 @@ void wrap_text(const char *txt, int mlen, char delim,
 
 #define LINKSATONCE 510 /* enough to almost fill a page */
 
+/* how many links a thread's cache takes from or gives back to the
+ * global pool at once */
+#define LINKCACHEBATCH 64
+
 static Link *freelinks = NULL;
+local LinkStats linkstats;
 
 #ifdef _REENTRANT
 
 local pthread_mutex_t freelinkmtx = PTHREAD_MUTEX_INITIALIZER;
 
-#define LOCK_FREE() pthread_mutex_lock(&freelinkmtx)
+#define LOCK_FREE() \
+	do { \
+		if (pthread_mutex_trylock(&freelinkmtx) != 0) \
+		{ \
+			pthread_mutex_lock(&freelinkmtx); \
+			linkstats.lockwaits++; \
+		} \
+	} while (0)
 #define UNLOCK_FREE() pthread_mutex_unlock(&freelinkmtx)
 
+#ifdef __GNUC__
+/* give each thread its own cache of links in front of the global pool */
+#define USE_LINK_CACHE
+#endif
+
 #else
 
 #define LOCK_FREE()
@@ -337,6 +355,7 @@ local pthread_mutex_t freelinkmtx = PTHREAD_MUTEX_INITIALIZER;
 
 #endif
 
+/* call with the global pool locked */
 local void GetSomeLinks(void)
 {
 	Link *mem, *start;
@@ -347,8 +366,119 @@ local void GetSomeLinks(void)
 		mem->next = mem + 1;
 	mem->next = freelinks;
 	freelinks = start;
+	linkstats.chunks++;
+}
+
+#ifdef USE_LINK_CACHE
+
+typedef struct LinkCache
+{
+	Link *head;
+	int count, registered;
+	/* collected into linkstats whenever we touch the global pool */
+	unsigned long allocs, frees;
+} LinkCache;
+
+local __thread LinkCache linkcache;
+local pthread_key_t linkcachekey;
+local pthread_once_t linkcacheonce = PTHREAD_ONCE_INIT;
+
+/* call with the global pool locked */
+local void flush_link_stats(LinkCache *c)
+{
+	linkstats.allocs += c->allocs;
+	linkstats.frees += c->frees;
+	c->allocs = c->frees = 0;
+}
+
+/* moves n links from a cache to the global pool. call with the global
+ * pool locked. */
+local void spill_links(LinkCache *c, int n)
+{
+	Link *start = c->head, *end = start;
+	int i;
+
+	for (i = 1; i < n; i++)
+		end = end->next;
+	c->head = end->next;
+	c->count -= n;
+	end->next = freelinks;
+	freelinks = start;
+}
+
+/* gives everything back when a thread exits */
+local void link_cache_exit(void *v)
+{
+	LinkCache *c = v;
+	LOCK_FREE();
+	flush_link_stats(c);
+	if (c->count)
+		spill_links(c, c->count);
+	UNLOCK_FREE();
+}
+
+local void link_cache_key_init(void)
+{
+	pthread_key_create(&linkcachekey, link_cache_exit);
+}
+
+local void refill_links(LinkCache *c)
+{
+	if (!c->registered)
+	{
+		pthread_once(&linkcacheonce, link_cache_key_init);
+		pthread_setspecific(linkcachekey, c);
+		c->registered = TRUE;
+	}
+
+	LOCK_FREE();
+	flush_link_stats(c);
+	linkstats.refills++;
+	while (c->count < LINKCACHEBATCH)
+	{
+		Link *l;
+		if (!freelinks) GetSomeLinks();
+		l = freelinks;
+		freelinks = l->next;
+		l->next = c->head;
+		c->head = l;
+		c->count++;
+	}
+	UNLOCK_FREE();
+}
+
+local inline Link *GetALink(void)
+{
+	LinkCache *c = &linkcache;
+	Link *ret;
+
+	if (!c->head) refill_links(c);
+	ret = c->head;
+	c->head = ret->next;
+	c->count--;
+	c->allocs++;
+	return ret;
+}
+
+local inline void FreeALink(Link *l)
+{
+	LinkCache *c = &linkcache;
+
+	l->next = c->head;
+	c->head = l;
+	c->frees++;
+	if (++c->count >= 2 * LINKCACHEBATCH)
+	{
+		LOCK_FREE();
+		flush_link_stats(c);
+		linkstats.spills++;
+		spill_links(c, LINKCACHEBATCH);
+		UNLOCK_FREE();
+	}
 }
 
+#else
+
 local inline Link *GetALink(void)
 {
 	Link *ret;
@@ -356,6 +486,7 @@ local inline Link *GetALink(void)
 	if (!freelinks) GetSomeLinks();
 	ret = freelinks;
 	freelinks = freelinks->next;
+	linkstats.allocs++;
 	UNLOCK_FREE();
 	return ret;
 }
@@ -365,6 +496,16 @@ local inline void FreeALink(Link *l)
 	LOCK_FREE();
 	l->next = freelinks;
 	freelinks = l;
+	linkstats.frees++;
+	UNLOCK_FREE();
+}
+
+#endif
+
+void LLGetStats(LinkStats *stats)
+{
+	LOCK_FREE();
+	*stats = linkstats;
 	UNLOCK_FREE();
 }
 
@@ -380,6 +521,12 @@ local inline void FreeALink(Link *l)
 	afree(l);
 }
 
+void LLGetStats(LinkStats *stats)
+{
+	/* we don't keep track without the free list */
+	memset(stats, 0, sizeof(*stats));
+}
+
 #endif
 
 
@@ -401,25 +548,12 @@ void LLEmpty(LinkedList *lst)
 {
 	Link *n = lst->start, *t;
 
-#ifdef CFG_USE_FREE_LINK_LIST
-	if (n)
-	{
-		LOCK_FREE();
-		t = freelinks;
-		freelinks = n;
-		while (n->next)
-			n = n->next;
-		n->next = t;
-		UNLOCK_FREE();
-	}
-#else
 	while (n)
 	{
 		t = n->next;
-		afree(n);
+		FreeALink(n);
 		n = t;
 	}
-#endif
 	lst->start = lst->end = NULL;
 }
 
@@ -1461,6 +1595,137 @@ void MPClearOne(MPQueue *q, void *data)
 #endif /* MPQUEUE */
 
 
+#ifndef NOMPSCQUEUE
+
+/* this is the usual bounded ring with a sequence number in each cell.
+ * a cell's seq equals the slot position when it's free for a producer
+ * to claim, and position + 1 once the producer has filled it in.
+ * producers claim slots by bumping tail with a cas, so they never wait
+ * on each other except when the queue is full. */
+
+void MPSCInit(MPSCQueue *q, int size)
+{
+	unsigned long i, n = 2;
+
+	while (n < (unsigned long)size)
+		n <<= 1;
+
+	memset(q, 0, sizeof(*q));
+	q->cells = amalloc(n * sizeof(*q->cells));
+	q->mask = n - 1;
+	for (i = 0; i < n; i++)
+		q->cells[i].seq = i;
+
+	pthread_mutex_init(&q->mtx, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+void MPSCDestroy(MPSCQueue *q)
+{
+	afree(q->cells);
+	q->cells = NULL;
+	pthread_mutex_destroy(&q->mtx);
+	pthread_cond_destroy(&q->cond);
+}
+
+int MPSCTryAdd(MPSCQueue *q, void *data)
+{
+	struct MPSCCell *cell;
+	unsigned long pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+	for (;;)
+	{
+		long diff;
+		cell = &q->cells[pos & q->mask];
+		diff = (long)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, TRUE,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			/* the consumer hasn't gotten to this one yet */
+			return FALSE;
+		else
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	}
+
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the fence in MPSCRemove: either we see that the
+	 * consumer is going to sleep, or it sees our item. */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->sleeping, __ATOMIC_RELAXED))
+	{
+		pthread_mutex_lock(&q->mtx);
+		__atomic_store_n(&q->sleeping, FALSE, __ATOMIC_RELAXED);
+		pthread_cond_signal(&q->cond);
+		pthread_mutex_unlock(&q->mtx);
+	}
+
+	return TRUE;
+}
+
+void MPSCAdd(MPSCQueue *q, void *data)
+{
+	while (!MPSCTryAdd(q, data))
+		sched_yield();
+}
+
+local int mpsc_take(MPSCQueue *q, void **data)
+{
+	unsigned long pos = q->head;
+	struct MPSCCell *cell = &q->cells[pos & q->mask];
+
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return FALSE;
+
+	*data = cell->data;
+	/* hand the cell back to producers for the next lap */
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+	q->head = pos + 1;
+	return TRUE;
+}
+
+void * MPSCTryRemove(MPSCQueue *q)
+{
+	void *data;
+	return mpsc_take(q, &data) ? data : NULL;
+}
+
+void * MPSCRemove(MPSCQueue *q)
+{
+	void *data;
+
+	while (!mpsc_take(q, &data))
+	{
+		__atomic_store_n(&q->sleeping, TRUE, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		/* check again now that producers will wake us */
+		if (mpsc_take(q, &data))
+		{
+			__atomic_store_n(&q->sleeping, FALSE, __ATOMIC_RELAXED);
+			break;
+		}
+
+		/* cond_wait is a cancellation point, so unlock on the way
+		 * out, like MPRemove does. */
+		pthread_cleanup_push((void(*)(void*)) pthread_mutex_unlock, (void*) &q->mtx);
+			pthread_mutex_lock(&q->mtx);
+			while (__atomic_load_n(&q->sleeping, __ATOMIC_RELAXED))
+				pthread_cond_wait(&q->cond, &q->mtx);
+		pthread_cleanup_pop(1);
+	}
+
+	return data;
+}
+
+#endif /* MPSCQUEUE */
+
+
 #ifndef NOMMAP
 
 typedef struct PrivMMD
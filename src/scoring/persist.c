@@ -2,6 +2,7 @@
 /* dist: public */
 
 #include <string.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <assert.h>
@@ -35,6 +36,14 @@
 
 #define MAXPERSISTLENGTH CFG_MAX_PERSIST_LENGTH
 
+/* how many queued commands can be written together */
+#define MAX_BATCH 256
+
+/* cdsgroup_begin showed up in 4.5 */
+#if DB_VERSION_MAJOR > 4 || DB_VERSION_MINOR >= 5
+#define CDS_GROUPS
+#endif
+
 
 typedef enum db_command
 {
@@ -47,7 +56,8 @@ typedef enum db_command
 	DBCMD_PUTALL,      /* no params */
 	DBCMD_ENDINTERVAL, /* agorname = ag (for shared) or name (nonshared), data2 = interval */
 	DBCMD_GET_GENERIC,
-	DBCMD_PUT_GENERIC
+	DBCMD_PUT_GENERIC,
+	DBCMD_QUIT         /* no params */
 } db_command;
 
 /* structs */
@@ -68,8 +78,27 @@ typedef struct DBMessage
 	int vallen;
 	void (*gencb)(void *clos, int result);
 	void *clos;
+	int result;
+	/* when it was queued, for batch timing */
+	ticks_t queued;
 } DBMessage;
 
+/* a put or delete waiting to be written with the rest of its batch.
+ * the data is copied out while holding whatever locks protect it, and
+ * the db is only touched after they're released. */
+typedef struct PendingPut
+{
+	/* if this isn't -1, the key's serial number is at this offset, and
+	 * gets looked up from ag and interval just before writing. */
+	int serialoff;
+	char ag[MAXAGLEN];
+	int interval;
+	/* for generic puts, which want to know if it worked */
+	DBMessage *msg;
+	int keylen, vallen; /* vallen of 0 means delete */
+	byte data[1]; /* the key, then the value */
+} PendingPut;
+
 /* private data */
 
 local Imodman *mm;
@@ -80,7 +109,7 @@ local Imainloop *ml;
 local Iarenaman *aman;
 
 local pthread_t dbthread;
-local MPQueue dbq;
+local MPSCQueue dbq;
 
 local pthread_mutex_t dbmtx = PTHREAD_MUTEX_INITIALIZER;
 /* this mutex protects these vars */
@@ -98,6 +127,10 @@ local DB *db;
 
 local int cfg_syncseconds;
 
+/* PendingPuts. only the db thread touches this. */
+local LinkedList batch = LL_INITIALIZER;
+local int batchlen;
+
 
 
 local void fill_in_ag(char buf[MAXAGLEN], Arena *arena, int interval)
@@ -112,11 +145,25 @@ local void fill_in_ag(char buf[MAXAGLEN], Arena *arena, int interval)
 }
 
 
+local PendingPut * queue_put(const void *key, int keylen, const void *val, int vallen)
+{
+	PendingPut *pp = amalloc(sizeof(*pp) + keylen + (vallen > 0 ? vallen : 0));
+
+	pp->serialoff = -1;
+	pp->keylen = keylen;
+	pp->vallen = vallen > 0 ? vallen : 0;
+	memcpy(pp->data, key, keylen);
+	if (vallen > 0)
+		memcpy(pp->data + keylen, val, vallen);
+	LLAdd(&batch, pp);
+	batchlen++;
+	return pp;
+}
+
+
 local void put_serialno(const char *sg, int interval, unsigned int serialno)
 {
 	struct current_serial_record_key curr;
-	int err;
-	DBT key, val;
 
 	memset(&curr, 0, sizeof(curr));
 	strncpy(curr.arenagrp, sg, sizeof(curr.arenagrp));
@@ -125,17 +172,7 @@ local void put_serialno(const char *sg, int interval, unsigned int serialno)
 	curr.rectype = ASSS_DB_SERIAL_RECTYPE;
 #endif
 
-	memset(&key, 0, sizeof(key));
-	key.data = &curr;
-	key.size = sizeof(curr);
-	memset(&val, 0, sizeof(val));
-	val.data = &serialno;
-	val.size = sizeof(serialno);
-
-	err = db->put(db, NULL, &key, &val, 0);
-	if (err)
-		lm->Log(L_WARN, "<persist> db->put error (1): %s",
-				db_strerror(err));
+	queue_put(&curr, sizeof(curr), &serialno, sizeof(serialno));
 }
 
 local unsigned int get_serialno(const char *sg, int interval)
@@ -189,8 +226,8 @@ local void put_one_arena(ArenaPersistentData *data, Arena *arena, int serialno)
 {
 	byte buf[MAXPERSISTLENGTH];
 	struct arena_record_key keydata;
-	int size, err;
-	DBT key, val;
+	PendingPut *pp;
+	int size;
 
 	/* check correct scope */
 	if ((data->scope == PERSIST_GLOBAL && arena != NULL) ||
@@ -201,43 +238,21 @@ local void put_one_arena(ArenaPersistentData *data, Arena *arena, int serialno)
 	memset(&keydata, 0, sizeof(keydata));
 	fill_in_ag(keydata.arena, arena, data->interval);
 	keydata.interval = data->interval;
-	if (serialno == -1)
-		keydata.serialno = get_serialno(keydata.arena, data->interval);
-	else
-		keydata.serialno = serialno;
+	keydata.serialno = serialno;
 	keydata.key = data->key;
 #ifdef USE_RECTYPES
 	keydata.rectype = ASSS_DB_ARENA_RECTYPE;
 #endif
 
-	/* prepare key dbt */
-	memset(&key, 0, sizeof(key));
-	key.data = &keydata;
-	key.size = sizeof(keydata);
-
-	/* get data */
+	/* get data. a size of 0 deletes the record. */
 	size = data->GetData(arena, buf, sizeof(buf), data->clos);
 
-	if (size > 0)
-	{
-		/* prepare val dbt */
-		memset(&val, 0, sizeof(val));
-		val.data = buf;
-		val.size = size;
-
-		/* put in db */
-		err = db->put(db, NULL, &key, &val, 0);
-
-		if (err)
-			lm->Log(L_WARN, "<persist> db->put error (2): %s",
-					db_strerror(err));
-	}
-	else
+	pp = queue_put(&keydata, sizeof(keydata), buf, size);
+	if (serialno == -1)
 	{
-		err = db->del(db, NULL, &key, 0);
-		if (err != 0 && err != DB_NOTFOUND)
-			lm->Log(L_WARN, "<persist> db->del error (1): %s",
-					db_strerror(err));
+		pp->serialoff = offsetof(struct arena_record_key, serialno);
+		astrncpy(pp->ag, keydata.arena, sizeof(pp->ag));
+		pp->interval = data->interval;
 	}
 }
 
@@ -246,8 +261,8 @@ local void put_one_player(PlayerPersistentData *data, Player *p, Arena *arena, i
 {
 	byte buf[MAXPERSISTLENGTH];
 	struct player_record_key keydata;
-	int size, err;
-	DBT key, val;
+	PendingPut *pp;
+	int size;
 
 	/* check correct scope */
 	if ((data->scope == PERSIST_GLOBAL && arena != NULL) ||
@@ -260,43 +275,21 @@ local void put_one_player(PlayerPersistentData *data, Player *p, Arena *arena, i
 	ToLowerStr(keydata.name);
 	keydata.interval = data->interval;
 	fill_in_ag(keydata.arenagrp, arena, data->interval);
-	if (serialno == -1)
-		keydata.serialno = get_serialno(keydata.arenagrp, data->interval);
-	else
-		keydata.serialno = serialno;
+	keydata.serialno = serialno;
 	keydata.key = data->key;
 #ifdef USE_RECTYPES
 	keydata.rectype = ASSS_DB_ARENA_RECTYPE;
 #endif
 
-	/* prepare key dbt */
-	memset(&key, 0, sizeof(key));
-	key.data = &keydata;
-	key.size = sizeof(keydata);
-
-	/* get data */
+	/* get data. a size of 0 deletes the record. */
 	size = data->GetData(p, buf, sizeof(buf), data->clos);
 
-	if (size > 0)
-	{
-		/* prepare val dbt */
-		memset(&val, 0, sizeof(val));
-		val.data = buf;
-		val.size = size;
-
-		/* put in db */
-		err = db->put(db, NULL, &key, &val, 0);
-
-		if (err)
-			lm->Log(L_WARN, "<persist> db->put error (3): %s",
-					db_strerror(err));
-	}
-	else
+	pp = queue_put(&keydata, sizeof(keydata), buf, size);
+	if (serialno == -1)
 	{
-		err = db->del(db, NULL, &key, 0);
-		if (err != 0 && err != DB_NOTFOUND)
-			lm->Log(L_WARN, "<persist> db->del error (2): %s",
-					db_strerror(err));
+		pp->serialoff = offsetof(struct player_record_key, serialno);
+		astrncpy(pp->ag, keydata.arenagrp, sizeof(pp->ag));
+		pp->interval = data->interval;
 	}
 }
 
@@ -450,7 +443,9 @@ local void do_end_interval(const char *ag, int interval)
 		statmax = S_WAIT_ARENA_SYNC2;
 	}
 
-	/* first get/clear all data for players in these arenas */
+	/* first get/clear all data for players in these arenas. this only
+	 * copies it into the batch, which is written after all the locks
+	 * are released. */
 	pd->Lock();
 	FOR_EACH_PLAYER(p)
 	{
@@ -541,135 +536,253 @@ local int get_generic(DBMessage *msg)
 	return err == 0;
 }
 
-local int put_generic(DBMessage *msg)
+local void put_generic(DBMessage *msg)
 {
-	DBT key, val;
-	int err;
-
-	memset(&key, 0, sizeof(key));
-	key.data = msg->key;
-	key.size = msg->keylen;
-	memset(&val, 0, sizeof(val));
-	val.data = msg->val;
-	val.size = msg->vallen;
-
-	err = db->put(db, NULL, &key, &val, 0);
+	/* the result is filled in when the batch is written */
+	queue_put(msg->key, msg->keylen, msg->val, msg->vallen)->msg = msg;
+	msg->result = TRUE;
 
 	afree(msg->key);
 	afree(msg->val);
+}
+
+
+/* writes everything in the batch, using one cds group if we can so the
+ * db's write lock is taken once instead of once per record. */
+local void write_batch(ticks_t queued, ticks_t started)
+{
+	DB_TXN *group = NULL;
+	ticks_t writing, done;
+	int count = batchlen, failed = 0, err;
+	Link *l;
+
+	if (count == 0)
+		return;
+
+	writing = current_millis();
 
-	if (err)
-		lm->Log(L_WARN, "<persist> db->put error (4): %s",
+	/* look up serial numbers first. reads outside the group would wait
+	 * for its write lock. */
+	for (l = LLGetHead(&batch); l; l = l->next)
+	{
+		PendingPut *pp = l->data;
+		if (pp->serialoff != -1)
+		{
+			unsigned int serialno = get_serialno(pp->ag, pp->interval);
+			memcpy(pp->data + pp->serialoff, &serialno, sizeof(serialno));
+		}
+	}
+
+#ifdef CDS_GROUPS
+	if ((err = dbenv->cdsgroup_begin(dbenv, &group)))
+	{
+		lm->Log(L_WARN, "<persist> cdsgroup_begin error: %s",
 				db_strerror(err));
+		group = NULL;
+	}
+#endif
 
-	return err == 0;
+	for (l = LLGetHead(&batch); l; l = l->next)
+	{
+		PendingPut *pp = l->data;
+		DBT key, val;
+
+		memset(&key, 0, sizeof(key));
+		key.data = pp->data;
+		key.size = pp->keylen;
+
+		if (pp->vallen > 0)
+		{
+			memset(&val, 0, sizeof(val));
+			val.data = pp->data + pp->keylen;
+			val.size = pp->vallen;
+
+			err = db->put(db, group, &key, &val, 0);
+			if (err)
+				lm->Log(L_WARN, "<persist> db->put error (1): %s",
+						db_strerror(err));
+		}
+		else
+		{
+			err = db->del(db, group, &key, 0);
+			if (err == DB_NOTFOUND)
+				err = 0;
+			else if (err)
+				lm->Log(L_WARN, "<persist> db->del error (1): %s",
+						db_strerror(err));
+		}
+
+		if (err)
+		{
+			failed++;
+			if (pp->msg)
+				pp->msg->result = FALSE;
+		}
+	}
+
+	if (group && (err = group->commit(group, 0)))
+		lm->Log(L_WARN, "<persist> cds group commit error: %s",
+				db_strerror(err));
+
+	LLEnum(&batch, afree);
+	LLEmpty(&batch);
+	batchlen = 0;
+
+	done = current_millis();
+	lm->Log(L_DRIVEL, "<persist> wrote %d records (%d failed): "
+			"queued %d ms, collected in %d ms, written in %d ms",
+			count, failed,
+			TICK_DIFF(started, queued),
+			TICK_DIFF(writing, started),
+			TICK_DIFF(done, writing));
 }
 
 
-local void *DBThread(void *dummy)
+local void do_command(DBMessage *msg)
 {
-	DBMessage *msg;
 	Link *l, *link;
 	Arena *arena;
 	Player *i;
-	int result;
 
-	for (;;)
+	switch (msg->command)
 	{
-		/* get next command */
-		msg = MPRemove(&dbq);
-
-		/* break on null */
-		if (!msg) break;
-
-		result = 0;
+		case DBCMD_NULL:
+		case DBCMD_QUIT:
+			break;
+
+		case DBCMD_GET_PLAYER:
+			for (l = LLGetHead(&playerpd); l; l = l->next)
+				get_one_player(l->data, msg->p, msg->arena, -1);
+			break;
+
+		case DBCMD_PUT_PLAYER:
+			do_put_player(msg->p, msg->arena);
+			break;
+
+		case DBCMD_GET_ARENA:
+			for (l = LLGetHead(&arenapd); l; l = l->next)
+				get_one_arena(l->data, msg->arena, -1);
+			break;
+
+		case DBCMD_PUT_ARENA:
+			for (l = LLGetHead(&arenapd); l; l = l->next)
+				put_one_arena(l->data, msg->arena, -1);
+			break;
+
+		case DBCMD_PUTALL:
+			/* try to sync all players */
+			pd->Lock();
+			FOR_EACH_PLAYER(i)
+				if (i->status == S_PLAYING)
+				{
+					do_put_player(i, NULL); /* global */
+					if (i->arena)
+						do_put_player(i, i->arena);
+				}
+			pd->Unlock();
+
+			/* now sync all arenas */
+			aman->Lock();
+			FOR_EACH_ARENA(arena)
+				if (arena->status == ARENA_RUNNING)
+					for (l = LLGetHead(&arenapd); l; l = l->next)
+						put_one_arena(l->data, arena, -1);
+			aman->Unlock();
+
+			/* now global data */
+			for (l = LLGetHead(&arenapd); l; l = l->next)
+				put_one_arena(l->data, NULL, -1);
+			break;
+
+		case DBCMD_SYNCWAIT:
+			db->sync(db, 0);
+			/* make sure nobody modifies db's for some time */
+			pthread_mutex_unlock(&dbmtx);
+			sleep(msg->data);
+			pthread_mutex_lock(&dbmtx);
+			break;
+
+		case DBCMD_ENDINTERVAL:
+			do_end_interval(msg->agorname, msg->data);
+			break;
+
+		case DBCMD_GET_GENERIC:
+			msg->result = get_generic(msg);
+			break;
+
+		case DBCMD_PUT_GENERIC:
+			put_generic(msg);
+			break;
+	}
+}
 
-		/* lock data descriptor lists */
-		pthread_mutex_lock(&dbmtx);
 
-		/* and do something with it */
-		switch (msg->command)
-		{
-			case DBCMD_NULL:
-				break;
+/* commands that only add to the batch, so several in a row can be
+ * written together. anything that reads from the db has to see the
+ * batch written first. */
+local int can_batch(DBMessage *msg)
+{
+	return msg->command == DBCMD_PUT_PLAYER ||
+	       msg->command == DBCMD_PUT_ARENA ||
+	       msg->command == DBCMD_PUT_GENERIC ||
+	       msg->command == DBCMD_PUTALL;
+}
 
-			case DBCMD_GET_PLAYER:
-				for (l = LLGetHead(&playerpd); l; l = l->next)
-					get_one_player(l->data, msg->p, msg->arena, -1);
-				break;
 
-			case DBCMD_PUT_PLAYER:
-				do_put_player(msg->p, msg->arena);
-				break;
+local void *DBThread(void *dummy)
+{
+	LinkedList done = LL_INITIALIZER;
+	DBMessage *msg, *next = NULL;
+	ticks_t started;
+	int count, quit = FALSE;
+	Link *l;
 
-			case DBCMD_GET_ARENA:
-				for (l = LLGetHead(&arenapd); l; l = l->next)
-					get_one_arena(l->data, msg->arena, -1);
-				break;
+	while (!quit)
+	{
+		/* get next command, unless one was left over from the last
+		 * batch */
+		msg = next ? next : MPSCRemove(&dbq);
+		next = NULL;
 
-			case DBCMD_PUT_ARENA:
-				for (l = LLGetHead(&arenapd); l; l = l->next)
-					put_one_arena(l->data, msg->arena, -1);
-				break;
-
-			case DBCMD_PUTALL:
-				/* try to sync all players */
-				pd->Lock();
-				FOR_EACH_PLAYER(i)
-					if (i->status == S_PLAYING)
-					{
-						do_put_player(i, NULL); /* global */
-						if (i->arena)
-							do_put_player(i, i->arena);
-					}
-				pd->Unlock();
+		/* lock data descriptor lists */
+		pthread_mutex_lock(&dbmtx);
 
-				/* now sync all arenas */
-				aman->Lock();
-				FOR_EACH_ARENA(arena)
-					if (arena->status == ARENA_RUNNING)
-						for (l = LLGetHead(&arenapd); l; l = l->next)
-							put_one_arena(l->data, arena, -1);
-				aman->Unlock();
+		/* and do something with it */
+		started = current_millis();
+		do_command(msg);
+		LLAdd(&done, msg);
+		quit = msg->command == DBCMD_QUIT;
+
+		/* puts that are already waiting go in the same batch */
+		count = 1;
+		if (can_batch(msg))
+			while (count < MAX_BATCH && (next = MPSCTryRemove(&dbq)) && can_batch(next))
+			{
+				do_command(next);
+				LLAdd(&done, next);
+				next = NULL;
+				count++;
+			}
 
-				/* now global data */
-				for (l = LLGetHead(&arenapd); l; l = l->next)
-					put_one_arena(l->data, NULL, -1);
-				break;
-
-			case DBCMD_SYNCWAIT:
-				db->sync(db, 0);
-				/* make sure nobody modifies db's for some time */
-				pthread_mutex_unlock(&dbmtx);
-				sleep(msg->data);
-				pthread_mutex_lock(&dbmtx);
-				break;
-
-			case DBCMD_ENDINTERVAL:
-				do_end_interval(msg->agorname, msg->data);
-				break;
-
-			case DBCMD_GET_GENERIC:
-				result = get_generic(msg);
-				break;
-
-			case DBCMD_PUT_GENERIC:
-				result = put_generic(msg);
-				break;
-		}
+		write_batch(msg->queued, started);
 
 		/* and unlock */
 		pthread_mutex_unlock(&dbmtx);
 
 		/* if we were looking for notification, notify */
-		if (msg->playercb) msg->playercb(msg->p);
-		if (msg->arenacb) msg->arenacb(msg->arena);
-		if (msg->gencb) msg->gencb(msg->clos, result);
-		if (msg->command == DBCMD_ENDINTERVAL)
-			DO_CBS(CB_INTERVAL_ENDED, ALLARENAS, EndIntervalFunc, ());
+		for (l = LLGetHead(&done); l; l = l->next)
+		{
+			DBMessage *m = l->data;
+			if (m->playercb) m->playercb(m->p);
+			if (m->arenacb) m->arenacb(m->arena);
+			if (m->gencb) m->gencb(m->clos, m->result);
+			if (m->command == DBCMD_ENDINTERVAL)
+				DO_CBS(CB_INTERVAL_ENDED, ALLARENAS, EndIntervalFunc, ());
+		}
 
-		/* free the message */
-		afree(msg);
+		/* free the messages */
+		LLEnum(&done, afree);
+		LLEmpty(&done);
 
 		/* and give up some time */
 		usleep(1000);
@@ -679,6 +792,15 @@ local void *DBThread(void *dummy)
 }
 
 
+local DBMessage * new_msg(db_command command)
+{
+	DBMessage *msg = amalloc(sizeof(*msg));
+	msg->command = command;
+	msg->queued = current_millis();
+	return msg;
+}
+
+
 /* interface funcs */
 
 local void RegPlayerPD(const PlayerPersistentData *pd)
@@ -717,55 +839,50 @@ local void UnregArenaPD(const ArenaPersistentData *pd)
 
 local void PutPlayer(Player *p, Arena *arena, void (*callback)(Player *p))
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_PUT_PLAYER);
 
-	msg->command = DBCMD_PUT_PLAYER;
 	msg->p = p;
 	msg->arena = arena;
 	msg->playercb = callback;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void GetPlayer(Player *p, Arena *arena, void (*callback)(Player *p))
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_GET_PLAYER);
 
-	msg->command = DBCMD_GET_PLAYER;
 	msg->p = p;
 	msg->arena = arena;
 	msg->playercb = callback;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void PutArena(Arena *arena, void (*callback)(Arena *a))
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_PUT_ARENA);
 
-	msg->command = DBCMD_PUT_ARENA;
 	msg->arena = arena;
 	msg->arenacb = callback;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void GetArena(Arena *arena, void (*callback)(Arena *a))
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_GET_ARENA);
 
-	msg->command = DBCMD_GET_ARENA;
 	msg->arena = arena;
 	msg->arenacb = callback;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void EndInterval(const char *agorname, Arena *arena, int interval)
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_ENDINTERVAL);
 
-	msg->command = DBCMD_ENDINTERVAL;
 	if (agorname)
 		astrncpy(msg->agorname, agorname, sizeof(msg->agorname));
 	else if (arena)
@@ -782,38 +899,33 @@ local void EndInterval(const char *agorname, Arena *arena, int interval)
 		astrncpy(msg->agorname, AG_GLOBAL, sizeof(msg->agorname));
 	msg->data = interval;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void StabilizeScores(int seconds, int query, void (*callback)(Player *dummy))
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg;
 
 	if (query)
-	{
-		DBMessage *msg2 = amalloc(sizeof(*msg2));
-		msg2->command = DBCMD_PUTALL;
-		MPAdd(&dbq, msg2);
-	}
+		MPSCAdd(&dbq, new_msg(DBCMD_PUTALL));
 
-	msg->command = DBCMD_SYNCWAIT;
+	msg = new_msg(DBCMD_SYNCWAIT);
 	msg->data = seconds;
 	msg->playercb = callback;
 
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 
 local int SyncTimer(void *dummy)
 {
-	DBMessage *msg = amalloc(sizeof(*msg));
-	msg->command = DBCMD_PUTALL;
-	MPAdd(&dbq, msg);
+	DBMessage *msg;
+
+	MPSCAdd(&dbq, new_msg(DBCMD_PUTALL));
 
-	msg = amalloc(sizeof(*msg));
-	msg->command = DBCMD_SYNCWAIT;
+	msg = new_msg(DBCMD_SYNCWAIT);
 	msg->data = 0;
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 
 	lm->Log(L_DRIVEL, "<persist> collecting all persistent data and syncing to disk");
 
@@ -828,7 +940,7 @@ local void GetGeneric(
 			void *clos)
 {
 	struct generic_record_key_suffix suffix;
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_GET_GENERIC);
 	byte *newkey = amalloc(keylen + sizeof(suffix));
 
 	suffix.key = typekey;
@@ -836,14 +948,13 @@ local void GetGeneric(
 	memcpy(newkey, key, keylen);
 	memcpy(newkey+keylen, &suffix, sizeof(suffix));
 
-	msg->command = DBCMD_GET_GENERIC;
 	msg->key = newkey;
 	msg->keylen = keylen + sizeof(suffix);
 	msg->val = val;
 	msg->vallen = vallen;
 	msg->gencb = callback;
 	msg->clos = clos;
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 local void PutGeneric(
@@ -854,7 +965,7 @@ local void PutGeneric(
 			void *clos)
 {
 	struct generic_record_key_suffix suffix;
-	DBMessage *msg = amalloc(sizeof(*msg));
+	DBMessage *msg = new_msg(DBCMD_PUT_GENERIC);
 	byte *newkey = amalloc(keylen + sizeof(suffix));
 	byte *newval = amalloc(vallen);
 
@@ -864,14 +975,13 @@ local void PutGeneric(
 	memcpy(newkey+keylen, &suffix, sizeof(suffix));
 	memcpy(newval, val, vallen);
 
-	msg->command = DBCMD_PUT_GENERIC;
 	msg->key = newkey;
 	msg->keylen = keylen + sizeof(suffix);
 	msg->val = newval;
 	msg->vallen = vallen;
 	msg->gencb = callback;
 	msg->clos = clos;
-	MPAdd(&dbq, msg);
+	MPSCAdd(&dbq, msg);
 }
 
 
@@ -1008,7 +1118,7 @@ EXPORT int MM_persist(int action, Imodman *mm_, Arena *arena)
 
 		LLInit(&playerpd);
 		LLInit(&arenapd);
-		MPInit(&dbq);
+		MPSCInit(&dbq, 8192);
 
 		pthread_create(&dbthread, NULL, DBThread, NULL);
 
@@ -1037,9 +1147,9 @@ EXPORT int MM_persist(int action, Imodman *mm_, Arena *arena)
 		mm->ReleaseInterface(cfg);
 		mm->ReleaseInterface(ml);
 
-		MPAdd(&dbq, NULL);
+		MPSCAdd(&dbq, new_msg(DBCMD_QUIT));
 		pthread_join(dbthread, NULL);
-		MPDestroy(&dbq);
+		MPSCDestroy(&dbq);
 		LLEmpty(&playerpd);
 		LLEmpty(&arenapd);
 
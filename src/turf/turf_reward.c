@@ -1197,14 +1197,11 @@ local void preCalc(Arena *arena, TurfArena *ta, ticks_t currentTicks)
 
 	/* Go through all players in arena creating nodes if DNE already */
 	playerdata->Lock();
-	FOR_EACH_PLAYER(pdPtr)
+	FOR_EACH_PLAYER_IN_ARENA(pdPtr, arena)
 	{
 		TurfPlayer *pPlayer = NULL;
 		TurfTeam   *pTeam   = NULL;
 
-		if (pdPtr->arena != arena)
-			continue; /* goto next player, this one's not in the arena */
-
 		pTeam   = getTeamPtr(ta, pdPtr->p_freq, 1);
 		pPlayer = getTurfPlayerPtr(ta, pdPtr->name, pTeam, 1);
 
@@ -0,0 +1,246 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -I../build -o emptytile emptytile.c ../src/main/util.c ../src/main/pathutil.c -lpthread
+exit # */
+
+/* benchmark and check for mapdata's FindEmptyTileNear. this pulls in
+ * core/mapdata.c directly, loads each lvl given (dist/maps by default)
+ * plus a generated map with big solid blocks, and looks up lots of
+ * points, mostly on walls, with both the old
+ * spiral search and the distance map. every answer has to be an empty
+ * tile that's as close as the closest one a brute force search finds,
+ * with and without bricks dropped around the point.
+ * usage: ./emptytile [lvl files...] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <sys/time.h>
+
+#include "../src/core/mapdata.c"
+
+
+#define POINTS 200000
+
+static void stub_log(char level, const char *format, ...) { }
+static void stub_loga(char level, const char *mod, Arena *a, const char *format, ...) { }
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* what FindEmptyTileNear used to do: spiral out one tile at a time */
+static void spiral(Arena *arena, int *x, int *y)
+{
+	struct
+	{
+		enum { up, right, down, left } dir;
+		int upto, remaining;
+		int x, y;
+	} ctx = { left, 0, 1, *x + 1, *y };
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	ELVL *lvl = ad->lvl;
+
+	for (;;)
+	{
+		switch (ctx.dir)
+		{
+			case down:  ctx.y++; break;
+			case right: ctx.x++; break;
+			case up:    ctx.y--; break;
+			case left:  ctx.x--; break;
+		}
+		ctx.remaining--;
+		if (ctx.remaining == 0)
+		{
+			ctx.dir = (ctx.dir + 1) % 4;
+			if (ctx.dir == 0 || ctx.dir == 2)
+				ctx.upto++;
+			ctx.remaining = ctx.upto;
+		}
+
+		if (get_tile(ad, lvl, ctx.x, ctx.y))
+		{
+			if (ctx.upto < 35)
+				continue;
+			else
+				return;
+		}
+
+		*x = ctx.x; *y = ctx.y;
+		break;
+	}
+}
+
+static int chebyshev(int x1, int y1, int x2, int y2)
+{
+	int dx = abs(x1 - x2), dy = abs(y1 - y2);
+	return dx > dy ? dx : dy;
+}
+
+/* the distance to the closest empty tile, by looking at all of them */
+static int brute(Arena *arena, int cx, int cy)
+{
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	int x, y, best = -1;
+
+	for (y = cy - EMPTY_SEARCH_MAX; y <= cy + EMPTY_SEARCH_MAX; y++)
+		for (x = cx - EMPTY_SEARCH_MAX; x <= cx + EMPTY_SEARCH_MAX; x++)
+			if (x >= 0 && x < MAPSIZE && y >= 0 && y < MAPSIZE &&
+			    !get_tile(ad, ad->lvl, x, y) &&
+			    (best < 0 || chebyshev(x, y, cx, cy) < best))
+				best = chebyshev(x, y, cx, cy);
+
+	return best;
+}
+
+static int check(Arena *arena, int cx, int cy)
+{
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	int x = cx, y = cy, want = brute(arena, cx, cy);
+
+	FindEmptyTileNear(arena, &x, &y);
+	if (want < 0)
+		return x == cx && y == cy;
+	return !get_tile(ad, ad->lvl, x, y) && chebyshev(x, y, cx, cy) == want;
+}
+
+/* random rectangles covering about half the map, some of them big
+ * enough that the middle is out of reach */
+static ELVL * generate(void)
+{
+	ELVL *lvl = amalloc(sizeof(*lvl));
+	int i, x, y;
+
+	lvl->tiles = amalloc(MAPSIZE * MAPSIZE);
+	srand(2);
+	for (i = 0; i < 3000; i++)
+	{
+		int x1 = rand() % MAPSIZE, y1 = rand() % MAPSIZE;
+		int w = 1 + rand() % (i < 20 ? 80 : 20), h = 1 + rand() % (i < 20 ? 80 : 20);
+		for (y = y1; y < y1 + h && y < MAPSIZE; y++)
+			for (x = x1; x < x1 + w && x < MAPSIZE; x++)
+				lvl->tiles[TILE_INDEX(x, y)] = 1;
+	}
+	build_empty_dist(lvl);
+	lvl->refs = 1;
+	return lvl;
+}
+
+static int run(const char *fn)
+{
+	Arena *arena = amalloc(sizeof(Arena) + sizeof(ArenaLvl));
+	ArenaLvl *ad = P_ARENA_DATA(arena, lvlkey);
+	static int px[POINTS], py[POINTS], wx[MAPSIZE * MAPSIZE], wy[MAPSIZE * MAPSIZE];
+	int i, n, x, y, walls = 0, bad = 0, farther = 0;
+	double t;
+
+	pthread_mutex_init(&ad->mtx, NULL);
+	if (!(ad->lvl = fn ? get_level(fn) : generate()))
+	{
+		printf("%s: can't load\n", fn);
+		return 1;
+	}
+	if (!fn)
+		fn = "generated";
+
+	/* mostly points on walls, which is where the search has work to do */
+	for (y = 0; y < MAPSIZE; y++)
+		for (x = 0; x < MAPSIZE; x++)
+			if (ad->lvl->tiles[TILE_INDEX(x, y)])
+			{
+				wx[walls] = x;
+				wy[walls++] = y;
+			}
+	srand(1);
+	for (n = 0; n < POINTS; n++)
+	{
+		if (walls && (rand() & 7))
+		{
+			i = rand() % walls;
+			px[n] = wx[i];
+			py[n] = wy[i];
+		}
+		else
+		{
+			px[n] = rand() % MAPSIZE;
+			py[n] = rand() % MAPSIZE;
+		}
+	}
+
+	t = now();
+	for (i = 0; i < n; i++)
+	{
+		int x = px[i], y = py[i];
+		spiral(arena, &x, &y);
+	}
+	t = now() - t;
+	printf("%s: %d points, %d wall tiles\n", fn, n, walls);
+	printf("  spiral search:  %7.1f ns/lookup\n", t * 1e9 / n);
+
+	t = now();
+	for (i = 0; i < n; i++)
+	{
+		int x = px[i], y = py[i];
+		FindEmptyTileNear(arena, &x, &y);
+	}
+	t = now() - t;
+	printf("  distance map:   %7.1f ns/lookup\n", t * 1e9 / n);
+
+	for (i = 0; i < n; i++)
+	{
+		int x1 = px[i], y1 = py[i], x2 = px[i], y2 = py[i];
+		bad += !check(arena, px[i], py[i]);
+		spiral(arena, &x1, &y1);
+		FindEmptyTileNear(arena, &x2, &y2);
+		/* the spiral leaves the point alone when it gives up, and can
+		 * wander off the edge of the map */
+		if (x1 >= 0 && x1 < MAPSIZE && y1 >= 0 && y1 < MAPSIZE &&
+		    !get_tile(ad, ad->lvl, x1, y1) &&
+		    (get_tile(ad, ad->lvl, x2, y2) ||
+		     chebyshev(x2, y2, px[i], py[i]) > chebyshev(x1, y1, px[i], py[i])))
+			farther++;
+	}
+
+	/* bricks make the distance map too optimistic. wall in some of the
+	 * points and make sure it still finds the right tile. */
+	for (i = 0; i < n; i += 97)
+	{
+		int x = px[i], y = py[i];
+		DoBrick(arena, 1, x - 2, y - 2, x + 2, y - 2);
+		DoBrick(arena, 1, x - 2, y + 2, x + 2, y + 2);
+		DoBrick(arena, 1, x - 2, y - 1, x - 2, y + 1);
+		DoBrick(arena, 1, x + 2, y - 1, x + 2, y + 1);
+		bad += !check(arena, x, y);
+		DoBrick(arena, 0, x - 2, y - 2, x + 2, y - 2);
+		DoBrick(arena, 0, x - 2, y + 2, x + 2, y + 2);
+		DoBrick(arena, 0, x - 2, y - 1, x - 2, y + 1);
+		DoBrick(arena, 0, x + 2, y - 1, x + 2, y + 1);
+	}
+
+	printf("  %d wrong answers, %d farther than the spiral's\n", bad, farther);
+	put_level(ad->lvl);
+	return bad || farther;
+}
+
+int main(int argc, char *argv[])
+{
+	static Ilogman logman;
+	int i, failed = 0;
+
+	logman.Log = stub_log;
+	logman.LogA = stub_loga;
+	lm = &logman;
+	lvlkey = 0;
+
+	if (argc < 2)
+		failed |= run("../dist/maps/smallmap.lvl");
+	for (i = 1; i < argc; i++)
+		failed |= run(argv[i]);
+	failed |= run(NULL);
+
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
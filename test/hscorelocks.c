@@ -0,0 +1,454 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -I../src/hscore -o hscorelocks hscorelocks.c ../src/main/util.c -lpthread
+exit # */
+
+/* stress test for the hscore_database locks. this pulls in
+ * hscore/hscore_database.c directly with stub modules. one thread per
+ * arena buys and sells items for that arena's players, moves money
+ * between players in different arenas, and a reload thread keeps
+ * rewriting the item catalog under lock(). at the end every player's
+ * money plus the value of their items has to add up to what they
+ * started with, nobody may have seen a half-written item, and every
+ * item count callback has to come with the player's lock held.
+ * it runs once with per-player locks and once with every buy taking
+ * lock(), which is how things worked before. a third run pays out
+ * kill rewards the way hscore_rewards does while another thread keeps
+ * calling StoreAllPerPlayerData, which takes lock() and then
+ * pd->Lock(). a plain mutex stands in for pd->Lock() there, which is
+ * stricter than the real one, so anything calling into the database
+ * with it held hangs and the alarm catches it.
+ * usage: ./hscorelocks [arenas] [players per arena] [milliseconds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../src/hscore/hscore_database.c"
+
+
+#define MAXARENAS 32
+#define ITEMS 16
+#define STARTMONEY 100000
+
+static int narenas, nplayers, globalmode, rewardmode;
+static Arena *arenas[MAXARENAS];
+static Player **players;
+static Item *testitems[ITEMS];
+
+static int stop;
+static long errors, torn, badcallbacks, callbacks, queries, reloads, stores;
+
+static struct
+{
+	long buys, sells, gives, kills, paid;
+} __attribute__((aligned(64))) counts[MAXARENAS];
+
+static pthread_mutex_t pdmtx;
+
+
+static void stub_log(char level, const char *format, ...)
+{
+	va_list args;
+	if (level != L_ERROR) return;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+}
+
+static void stub_logp(char level, const char *mod, Player *p, const char *format, ...)
+{
+	va_list args;
+	if (level != L_ERROR) return;
+	printf("<%s> [%d] ", mod, p->pid);
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+}
+
+static int stub_query(query_callback cb, void *clos, int notifyfail, const char *fmt, ...)
+{
+	/* item and money changes get written out through here. drop them */
+	afree(clos);
+	__atomic_add_fetch(&queries, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/* every item count change has to happen under that player's lock */
+static void item_count_changed(Player *p, ShipHull *hull, Item *item, InventoryEntry *entry, int newCount, int oldCount)
+{
+	PerPlayerData *playerData = getPerPlayerData(p);
+
+	if (!catalogHolds.shared && !catalogHolds.exclusive)
+		__atomic_add_fetch(&badcallbacks, 1, __ATOMIC_RELAXED);
+	else if (!catalogHolds.exclusive)
+	{
+		/* recursive, so this only fails if someone else owns it */
+		if (pthread_mutex_trylock(&playerData->mutex) == EBUSY)
+			__atomic_add_fetch(&badcallbacks, 1, __ATOMIC_RELAXED);
+		else
+			pthread_mutex_unlock(&playerData->mutex);
+	}
+	__atomic_add_fetch(&callbacks, 1, __ATOMIC_RELAXED);
+}
+
+static struct { CallbackSet set; void *funcs[1]; } countset = { { 1 }, { item_count_changed } };
+
+static int stub_slot(const char *id) { return 0; }
+static void stub_begin(const char *id, int slot, Arena *arena, CallbackSnapshot *snap)
+{
+	snap->sets[0] = strcmp(id, CB_ITEM_COUNT_CHANGED) == 0 ? &countset.set : NULL;
+	snap->sets[1] = NULL;
+}
+static void stub_end(CallbackSnapshot *snap) { }
+
+static const char * stub_getstr(ConfigHandle ch, const char *section, const char *key) { return NULL; }
+
+static void stub_pdlock(void) { pthread_mutex_lock(&pdmtx); }
+static void stub_pdunlock(void) { pthread_mutex_unlock(&pdmtx); }
+
+static void on_alarm(int sig)
+{
+	printf("deadlocked: something called into the database under pd->Lock()\n");
+	fflush(stdout);
+	_exit(1);
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int count_on_hull(ShipHull *hull, Item *item)
+{
+	Link *link;
+	for (link = LLGetHead(&hull->inventoryEntryList); link; link = link->next)
+	{
+		InventoryEntry *entry = link->data;
+		if (entry->item == item)
+			return entry->count;
+	}
+	return 0;
+}
+
+static void player_lock(Player *p)
+{
+	if (globalmode) lock(); else lockPlayer(p);
+}
+
+static void player_unlock(Player *p)
+{
+	if (globalmode) unlock(); else unlockPlayer(p);
+}
+
+/* like ?buy and ?sell in hscore_buysell: check and change under one lock */
+static void buy_or_sell(Player *p, Item *item, long id)
+{
+	ShipHull *hull;
+	int have, price;
+
+	player_lock(p);
+	hull = getPlayerHull(p, SHIP_WARBIRD, 0);
+	price = item->buyPrice;
+	if (price <= 0 || item->sellPrice != price)
+		__atomic_add_fetch(&torn, 1, __ATOMIC_RELAXED);
+
+	have = count_on_hull(hull, item);
+	if (getMoney(p) >= price && have < 50)
+	{
+		updateItemOnHull(p, hull, item, have + 1, 0);
+		addMoney(p, MONEY_TYPE_BUYSELL, -price);
+		counts[id].buys++;
+	}
+	else if (have > 0)
+	{
+		updateItemOnHull(p, hull, item, have - 1, 0);
+		addMoney(p, MONEY_TYPE_BUYSELL, price);
+		counts[id].sells++;
+	}
+	player_unlock(p);
+}
+
+/* like ?give between two arenas, taking the lower pid first */
+static void give(Player *from, Player *to, int amount)
+{
+	Player *first = from->pid < to->pid ? from : to;
+	Player *second = first == from ? to : from;
+
+	player_lock(first);
+	player_lock(second);
+	if (getMoney(from) >= amount)
+	{
+		addMoney(from, MONEY_TYPE_GIVE, -amount);
+		addMoney(to, MONEY_TYPE_GIVE, amount);
+	}
+	player_unlock(second);
+	player_unlock(first);
+}
+
+/* like killCallback in hscore_rewards: find the killer's teammates
+ * under pd->Lock(), then pay them after letting go of it */
+static void kill_reward(Player *killer, long id)
+{
+	LinkedList mates = LL_INITIALIZER;
+	Player *p;
+	Link *link;
+	int killerexp;
+
+	addMoney(killer, MONEY_TYPE_KILL, 10);
+	counts[id].paid += 10;
+	killerexp = getExp(killer);
+
+	pd->Lock();
+	FOR_EACH_PLAYER(p)
+		if (p->arena == killer->arena && p != killer)
+			LLAdd(&mates, p);
+	pd->Unlock();
+
+	FOR_EACH(&mates, p, link)
+	{
+		int reward = getExp(p) > killerexp ? 2 : 1;
+		addMoney(p, MONEY_TYPE_KILL, reward);
+		counts[id].paid += reward;
+	}
+	LLEmpty(&mates);
+	counts[id].kills++;
+}
+
+static void * arena_thread(void *v)
+{
+	long id = (long)v;
+	unsigned seed = id + 1;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		Player *p = players[id * nplayers + rand_r(&seed) % nplayers];
+
+		buy_or_sell(p, testitems[rand_r(&seed) % ITEMS], id);
+
+		if (rewardmode && (rand_r(&seed) & 15) == 0)
+			kill_reward(p, id);
+
+		if ((rand_r(&seed) & 63) == 0)
+		{
+			Player *to = players[rand_r(&seed) % (narenas * nplayers)];
+			if (to != p)
+			{
+				give(p, to, 1 + rand_r(&seed) % 100);
+				counts[id].gives++;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* ?reloaditems rewrites every item in place under lock() */
+static void * reload_thread(void *v)
+{
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		Link *link;
+		lock();
+		for (link = LLGetHead(&itemList); link; link = link->next)
+		{
+			Item *item = link->data;
+			int price = item->buyPrice;
+			item->buyPrice = item->sellPrice = -1;
+			item->buyPrice = item->sellPrice = price;
+		}
+		unlock();
+		reloads++;
+		usleep(1000);
+	}
+	return NULL;
+}
+
+/* the periodic save in hscore_database */
+static void * store_thread(void *v)
+{
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		StoreAllPerPlayerData();
+		stores++;
+		usleep(1000);
+	}
+	return NULL;
+}
+
+static long total_value(void)
+{
+	long total = 0;
+	int i, j;
+
+	for (i = 0; i < narenas * nplayers; i++)
+	{
+		ShipHull *hull = getPlayerHull(players[i], SHIP_WARBIRD, 0);
+		total += getMoney(players[i]);
+		for (j = 0; j < ITEMS; j++)
+			total += (long)count_on_hull(hull, testitems[j]) * testitems[j]->buyPrice;
+	}
+
+	return total;
+}
+
+static int run(const char *name, int ms)
+{
+	pthread_t thds[MAXARENAS], rthd, sthd;
+	long i, buys = 0, sells = 0, gives = 0, kills = 0, paid = 0, before;
+	double t;
+
+	stop = 0;
+	errors = torn = badcallbacks = callbacks = reloads = stores = 0;
+	memset(counts, 0, sizeof(counts));
+	before = total_value();
+
+	t = now();
+	for (i = 0; i < narenas; i++)
+		pthread_create(&thds[i], NULL, arena_thread, (void *)i);
+	pthread_create(&rthd, NULL, reload_thread, NULL);
+	if (rewardmode)
+		pthread_create(&sthd, NULL, store_thread, NULL);
+	usleep(ms * 1000);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	alarm(10);
+	for (i = 0; i < narenas; i++)
+		pthread_join(thds[i], NULL);
+	pthread_join(rthd, NULL);
+	if (rewardmode)
+		pthread_join(sthd, NULL);
+	alarm(0);
+	t = now() - t;
+
+	for (i = 0; i < narenas; i++)
+	{
+		buys += counts[i].buys;
+		sells += counts[i].sells;
+		gives += counts[i].gives;
+		kills += counts[i].kills;
+		paid += counts[i].paid;
+	}
+
+	printf("%-14s %2d arenas: %8.0f trades/sec, %ld buys, %ld sells, %ld gives, %ld reloads\n",
+			name, narenas, (buys + sells) / t, buys, sells, gives, reloads);
+	if (rewardmode)
+		printf("%-14s %ld kills paid $%ld, %ld stores\n", "", kills, paid, stores);
+
+	if (total_value() != before + paid || torn || badcallbacks || errors)
+	{
+		printf("FAILED: value %ld -> %ld, %ld torn item reads, %ld unlocked callbacks, %ld errors\n",
+				before + paid, total_value(), torn, badcallbacks, errors);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static Ilogman logman;
+	static Ihscoremysql mysqlstub;
+	static Imodman modman;
+	static Iconfig config;
+	static Iplayerdata playerdata;
+	pthread_rwlockattr_t rwattr;
+	int ms, i, failed = 0;
+
+	narenas = argc > 1 ? atoi(argv[1]) : 4;
+	nplayers = argc > 2 ? atoi(argv[2]) : 8;
+	ms = argc > 3 ? atoi(argv[3]) : 500;
+	if (narenas < 1 || narenas > MAXARENAS) narenas = 4;
+	if (nplayers < 2) nplayers = 8;
+
+	logman.Log = stub_log;
+	logman.LogP = stub_logp;
+	mysqlstub.Query = stub_query;
+	modman.GetCallbackSlot = stub_slot;
+	modman.BeginCallbacks = stub_begin;
+	modman.EndCallbacks = stub_end;
+	config.GetStr = stub_getstr;
+	lm = &logman;
+	mysql = &mysqlstub;
+	mm = &modman;
+	cfg = &config;
+	playerdata.Lock = stub_pdlock;
+	playerdata.Unlock = stub_pdunlock;
+	LLInit(&playerdata.playerlist);
+	pd = &playerdata;
+	pthread_mutex_init(&pdmtx, NULL);
+	signal(SIGALRM, on_alarm);
+
+	/* what MM_LOAD sets up */
+	pthread_rwlockattr_init(&rwattr);
+	pthread_rwlockattr_setkind_np(&rwattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&catalogLock, &rwattr);
+	pthread_mutexattr_init(&player_mutex_attr);
+	pthread_mutexattr_settype(&player_mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+	playerDataKey = arenaDataKey = 0;
+	LLInit(&itemList);
+	LLInit(&itemTypeList);
+
+	for (i = 0; i < ITEMS; i++)
+	{
+		Item *item = amalloc(sizeof(*item));
+		LLInit(&item->propertyList);
+		LLInit(&item->eventList);
+		LLInit(&item->itemTypeEntries);
+		LLInit(&item->ammoUsers);
+		item->id = i + 1;
+		snprintf(item->name, sizeof(item->name), "item%d", i);
+		item->buyPrice = item->sellPrice = 10 * (i + 1);
+		LLAdd(&itemList, item);
+		testitems[i] = item;
+	}
+
+	for (i = 0; i < narenas; i++)
+	{
+		arenas[i] = amalloc(sizeof(Arena) + sizeof(PerArenaData));
+		snprintf(arenas[i]->name, sizeof(arenas[i]->name), "arena%d", i);
+		InitPerArenaData(arenas[i]);
+	}
+
+	players = amalloc(narenas * nplayers * sizeof(Player *));
+	for (i = 0; i < narenas * nplayers; i++)
+	{
+		Player *p = amalloc(sizeof(Player) + sizeof(PerPlayerData));
+		PerPlayerData *playerData = getPerPlayerData(p);
+
+		p->pid = i;
+		p->type = T_CONT;
+		p->arena = arenas[i / nplayers];
+		InitPerPlayerData(p);
+		playerData->walletLoaded = 1;
+		playerData->shipsLoaded = 1;
+		playerData->money = STARTMONEY;
+
+		/* the ship id query never comes back here, so fill it in */
+		addShipToShipSet(p, SHIP_WARBIRD, 0);
+		getPlayerHull(p, SHIP_WARBIRD, 0)->id = i + 1;
+		players[i] = p;
+		LLAdd(&playerdata.playerlist, p);
+	}
+
+	printf("%ld cpus online, %d players per arena\n", sysconf(_SC_NPROCESSORS_ONLN), nplayers);
+	globalmode = 0;
+	failed |= run("per-player", ms);
+	globalmode = 1;
+	failed |= run("global lock", ms);
+	globalmode = 0;
+	rewardmode = 1;
+	failed |= run("kill rewards", ms);
+
+	printf("%ld item count callbacks, %ld queries\n", callbacks, queries);
+	printf(failed ? "FAILED\n" : "ok\n");
+	return failed;
+}
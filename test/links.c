@@ -0,0 +1,186 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -o links links.c ../src/main/util.c -lpthread
+exit # */
+
+/* multithreaded benchmark for the LinkedList link allocator. each
+ * thread builds and empties its own lists, and also hands lists to the
+ * next thread, so links get freed by threads other than the one that
+ * allocated them. the same workload runs once against a copy of the old
+ * single-mutex free list, and once against util.c's per-thread caches.
+ * usage: ./links [threads] [rounds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "util.h"
+
+
+#define MAXTHREADS 64
+#define LISTLEN 32
+
+static int threads, rounds;
+static int use_old;
+
+
+/* the old allocator: one free list behind one mutex */
+
+static Link *oldfree;
+static pthread_mutex_t oldmtx = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long oldwaits;
+
+static void old_lock(void)
+{
+	if (pthread_mutex_trylock(&oldmtx) != 0)
+	{
+		pthread_mutex_lock(&oldmtx);
+		oldwaits++;
+	}
+}
+
+static Link * old_get(void)
+{
+	Link *l;
+	old_lock();
+	if (!oldfree)
+	{
+		int i;
+		Link *mem = malloc(510 * sizeof(Link));
+		for (i = 0; i < 509; i++)
+			mem[i].next = mem + i + 1;
+		mem[509].next = NULL;
+		oldfree = mem;
+	}
+	l = oldfree;
+	oldfree = l->next;
+	pthread_mutex_unlock(&oldmtx);
+	return l;
+}
+
+static void old_put(Link *l)
+{
+	old_lock();
+	l->next = oldfree;
+	oldfree = l;
+	pthread_mutex_unlock(&oldmtx);
+}
+
+
+/* hand-off slots between neighbouring threads */
+static struct
+{
+	pthread_mutex_t mtx;
+	Link *oldlist;
+	LinkedList *list;
+} slots[MAXTHREADS];
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void * worker(void *v)
+{
+	long id = (long)v, r, i;
+	int next = (id + 1) % threads;
+
+	for (r = 0; r < rounds; r++)
+	{
+		if (use_old)
+		{
+			Link *head = NULL, *l;
+			for (i = 0; i < LISTLEN; i++)
+			{
+				l = old_get();
+				l->data = (void *)i;
+				l->next = head;
+				head = l;
+			}
+			/* give it to the neighbour, and free whatever was there */
+			pthread_mutex_lock(&slots[next].mtx);
+			l = slots[next].oldlist;
+			slots[next].oldlist = head;
+			pthread_mutex_unlock(&slots[next].mtx);
+			while (l)
+			{
+				Link *t = l->next;
+				old_put(l);
+				l = t;
+			}
+		}
+		else
+		{
+			LinkedList *lst = LLAlloc();
+			for (i = 0; i < LISTLEN; i++)
+				LLAdd(lst, (void *)i);
+			pthread_mutex_lock(&slots[next].mtx);
+			LLFree(slots[next].list);
+			slots[next].list = lst;
+			pthread_mutex_unlock(&slots[next].mtx);
+		}
+	}
+
+	return NULL;
+}
+
+static void run(const char *name)
+{
+	pthread_t thds[MAXTHREADS];
+	LinkStats before, after;
+	unsigned long waits = oldwaits;
+	double t;
+	long i;
+
+	for (i = 0; i < threads; i++)
+		slots[i].list = LLAlloc();
+
+	LLGetStats(&before);
+	t = now();
+	for (i = 0; i < threads; i++)
+		pthread_create(&thds[i], NULL, worker, (void *)i);
+	for (i = 0; i < threads; i++)
+		pthread_join(thds[i], NULL);
+	t = now() - t;
+	LLGetStats(&after);
+
+	if (!use_old)
+		waits = after.lockwaits - before.lockwaits;
+	else
+		waits = oldwaits - waits;
+
+	printf("%-14s %2d threads: %6.1f ns/link, %8lu lock waits\n",
+			name, threads, t * 1e9 / ((double)threads * rounds * LISTLEN),
+			waits);
+	if (!use_old)
+		printf("%-14s refills=%lu spills=%lu chunks=%lu\n", "",
+				after.refills - before.refills,
+				after.spills - before.spills,
+				after.chunks - before.chunks);
+
+	for (i = 0; i < threads; i++)
+		LLFree(slots[i].list);
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+
+	threads = argc > 1 ? atoi(argv[1]) : 4;
+	rounds = argc > 2 ? atoi(argv[2]) : 100000;
+	if (threads < 1 || threads > MAXTHREADS)
+		threads = 4;
+
+	for (i = 0; i < threads; i++)
+		pthread_mutex_init(&slots[i].mtx, NULL);
+
+	use_old = 1;
+	run("global mutex");
+	use_old = 0;
+	run("thread caches");
+
+	return 0;
+}
@@ -1,97 +1,104 @@
-
 /* 2>/dev/null
-gcc -I../src/include -I../src -o mpqueue mpqueue.c ../src/main/util.c -lpthread
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -o mpqueue mpqueue.c ../src/main/util.c -lpthread
 exit # */
 
+/* contention benchmark for MPQueue against MPSCQueue. a bunch of
+ * producer threads push items at one consumer thread, which checks
+ * that every producer's items arrive in order.
+ * usage: ./mpqueue [producers] [items per producer] */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 #include "util.h"
 
 
+#define MAXPRODUCERS 64
 
-struct QueueData
-{
-	int d;
-	char *s;
-};
-
+static int producers, items;
+static MPQueue mpq;
+static MPSCQueue mpscq;
+static int use_mpsc;
 
 
-LinkedList *queue;
-pthread_mutex_t queuemtx = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t queuecond = PTHREAD_COND_INITIALIZER;
-
-
-void * reader(void *foo)
+static double now(void)
 {
-	Link *l;
-	struct QueueData *qd;
-	int done = 0;
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-	while (!done)
+/* items are (producer << 24) | (sequence + 1), so they're never NULL */
+static void * producer(void *v)
+{
+	long id = (long)v, i;
+	for (i = 0; i < items; i++)
 	{
-		pthread_mutex_lock(&queuemtx);
-		
-		while ( !(l = LLGetHead(queue)) )
-		{
-			printf("waiting...\n");
-/*			pthread_mutex_unlock(&queuemtx);
-			usleep(200000);
-			pthread_mutex_lock(&queuemtx); */
-			pthread_cond_wait(&queuecond, &queuemtx);
-		}
-
-		qd = l->data;
-		LLRemove(queue,qd);
-
-		pthread_mutex_unlock(&queuemtx);
-
-		printf("%d: %s\n", qd->d, qd->s);
-		free(qd);
+		void *item = (void *)((id << 24) | (i + 1));
+		if (use_mpsc)
+			MPSCAdd(&mpscq, item);
+		else
+			MPAdd(&mpq, item);
 	}
+	return NULL;
 }
 
-
-int main()
+static void * consumer(void *v)
 {
-	pthread_t th;
-	int i;
-
-	queue = LLAlloc();
+	long next[MAXPRODUCERS] = { 0 }, i, total = (long)producers * items;
+	int bad = 0;
 
-	printf("creating thread\n");
-	pthread_create(&th, NULL, reader, NULL);
-
-
-	for (i = 0; i < 10000; i++)
+	for (i = 0; i < total; i++)
 	{
-		struct QueueData *qd;
-
-		/* printf("writing %d\n", i); */
-	   
-		qd = malloc(sizeof(struct QueueData));
-
-		qd->d = i;
-		qd->s = "foo!";
-
-		pthread_mutex_lock(&queuemtx);
-
-		LLAdd(queue, qd);
-
-		pthread_cond_signal(&queuecond);
-
-		pthread_mutex_unlock(&queuemtx);
-
-		if (rand() > RAND_MAX/2) sleep(1);
+		long item = (long)(use_mpsc ? MPSCRemove(&mpscq) : MPRemove(&mpq));
+		long id = item >> 24, seq = (item & 0xffffff) - 1;
+		if (id < 0 || id >= producers || seq != next[id]++)
+			bad++;
 	}
 
-	printf("finished writing data to queue\n");
-
-	pthread_join(th, NULL);
-
-	LLFree(queue);
+	return (void *)(long)bad;
+}
 
+static void run(const char *name)
+{
+	pthread_t thds[MAXPRODUCERS], cthd;
+	void *bad;
+	double t;
+	long i;
+
+	t = now();
+	pthread_create(&cthd, NULL, consumer, NULL);
+	for (i = 0; i < producers; i++)
+		pthread_create(&thds[i], NULL, producer, (void *)i);
+	for (i = 0; i < producers; i++)
+		pthread_join(thds[i], NULL);
+	pthread_join(cthd, &bad);
+	t = now() - t;
+
+	printf("%-10s %3d producers: %8.1f ns/item, %.2f M items/sec%s\n",
+			name, producers, t * 1e9 / ((double)producers * items),
+			producers * items / t / 1e6,
+			bad ? "  OUT OF ORDER" : "");
 }
 
+int main(int argc, char *argv[])
+{
+	producers = argc > 1 ? atoi(argv[1]) : 4;
+	items = argc > 2 ? atoi(argv[2]) : 1000000;
+	if (producers < 1 || producers > MAXPRODUCERS)
+		producers = 4;
+
+	MPInit(&mpq);
+	use_mpsc = 0;
+	run("MPQueue");
+	MPDestroy(&mpq);
+
+	MPSCInit(&mpscq, 4096);
+	use_mpsc = 1;
+	run("MPSCQueue");
+	MPSCDestroy(&mpscq);
+
+	return 0;
+}
@@ -0,0 +1,138 @@
+/* 2>/dev/null
+gcc -O2 -o ppkgrid ppkgrid.c
+exit # */
+
+/* compares the cost of picking position packet receivers by scanning
+ * every player in the zone against the per-arena spatial grid used by
+ * game.c. usage: ./ppkgrid [arenas] [range] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define GRID_SHIFT 10
+#define GRID_DIM (1 << (14 - GRID_SHIFT))
+
+#define PACKETS 200000
+
+typedef struct Player
+{
+	int arena, x, y;
+	struct Player *gridnext;
+} Player;
+
+Player *players;
+Player **cells;
+
+
+long lhypot(long dx, long dy)
+{
+	unsigned long r, dd;
+
+	dd = dx*dx+dy*dy;
+
+	if (dx < 0) dx = -dx;
+	if (dy < 0) dy = -dy;
+
+	r = (dx > dy) ? (dx+(dy>>1)) : (dy+(dx>>1));
+
+	if (r == 0) return (long)r;
+
+	r = (dd/r+r)>>1;
+	r = (dd/r+r)>>1;
+	r = (dd/r+r)>>1;
+
+	return (long)r;
+}
+
+int grid_coord(int v)
+{
+	v >>= GRID_SHIFT;
+	return v < 0 ? 0 : v >= GRID_DIM ? GRID_DIM - 1 : v;
+}
+
+double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int scan(int count, Player *p, int range)
+{
+	int i, sent = 0;
+	for (i = 0; i < count; i++)
+		if (players[i].arena == p->arena &&
+		    lhypot(p->x - players[i].x, p->y - players[i].y) <= range)
+			sent++;
+	return sent;
+}
+
+int grid(Player *p, int range)
+{
+	int cx, cy, sent = 0;
+	Player *i, **arenacells = cells + p->arena * GRID_DIM * GRID_DIM;
+
+	for (cy = grid_coord(p->y - range); cy <= grid_coord(p->y + range); cy++)
+		for (cx = grid_coord(p->x - range); cx <= grid_coord(p->x + range); cx++)
+			for (i = arenacells[cy * GRID_DIM + cx]; i; i = i->gridnext)
+				if (lhypot(p->x - i->x, p->y - i->y) <= range)
+					sent++;
+	return sent;
+}
+
+int main(int argc, char *argv[])
+{
+	int arenas = argc > 1 ? atoi(argv[1]) : 4;
+	int range = argc > 2 ? atoi(argv[2]) : 2000;
+	int counts[] = { 25, 50, 100, 250, 500, 1000 };
+	int c, i, n, s1, s2;
+	double t;
+
+	printf("%d arenas, range %d pixels, %d packets per run\n", arenas, range, PACKETS);
+	printf("%8s %12s %12s\n", "players", "scan ns/pkt", "grid ns/pkt");
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		n = counts[c];
+		players = calloc(n, sizeof(Player));
+		cells = calloc(arenas * GRID_DIM * GRID_DIM, sizeof(Player *));
+
+		srand(1);
+		for (i = 0; i < n; i++)
+		{
+			Player *p = players + i, **cell;
+			p->arena = rand() % arenas;
+			/* keep players clustered near the middle, like a real map */
+			p->x = 8192 + (rand() % 6000) - 3000;
+			p->y = 8192 + (rand() % 6000) - 3000;
+			cell = cells + p->arena * GRID_DIM * GRID_DIM +
+				grid_coord(p->y) * GRID_DIM + grid_coord(p->x);
+			p->gridnext = *cell;
+			*cell = p;
+		}
+
+		s1 = s2 = 0;
+		t = now();
+		for (i = 0; i < PACKETS; i++)
+			s1 += scan(n, players + i % n, range);
+		t = now() - t;
+		printf("%8d %12.1f", n, t * 1e9 / PACKETS);
+
+		t = now();
+		for (i = 0; i < PACKETS; i++)
+			s2 += grid(players + i % n, range);
+		t = now() - t;
+		printf(" %12.1f", t * 1e9 / PACKETS);
+
+		if (s1 != s2)
+			printf("  MISMATCH: %d != %d", s1, s2);
+		printf("\n");
+
+		free(players);
+		free(cells);
+	}
+
+	return 0;
+}
+
@@ -1,31 +1,251 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -o rwlock rwlock.c ../src/main/rwlock.c -lpthread
+exit # */
 
-#define ___dummy \
-: /*
-set -e
-gcc -g -D_REENTRANT -D_GNU_SOURCE rwlock.c -o rwlock -lpthread
-exit
-*/
+/* contention benchmark for the player table lock. reader threads take
+ * and drop a read lock in a tight loop, walking a small shared table
+ * while they hold it, like code doing FOR_EACH_PLAYER. one writer takes
+ * the write lock every millisecond and checks that no reader ever sees
+ * a half-updated table. this runs for pthread_rwlock_t, rwlock_t and
+ * brlock_t with 1 to the given number of readers. after that, two
+ * threads take a mutex and a read lock in opposite orders while a
+ * writer keeps trying to get in, which only works if readers never
+ * wait for a writer that's just waiting.
+ * usage: ./rwlock [max readers] [milliseconds per run] */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
 
-int main(int argc, char *argv[])
+#include "rwlock.h"
+
+
+#define MAXREADERS 64
+#define TABLESIZE 16
+
+enum { PTHREAD_RW, RWLOCK, BRLOCK };
+
+static int kind;
+static pthread_rwlock_t prw;
+static rwlock_t rwl;
+static brlock_t brl;
+
+static int stop;
+static int table[TABLESIZE];
+static long bad;
+
+/* each reader counts into its own cache line */
+static struct
+{
+	long ops;
+} __attribute__((aligned(64))) counts[MAXREADERS];
+
+
+static void rdlock(void)
+{
+	if (kind == PTHREAD_RW) pthread_rwlock_rdlock(&prw);
+	else if (kind == RWLOCK) rwl_readlock(&rwl);
+	else brl_readlock(&brl);
+}
+
+static void rdunlock(void)
+{
+	if (kind == PTHREAD_RW) pthread_rwlock_unlock(&prw);
+	else if (kind == RWLOCK) rwl_readunlock(&rwl);
+	else brl_readunlock(&brl);
+}
+
+static void wrlock(void)
+{
+	if (kind == PTHREAD_RW) pthread_rwlock_wrlock(&prw);
+	else if (kind == RWLOCK) rwl_writelock(&rwl);
+	else brl_writelock(&brl);
+}
+
+static void wrunlock(void)
+{
+	if (kind == PTHREAD_RW) pthread_rwlock_unlock(&prw);
+	else if (kind == RWLOCK) rwl_writeunlock(&rwl);
+	else brl_writeunlock(&brl);
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void * reader(void *v)
+{
+	long id = (long)v, ops = 0, mybad = 0;
+	int i;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		rdlock();
+		/* the writer keeps every entry equal */
+		for (i = 1; i < TABLESIZE; i++)
+			if (table[i] != table[0])
+				mybad++;
+		/* and nested read locks must work while a writer waits */
+		if ((ops & 15) == 0)
+		{
+			rdlock();
+			rdunlock();
+		}
+		rdunlock();
+		ops++;
+	}
+
+	counts[id].ops = ops;
+	__atomic_add_fetch(&bad, mybad, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void * writer(void *v)
+{
+	long writes = 0;
+	int i;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		wrlock();
+		for (i = 0; i < TABLESIZE; i++)
+			table[i]++;
+		wrunlock();
+		writes++;
+		usleep(1000);
+	}
+
+	return (void *)writes;
+}
+
+static pthread_mutex_t ordermtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* mutex, then read lock */
+static void * order_a(void *v)
+{
+	long n = 0;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		pthread_mutex_lock(&ordermtx);
+		rdlock();
+		rdunlock();
+		pthread_mutex_unlock(&ordermtx);
+		n++;
+	}
+	return (void *)n;
+}
+
+/* read lock, then mutex */
+static void * order_b(void *v)
+{
+	long n = 0;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+	{
+		rdlock();
+		usleep(10);
+		pthread_mutex_lock(&ordermtx);
+		pthread_mutex_unlock(&ordermtx);
+		rdunlock();
+		n++;
+	}
+	return (void *)n;
+}
+
+static void on_alarm(int sig)
 {
-	pthread_rwlock_t l;
+	printf("deadlocked: readers waited for a waiting writer\n");
+	fflush(stdout);
+	_exit(1);
+}
+
+static void order_check(const char *name, int ms)
+{
+	pthread_t a, b, w;
+	void *na, *nb, *writes;
+
+	stop = 0;
+	signal(SIGALRM, on_alarm);
+	alarm(ms / 1000 + 5);
+	pthread_create(&a, NULL, order_a, NULL);
+	pthread_create(&b, NULL, order_b, NULL);
+	pthread_create(&w, NULL, writer, NULL);
+	usleep(ms * 1000);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	pthread_join(a, &na);
+	pthread_join(b, &nb);
+	pthread_join(w, &writes);
+	alarm(0);
 
-	pthread_rwlock_init(&l, NULL);
+	printf("%-16s lock order: %ld + %ld reads, %ld writes\n",
+			name, (long)na, (long)nb, (long)writes);
+}
+
+static void run(const char *name, int readers, int ms)
+{
+	pthread_t thds[MAXREADERS], wthd;
+	long i, ops = 0;
+	void *writes;
+	double t;
 
-	puts("acquiring read lock");
-	pthread_rwlock_rdlock(&l);
-	puts("got read lock");
+	stop = 0;
+	bad = 0;
+	t = now();
+	for (i = 0; i < readers; i++)
+		pthread_create(&thds[i], NULL, reader, (void *)i);
+	pthread_create(&wthd, NULL, writer, NULL);
+	usleep(ms * 1000);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < readers; i++)
+		pthread_join(thds[i], NULL);
+	pthread_join(wthd, &writes);
+	t = now() - t;
 
-	puts("acquiring read lock");
-	pthread_rwlock_rdlock(&l);
-	puts("got read lock");
+	for (i = 0; i < readers; i++)
+		ops += counts[i].ops;
 
-	puts("acquiring write lock");
-	pthread_rwlock_wrlock(&l);
-	puts("got write lock");
+	printf("%-16s %2d readers: %8.2f M reads/sec, %6.1f ns/read/thread, %4ld writes%s\n",
+			name, readers, ops / t / 1e6, t * 1e9 * readers / ops,
+			(long)writes, bad ? "  TORN READS" : "");
 }
 
+int main(int argc, char *argv[])
+{
+	int maxreaders = argc > 1 ? atoi(argv[1]) : 8;
+	int ms = argc > 2 ? atoi(argv[2]) : 500;
+	int n;
+
+	if (maxreaders < 1 || maxreaders > MAXREADERS)
+		maxreaders = 8;
+
+	pthread_rwlock_init(&prw, NULL);
+	rwl_init(&rwl);
+	brl_init(&brl);
 
+	printf("%ld cpus online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	for (n = 1; n <= maxreaders; n *= 2)
+	{
+		kind = PTHREAD_RW;
+		run("pthread_rwlock_t", n, ms);
+		kind = RWLOCK;
+		run("rwlock_t", n, ms);
+		kind = BRLOCK;
+		run("brlock_t", n, ms);
+	}
+
+	/* pthread_rwlock_t might prefer writers, so it's not checked */
+	kind = RWLOCK;
+	order_check("rwlock_t", ms);
+	kind = BRLOCK;
+	order_check("brlock_t", ms);
+
+	pthread_rwlock_destroy(&prw);
+	rwl_destroy(&rwl);
+	brl_destroy(&brl);
+	return 0;
+}
@@ -0,0 +1,100 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -o timers timers.c ../src/main/util.c -lpthread
+exit # */
+
+/* microbenchmark for the mainloop timer scheduler. this pulls in
+ * core/mainloop.c directly and drives it with a stub module manager.
+ * usage: ./timers [timers] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../src/core/mainloop.c"
+
+
+static int fired, rounds;
+
+static void stub_lookup(const char *id, Arena *arena, LinkedList *res) { LLInit(res); }
+static void stub_free(LinkedList *res) { }
+static int stub_slot(const char *id) { return 0; }
+static void stub_begin(const char *id, int slot, Arena *arena, CallbackSnapshot *snap)
+{
+	snap->sets[0] = snap->sets[1] = NULL;
+}
+static void stub_end(CallbackSnapshot *snap) { }
+static void stub_reg(void *iface, Arena *arena) { }
+static int stub_unreg(void *iface, Arena *arena) { return 0; }
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int tick(void *param)
+{
+	fired++;
+	return TRUE;
+}
+
+static int stopper(void *param)
+{
+	if (--rounds <= 0)
+		KillML(0);
+	return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+	Imodman mm;
+	int count = argc > 1 ? atoi(argv[1]) : 1000;
+	int i, reps = 200000;
+	double t;
+
+	memset(&mm, 0, sizeof(mm));
+	mm.LookupCallback = stub_lookup;
+	mm.FreeLookupResult = stub_free;
+	mm.GetCallbackSlot = stub_slot;
+	mm.BeginCallbacks = stub_begin;
+	mm.EndCallbacks = stub_end;
+	mm.RegInterface = stub_reg;
+	mm.UnregInterface = stub_unreg;
+	MM_mainloop(MM_LOAD, &mm, NULL);
+
+	/* lots of per-player style timers, keyed by "player" */
+	for (i = 0; i < count; i++)
+		StartTimer(tick, 10 + i % 10, 10, NULL, (void *)(long)(i + 1));
+
+	t = now();
+	for (i = 0; i < reps; i++)
+	{
+		void *key = (void *)(long)(count + 1 + i % 64);
+		StartTimer(tick, 1000, 1000, NULL, key);
+		ClearTimer(tick, key);
+	}
+	t = now() - t;
+	printf("%d timers: set+clear %.1f ns/pair\n", count, t * 1e9 / reps);
+
+	/* let the loop run for one second and see how much time it spends */
+	rounds = 100;
+	StartTimer(stopper, 1, 1, NULL, NULL);
+	t = now();
+	{
+		clock_t c = clock();
+		RunLoop();
+		c = clock() - c;
+		t = now() - t;
+		printf("%d timers: %d expiries in %.2fs wall, %.3fs cpu, %.1f ns cpu/expiry\n",
+				count, fired, t, (double)c / CLOCKS_PER_SEC,
+				fired ? (double)c / CLOCKS_PER_SEC * 1e9 / fired : 0.0);
+	}
+
+	ClearTimer(tick, NULL);
+	ClearTimer(stopper, NULL);
+	MM_mainloop(MM_UNLOAD, &mm, NULL);
+	return 0;
+}
+
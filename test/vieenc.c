@@ -0,0 +1,188 @@
+/* 2>/dev/null
+gcc -O2 -D_REENTRANT -D_GNU_SOURCE -I../src/include -I../src -I../build -o vieenc vieenc.c ../src/main/util.c -lpthread
+exit # */
+
+/* check and benchmark for enc_vie's packet loops. this pulls in
+ * core/enc_vie.c directly. the key table is checked against the
+ * original table code from enctest.c and deenc.c, and every kernel
+ * this cpu has is checked against the plain loops (which are the same
+ * as the ones in those files) for lots of keys and every length, with
+ * and without the two byte header. then it times each one.
+ * usage: ./vieenc */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../src/core/enc_vie.c"
+
+
+#define ROUNDS 200000
+
+typedef void (*kernel_t)(EncData *ed, int *data, int n);
+
+struct
+{
+	const char *name;
+	kernel_t enc, dec;
+	const char *feature;
+} kernels[] =
+{
+	{ "plain", enc_words, dec_words, NULL },
+#ifdef VIE_SIMD
+	{ "sse2", enc_sse2, dec_sse2, "sse2" },
+	{ "avx2", enc_avx2, dec_avx2, "avx2" },
+#endif
+};
+
+#define NKERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int have(int k)
+{
+#ifdef VIE_SIMD
+	const char *f = kernels[k].feature;
+	__builtin_cpu_init();
+	if (f && !strcmp(f, "sse2") && !__builtin_cpu_supports("sse2"))
+		return 0;
+	if (f && !strcmp(f, "avx2") && !__builtin_cpu_supports("avx2"))
+		return 0;
+#endif
+	return 1;
+}
+
+/* the table setup from enctest.c, without the asm */
+static void old_init(short *mytable, int k)
+{
+	int t, loop;
+
+	for (loop = 0; loop < 0x104; loop++)
+	{
+		t = ((i64)k * (int)0x834E0B5F) >> 32;
+		t = (t + k) >> 16;
+		t += t >> 31;
+		t = ((((((t * 9) << 3) - t) * 5) << 1) - t) << 2;
+		k = (((k % 0x1F31D) * 0x41A7) - t) + 0x7B;
+		if (!k || (k & 0x80000000)) k += 0x7FFFFFFF;
+		mytable[loop] = (short)k;
+	}
+}
+
+static int check(void)
+{
+	static EncData ed;
+	short table[0x104];
+	byte orig[TABLE_WORDS*4+8], want[sizeof(orig)], got[sizeof(orig)];
+	int i, k, len, hdr, bad = 0;
+
+	srand(1);
+	for (i = 0; i < 200; i++)
+	{
+		int key = i < 100 ? rand() : -rand();
+		do_init(&ed, key);
+		old_init(table, key);
+		if (memcmp(table, ed.table, sizeof(table)))
+		{
+			printf("key %d: table differs from enctest.c\n", key);
+			bad++;
+		}
+
+		for (len = 1; len <= TABLE_WORDS*4 - 4; len++)
+			for (hdr = 1; hdr <= 2; hdr++)
+			{
+				int until = (len - hdr)/4 + 1;
+				for (k = 0; k < (int)sizeof(orig); k++)
+					orig[k] = rand();
+
+				for (k = 1; k < NKERNELS; k++)
+				{
+					if (!have(k))
+						continue;
+
+					memcpy(want, orig, sizeof(orig));
+					memcpy(got, orig, sizeof(orig));
+					enc_words(&ed, (int*)(want + hdr), until);
+					kernels[k].enc(&ed, (int*)(got + hdr), until);
+					if (memcmp(want, got, sizeof(got)))
+					{
+						printf("%s encrypt: key %d len %d hdr %d wrong\n",
+								kernels[k].name, key, len, hdr);
+						bad++;
+					}
+
+					memcpy(want, orig, sizeof(orig));
+					memcpy(got, orig, sizeof(orig));
+					dec_words(&ed, (int*)(want + hdr), until);
+					kernels[k].dec(&ed, (int*)(got + hdr), until);
+					if (memcmp(want, got, sizeof(got)))
+					{
+						printf("%s decrypt: key %d len %d hdr %d wrong\n",
+								kernels[k].name, key, len, hdr);
+						bad++;
+					}
+
+					/* and back again */
+					kernels[k].enc(&ed, (int*)(got + hdr), until);
+					if (memcmp(orig, got, sizeof(got)))
+					{
+						printf("%s: key %d len %d hdr %d doesn't round trip\n",
+								kernels[k].name, key, len, hdr);
+						bad++;
+					}
+				}
+			}
+	}
+
+	return bad;
+}
+
+static void bench(int len)
+{
+	static EncData ed;
+	byte pkt[TABLE_WORDS*4+8];
+	int i, k, until = (len - 1)/4 + 1;
+	double t;
+
+	do_init(&ed, 0x12345678);
+	memset(pkt, 0x5a, sizeof(pkt));
+	printf("%d byte packets:\n", len);
+
+	for (k = 0; k < NKERNELS; k++)
+	{
+		if (!have(k))
+			continue;
+
+		t = now();
+		for (i = 0; i < ROUNDS; i++)
+			kernels[k].enc(&ed, (int*)(pkt + 1), until);
+		t = now() - t;
+		printf("  %-5s encrypt: %7.1f ns/packet %6.0f MB/s\n",
+				kernels[k].name, t * 1e9 / ROUNDS, len * ROUNDS / t / 1e6);
+
+		t = now();
+		for (i = 0; i < ROUNDS; i++)
+			kernels[k].dec(&ed, (int*)(pkt + 1), until);
+		t = now() - t;
+		printf("  %-5s decrypt: %7.1f ns/packet %6.0f MB/s\n",
+				kernels[k].name, t * 1e9 / ROUNDS, len * ROUNDS / t / 1e6);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int bad = check();
+
+	bench(32);
+	bench(150);
+	bench(512);
+
+	printf(bad ? "FAILED\n" : "ok\n");
+	return bad != 0;
+}